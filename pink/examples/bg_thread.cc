@@ -6,6 +6,8 @@
 #include "unistd.h"
 #include <string>
 #include <iostream>
+#include <memory>
+#include <vector>
 #include "pink/include/bg_thread.h"
 #include "slash/include/slash_mutex.h"
 
@@ -22,6 +24,15 @@ void task(void *arg) {
   delete (int*)arg;
 }
 
+// A move-only task
+struct PrintTask {
+  std::unique_ptr<std::string> name;
+  void operator()() {
+    slash::MutexLock l(&print_lock);
+    std::cout << " task : " << *name << std::endl;
+  }
+};
+
 struct TimerItem {
   uint64_t exec_time;
   void (*function)(void *);
@@ -73,6 +84,21 @@ int main() {
     sleep(1);
   }
   
+  std::cout << "Closure BGTask... " << std::endl;
+  std::vector<pink::BGTask> tasks;
+  for (int i = 0; i < 10; i++) {
+    PrintTask print_task;
+    print_task.name.reset(new std::string("closure " + std::to_string(i)));
+    tasks.emplace_back(std::move(print_task));
+  }
+  t.ScheduleBatch(&tasks);
+  t.Schedule([]() {
+    slash::MutexLock l(&print_lock);
+    std::cout << " task : single closure" << std::endl;
+  });
+  sleep(1);
+  std::cout << std::endl << std::endl;
+
   std::cout << "TimerItem Struct... " << std::endl;
   std::priority_queue<TimerItem> pq;
   pq.push(TimerItem(1, task, NULL));
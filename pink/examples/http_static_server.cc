@@ -0,0 +1,79 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include <string>
+#include <atomic>
+#include <signal.h>
+#include <unistd.h>
+
+#include "pink/include/server_thread.h"
+#include "pink/include/http_static.h"
+
+using namespace pink;
+
+class StaticConnFactory : public ConnFactory {
+ public:
+  explicit StaticConnFactory(const std::string& root)
+      : root_(root),
+        cache_(std::make_shared<HTTPFileCache>()) {
+  }
+
+  virtual PinkConn* NewPinkConn(int connfd, const std::string& ip_port,
+                                ServerThread* thread,
+                                void* worker_specific_data) const {
+    auto handles = std::make_shared<HTTPStaticHandles>(root_, cache_);
+    return new pink::HTTPConn(connfd, ip_port, thread, handles,
+                              worker_specific_data);
+  }
+
+ private:
+  std::string root_;
+  // Shared by all the connections
+  std::shared_ptr<HTTPFileCache> cache_;
+};
+
+static std::atomic<bool> running(false);
+
+static void IntSigHandle(const int sig) {
+  printf("Catch Signal %d, cleanup...\n", sig);
+  running.store(false);
+  printf("server Exit");
+}
+
+static void SignalSetup() {
+  signal(SIGHUP, SIG_IGN);
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, &IntSigHandle);
+  signal(SIGQUIT, &IntSigHandle);
+  signal(SIGTERM, &IntSigHandle);
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    printf("Usage: ./http_static_server port root\n");
+    return -1;
+  }
+  int port = atoi(argv[1]);
+
+  SignalSetup();
+
+  ConnFactory* conn_factory = new StaticConnFactory(argv[2]);
+  ServerThread *st = NewDispatchThread(port, 4, conn_factory, 1000);
+
+  if (st->StartThread() != 0) {
+    printf("StartThread error happened!\n");
+    exit(-1);
+  }
+  running.store(true);
+  while (running.load()) {
+    sleep(1);
+  }
+  st->StopThread();
+
+  delete st;
+  delete conn_factory;
+
+  return 0;
+}
@@ -0,0 +1,139 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "pink/src/http_parser.h"
+
+static uint64_t NowMicros() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+static std::string MakeRequest(size_t cookie_size) {
+  std::string req =
+    "GET /api/v1/users/12345/posts?limit=20&offset=40 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+    "(KHTML, like Gecko) Chrome/58.0.3029.110 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+    "*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n";
+  if (cookie_size > 0) {
+    req += "Cookie: " + std::string(cookie_size, 'c') + "\r\n";
+  }
+  req += "\r\n";
+  return req;
+}
+
+typedef std::vector<std::pair<slash::Slice, slash::Slice>> Fields;
+
+// The header looked up again in the whole buffer after each read, then
+// split into lines and fields, as the connections used to do
+static int RescanParse(char* buf, size_t size, Fields* fields) {
+  char saved = buf[size];
+  buf[size] = '\0';
+  char* sep = strstr(buf, "\r\n\r\n");
+  buf[size] = saved;
+  if (sep == NULL) {
+    return 0;
+  }
+  int header_len = sep - buf + 4;
+  fields->clear();
+  const char* line = buf;
+  const char* end = buf + header_len - 2;
+  while (line < end) {
+    const char* lf = static_cast<const char*>(memchr(line, '\n', end - line));
+    if (lf == NULL) {
+      return -1;
+    }
+    const char* line_end = (lf > line && lf[-1] == '\r') ? lf - 1 : lf;
+    const char* colon = static_cast<const char*>(
+        memchr(line, line == buf ? ' ' : ':', line_end - line));
+    if (colon == NULL) {
+      return -1;
+    }
+    const char* value = colon + 1;
+    while (value < line_end && *value == ' ') {
+      value++;
+    }
+    fields->push_back(std::make_pair(slash::Slice(line, colon - line),
+                                     slash::Slice(value, line_end - value)));
+    line = lf + 1;
+  }
+  return header_len;
+}
+
+// Parse the request n times as it comes in reads of read_size bytes
+static void Bench(const char* name, const std::string& req, size_t read_size,
+                  int n) {
+  std::string buf(req.size() + 1, '\0');
+  memcpy(&buf[0], req.data(), req.size());
+  pink::HTTPParser parser;
+  Fields fields;
+
+  uint64_t parsed = 0;
+  uint64_t start = NowMicros();
+  for (int i = 0; i < n; i++) {
+    for (size_t size = std::min(read_size, req.size()); ;
+         size = std::min(size + read_size, req.size())) {
+      if (RescanParse(&buf[0], size, &fields) != 0) {
+        parsed++;
+        break;
+      }
+    }
+  }
+  uint64_t rescan = NowMicros() - start;
+
+  start = NowMicros();
+  for (int i = 0; i < n; i++) {
+    parser.Reset();
+    for (size_t size = std::min(read_size, req.size()); ;
+         size = std::min(size + read_size, req.size())) {
+      if (parser.Parse(&buf[0], size) != 0) {
+        parsed--;
+        break;
+      }
+    }
+  }
+  uint64_t incremental = NowMicros() - start;
+
+  double mb = static_cast<double>(req.size()) * n / (1024 * 1024);
+  printf("%-8s %6zu bytes  read %6zu  rescan %8.1f MB/s  "
+         "incremental %8.1f MB/s %8.0f req/ms%s\n",
+         name, req.size(), read_size,
+         mb * 1000000 / (rescan > 0 ? rescan : 1),
+         mb * 1000000 / (incremental > 0 ? incremental : 1),
+         static_cast<double>(n) * 1000 / (incremental > 0 ? incremental : 1),
+         parsed == 0 ? "" : "  (MISMATCH)");
+}
+
+int main(int argc, char* argv[]) {
+  int requests = 100000;
+  if (argc > 1) {
+    requests = atoi(argv[1]);
+  }
+  std::string small = MakeRequest(0);
+  std::string large = MakeRequest(8192);
+  size_t read_sizes[] = {1 << 20, 1024, 128};
+  for (size_t read_size : read_sizes) {
+    Bench("small", small, read_size, requests);
+  }
+  for (size_t read_size : read_sizes) {
+    Bench("large", large, read_size, requests / 10);
+  }
+  return 0;
+}
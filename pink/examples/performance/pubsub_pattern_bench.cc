@@ -0,0 +1,97 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <string>
+#include <vector>
+
+#include "slash/include/slash_string.h"
+#include "pink/src/pattern_index.h"
+
+static uint64_t NowMicros() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+/*
+ * The match cost of publishing the channels against n patterns made by
+ * format from 0 to n - 1, once by looping over all of the patterns as
+ * PubSubThread used to do, once by the PatternIndex. Sending the frames
+ * to the subscribers is not timed.
+ */
+static void Bench(const char* format, int n,
+                  const std::vector<std::string>& channels) {
+  std::vector<std::string> patterns;
+  pink::PatternIndex index;
+  for (int i = 0; i < n; i++) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), format, i);
+    patterns.push_back(buf);
+    index.Add(buf);
+  }
+
+  uint64_t matched = 0;
+  uint64_t start = NowMicros();
+  for (auto& channel : channels) {
+    for (auto& pattern : patterns) {
+      if (slash::stringmatchlen(pattern.data(), pattern.size(),
+                                channel.data(), channel.size(), 0)) {
+        matched++;
+      }
+    }
+  }
+  uint64_t linear = NowMicros() - start;
+
+  std::vector<const std::string*> result;
+  uint64_t indexed_matched = 0;
+  start = NowMicros();
+  for (auto& channel : channels) {
+    result.clear();
+    index.Match(channel, &result);
+    indexed_matched += result.size();
+  }
+  uint64_t indexed = NowMicros() - start;
+
+  printf("%-14s patterns %7d  match cost: linear %10.3f us/msg"
+         "  index %8.3f us/msg%s\n", format, n,
+         static_cast<double>(linear) / channels.size(),
+         static_cast<double>(indexed) / channels.size(),
+         matched == indexed_matched ? "" : "  (MISMATCH)");
+}
+
+int main(int argc, char* argv[]) {
+  int messages = 1000;
+  if (argc > 1) {
+    messages = atoi(argv[1]);
+  }
+
+  std::vector<std::string> channels;
+  for (int i = 0; i < messages; i++) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "user.%d.kind%d", rand() % 100000,
+             rand() % 1000);
+    channels.push_back(buf);
+  }
+
+  int sizes[] = {10, 1000, 100000};
+  // A distinct literal prefix for each pattern, the best case of the index
+  for (int n : sizes) {
+    Bench("user.%d.*", n, channels);
+  }
+  // One shared prefix, every pattern is matched past it
+  for (int n : sizes) {
+    Bench("user.*.kind%d", n, channels);
+  }
+  // No literal prefix at all, the worst case of the index
+  for (int n : sizes) {
+    Bench("*.kind%d", n, channels);
+  }
+  return 0;
+}
@@ -31,11 +31,14 @@ class PingConn : public PbConn {
 
   int DealMessage() {
     num++;
-    request_.ParseFromArray(rbuf_ + cur_pos_ - header_len_, header_len_);
+    Ping* request = NewMessage<Ping>();
+    if (!ParseRequest(request)) {
+      return -1;
+    }
 
-    response_.Clear();
-    response_.set_pong("hello " + request_.ping());
-    res_ = &response_;
+    Pong* response = NewMessage<Pong>();
+    response->set_pong("hello " + request->ping());
+    res_ = response;
 
     set_is_reply(true);
 
@@ -43,10 +46,6 @@ class PingConn : public PbConn {
   }
 
  private:
-
-  Ping request_;
-  Pong response_;
-
   PingConn(PingConn&);
   PingConn& operator=(PingConn&);
 };
@@ -0,0 +1,205 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef PINK_INCLUDE_ASYNC_CLI_H_
+#define PINK_INCLUDE_ASYNC_CLI_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "slash/include/slash_mutex.h"
+#include "slash/include/slash_status.h"
+
+#include "pink/include/pink_thread.h"
+
+namespace pink {
+
+using slash::Status;
+
+class PinkEpoll;
+
+/*
+ * AsyncCliBase is the loop of an asynchronous client on one connection.
+ * It connects and reconnects every reconnect_interval ms, writes the
+ * requests of a loop iteration in one write, and reads the replies as
+ * they come. The client decodes the replies and calls back, by the hooks
+ * below. See AsyncCli for the requests.
+ *
+ * It runs the loop on its own thread after StartThread(), or on the
+ * caller's thread by calling Poll() repeatedly, never both.
+ */
+class AsyncCliBase : public Thread {
+ public:
+  virtual ~AsyncCliBase();
+
+  virtual int StopThread() override;
+
+  // Run one loop iteration, wait at most timeout ms for the events
+  void Poll(int timeout);
+
+  bool connected() const {
+    return state_ == kConnected;
+  }
+  // Requests sent and not called back yet
+  size_t pending() const {
+    return pending_;
+  }
+
+  void set_connect_timeout(int connect_timeout) {
+    connect_timeout_ = connect_timeout;
+  }
+  void set_reconnect_interval(int reconnect_interval) {
+    reconnect_interval_ = reconnect_interval;
+  }
+
+ protected:
+  AsyncCliBase(const std::string& ip, int port);
+
+  // Wake the loop up once for all the requests before it takes them
+  void Notify();
+  void AddPending() {
+    pending_++;
+  }
+  // A request is called back
+  void Done() {
+    pending_--;
+  }
+  // Append a request to the output, on the loop thread when connected
+  void Write(const std::string& data) {
+    wbuf_.append(data);
+  }
+  void Disconnect(const Status& s);
+
+  // Move the submitted requests to the output, or keep them until connected
+  virtual void TakeSubmitted() = 0;
+  // read() the socket once into the decoder, return what read() returns
+  virtual ssize_t ReadReplies(int fd) = 0;
+  // Call back the complete replies, return false if disconnected for a bad one
+  virtual bool HandleReplies() = 0;
+  // The connection is gone, drop the partial reply, fail the requests sent
+  virtual void Disconnected(const Status& s) = 0;
+
+ private:
+  enum State {
+    kDisconnected,
+    kConnecting,
+    kConnected
+  };
+
+  virtual void *ThreadMain() override;
+
+  void StartConnect(uint64_t now);
+  void FinishConnect();
+  void HandleRead();
+  bool Flush();
+  void SetWritable(bool writable);
+
+  std::string ip_;
+  int port_;
+  int connect_timeout_;
+  int reconnect_interval_;
+
+  // Loop thread only
+  PinkEpoll* pink_epoll_;
+  int fd_;
+  std::atomic<int> state_;
+  bool writable_;               // EPOLLOUT is on
+  uint64_t connect_time_;       // ms, when the connecting began
+  uint64_t next_connect_;       // ms, no reconnect before it
+  std::string wbuf_;
+  size_t wbuf_pos_;
+
+  std::atomic<bool> notified_;
+  int notify_receive_fd_;
+  int notify_send_fd_;
+  std::atomic<size_t> pending_;
+
+  // No copying allowed
+  AsyncCliBase(const AsyncCliBase&);
+  void operator=(const AsyncCliBase&);
+};
+
+/*
+ * AsyncCli queues the encoded requests of any thread for the loop, with
+ * the Call kept to call back the reply. The requests sent while
+ * disconnected wait for the connection.
+ */
+template <typename Call>
+class AsyncCli : public AsyncCliBase {
+ protected:
+  AsyncCli(const std::string& ip, int port)
+      : AsyncCliBase(ip, port) {}
+
+  // Thread safe
+  void Submit(std::string&& data, Call&& call) {
+    AddPending();
+    {
+    slash::MutexLock l(&mu_);
+    submitted_.push_back(Request(std::move(data), std::move(call)));
+    }
+    Notify();
+  }
+
+  /*
+   * Fail all the requests, the destructor of the client calls it, while
+   * the hooks are still there
+   */
+  void Close() {
+    StopThread();
+    Disconnect(Status::IOError("client closed"));
+    TakeSubmitted();
+    while (!waiting_.empty()) {
+      Fail(&waiting_.front().call, Status::IOError("client closed"));
+      waiting_.pop_front();
+    }
+  }
+
+  // The request is in the output, keep call for its reply
+  virtual void Sent(Call&& call) = 0;
+  // The request is never sent
+  virtual void Fail(Call* call, const Status& s) = 0;
+
+ private:
+  struct Request {
+    std::string data;
+    Call call;
+    Request(std::string&& _data, Call&& _call)
+        : data(std::move(_data)), call(std::move(_call)) {}
+  };
+
+  virtual void TakeSubmitted() override {
+    std::vector<Request> submitted;
+    {
+    slash::MutexLock l(&mu_);
+    submitted.swap(submitted_);
+    }
+    for (auto& request : submitted) {
+      waiting_.push_back(std::move(request));
+    }
+    if (!connected()) {
+      return;
+    }
+    while (!waiting_.empty()) {
+      Request& request = waiting_.front();
+      Write(request.data);
+      Sent(std::move(request.call));
+      waiting_.pop_front();
+    }
+  }
+
+  // mu_ guards submitted_
+  slash::Mutex mu_;
+  std::vector<Request> submitted_;
+  std::deque<Request> waiting_;   // loop thread only
+};
+
+}  // namespace pink
+#endif  // PINK_INCLUDE_ASYNC_CLI_H_
@@ -0,0 +1,72 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef PINK_INCLUDE_ASYNC_REDIS_CLIENT_H_
+#define PINK_INCLUDE_ASYNC_REDIS_CLIENT_H_
+
+#include <deque>
+#include <functional>
+#include <string>
+
+#include "slash/include/slash_status.h"
+
+#include "pink/include/async_cli.h"
+#include "pink/include/redis_cli.h"
+
+namespace pink {
+
+using slash::Status;
+
+class RedisReader;
+
+/*
+ * The status is Corruption with the message for an error reply, IOError
+ * if the connection broke before the reply came, then the command may or
+ * may not have run. The elements of an array reply are flattened, and a
+ * nil adds no element.
+ */
+typedef std::function<void(const Status& s, const RedisCmdArgsType& reply)>
+  RedisCallback;
+
+/*
+ * AsyncRedisClient pipelines the commands on one connection without
+ * waiting for the replies, and calls back in the order of the commands.
+ * The commands sent in one loop iteration go out in one write.
+ *
+ * It runs the loop on its own thread after StartThread(), or on the
+ * caller's thread by calling Poll() repeatedly, never both. Callbacks run
+ * on the loop thread. A broken connection is reconnected every
+ * reconnect_interval ms, the commands sent meanwhile wait for it.
+ */
+class AsyncRedisClient : public AsyncCli<RedisCallback> {
+ public:
+  AsyncRedisClient(const std::string& ip, int port);
+  virtual ~AsyncRedisClient();
+
+  // Thread safe
+  void Send(const RedisCmdArgsType& argv, const RedisCallback& callback);
+  // cmd is serialized by SerializeRedisCommand
+  void SendSerialized(const std::string& cmd, const RedisCallback& callback);
+
+ private:
+  virtual void Sent(RedisCallback&& callback) override;
+  virtual void Fail(RedisCallback* callback, const Status& s) override;
+  virtual ssize_t ReadReplies(int fd) override;
+  virtual bool HandleReplies() override;
+  virtual void Disconnected(const Status& s) override;
+  void Callback(const RedisCallback& callback, const Status& s,
+                const RedisCmdArgsType& reply);
+
+  // Loop thread only
+  RedisReader* reader_;
+  std::deque<RedisCallback> inflight_;  // commands written or in the output
+
+  // No copying allowed
+  AsyncRedisClient(const AsyncRedisClient&);
+  void operator=(const AsyncRedisClient&);
+};
+
+}  // namespace pink
+#endif  // PINK_INCLUDE_ASYNC_REDIS_CLIENT_H_
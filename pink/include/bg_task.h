@@ -0,0 +1,196 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef PINK_INCLUDE_BG_TASK_H_
+#define PINK_INCLUDE_BG_TASK_H_
+
+#include <stddef.h>
+
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace pink {
+
+/*
+ * BGTask holds a move-only callable with no arguments. Callables up to
+ * kInlineSize bytes, including the plain function(arg) pair, live inside
+ * the task, larger ones are allocated on heap.
+ */
+class BGTask {
+ public:
+  static const size_t kInlineSize = 48;
+
+  BGTask() : ops_(NULL) {}
+
+  BGTask(void (*function)(void*), void* arg) : ops_(NULL) {
+    Init(FunctionCall(function, arg));
+  }
+
+  template <typename F,
+            typename = typename std::enable_if<!std::is_same<
+                typename std::decay<F>::type, BGTask>::value>::type>
+  explicit BGTask(F&& f) : ops_(NULL) {
+    Init(std::forward<F>(f));
+  }
+
+  BGTask(BGTask&& other) : ops_(NULL) {
+    MoveFrom(&other);
+  }
+
+  BGTask& operator=(BGTask&& other) {
+    if (this != &other) {
+      Reset();
+      MoveFrom(&other);
+    }
+    return *this;
+  }
+
+  ~BGTask() {
+    Reset();
+  }
+
+  void operator()() {
+    ops_->invoke(&buf_);
+  }
+
+  explicit operator bool() const {
+    return ops_ != NULL;
+  }
+
+  void Reset() {
+    if (ops_ != NULL) {
+      ops_->destroy(&buf_);
+      ops_ = NULL;
+    }
+  }
+
+  /*
+   * Identify the callback of the task for statistics, the function of a
+   * function(arg) task, or the type of a callable, see KeyOf()
+   */
+  const void* key() const {
+    if (ops_ == &InlineOps<FunctionCall>::ops) {
+      return KeyOf(reinterpret_cast<const FunctionCall*>(&buf_)->function);
+    }
+    return ops_;
+  }
+
+  static const void* KeyOf(void (*function)(void*)) {
+    return reinterpret_cast<const void*>(function);
+  }
+
+  template <typename F>
+  static const void* KeyOf() {
+    typedef typename std::decay<F>::type T;
+    return FitsInline<T>::value ?
+      &InlineOps<T>::ops : &HeapOps<T>::ops;
+  }
+
+ private:
+  struct FunctionCall {
+    void (*function)(void*);
+    void* arg;
+    FunctionCall(void (*_function)(void*), void* _arg)
+      : function(_function), arg(_arg) {}
+    void operator()() {
+      (*function)(arg);
+    }
+  };
+
+  typedef std::aligned_storage<kInlineSize>::type Storage;
+
+  struct Ops {
+    void (*invoke)(void* buf);
+    void (*move)(void* dst, void* src);   // src is left empty
+    void (*destroy)(void* buf);
+  };
+
+  template <typename T>
+  struct InlineOps {
+    static void Invoke(void* buf) {
+      (*static_cast<T*>(buf))();
+    }
+    static void Move(void* dst, void* src) {
+      new (dst) T(std::move(*static_cast<T*>(src)));
+      static_cast<T*>(src)->~T();
+    }
+    static void Destroy(void* buf) {
+      static_cast<T*>(buf)->~T();
+    }
+    static const Ops ops;
+  };
+
+  template <typename T>
+  struct HeapOps {
+    static void Invoke(void* buf) {
+      (**static_cast<T**>(buf))();
+    }
+    static void Move(void* dst, void* src) {
+      *static_cast<T**>(dst) = *static_cast<T**>(src);
+    }
+    static void Destroy(void* buf) {
+      delete *static_cast<T**>(buf);
+    }
+    static const Ops ops;
+  };
+
+  template <typename T>
+  struct FitsInline : std::integral_constant<bool,
+      sizeof(T) <= kInlineSize &&
+      std::alignment_of<T>::value <= std::alignment_of<Storage>::value &&
+      std::is_nothrow_move_constructible<T>::value> {
+  };
+
+  template <typename F>
+  void Init(F&& f) {
+    typedef typename std::decay<F>::type T;
+    Init<T>(std::forward<F>(f), FitsInline<T>());
+  }
+
+  template <typename T, typename F>
+  void Init(F&& f, std::true_type) {
+    new (&buf_) T(std::forward<F>(f));
+    ops_ = &InlineOps<T>::ops;
+  }
+
+  template <typename T, typename F>
+  void Init(F&& f, std::false_type) {
+    *reinterpret_cast<T**>(&buf_) = new T(std::forward<F>(f));
+    ops_ = &HeapOps<T>::ops;
+  }
+
+  void MoveFrom(BGTask* other) {
+    if (other->ops_ != NULL) {
+      other->ops_->move(&buf_, &other->buf_);
+      ops_ = other->ops_;
+      other->ops_ = NULL;
+    }
+  }
+
+  Storage buf_;
+  const Ops* ops_;
+
+  // No copying allowed
+  BGTask(const BGTask&);
+  void operator=(const BGTask&);
+};
+
+template <typename T>
+const BGTask::Ops BGTask::InlineOps<T>::ops = {
+  &BGTask::InlineOps<T>::Invoke,
+  &BGTask::InlineOps<T>::Move,
+  &BGTask::InlineOps<T>::Destroy,
+};
+
+template <typename T>
+const BGTask::Ops BGTask::HeapOps<T>::ops = {
+  &BGTask::HeapOps<T>::Invoke,
+  &BGTask::HeapOps<T>::Move,
+  &BGTask::HeapOps<T>::Destroy,
+};
+
+}  // namespace pink
+#endif  // PINK_INCLUDE_BG_TASK_H_
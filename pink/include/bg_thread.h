@@ -7,15 +7,67 @@
 #define PINK_INCLUDE_BG_THREAD_H_
 
 #include <atomic>
+#include <map>
 #include <queue>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "pink/include/pink_thread.h"
+#include "pink/include/bg_task.h"
+#include "pink/include/pink_histogram.h"
+#include "pink/include/timer_wheel.h"
+#include "pink/src/pink_util.h"
 
 #include "slash/include/slash_mutex.h"
 
 namespace pink {
 
-struct TimerItem {
+/*
+ * A lane of BGThread, the non-empty lanes share the thread in proportion
+ * to their weight, the lower lane wins a tie. A task still queued after
+ * its timeout is expired, it is dropped if drop_expired, else it is run
+ * late, both are counted in BGLaneStats.
+ */
+struct BGLaneOptions {
+  int weight;
+  bool drop_expired;
+  explicit BGLaneOptions(int _weight = 1, bool _drop_expired = false)
+      : weight(_weight), drop_expired(_drop_expired) {}
+};
+
+/*
+ * The queue wait is only known for the tasks scheduled with a timeout or
+ * while the timing is enabled
+ */
+struct BGLaneStats {
+  size_t depth;             // tasks queued now
+  uint64_t dequeued;
+  uint64_t expired;         // dequeued after the timeout
+  uint64_t dropped;         // expired and not run
+  uint64_t total_wait_us;
+  uint64_t max_wait_us;
+  BGLaneStats()
+      : depth(0), dequeued(0), expired(0), dropped(0),
+        total_wait_us(0), max_wait_us(0) {}
+};
+
+// Run time of one callback, see BGTask::key()
+struct BGTaskTiming {
+  const void* key;
+  std::string name;         // empty if not registered
+  uint64_t count;
+  uint64_t total_us;
+  uint64_t max_us;
+  uint64_t p99_us;
+};
+
+/*
+ * The item of the timer heap BGThread had before the TimerWheel, no
+ * longer used, kept for the code built against it for one release
+ */
+struct __attribute__((deprecated("BGThread schedules timers by TimerWheel")))
+TimerItem {
   uint64_t exec_time;
   void (*function)(void *);
   void* arg;
@@ -33,15 +85,33 @@ class BGThread : public Thread {
   explicit BGThread(int full = 100000) :
     Thread::Thread(),
     full_(full),
+    size_(0),
     mu_(),
     rsignal_(&mu_),
-    wsignal_(&mu_) {
+    wsignal_(&mu_),
+    timer_wheel_(NowMs()),
+    timing_(false) {
+      lanes_.push_back(new Lane(BGLaneOptions()));
     }
 
   virtual ~BGThread() {
     StopThread();
+    for (auto lane : lanes_) {
+      delete lane;
+    }
+    for (auto& timing : task_timings_) {
+      delete timing.second;
+    }
   }
 
+  /*
+   * Replace the lanes, lane 0 is where Schedule() without a lane goes.
+   * The tasks of the removed lanes move to lane 0, the stats are kept
+   * for the remaining lanes.
+   */
+  void SetLanes(const std::vector<BGLaneOptions>& options);
+  int lane_num();
+
   virtual int StopThread() override {
     should_stop_ = true;
     rsignal_.Signal();
@@ -52,30 +122,124 @@ class BGThread : public Thread {
   void Schedule(void (*function)(void*), void* arg);
 
   /*
-   * timeout is in millionsecond
+   * Schedule a move-only callable, e.g. a lambda, small ones are stored
+   * in the queue without allocation
    */
-  void DelaySchedule(uint64_t timeout, void (*function)(void *), void* arg);
+  template <typename F>
+  void Schedule(F&& f) {
+    Schedule(BGTask(std::forward<F>(f)));
+  }
+  void Schedule(BGTask&& task);
 
+  /*
+   * Schedule to the lane, an invalid lane means lane 0. timeout is in
+   * millisecond, 0 for no timeout
+   */
+  template <typename F>
+  void Schedule(int lane, F&& f, uint64_t timeout = 0) {
+    Schedule(lane, BGTask(std::forward<F>(f)), timeout);
+  }
+  void Schedule(int lane, BGTask&& task, uint64_t timeout = 0);
+
+  /*
+   * Enqueue all the tasks under one lock with one wakeup, it waits only
+   * for the queue to be below full, so the batch may pass over it
+   */
+  void ScheduleBatch(std::vector<BGTask>* tasks, int lane = 0);
+
+  /*
+   * timeout is in millionsecond, the handle could cancel or reschedule
+   * the task before it runs
+   */
+  TimerHandle DelaySchedule(uint64_t timeout,
+                            void (*function)(void *), void* arg);
+  template <typename F>
+  TimerHandle DelaySchedule(uint64_t timeout, F&& f) {
+    return DelaySchedule(timeout, BGTask(std::forward<F>(f)));
+  }
+  TimerHandle DelaySchedule(uint64_t timeout, BGTask&& task);
+
+  // Return false if the task has run or been cancelled
+  bool Cancel(const TimerHandle& handle);
+  bool Reschedule(const TimerHandle& handle, uint64_t timeout);
+
+  // qu_size is the sum of all the lanes
   void QueueSize(int* pri_size, int* qu_size);
+  // One BGLaneStats for each lane
+  void QueueSize(std::vector<BGLaneStats>* lanes);
   void QueueClear();
   void SwallowReadyTasks();
 
+  /*
+   * Time the queue wait and the run of the tasks, it costs two clock
+   * reads per task so it's off by default. All the timings are readable
+   * while the thread runs.
+   */
+  void EnableTiming(bool enable) {
+    timing_ = enable;
+  }
+  bool timing() const {
+    return timing_;
+  }
+  const LatencyHistogram& wait_histogram() const {
+    return wait_histogram_;
+  }
+  const LatencyHistogram& run_histogram() const {
+    return run_histogram_;
+  }
+
+  // Name a callback in TaskTimings, key is from BGTask::KeyOf()
+  void RegisterTaskName(const void* key, const std::string& name);
+  void RegisterTaskName(void (*function)(void*), const std::string& name) {
+    RegisterTaskName(BGTask::KeyOf(function), name);
+  }
+  // The run time of every callback run since timing enabled
+  void TaskTimings(std::vector<BGTaskTiming>* timings);
+  void ClearTimings();
+
  private:
+  struct LaneItem {
+    BGTask task;
+    uint64_t enqueue_us;
+    uint64_t deadline_us;   // 0 for no deadline
+    LaneItem(BGTask&& _task, uint64_t _enqueue_us, uint64_t _deadline_us)
+        : task(std::move(_task)),
+          enqueue_us(_enqueue_us),
+          deadline_us(_deadline_us) {}
+  };
 
-  struct BGItem {
-    void (*function)(void*);
-    void* arg;
-    BGItem(void (*_function)(void*), void* _arg)
-      : function(_function), arg(_arg) {}
+  struct Lane {
+    BGLaneOptions options;
+    std::queue<LaneItem> queue;
+    int current;            // credit of the weighted round robin
+    BGLaneStats stats;
+    explicit Lane(const BGLaneOptions& _options)
+        : options(_options), current(0) {}
   };
 
-  std::queue<BGItem> queue_;
-  std::priority_queue<TimerItem> timer_queue_;
+  Lane* GetLane(int lane);
+  void WaitForRoom();
+  bool TakeTask(BGTask* task);
+  void RunTask(BGTask* task);
+  void RunExpiredTimers();
+
+  std::vector<Lane*> lanes_;
 
   size_t full_;
+  size_t size_;             // tasks of all the lanes
   slash::Mutex mu_;
   slash::CondVar rsignal_;
   slash::CondVar wsignal_;
+  TimerWheel timer_wheel_;
+  std::vector<BGTask> expired_;     // expired timers to run
+
+  std::atomic<bool> timing_;
+  LatencyHistogram wait_histogram_;
+  LatencyHistogram run_histogram_;
+  // timing_mu_ guards task_timings_ and task_names_
+  slash::Mutex timing_mu_;
+  std::map<const void*, LatencyHistogram*> task_timings_;
+  std::map<const void*, std::string> task_names_;
   virtual void *ThreadMain() override;
 };
 
@@ -0,0 +1,121 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef PINK_INCLUDE_BG_THREAD_POOL_H_
+#define PINK_INCLUDE_BG_THREAD_POOL_H_
+
+#include <atomic>
+#include <deque>
+#include <utility>
+#include <vector>
+
+#include "pink/include/bg_thread.h"
+
+#include "slash/include/slash_mutex.h"
+
+namespace pink {
+
+/*
+ * BGThreadPool has the Schedule/DelaySchedule interface of BGThread, but
+ * runs the tasks on several workers. Every worker owns a work stealing
+ * deque, tasks scheduled from a worker go to its own deque, the others go
+ * to a shared queue, and an idle worker steals from the others before it
+ * spins for a while and parks. A long task only holds its own worker.
+ */
+class BGThreadPool {
+ public:
+  explicit BGThreadPool(int thread_num, int full = 100000);
+  virtual ~BGThreadPool();
+
+  int StartThread();
+  /*
+   * Stop and join the workers, then run the ready tasks and the expired
+   * timers left, as BGThread does
+   */
+  int StopThread();
+
+  void Schedule(void (*function)(void*), void* arg);
+
+  template <typename F>
+  void Schedule(F&& f) {
+    Schedule(BGTask(std::forward<F>(f)));
+  }
+  void Schedule(BGTask&& task);
+
+  /*
+   * Enqueue all the tasks with one lock, the parked workers are waked up
+   * together
+   */
+  void ScheduleBatch(std::vector<BGTask>* tasks);
+
+  /*
+   * timeout is in millionsecond, the handle could cancel or reschedule
+   * the task before it runs
+   */
+  TimerHandle DelaySchedule(uint64_t timeout,
+                            void (*function)(void *), void* arg);
+  template <typename F>
+  TimerHandle DelaySchedule(uint64_t timeout, F&& f) {
+    return DelaySchedule(timeout, BGTask(std::forward<F>(f)));
+  }
+  TimerHandle DelaySchedule(uint64_t timeout, BGTask&& task);
+
+  // Return false if the task has run or been cancelled
+  bool Cancel(const TimerHandle& handle);
+  bool Reschedule(const TimerHandle& handle, uint64_t timeout);
+
+  void QueueSize(int* pri_size, int* qu_size);
+  void QueueClear();
+  void SwallowReadyTasks();
+
+  int thread_num() const {
+    return static_cast<int>(workers_.size());
+  }
+
+  bool should_stop() const {
+    return should_stop_.load();
+  }
+
+ private:
+  class Worker;
+
+  void PushTasks(BGTask** items, size_t num);
+  BGTask* TakeTask(Worker* worker);
+  BGTask* TakeShared();
+  bool RunExpiredTimers();
+  void UpdateNextTimer(uint64_t now);
+  void Park();
+  void WakeUp(size_t tasks);
+
+  std::vector<Worker*> workers_;
+
+  std::atomic<bool> should_stop_;
+  size_t full_;
+  std::atomic<size_t> pending_;     // ready tasks of all the queues
+  std::atomic<int> sleepers_;       // parked workers
+  std::atomic<int> waiters_;        // Schedule() blocked by full_
+
+  /*
+   * Tasks scheduled by the threads out of the pool
+   */
+  slash::Mutex queue_mu_;
+  std::deque<BGTask*> queue_;
+
+  /*
+   * mu_ guards timer_wheel_ and the parking of workers and schedulers
+   */
+  slash::Mutex mu_;
+  slash::CondVar rsignal_;
+  slash::CondVar wsignal_;
+  TimerWheel timer_wheel_;
+  std::atomic<uint64_t> next_timer_;   // the next tick of timer_wheel_
+
+  // No copying allowed
+  BGThreadPool(const BGThreadPool&);
+  void operator=(const BGThreadPool&);
+};
+
+}  // namespace pink
+#endif  // PINK_INCLUDE_BG_THREAD_POOL_H_
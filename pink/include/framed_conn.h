@@ -0,0 +1,279 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef PINK_INCLUDE_FRAMED_CONN_H_
+#define PINK_INCLUDE_FRAMED_CONN_H_
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <deque>
+#include <string>
+#include <utility>
+
+#include "pink/include/pink_conn.h"
+#include "pink/include/pink_define.h"
+
+namespace pink {
+
+/*
+ * A complete frame in the read buffer, valid during DealFrame() only
+ */
+struct FrameView {
+  const char* header;       // Codec::kHeaderSize bytes
+  const char* body;
+  size_t body_len;
+};
+
+/*
+ * FramedConn reads the frames of a length prefixed binary protocol. The
+ * protocol is given by a Codec struct, known at compile time:
+ *
+ *   struct MyCodec {
+ *     // Fixed size of the frame header
+ *     static const size_t kHeaderSize = 8;
+ *     // Max body length, a larger frame closes the connection
+ *     static const size_t kMaxBody = 1 << 20;
+ *     // Body length of the frame, kHeaderSize bytes are at header
+ *     static size_t BodyLength(const char* header);
+ *   };
+ *
+ *   class MyConn : public FramedConn<MyCodec> {
+ *     int DealFrame(const FrameView& frame) override;
+ *   };
+ *
+ * A read takes all the socket has, and every complete frame in it is dealt
+ * in place, the partial one is kept for the next read. The replies given
+ * by Reply() are gathered, small ones share a segment, large ones and the
+ * shared responses are sent without copy, by one writev().
+ */
+template <typename Codec>
+class FramedConn : public PinkConn {
+ public:
+  FramedConn(const int fd, const std::string &ip_port, ServerThread *thread)
+      : PinkConn(fd, ip_port, thread),
+        rbuf_(static_cast<char*>(malloc(kInitBufferSize))),
+        rbuf_size_(kInitBufferSize),
+        rbuf_len_(0),
+        wbuf_pos_(0) {}
+
+  virtual ~FramedConn() {
+    free(rbuf_);
+  }
+
+  virtual ReadStatus GetRequest() override;
+  virtual WriteStatus SendReply() override;
+
+  virtual void WriteResp(const std::string& resp) override {
+    Reply(resp.data(), resp.size());
+    set_is_reply(true);
+  }
+  virtual void WriteSharedResp(const SharedResp& resp) override {
+    segments_.push_back(Segment());
+    segments_.back().shared = resp;
+    set_is_reply(true);
+  }
+
+  // Shrink the read buffer grown by a large frame
+  virtual void TryResizeBuffer() override;
+
+ protected:
+  /*
+   * Deal a complete frame, return non 0 to close the connection
+   */
+  virtual int DealFrame(const FrameView& frame) = 0;
+
+  // Copy the data to the end of the output
+  void Reply(const char* data, size_t len);
+  // Queue the data without copy
+  void Reply(std::string&& data);
+
+ private:
+  static const size_t kInitBufferSize = 16 * 1024;
+  // The least free room for a read
+  static const size_t kReadChunk = 4 * 1024;
+  // Replies up to it are copied into a shared segment
+  static const size_t kCopyLimit = 4 * 1024;
+  static const size_t kSegmentSize = 16 * 1024;
+  static const int kMaxIov = 64;
+
+  struct Segment {
+    std::string buf;
+    SharedResp shared;      // the data if set, buf is empty
+
+    const char* data() const {
+      return shared ? shared->data() : buf.data();
+    }
+    size_t size() const {
+      return shared ? shared->size() : buf.size();
+    }
+  };
+
+  bool Reserve(size_t size);
+
+  char* rbuf_;
+  size_t rbuf_size_;
+  size_t rbuf_len_;
+
+  std::deque<Segment> segments_;
+  size_t wbuf_pos_;         // the offset in the first segment
+
+  // No copying allowed
+  FramedConn(const FramedConn&);
+  void operator=(const FramedConn&);
+};
+
+template <typename Codec>
+const size_t FramedConn<Codec>::kInitBufferSize;
+template <typename Codec>
+const size_t FramedConn<Codec>::kReadChunk;
+template <typename Codec>
+const size_t FramedConn<Codec>::kCopyLimit;
+template <typename Codec>
+const size_t FramedConn<Codec>::kSegmentSize;
+
+template <typename Codec>
+bool FramedConn<Codec>::Reserve(size_t size) {
+  if (size <= rbuf_size_) {
+    return true;
+  }
+  size_t new_size = rbuf_size_;
+  while (new_size < size) {
+    new_size *= 2;
+  }
+  char* buf = static_cast<char*>(realloc(rbuf_, new_size));
+  if (buf == NULL) {
+    return false;
+  }
+  rbuf_ = buf;
+  rbuf_size_ = new_size;
+  return true;
+}
+
+template <typename Codec>
+ReadStatus FramedConn<Codec>::GetRequest() {
+  if (rbuf_size_ - rbuf_len_ < kReadChunk &&
+      !Reserve(rbuf_len_ + kReadChunk)) {
+    return kFullError;
+  }
+  ssize_t nread = read(fd(), rbuf_ + rbuf_len_, rbuf_size_ - rbuf_len_);
+  if (nread == -1) {
+    if (errno == EAGAIN) {
+      return kReadHalf;
+    } else {
+      return kReadError;
+    }
+  } else if (nread == 0) {
+    return kReadClose;
+  }
+  rbuf_len_ += nread;
+
+  size_t pos = 0;
+  while (rbuf_len_ - pos >= Codec::kHeaderSize) {
+    FrameView frame;
+    frame.header = rbuf_ + pos;
+    frame.body_len = Codec::BodyLength(frame.header);
+    if (frame.body_len > Codec::kMaxBody) {
+      return kFullError;
+    }
+    size_t frame_len = Codec::kHeaderSize + frame.body_len;
+    if (rbuf_len_ - pos < frame_len) {
+      // Make room for the whole frame
+      if (!Reserve(frame_len)) {
+        return kFullError;
+      }
+      break;
+    }
+    frame.body = frame.header + Codec::kHeaderSize;
+    pos += frame_len;
+    if (DealFrame(frame) != 0) {
+      return kDealError;
+    }
+  }
+
+  // Keep the partial frame
+  if (pos > 0) {
+    memmove(rbuf_, rbuf_ + pos, rbuf_len_ - pos);
+    rbuf_len_ -= pos;
+  }
+  set_is_reply(!segments_.empty());
+  return rbuf_len_ == 0 ? kReadAll : kReadHalf;
+}
+
+template <typename Codec>
+void FramedConn<Codec>::Reply(const char* data, size_t len) {
+  if (segments_.empty() || segments_.back().shared ||
+      segments_.back().buf.capacity() - segments_.back().buf.size() < len) {
+    segments_.push_back(Segment());
+    segments_.back().buf.reserve(len > kSegmentSize ? len : kSegmentSize);
+  }
+  segments_.back().buf.append(data, len);
+}
+
+template <typename Codec>
+void FramedConn<Codec>::Reply(std::string&& data) {
+  if (data.size() <= kCopyLimit) {
+    Reply(data.data(), data.size());
+    return;
+  }
+  segments_.push_back(Segment());
+  segments_.back().buf = std::move(data);
+}
+
+template <typename Codec>
+WriteStatus FramedConn<Codec>::SendReply() {
+  struct iovec iov[kMaxIov];
+  ssize_t nwritten = 0;
+  while (!segments_.empty()) {
+    // The first segment may be partially sent
+    int iovcnt = 0;
+    size_t offset = wbuf_pos_;
+    for (auto iter = segments_.begin();
+         iter != segments_.end() && iovcnt < kMaxIov; iter++) {
+      iov[iovcnt].iov_base = const_cast<char*>(iter->data()) + offset;
+      iov[iovcnt].iov_len = iter->size() - offset;
+      offset = 0;
+      iovcnt++;
+    }
+    nwritten = writev(fd(), iov, iovcnt);
+    if (nwritten <= 0) {
+      break;
+    }
+
+    size_t consumed = nwritten;
+    while (!segments_.empty() &&
+           consumed >= segments_.front().size() - wbuf_pos_) {
+      consumed -= segments_.front().size() - wbuf_pos_;
+      segments_.pop_front();
+      wbuf_pos_ = 0;
+    }
+    wbuf_pos_ += consumed;
+  }
+  if (nwritten == -1) {
+    if (errno == EAGAIN) {
+      return kWriteHalf;
+    } else {
+      return kWriteError;
+    }
+  }
+  return segments_.empty() ? kWriteAll : kWriteHalf;
+}
+
+template <typename Codec>
+void FramedConn<Codec>::TryResizeBuffer() {
+  if (rbuf_size_ > kInitBufferSize && rbuf_len_ <= kInitBufferSize / 2) {
+    char* buf = static_cast<char*>(realloc(rbuf_, kInitBufferSize));
+    if (buf != NULL) {
+      rbuf_ = buf;
+      rbuf_size_ = kInitBufferSize;
+    }
+  }
+}
+
+}  // namespace pink
+#endif  // PINK_INCLUDE_FRAMED_CONN_H_
@@ -9,62 +9,152 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <utility>
 
+#include "slash/include/slash_slice.h"
 #include "slash/include/slash_status.h"
 #include "slash/include/xdebug.h"
 
 #include "pink/include/pink_conn.h"
 #include "pink/include/pink_define.h"
+#include "pink/src/http_parser.h"
 #include "pink/src/pink_util.h"
+#include "pink/src/pooled_buffer.h"
 
 namespace pink {
 
 class HTTPConn;
+class HTTPRequest;
+class HTTPRouter;
+class HTTPRouterHandles;
+
+/*
+ * HTTPFields is a flat list of key value views, in the order they come.
+ * The header fields are looked up ignoring case, the params are not.
+ */
+class HTTPFields {
+ public:
+  typedef std::pair<slash::Slice, slash::Slice> Field;
+  typedef std::vector<Field>::const_iterator const_iterator;
+
+  explicit HTTPFields(bool ignore_case)
+      : ignore_case_(ignore_case) {}
+
+  // Return the value of the first field with the key, NULL if not found
+  const slash::Slice* Find(const slash::Slice& key) const;
+
+  // Return an empty view if not found
+  slash::Slice Get(const slash::Slice& key) const {
+    const slash::Slice* value = Find(key);
+    return value != NULL ? *value : slash::Slice();
+  }
+  bool Has(const slash::Slice& key) const {
+    return Find(key) != NULL;
+  }
+
+  const_iterator begin() const {
+    return fields_.begin();
+  }
+  const_iterator end() const {
+    return fields_.end();
+  }
+  size_t size() const {
+    return fields_.size();
+  }
+  bool empty() const {
+    return fields_.empty();
+  }
+
+ private:
+  friend class HTTPRequest;
+  friend class HTTPRouter;
+
+  void Add(const slash::Slice& key, const slash::Slice& value) {
+    fields_.push_back(Field(key, value));
+  }
+  // Keep the capacity for the next request
+  void Clear() {
+    fields_.clear();
+  }
+  void Truncate(size_t size) {
+    fields_.resize(size);
+  }
+
+  bool ignore_case_;
+  std::vector<Field> fields_;
+};
 
+/*
+ * The views returned point into the read buffer of the connection, they
+ * are valid until PrepareResponse() returns.
+ */
 class HTTPRequest {
  public:
-  const std::string url() const;
-  const std::string path() const;
-  const std::string query_value(const std::string& field) const;
-  const std::map<std::string, std::string> query_params() const;
-  const std::map<std::string, std::string> postform_params() const;
-  const std::map<std::string, std::string> headers() const;
-  const std::string postform_value(const std::string& field) const;
-  const std::string method() const;
-  const std::string content_type() const;
-
-  const std::string client_ip_port() const;
+  slash::Slice url() const {
+    return url_;
+  }
+  slash::Slice path() const {
+    return path_;
+  }
+  slash::Slice method() const {
+    return method_;
+  }
+  slash::Slice version() const {
+    return version_;
+  }
+  slash::Slice content_type() const {
+    return content_type_;
+  }
+  slash::Slice query_value(const slash::Slice& field) const {
+    return query_params_.Get(field);
+  }
+  slash::Slice postform_value(const slash::Slice& field) const {
+    return postform_params_.Get(field);
+  }
+  const HTTPFields& query_params() const {
+    return query_params_;
+  }
+  const HTTPFields& postform_params() const {
+    return postform_params_;
+  }
+  const HTTPFields& headers() const {
+    return headers_;
+  }
+  // The params of the route matched by HTTPRouter, not decoded
+  slash::Slice path_param(const slash::Slice& key) const {
+    return path_params_.Get(key);
+  }
+  const HTTPFields& path_params() const {
+    return path_params_;
+  }
+
+  const std::string& client_ip_port() const;
 
   void Reset();
   void Dump() const;
 
  private:
   friend class HTTPConn;
+  friend class HTTPRouterHandles;
   explicit HTTPRequest(HTTPConn* conn);
   ~HTTPRequest();
 
   HTTPConn* conn_;
 
-  std::string method_;
-  std::string url_;
-  std::string path_;
-  std::string version_;
-  std::string content_type_;
+  slash::Slice method_;
+  slash::Slice url_;
+  slash::Slice path_;
+  slash::Slice version_;
+  slash::Slice content_type_;
   bool reply_100continue_;
-  std::map<std::string, std::string> postform_params_;
-  std::map<std::string, std::string> query_params_;
-  std::map<std::string, std::string> headers_;
+  HTTPFields postform_params_;
+  HTTPFields query_params_;
+  HTTPFields headers_;
+  // Filled when the route is matched
+  mutable HTTPFields path_params_;
 
   std::string client_ip_port_;
 
-  enum RequestParserStatus {
-    kHeaderMethod,
-    kHeaderPath,
-    kHeaderVersion,
-    kHeaderParamKey,
-    kHeaderParamValue,
-  };
-
   enum RequestStatus {
     kNewRequest,
     kHeaderReceiving,
@@ -73,34 +163,89 @@ class HTTPRequest {
   };
 
   RequestStatus req_status_;
-  RequestParserStatus parse_status_;
 
-  char* rbuf_;
+  // The body of "Transfer-Encoding: chunked", decoded as it comes
+  enum ChunkStatus {
+    kChunkSize,
+    kChunkData,
+    kChunkDataEnd,
+    kChunkTrailer,
+  };
+
+  bool chunked_;
+  ChunkStatus chunk_status_;
+
+  /*
+   * Taken when the request comes, released after the response is prepared.
+   * The header stays at the front, the body goes through the room after it.
+   */
+  PooledBuffer rbuf_;
   uint64_t rbuf_pos_;
+  uint64_t body_start_;
+  uint64_t next_start_;       // the pipelined request after this one
   uint64_t remain_recv_len_;
+  // Goes on from where the last read stopped
+  HTTPParser parser_;
 
+  /*
+   * Deal a request from the buffer or the socket, return kReadAll when its
+   * response is prepared
+   */
   ReadStatus ReadData();
+  ReadStatus Closed(ReadStatus status);
+  int DecodeChunked();
+  bool HasPipelined() const;
   int ParseHeader();
 
   ReadStatus DoRead();
-  bool ParseHeadFromArray(const char* data, const int size);
-  bool ParseGetUrl();
-  bool ParseHeadLine(const char* data, int line_start, int line_end);
-  bool ParseParameters(const std::string data, size_t line_start = 0);
+};
+
+/*
+ * HTTPFile owns an open file, it's closed after the last response sending
+ * it is done
+ */
+class HTTPFile {
+ public:
+  explicit HTTPFile(int fd)
+      : fd_(fd) {}
+  ~HTTPFile();
+
+  int fd() const {
+    return fd_;
+  }
+
+ private:
+  int fd_;
+
+  // No copying allowed
+  HTTPFile(const HTTPFile&);
+  void operator=(const HTTPFile&);
 };
 
 class HTTPResponse {
  public:
   void SetStatusCode(int code);
-  void SetHeaders(const std::string& key, const std::string& value);
-  void SetHeaders(const std::string& key, const size_t value);
+  // Replace the header with the same key, ignoring case
+  void SetHeaders(const slash::Slice& key, const slash::Slice& value);
+  void SetHeaders(const slash::Slice& key, const size_t value);
   void SetContentLength(uint64_t size);
+  /*
+   * Send size bytes of the file from offset as the body, by sendfile()
+   * without copy, instead of WriteResponseBody(). Content-Length is set.
+   */
+  void SetBodyFile(const std::shared_ptr<HTTPFile>& file,
+                   uint64_t offset, uint64_t size);
 
   void Reset();
   bool Finished();
 
+  int status_code() const {
+    return status_code_;
+  }
+
  private:
   friend class HTTPConn;
+  friend class HTTPRequest;
   HTTPConn* conn_;
 
   explicit HTTPResponse(HTTPConn* conn);
@@ -108,13 +253,23 @@ class HTTPResponse {
 
   enum ResponseStatus {
     kPrepareHeader,
-    kSendingHeader,
     kSendingBody,
   };
 
   ResponseStatus resp_status_;
+  // No Content-Length is set, the body is sent in chunks
+  bool chunked_;
+  // The request is HEAD, only the header is sent
+  bool head_;
+  std::shared_ptr<HTTPFile> body_file_;
+  uint64_t file_offset_;
 
-  char* wbuf_;
+  /*
+   * The output of the pipelined responses, one after another, sent from
+   * wbuf_pos_ to buf_len_. Taken when a response is filled, released after
+   * all is sent.
+   */
+  PooledBuffer wbuf_;
   int64_t buf_len_;
   int64_t wbuf_pos_;
 
@@ -122,8 +277,19 @@ class HTTPResponse {
   bool finished_;
 
   int status_code_;
-  std::map<std::string, std::string> headers_;
+  // The first header_num_ are set, the strings are reused by the next response
+  std::vector<std::pair<std::string, std::string>> headers_;
+  size_t header_num_;
 
+  int64_t Pending() const {
+    return buf_len_ - wbuf_pos_;
+  }
+  bool HasHeader(const slash::Slice& key) const;
+  bool CanSendFile() const;
+  bool AppendContinue();
+  bool Fill();
+  bool FillChunk();
+  bool SendFile();
   bool Flush();
   bool SerializeHeader();
 };
@@ -140,20 +306,25 @@ class HTTPHandles {
   virtual bool HandleRequest(const HTTPRequest* req) = 0;
   /*
    * ReadBodyData(...) will be called if there are data follow up,
-   * We deliver data just once.
+   * A large body is delivered in several chunks, in order. A chunked
+   * request body is decoded, the data of every chunk is delivered.
    */
   virtual void HandleBodyData(const char* data, size_t data_size) = 0;
 
   /*
    * Fill response headers in this handle when body received.
-   * You MUST set Content-Length by means of calling resp->SetContentLength(num).
+   * Set Content-Length by means of calling resp->SetContentLength(num),
+   * otherwise the body is sent with "Transfer-Encoding: chunked". The body
+   * of the response to HEAD is never written.
    * Besides, resp->SetStatusCode(code) should be called either.
    */
   virtual void PrepareResponse(HTTPResponse* resp) = 0;
   /*
    * Fill write buffer 'buf' in this handle, and should not exceed 'max_size'.
+   * It's called repeatedly with a buffer of a few KB until the body is
+   * written, every call makes a chunk of a chunked body.
    * Return actual size filled.
-   * Return -2 if has written all
+   * Return -2 if has written all, a chunked body also ends at 0
    * Return Other as Error and close connection
    */
   virtual int WriteResponseBody(char* buf, size_t max_size) = 0;
@@ -176,6 +347,7 @@ class HTTPHandles {
 
  private:
   friend class HTTPConn;
+  friend class HTTPRouterHandles;
 
   /*
    * No allowed copy and copy assign
@@ -198,6 +370,8 @@ class HTTPConn: public PinkConn {
   friend class HTTPRequest;
   friend class HTTPResponse;
 
+  ReadStatus ProcessRequests();
+
   HTTPRequest* request_;
   HTTPResponse* response_;
 
@@ -0,0 +1,107 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef PINK_INCLUDE_HTTP_ROUTER_H_
+#define PINK_INCLUDE_HTTP_ROUTER_H_
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "pink/include/http_conn.h"
+#include "pink/include/server_thread.h"
+
+namespace pink {
+
+// Make the handles of a route for a connection
+typedef std::function<std::shared_ptr<HTTPHandles>()> HTTPHandlesFactory;
+
+struct HTTPRouteStats {
+  std::string method;
+  std::string pattern;
+  uint64_t count;           // requests handled
+  uint64_t errors;          // 5xx responses
+  uint64_t total_us;
+  uint64_t max_us;
+  uint64_t p99_us;
+};
+
+// HTTPRouter maps the method and the path of a request to the handles of a
+// route, by a radix tree of the patterns. A pattern is made of static text,
+// ":name" matching a segment, and a trailing "*name" matching the rest:
+//
+//   HTTPRouter router;
+//   router.AddRoute("GET", "/users/:id", [] {
+//     return std::make_shared<UserHandles>();
+//   });
+//   router.AddRoute("GET", "/files/*path", ...);
+//   ServerThread* thread = NewDispatchThread(port, 4, &router);
+//
+// The static text is preferred to a param, and a param to a wildcard. The
+// params are views of the path, see HTTPRequest::path_param(). A
+// connection makes the handles of a route when it's first matched. An
+// unmatched path gets 404, a path matched with other methods 405. The
+// latency of a request is from its header parsed to its response
+// prepared.
+class HTTPRouter : public ConnFactory {
+ public:
+  HTTPRouter();
+  virtual ~HTTPRouter();
+
+  /*
+   * method "*" matches any method. Add all the routes before the server
+   * starts, return false if the pattern is malformed, or conflicts with a
+   * route added, as a param of another name at the same place
+   */
+  bool AddRoute(const std::string& method, const std::string& pattern,
+                const HTTPHandlesFactory& factory);
+
+  /*
+   * Return the id of the route, the params are appended. Return -1 if not
+   * found, *method_allowed is false if another method matches the path
+   */
+  int Match(const slash::Slice& method, const slash::Slice& path,
+            HTTPFields* params, bool* method_allowed = NULL) const;
+
+  void RouteStats(std::vector<HTTPRouteStats>* stats) const;
+  void ClearStats();
+  // Requests with no route matched
+  uint64_t unmatched() const {
+    return unmatched_.load(std::memory_order_relaxed);
+  }
+
+  virtual PinkConn* NewPinkConn(
+      int connfd,
+      const std::string &ip_port,
+      ServerThread *server_thread,
+      void* worker_private_data) const override;
+
+ private:
+  friend class HTTPRouterHandles;
+  struct Route;
+  struct Node;
+
+  Node* InsertStatic(Node* node, const char* text, size_t size);
+  int MatchNode(const Node* node, const slash::Slice& method,
+                const char* path, const char* end, HTTPFields* params,
+                bool* method_allowed) const;
+  // The methods matching path, for the Allow header of 405
+  void AllowedMethods(const slash::Slice& path, std::string* allow) const;
+  static int FindRoute(const Node* node, const slash::Slice& method);
+  void DeleteNode(Node* node);
+
+  Node* root_;
+  std::vector<Route*> routes_;
+  mutable std::atomic<uint64_t> unmatched_;
+
+  // No copying allowed
+  HTTPRouter(const HTTPRouter&);
+  void operator=(const HTTPRouter&);
+};
+
+}  // namespace pink
+#endif  // PINK_INCLUDE_HTTP_ROUTER_H_
@@ -0,0 +1,116 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef PINK_INCLUDE_HTTP_STATIC_H_
+#define PINK_INCLUDE_HTTP_STATIC_H_
+
+#include <sys/types.h>
+#include <time.h>
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "slash/include/slash_mutex.h"
+#include "slash/include/slash_status.h"
+
+#include "pink/include/http_conn.h"
+
+namespace pink {
+
+/*
+ * HTTPFileCache keeps the files opened recently in LRU order, with their
+ * metadata and header values, so that a repeat request costs no open() or
+ * stat(). It's shared by the connections of all the workers.
+ */
+class HTTPFileCache {
+ public:
+  struct Entry {
+    std::shared_ptr<HTTPFile> file;
+    uint64_t size;
+    time_t mtime;
+    ino_t ino;
+    std::string etag;
+    std::string last_modified;
+    const char* content_type;
+  };
+
+  /*
+   * capacity is the most files kept open, a cached file is stat() again
+   * after check_interval_ms to find it changed
+   */
+  explicit HTTPFileCache(size_t capacity = 1024,
+                         uint64_t check_interval_ms = 1000);
+  ~HTTPFileCache();
+
+  // Return NotFound if path is not a regular file
+  slash::Status Get(const std::string& path,
+                    std::shared_ptr<const Entry>* entry);
+
+  size_t size();
+  void Clear();
+
+ private:
+  struct Node {
+    std::string path;
+    std::shared_ptr<const Entry> entry;
+    uint64_t checked_ms;
+  };
+  typedef std::list<Node> NodeList;
+
+  void Put(const std::string& path, const std::shared_ptr<const Entry>& entry,
+           uint64_t now_ms);
+  void Erase(const std::string& path);
+
+  size_t capacity_;
+  uint64_t check_interval_ms_;
+
+  slash::Mutex mu_;
+  NodeList lru_;      // the most recent at front
+  std::unordered_map<std::string, NodeList::iterator> index_;
+
+  // No copying allowed
+  HTTPFileCache(const HTTPFileCache&);
+  void operator=(const HTTPFileCache&);
+};
+
+/*
+ * HTTPStaticHandles serves the files under root for GET and HEAD, a path
+ * ending with '/' serves its index.html. The body is sent by sendfile().
+ * A single byte range, and the conditional GET by If-None-Match or
+ * If-Modified-Since, which matches the Last-Modified exactly, are supported.
+ */
+class HTTPStaticHandles : public HTTPHandles {
+ public:
+  HTTPStaticHandles(const std::string& root,
+                    std::shared_ptr<HTTPFileCache> cache);
+
+  virtual bool HandleRequest(const HTTPRequest* req) override;
+  virtual void HandleBodyData(const char* data, size_t data_size) override;
+  virtual void PrepareResponse(HTTPResponse* resp) override;
+  virtual int WriteResponseBody(char* buf, size_t max_size) override;
+
+ private:
+  bool ResolvePath(const slash::Slice& path);
+
+  std::string root_;
+  std::shared_ptr<HTTPFileCache> cache_;
+
+  // Decided by HandleRequest()
+  int status_code_;
+  bool head_;
+  std::shared_ptr<const HTTPFileCache::Entry> entry_;
+  uint64_t range_start_;
+  uint64_t range_len_;
+  std::string path_;
+
+  // No copying allowed
+  HTTPStaticHandles(const HTTPStaticHandles&);
+  void operator=(const HTTPStaticHandles&);
+};
+
+}  // namespace pink
+#endif  // PINK_INCLUDE_HTTP_STATIC_H_
@@ -0,0 +1,90 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef PINK_INCLUDE_PB_ASYNC_CLI_H_
+#define PINK_INCLUDE_PB_ASYNC_CLI_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+#include "google/protobuf/message.h"
+#include "slash/include/slash_status.h"
+
+#include "pink/include/async_cli.h"
+
+namespace pink {
+
+using slash::Status;
+
+/*
+ * The status is Corruption with the error text if the server replied
+ * kPbFlagError or the reply couldn't be parsed into res, IOError if the
+ * connection broke before the reply came, then the request may or may not
+ * have run.
+ */
+typedef std::function<void(const Status& s)> PbDone;
+
+// A request of PbAsyncCli waiting for its reply
+struct PbAsyncCall {
+  uint64_t request_id;
+  google::protobuf::Message* res;
+  PbDone done;
+};
+
+/*
+ * PbAsyncCli sends the requests in extended frames, see kPbExtFrame, many
+ * of them in flight on one connection, and calls back each one when its
+ * reply comes, in any order.
+ *
+ * It runs the loop on its own thread after StartThread(), or on the
+ * caller's thread by calling Poll() repeatedly, never both. Callbacks run
+ * on the loop thread. A broken connection is reconnected every
+ * reconnect_interval ms, the requests sent meanwhile wait for it.
+ */
+class PbAsyncCli : public AsyncCli<PbAsyncCall> {
+ public:
+  PbAsyncCli(const std::string& ip, int port);
+  virtual ~PbAsyncCli();
+
+  /*
+   * Thread safe, req is serialized before return, res must be kept until
+   * done is called
+   */
+  void Send(const google::protobuf::Message& req,
+            google::protobuf::Message* res, const PbDone& done);
+  // Send with the method id in the frame, see PbRpcServer
+  void Call(uint32_t method_id, const google::protobuf::Message& req,
+            google::protobuf::Message* res, const PbDone& done);
+
+ private:
+  void Submit(const google::protobuf::Message& req, uint32_t flags,
+              uint32_t method_id, google::protobuf::Message* res,
+              const PbDone& done);
+  virtual void Sent(PbAsyncCall&& call) override;
+  virtual void Fail(PbAsyncCall* call, const Status& s) override;
+  virtual ssize_t ReadReplies(int fd) override;
+  virtual bool HandleReplies() override;
+  virtual void Disconnected(const Status& s) override;
+  void Callback(const PbDone& done, const Status& s);
+
+  // Loop thread only
+  std::string rbuf_;
+  size_t rbuf_len_;
+  // requests written or in the output, by request id
+  std::unordered_map<uint64_t, PbAsyncCall> inflight_;
+
+  std::atomic<uint64_t> next_request_id_;
+
+  // No copying allowed
+  PbAsyncCli(const PbAsyncCli&);
+  void operator=(const PbAsyncCli&);
+};
+
+}  // namespace pink
+#endif  // PINK_INCLUDE_PB_ASYNC_CLI_H_
@@ -8,7 +8,10 @@
 
 #include <string>
 #include <map>
+#include <deque>
+#include <memory>
 
+#include "google/protobuf/arena.h"
 #include "google/protobuf/message.h"
 #include "slash/include/slash_status.h"
 #include "pink/include/pink_conn.h"
@@ -18,6 +21,39 @@ namespace pink {
 
 using slash::Status;
 
+struct PbReplyQueue;
+
+/*
+ * PbReplier answers a request after DealMessage() returns, from any
+ * thread, see PbConn::DeferReply(). It's copyable and harmless to use
+ * after the connection is closed.
+ */
+class PbReplier {
+ public:
+  PbReplier() : request_id_(0), ext_(false) {}
+
+  // Return false if the connection is closed or it's not a valid replier
+  bool Reply(const google::protobuf::Message& res);
+  // Reply the error text with kPbFlagError, for the extended frames
+  bool ReplyError(const std::string& error);
+
+  bool valid() const {
+    return queue_ != nullptr;
+  }
+
+  uint64_t request_id() const {
+    return request_id_;
+  }
+
+ private:
+  friend class PbConn;
+  bool Reply(std::string* frame);
+
+  std::shared_ptr<PbReplyQueue> queue_;
+  uint64_t request_id_;
+  bool ext_;
+};
+
 class PbConn: public PinkConn {
  public:
   PbConn(const int fd, const std::string &ip_port, ServerThread *thread);
@@ -28,7 +64,9 @@ class PbConn: public PinkConn {
 
   /*
    * The Variable need by read the buf,
-   * We allocate the memory when we start the server
+   * We allocate the memory when we start the server.
+   * rbuf_ may hold several frames, in DealMessage() the body of the
+   * request is the header_len_ bytes before rbuf_ + cur_pos_
    */
   uint32_t header_len_;
   char* rbuf_;
@@ -40,7 +78,49 @@ class PbConn: public PinkConn {
 
   google::protobuf::Message *res_;
 
+  /*
+   * The frame of the request being dealt, an extended frame carries the
+   * request id, see kPbExtFrame. Its reply is sent with the same id.
+   */
+  bool ext_frame() const {
+    return ext_frame_;
+  }
+  uint64_t request_id() const {
+    return request_id_;
+  }
+  uint32_t frame_flags() const {
+    return frame_flags_;
+  }
+  // Valid with kPbFlagMethod in frame_flags()
+  uint32_t method_id() const {
+    return method_id_;
+  }
+
  protected:
+  /*
+   * Called in DealMessage() to reply later by the replier, instead of res_
+   * and set_is_reply(). The requests of extended frames could be replied
+   * in any order, the others must be replied in order. Invalid if the
+   * connection is not served by a worker thread.
+   */
+  PbReplier DeferReply();
+
+  /*
+   * The messages of the requests are better allocated on the arena, it's
+   * reset after the replies of the requests read together are flushed.
+   * Don't keep them longer, or use them in a deferred reply.
+   */
+  google::protobuf::Arena* arena() {
+    return &arena_;
+  }
+  template <typename T>
+  T* NewMessage() {
+    return google::protobuf::Arena::CreateMessage<T>(&arena_);
+  }
+
+  // Parse the body of the request being dealt into req, in place in rbuf_
+  bool ParseRequest(google::protobuf::Message* req);
+
   // NOTE: if this function return non 0, the the server will close this connection
   //
   // In the implementation of DealMessage, we should distinguish two types of error
@@ -68,8 +148,22 @@ class PbConn: public PinkConn {
   virtual int DealMessage() = 0;
 
  private:
-  char* wbuf_;
-  uint32_t wbuf_len_;
+  bool ext_frame_;
+  uint64_t request_id_;
+  uint32_t frame_flags_;
+  uint32_t method_id_;
+  bool deferred_;
+
+  google::protobuf::Arena arena_;
+
+  /*
+   * The deferred replies go to the queue, shared with the PbRepliers,
+   * SendReply() takes them to frames_. The other replies are serialized
+   * into the output segments in frames_, several small ones may share a
+   * segment. wbuf_pos_ is the offset in the first segment
+   */
+  std::shared_ptr<PbReplyQueue> queue_;
+  std::deque<std::string> frames_;
   uint32_t wbuf_pos_;
   virtual Status BuildObuf();
 };
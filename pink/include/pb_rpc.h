@@ -0,0 +1,136 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef PINK_INCLUDE_PB_RPC_H_
+#define PINK_INCLUDE_PB_RPC_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/service.h"
+
+#include "pink/include/pb_async_cli.h"
+#include "pink/include/pink_conn.h"
+
+namespace pink {
+
+// The method id in the frame, FNV-1a hash of the full name of the method
+uint32_t PbMethodId(const std::string& full_name);
+uint32_t PbMethodId(const google::protobuf::MethodDescriptor* method);
+
+class PbRpcConn;
+class PbRpcCall;
+
+class PbRpcController : public google::protobuf::RpcController {
+ public:
+  PbRpcController() : failed_(false) {}
+
+  void Reset() override;
+  bool Failed() const override {
+    return failed_;
+  }
+  std::string ErrorText() const override {
+    return reason_;
+  }
+  void StartCancel() override {}
+  void SetFailed(const std::string& reason) override;
+  bool IsCanceled() const override {
+    return false;
+  }
+  void NotifyOnCancel(google::protobuf::Closure* /*callback*/) override {}
+
+ private:
+  bool failed_;
+  std::string reason_;
+};
+
+struct PbMethodStats {
+  std::string name;         // full name of the method
+  uint64_t count;           // calls done
+  uint64_t errors;          // bad requests and failed calls
+  uint64_t total_us;
+  uint64_t max_us;
+  uint64_t p99_us;
+};
+
+/*
+ * PbRpcServer calls the methods of the services added by the method id in
+ * the frame, see kPbFlagMethod, so no wrapper message is parsed. It's the
+ * ConnFactory of a dispatch thread:
+ *
+ *   PbRpcServer rpc;
+ *   rpc.AddService(&service);
+ *   ServerThread* thread = NewDispatchThread(port, 4, &rpc);
+ *
+ * A method is called on the worker thread, and may run done later on any
+ * thread, its request, response and controller are kept until then. The
+ * reply is the response, or the error text with kPbFlagError if the
+ * controller failed. The latency of a call is from the request dealt to
+ * done.
+ */
+class PbRpcServer : public ConnFactory {
+ public:
+  PbRpcServer();
+  virtual ~PbRpcServer();
+
+  /*
+   * The service is not owned. Add all the services before the server
+   * starts, return false if an id of its methods is taken,
+   * or shared by two of its methods
+   */
+  bool AddService(google::protobuf::Service* service);
+
+  void MethodStats(std::vector<PbMethodStats>* stats) const;
+  void ClearStats();
+
+  virtual PinkConn* NewPinkConn(
+      int connfd,
+      const std::string &ip_port,
+      ServerThread *server_thread,
+      void* worker_private_data) const override;
+
+ private:
+  friend class PbRpcConn;
+  friend class PbRpcCall;
+  struct Method;
+  Method* FindMethod(uint32_t method_id) const;
+
+  std::map<uint32_t, Method*> methods_;
+
+  // No copying allowed
+  PbRpcServer(const PbRpcServer&);
+  void operator=(const PbRpcServer&);
+};
+
+/*
+ * RpcChannel over a PbAsyncCli for the generated stubs. done runs on the
+ * loop thread of the client, and the controller is failed with the status
+ * text if the call failed. The controller, request and response are kept
+ * until done.
+ */
+class PbRpcChannel : public google::protobuf::RpcChannel {
+ public:
+  explicit PbRpcChannel(PbAsyncCli* cli) : cli_(cli) {}
+
+  void CallMethod(const google::protobuf::MethodDescriptor* method,
+                  google::protobuf::RpcController* controller,
+                  const google::protobuf::Message* request,
+                  google::protobuf::Message* response,
+                  google::protobuf::Closure* done) override;
+
+ private:
+  PbAsyncCli* cli_;
+
+  // No copying allowed
+  PbRpcChannel(const PbRpcChannel&);
+  void operator=(const PbRpcChannel&);
+};
+
+}  // namespace pink
+#endif  // PINK_INCLUDE_PB_RPC_H_
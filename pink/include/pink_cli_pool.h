@@ -0,0 +1,379 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef PINK_INCLUDE_PINK_CLI_POOL_H_
+#define PINK_INCLUDE_PINK_CLI_POOL_H_
+
+#include <stdint.h>
+
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "slash/include/slash_mutex.h"
+#include "slash/include/slash_status.h"
+
+#include "pink/include/pink_cli.h"
+#include "pink/include/pink_thread.h"
+#include "pink/src/pink_util.h"
+
+namespace pink {
+
+struct PinkCliPoolOptions {
+  int size;               // warm connections per endpoint
+  int connect_timeout;    // ms
+  int send_timeout;       // ms, 0 for none
+  int recv_timeout;       // ms, 0 for none
+  int check_interval;     // ms between the checks of the idle connections
+  bool check_on_get;      // CheckAliveness before a lease is given out
+
+  PinkCliPoolOptions()
+      : size(4),
+        connect_timeout(1000),
+        send_timeout(0),
+        recv_timeout(0),
+        check_interval(1000),
+        check_on_get(true) {}
+};
+
+/*
+ * PinkCliPool keeps options.size connected clients for each endpoint. A
+ * background thread checks the idle ones with CheckAliveness, evicts the
+ * broken ones and connects new ones, so Get() hands out a warm connection
+ * and never connects by itself. T is PinkCli or a subclass, made by the
+ * factory given, new T() by default.
+ *
+ *   PinkCliPool<RedisCli> pool(options);
+ *   pool.AddEndpoint("127.0.0.1", 6379);
+ *   pool.Start();
+ *   PinkCliPool<RedisCli>::Lease cli = pool.Get("127.0.0.1", 6379, 10);
+ *   if (cli) {
+ *     Status s = cli->Send(&cmd);
+ *     if (!s.ok()) cli.Invalidate();
+ *   }
+ */
+template <typename T>
+class PinkCliPool {
+ public:
+  typedef std::function<T*()> Factory;
+
+  /*
+   * Lease gives back the client when destroyed. Invalidate() a client
+   * that failed, it is closed instead and replaced by a new one.
+   */
+  class Lease {
+   public:
+    Lease() : pool_(NULL), endpoint_(NULL), cli_(NULL) {}
+    Lease(Lease&& other)
+        : pool_(other.pool_), endpoint_(other.endpoint_), cli_(other.cli_) {
+      other.cli_ = NULL;
+    }
+    Lease& operator=(Lease&& other) {
+      if (this != &other) {
+        Release();
+        pool_ = other.pool_;
+        endpoint_ = other.endpoint_;
+        cli_ = other.cli_;
+        other.cli_ = NULL;
+      }
+      return *this;
+    }
+    ~Lease() {
+      Release();
+    }
+
+    T* get() const {
+      return cli_;
+    }
+    T* operator->() const {
+      return cli_;
+    }
+    explicit operator bool() const {
+      return cli_ != NULL;
+    }
+
+    void Invalidate() {
+      if (cli_ != NULL) {
+        cli_->Close();
+      }
+      Release();
+    }
+
+    // Give back the client now
+    void Release() {
+      if (cli_ != NULL) {
+        pool_->Return(endpoint_, cli_);
+        cli_ = NULL;
+      }
+    }
+
+   private:
+    friend class PinkCliPool;
+    Lease(PinkCliPool* pool, typename PinkCliPool::Endpoint* endpoint,
+          T* cli)
+        : pool_(pool), endpoint_(endpoint), cli_(cli) {}
+
+    PinkCliPool* pool_;
+    typename PinkCliPool::Endpoint* endpoint_;
+    T* cli_;
+
+    // No copying allowed
+    Lease(const Lease&);
+    void operator=(const Lease&);
+  };
+
+  explicit PinkCliPool(const PinkCliPoolOptions& options,
+                       const Factory& factory = Factory())
+      : options_(options),
+        factory_(factory),
+        mu_(),
+        checker_(this) {
+    if (!factory_) {
+      factory_ = []() { return new T(); };
+    }
+  }
+
+  /*
+   * The leases must be given back before the pool is destroyed
+   */
+  ~PinkCliPool() {
+    Stop();
+    for (auto& item : endpoints_) {
+      for (auto cli : item.second->idle) {
+        delete cli;
+      }
+      delete item.second;
+    }
+  }
+
+  // Connect the warm clients in the background, after Start()
+  void AddEndpoint(const std::string& ip, int port) {
+    slash::MutexLock l(&mu_);
+    std::string key = ip + ":" + std::to_string(port);
+    if (endpoints_.find(key) == endpoints_.end()) {
+      endpoints_[key] = new Endpoint(ip, port, &mu_);
+    }
+    checker_.Wake();
+  }
+
+  int Start() {
+    return checker_.StartThread();
+  }
+
+  int Stop() {
+    return checker_.StopThread();
+  }
+
+  /*
+   * Take an idle client of the endpoint, wait at most timeout ms for one
+   * to be given back. The lease is empty if none, or the endpoint is not
+   * added. The client is probed by check_on_get after it's taken, out of
+   * the lock.
+   */
+  Lease Get(const std::string& ip, int port, int timeout = 0) {
+    std::string key = ip + ":" + std::to_string(port);
+    uint64_t deadline = NowMs() + timeout;
+    while (true) {
+      Endpoint* endpoint;
+      T* cli;
+      {
+        slash::MutexLock l(&mu_);
+        auto iter = endpoints_.find(key);
+        if (iter == endpoints_.end()) {
+          return Lease();
+        }
+        endpoint = iter->second;
+        // The clients being probed by the checker come back with a signal
+        while (endpoint->idle.empty()) {
+          uint64_t now = NowMs();
+          if (now >= deadline) {
+            return Lease();
+          }
+          uint32_t wait = static_cast<uint32_t>(deadline - now);
+          endpoint->available.TimedWait(wait);
+        }
+        cli = endpoint->idle.back();
+        endpoint->idle.pop_back();
+        // Leased while probed, so that the checker doesn't replace it
+        endpoint->leased++;
+      }
+
+      if (!options_.check_on_get || cli->CheckAliveness() == 0) {
+        return Lease(this, endpoint, cli);
+      }
+      delete cli;
+      {
+        slash::MutexLock l(&mu_);
+        endpoint->leased--;
+      }
+      checker_.Wake();
+    }
+  }
+
+  // Idle and leased clients of the endpoint
+  void Size(const std::string& ip, int port, int* idle, int* leased) {
+    slash::MutexLock l(&mu_);
+    *idle = *leased = 0;
+    auto iter = endpoints_.find(ip + ":" + std::to_string(port));
+    if (iter != endpoints_.end()) {
+      *idle = iter->second->idle.size() + iter->second->checking;
+      *leased = iter->second->leased;
+    }
+  }
+
+ private:
+  struct Endpoint {
+    std::string ip;
+    int port;
+    std::vector<T*> idle;
+    int leased;
+    int checking;           // taken from idle by the checker
+    slash::CondVar available;   // signaled when idle grows, on mu_
+    Endpoint(const std::string& _ip, int _port, slash::Mutex* mu)
+        : ip(_ip), port(_port), leased(0), checking(0), available(mu) {}
+  };
+
+  class Checker : public Thread {
+   public:
+    explicit Checker(PinkCliPool* pool)
+        : pool_(pool), mu_(), signal_(&mu_), woken_(false) {
+      set_thread_name("PinkCliPool");
+    }
+
+    virtual int StopThread() override {
+      should_stop_ = true;
+      Wake();
+      return Thread::StopThread();
+    }
+
+    void Wake() {
+      slash::MutexLock l(&mu_);
+      woken_ = true;
+      signal_.Signal();
+    }
+
+   private:
+    virtual void *ThreadMain() override {
+      while (!should_stop()) {
+        pool_->Check();
+        slash::MutexLock l(&mu_);
+        if (!woken_ && !should_stop()) {
+          signal_.TimedWait(pool_->options_.check_interval);
+        }
+        woken_ = false;
+      }
+      return NULL;
+    }
+
+    PinkCliPool* pool_;
+    slash::Mutex mu_;
+    slash::CondVar signal_;
+    bool woken_;
+  };
+
+  void Return(Endpoint* endpoint, T* cli) {
+    if (!cli->Available()) {
+      delete cli;
+      slash::MutexLock l(&mu_);
+      endpoint->leased--;
+      checker_.Wake();
+      return;
+    }
+    slash::MutexLock l(&mu_);
+    endpoint->leased--;
+    endpoint->idle.push_back(cli);
+    endpoint->available.Signal();
+  }
+
+  T* NewCli(const std::string& ip, int port) {
+    T* cli = factory_();
+    cli->set_connect_timeout(options_.connect_timeout);
+    Status s = cli->Connect(ip, port);
+    if (!s.ok()) {
+      delete cli;
+      return NULL;
+    }
+    cli->set_send_timeout(options_.send_timeout);
+    cli->set_recv_timeout(options_.recv_timeout);
+    return cli;
+  }
+
+  /*
+   * Evict the broken idle clients and connect the missing ones. The idle
+   * clients of an endpoint are taken out to be probed, the probing and the
+   * connecting are done out of the lock.
+   */
+  void Check() {
+    std::vector<Endpoint*> endpoints;
+    mu_.Lock();
+    for (auto& item : endpoints_) {
+      endpoints.push_back(item.second);
+    }
+    mu_.Unlock();
+
+    std::vector<std::pair<Endpoint*, int> > missing;
+    std::vector<T*> idle;
+    for (auto endpoint : endpoints) {
+      mu_.Lock();
+      idle.swap(endpoint->idle);
+      endpoint->checking = static_cast<int>(idle.size());
+      mu_.Unlock();
+
+      for (size_t i = 0; i < idle.size(); ) {
+        if (idle[i]->CheckAliveness() != 0) {
+          delete idle[i];
+          idle[i] = idle.back();
+          idle.pop_back();
+        } else {
+          i++;
+        }
+      }
+
+      mu_.Lock();
+      endpoint->idle.insert(endpoint->idle.end(), idle.begin(), idle.end());
+      endpoint->checking = 0;
+      int num = options_.size - endpoint->leased -
+        static_cast<int>(endpoint->idle.size());
+      endpoint->available.SignalAll();
+      mu_.Unlock();
+      idle.clear();
+      if (num > 0) {
+        missing.push_back(std::make_pair(endpoint, num));
+      }
+    }
+
+    for (auto& item : missing) {
+      Endpoint* endpoint = item.first;
+      for (int i = 0; i < item.second && !checker_.should_stop(); i++) {
+        T* cli = NewCli(endpoint->ip, endpoint->port);
+        if (cli == NULL) {
+          // The endpoint is down, try again in the next check
+          break;
+        }
+        slash::MutexLock l(&mu_);
+        endpoint->idle.push_back(cli);
+        endpoint->available.Signal();
+      }
+    }
+  }
+
+  PinkCliPoolOptions options_;
+  Factory factory_;
+
+  // mu_ guards endpoints_
+  slash::Mutex mu_;
+  std::map<std::string, Endpoint*> endpoints_;
+
+  Checker checker_;
+
+  // No copying allowed
+  PinkCliPool(const PinkCliPool&);
+  void operator=(const PinkCliPool&);
+};
+
+}  // namespace pink
+#endif  // PINK_INCLUDE_PINK_CLI_POOL_H_
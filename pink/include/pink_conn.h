@@ -8,6 +8,7 @@
 
 #include <sys/time.h>
 #include <string>
+#include <memory>
 
 #ifdef __ENABLE_SSL
 #include <openssl/err.h>
@@ -20,6 +21,13 @@
 namespace pink {
 
 class Thread;
+class WorkerThread;
+
+/*
+ * Immutable reply buffer which can be queued on several connections at once,
+ * e.g. a message published to many subscribers is serialized only once.
+ */
+typedef std::shared_ptr<const std::string> SharedResp;
 
 class PinkConn {
  public:
@@ -38,6 +46,13 @@ class PinkConn {
   virtual ReadStatus GetRequest() = 0;
   virtual WriteStatus SendReply() = 0;
   virtual void WriteResp(const std::string& resp) { }
+  /*
+   * Queue a shared reply, connections which keep an output queue hold a
+   * reference instead of copying, others fall back to WriteResp()
+   */
+  virtual void WriteSharedResp(const SharedResp& resp) {
+    WriteResp(*resp);
+  }
 
   virtual void TryResizeBuffer() {}
 
@@ -77,6 +92,18 @@ class PinkConn {
     return server_thread_;
   }
 
+  /*
+   * The worker thread serving the connection, NULL if it's served by a
+   * holy thread, see WorkerThread::NotifyWrite()
+   */
+  WorkerThread *worker_thread() const {
+    return worker_thread_;
+  }
+
+  void set_worker_thread(WorkerThread *worker_thread) {
+    worker_thread_ = worker_thread;
+  }
+
 #ifdef __ENABLE_SSL
   SSL* ssl() {
     return ssl_;
@@ -100,6 +127,7 @@ class PinkConn {
 
   // the server thread this conn belong to
   ServerThread *server_thread_;
+  WorkerThread *worker_thread_;
 
   /*
    * No allowed copy and copy assign operator
@@ -6,6 +6,8 @@
 #ifndef PINK_INCLUDE_PINK_DEFINE_H_
 #define PINK_INCLUDE_PINK_DEFINE_H_
 
+#include <stdint.h>
+
 #include <functional>
 #include <iostream>
 #include <map>
@@ -26,6 +28,24 @@ const int kProtoMaxMessage = 64 * 1024 * 1024;  // 64MB
 
 const int kCommandHeaderLength = 4;
 
+/*
+ * The extended pb frame is marked by the high bit of the length:
+ *   [ length | kPbExtFrame (4) | request id (8) | flags (4) | body ]
+ * The reply carries the request id of its request, so the requests on a
+ * connection may complete in any order. With kPbFlagMethod the method id
+ * follows the flags:
+ *   [ length | kPbExtFrame (4) | request id (8) | flags (4) | method id (4)
+ *     | body ]
+ */
+const uint32_t kPbExtFrame = 0x80000000;
+const int kPbExtHeaderLength = 16;
+const int kPbMethodIdLength = 4;
+
+enum PbFrameFlag {
+  kPbFlagError = 1,     // the body of the reply is an error text
+  kPbFlagMethod = 2,    // the request carries a method id, see PbRpcServer
+};
+
 /*
  * The socket block type
  */
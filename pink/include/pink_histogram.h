@@ -0,0 +1,66 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef PINK_INCLUDE_PINK_HISTOGRAM_H_
+#define PINK_INCLUDE_PINK_HISTOGRAM_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+
+namespace pink {
+
+/*
+ * Latency histogram with power of 2 buckets, bucket i holds the values in
+ * [2^(i-1), 2^i), bucket 0 holds 0. Add is lock free, so one thread could
+ * record while the others read it. The unit is up to the caller,
+ * microsecond in pink.
+ */
+class LatencyHistogram {
+ public:
+  static const int kBuckets = 64;
+
+  LatencyHistogram();
+
+  void Add(uint64_t value);
+  void Clear();
+
+  uint64_t count() const {
+    return count_.load(std::memory_order_relaxed);
+  }
+  uint64_t sum() const {
+    return sum_.load(std::memory_order_relaxed);
+  }
+  uint64_t max() const {
+    return max_.load(std::memory_order_relaxed);
+  }
+  uint64_t bucket(int i) const {
+    return buckets_[i].load(std::memory_order_relaxed);
+  }
+  double Average() const;
+
+  /*
+   * The upper bound of the bucket where the percentile falls, no larger
+   * than max(). percentile is in [0, 100]
+   */
+  uint64_t Percentile(double percentile) const;
+
+  // count, avg, p50, p99, p999 and max in one line
+  std::string ToString() const;
+
+ private:
+  std::atomic<uint64_t> buckets_[kBuckets];
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_;
+  std::atomic<uint64_t> max_;
+
+  // No copying allowed
+  LatencyHistogram(const LatencyHistogram&);
+  void operator=(const LatencyHistogram&);
+};
+
+}  // namespace pink
+#endif  // PINK_INCLUDE_PINK_HISTOGRAM_H_
@@ -12,6 +12,9 @@
 #include <functional>
 #include <queue>
 #include <map>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <atomic>
 #include <vector>
@@ -23,14 +26,27 @@
 #include "slash/include/slash_string.h"
 
 #include "pink/src/pink_epoll.h"
+#include "pink/src/pattern_index.h"
 #include "pink/include/pink_thread.h"
 #include "pink/include/pink_define.h"
+#include "pink/include/pink_conn.h"
 
 namespace pink {
 
 class PinkEpoll;
 class PinkFiredEvent;
 class PinkConn;
+class ShardedPubSub;
+
+/*
+ * What to do with a message for a subscriber whose pending messages
+ * already reach the limit
+ */
+enum SlowSubscriberPolicy {
+  kSubscriberDisconnect = 0,
+  kSubscriberDropOldest = 1,
+  kSubscriberDropNewest = 2,
+};
 
 class PubSubThread : public Thread {
  public:
@@ -60,15 +76,106 @@ class PubSubThread : public Thread {
 
   int PubSubNumPat();
 
+  /*
+   * return the number of channels and patterns that the connection
+   * currently subscribed in this thread
+   */
+  int ClientChannelSize(PinkConn* conn);
+
+  /*
+   * Bound the messages waiting for a subscriber whose socket is not
+   * writable, 0 means no limit on bytes or messages. No limit by default.
+   */
+  void SetSubscriberLimit(size_t max_bytes, size_t max_msgs,
+                          SlowSubscriberPolicy policy);
+
+  /*
+   * The number of messages dropped for slow subscribers of each channel,
+   * past 4096 channels the new ones are counted under the empty name
+   */
+  void PubSubDropped(std::vector<std::pair<std::string, uint64_t>>* result);
+
  private:
+  friend class ShardedPubSub;
+
+  static const size_t kMaxDroppedChannels = 4096;
+
+  // The subscribers of a channel or pattern <---> their home thread
+  typedef std::unordered_map<PinkConn*, PubSubThread*> Subscribers;
+
+  struct PendingMessage {
+    SharedResp resp;
+    std::string channel;
+  };
+
+  // A message for a subscriber of another shard, sent by its home thread
+  struct Delivery {
+    PinkConn* conn;
+    SharedResp resp;
+    std::string channel;
+    Delivery(PinkConn* _conn, const SharedResp& _resp,
+             const std::string& _channel)
+        : conn(_conn), resp(_resp), channel(_channel) {}
+  };
+  typedef std::unordered_map<PubSubThread*, std::vector<Delivery>> Deliveries;
+
+  /*
+   * The messages published to a subscriber while its reply is still being
+   * written, they are handed to the connection when its socket drains
+   */
+  struct SubscriberQueue {
+    std::deque<PendingMessage> msgs;
+    size_t bytes;
+    SubscriberQueue() : bytes(0) {}
+  };
+
   void RemoveConn(PinkConn* conn);
+  // Own the socket of conn, or give it up, the subscriptions are elsewhere
+  void AttachConn(PinkConn* conn);
+  void DetachConn(PinkConn* conn);
+  void CloseConns(const std::unordered_set<PinkConn*>& conns);
 
-  int ClientChannelSize(PinkConn* conn);
+  bool AddSubscription(PinkConn* conn, const std::string& name,
+                       const bool pattern, PubSubThread* home);
+  bool DropSubscription(PinkConn* conn, const std::string& name,
+                        const bool pattern);
+  void DropSubscriptions(PinkConn* conn, const bool pattern,
+                         std::vector<std::string>* removed);
+  void DropAllSubscriptions(PinkConn* conn);
+  void EraseSubscriber(PinkConn* conn, const std::string& name,
+                       const bool pattern);
+
+  int SendToSubscribers(const Subscribers& conns,
+                        const SharedResp& resp,
+                        const std::string& channel,
+                        std::unordered_set<PinkConn*>* closed_conns,
+                        Deliveries* remote);
+  bool SendToSubscriber(PinkConn* conn, const SharedResp& resp,
+                        const std::string& channel,
+                        std::unordered_set<PinkConn*>* closed_conns);
+  // Hand the deliveries to this thread, it sends them in the order given
+  void Deliver(std::vector<Delivery>* deliveries);
+  void DrainInbox();
+  // Send the deliveries of conn now, before it is detached
+  void FlushInbox(PinkConn* conn);
+
+  bool IsBlocked(PinkConn* conn);
+  void MarkBlocked(PinkConn* conn);
+  // Return false if the policy disconnects the subscriber
+  bool QueueMessage(PinkConn* conn, const SharedResp& resp,
+                    const std::string& channel);
+  bool TakePending(PinkConn* conn);
+  WriteStatus FlushPending(PinkConn* conn);
+  void RecordDrop(const std::string& channel, uint64_t count);
 
   int msg_pfd_[2];
   int notify_pfd_[2];
+  int inbox_pfd_[2];
   bool should_exit_;
 
+  // The ShardedPubSub this thread is a shard of, NULL if it runs alone
+  ShardedPubSub* group_;
+
   mutable slash::RWMutex rwlock_; /* For external statistics */
   std::map<int, PinkConn*> conns_;
 
@@ -100,13 +207,121 @@ class PubSubThread : public Thread {
   slash::Mutex channel_mutex_;
   slash::Mutex pattern_mutex_;
 
-  std::map<std::string, std::vector<PinkConn* >> pubsub_channel_;    // channel <---> conns
-  std::map<std::string, std::vector<PinkConn* >> pubsub_pattern_;    // channel <---> conns
+  typedef std::unordered_map<std::string, Subscribers> SubscriberMap;
+  typedef std::unordered_map<PinkConn*,
+                             std::unordered_set<std::string>> SubscriptionMap;
+
+  /*
+   * Channels and patterns without subscribers are erased, client_channels_
+   * and client_patterns_ are the reverse index of pubsub_channel_ and
+   * pubsub_pattern_, so the work of a client is bounded by its own
+   * subscriptions. Guarded by channel_mutex_ and pattern_mutex_.
+   */
+  SubscriberMap pubsub_channel_;      // channel <---> conns
+  SubscriberMap pubsub_pattern_;      // pattern <---> conns
+  SubscriptionMap client_channels_;   // conn <---> channels
+  SubscriptionMap client_patterns_;   // conn <---> patterns
+  PatternIndex pattern_index_;    // patterns of pubsub_pattern_ by literal prefix
+
+  // Slow subscribers
+  std::atomic<size_t> max_pending_bytes_;
+  std::atomic<size_t> max_pending_msgs_;
+  std::atomic<int> slow_policy_;
+  slash::Mutex pending_mutex_;
+  std::unordered_map<PinkConn*, SubscriberQueue> pending_;
+  slash::Mutex dropped_mutex_;
+  std::unordered_map<std::string, uint64_t> dropped_;   // channel <---> drops
+
+  /*
+   * The deliveries of the other shards to the conns of this thread, a
+   * byte is written to inbox_pfd_ when it becomes non-empty
+   */
+  slash::Mutex inbox_mutex_;
+  std::vector<Delivery> inbox_;
 
   // No copying allowed
   PubSubThread(const PubSubThread&);
   void operator=(const PubSubThread&);
 };  // class PubSubThread
 
+/*
+ * ShardedPubSub runs several PubSubThread as shards, the channels are
+ * hashed to the shards, a pattern is subscribed in all of them. A message
+ * is published by the shard of its channel only, so the messages of one
+ * channel keep their order.
+ *
+ * The socket of a connection is owned by one shard, its home, picked
+ * round robin when it subscribes first, only the home writes to it. The
+ * shard publishing a message hands the frames for the subscribers of
+ * other homes to the home in one batch, such a frame counts as received.
+ */
+class ShardedPubSub {
+ public:
+  explicit ShardedPubSub(int shard_num);
+  virtual ~ShardedPubSub();
+
+  int StartThread();
+  int StopThread();
+
+  // PubSub
+
+  int Publish(const std::string& channel, const std::string& msg);
+
+  void Subscribe(PinkConn* conn,
+                 const std::vector<std::string>& channels,
+                 const bool pattern,
+                 std::vector<std::pair<std::string, int>>* result);
+
+  int UnSubscribe(PinkConn* conn,
+                  const std::vector<std::string>& channels,
+                  const bool pattern,
+                  std::vector<std::pair<std::string, int>>* result);
+
+  void PubSubChannels(const std::string& pattern,
+                      std::vector<std::string >* result);
+
+  void PubSubNumSub(const std::vector<std::string>& channels,
+                    std::vector<std::pair<std::string, int>>* result);
+
+  int PubSubNumPat();
+
+  void SetSubscriberLimit(size_t max_bytes, size_t max_msgs,
+                          SlowSubscriberPolicy policy);
+
+  void PubSubDropped(std::vector<std::pair<std::string, uint64_t>>* result);
+
+  int shard_num() const {
+    return static_cast<int>(shards_.size());
+  }
+
+ private:
+  friend class PubSubThread;
+
+  struct ConnInfo {
+    PubSubThread* home;
+    int subscribed;         // channels and patterns
+  };
+
+  PubSubThread* ChannelShard(const std::string& channel) {
+    return shards_[std::hash<std::string>()(channel) % shards_.size()];
+  }
+  // Drop all the subscriptions of conn and detach it from its home
+  void RemoveConn(PinkConn* conn);
+
+  std::vector<PubSubThread*> shards_;
+
+  /*
+   * Taken before the locks of the shards, guards conns_ and the
+   * subscriptions spanning the shards
+   */
+  slash::Mutex conns_mutex_;
+  std::unordered_map<PinkConn*, ConnInfo> conns_;
+  size_t next_home_;
+
+  // No copying allowed
+  ShardedPubSub(const ShardedPubSub&);
+  void operator=(const ShardedPubSub&);
+};  // class ShardedPubSub
+
 }  // namespace pink
 #endif  // THIRD_PINK_PINK_INCLUDE_PINK_PUBSUB_H_
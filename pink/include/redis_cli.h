@@ -9,6 +9,8 @@
 #include <vector>
 #include <string>
 
+#include "pink/include/pink_cli.h"
+
 namespace pink {
 
 
@@ -23,6 +25,42 @@ typedef std::vector<std::string> RedisCmdArgsType;
 extern int SerializeRedisCommand(std::string *cmd, const char *format, ...);
 extern int SerializeRedisCommand(RedisCmdArgsType argv, std::string *cmd);
 
+class RedisReader;
+
+class RedisCli : public PinkCli {
+ public:
+  RedisCli();
+  virtual ~RedisCli();
+
+  // msg should have been parsed
+  virtual Status Send(void *msg);
+
+  // Read, parse and store the reply
+  virtual Status Recv(void *result = NULL);
+
+  /*
+   * Pipeline: serialize all the commands into one buffer and write it at
+   * once, then RecvBatch the replies
+   */
+  Status SendBatch(const std::vector<RedisCmdArgsType>& cmds);
+
+  /*
+   * Receive n replies, each read takes as many as the socket has. The
+   * replies received are kept in replies if it fails in the middle
+   */
+  Status RecvBatch(size_t n, std::vector<RedisCmdArgsType>* replies);
+
+ private:
+  RedisCmdArgsType argv_;   // The parsed result
+  RedisReader* reader_;
+
+  int GetReply(RedisCmdArgsType* argv);
+
+  // No copyable
+  RedisCli(const RedisCli&);
+  void operator=(const RedisCli&);
+};
+
 }   // namespace pink
 
 #endif  // PINK_INCLUDE_REDIS_CLI_H_
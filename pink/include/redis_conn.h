@@ -7,6 +7,7 @@
 #define PINK_INCLUDE_REDIS_CONN_H_
 
 #include <map>
+#include <deque>
 #include <vector>
 #include <string>
 
@@ -26,6 +27,7 @@ class RedisConn: public PinkConn {
   virtual ReadStatus GetRequest();
   virtual WriteStatus SendReply();
   virtual void WriteResp(const std::string& resp);
+  virtual void WriteSharedResp(const SharedResp& resp);
 
   void TryResizeBuffer() override;
 
@@ -43,7 +45,10 @@ class RedisConn: public PinkConn {
   int msg_peak_;
   RedisCmdArgsType argv_;
 
+  // Shared replies are sent before response_, wbuf_pos_ is the offset in
+  // the first pending buffer
   uint32_t wbuf_pos_;
+  std::deque<SharedResp> shared_resp_;
   std::string response_;
 
   // For Redis Protocol parser
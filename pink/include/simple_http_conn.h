@@ -15,7 +15,9 @@
 
 #include "pink/include/pink_conn.h"
 #include "pink/include/pink_define.h"
+#include "pink/src/http_parser.h"
 #include "pink/src/pink_util.h"
+#include "pink/src/pooled_buffer.h"
 
 namespace pink {
 
@@ -42,23 +44,10 @@ class Request {
   bool ParseBodyFromArray(const char* data, const int size);
 
  private:
-  enum ParseStatus {
-    kHeaderMethod,
-    kHeaderPath,
-    kHeaderVersion,
-    kHeaderParamKey,
-    kHeaderParamValue,
-    kBody
-  };
-
-  bool ParseGetUrl();
-  bool ParseHeadLine(
-      const char* data, int line_start,
-      int line_end, ParseStatus* parseStatus);
-  bool ParseParameters(
-      const std::string data,
-      size_t line_start = 0,
-      bool from_url = true);
+  friend class SimpleHTTPConn;
+
+  // Copy the header parsed from data
+  void BuildHeader(const char* data, const HTTPParser& parser);
 };
 
 class Response {
@@ -67,6 +56,7 @@ class Response {
     status_code_(0) {
   }
   void Clear();
+  // Return -1 if the header is larger than size
   int SerializeHeaderToArray(char* data, size_t size);
   int SerializeBodyToArray(char* data, size_t size, int *pos);
   bool HasMoreBody(size_t pos) {
@@ -113,14 +103,20 @@ class SimpleHTTPConn: public PinkConn {
   bool FillResponseBuf();
   void HandleMessage();
 
+  /*
+   * The buffers are taken from the pool when a message comes and released
+   * after it's dealt, the body goes through them in chunks
+   */
   ConnStatus conn_status_;
-  char* rbuf_;
+  PooledBuffer rbuf_;
   uint32_t rbuf_pos_;
-  char* wbuf_;
+  PooledBuffer wbuf_;
   uint32_t wbuf_len_;  // length we wanna write out
   uint32_t wbuf_pos_;
   uint32_t header_len_;
   uint64_t remain_packet_len_;
+  // Goes on from where the last read stopped
+  HTTPParser parser_;
 
   Request* request_;
   int response_pos_;
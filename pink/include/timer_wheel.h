@@ -0,0 +1,107 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef PINK_INCLUDE_TIMER_WHEEL_H_
+#define PINK_INCLUDE_TIMER_WHEEL_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "pink/include/bg_task.h"
+
+namespace pink {
+
+struct TimerNode;
+
+/*
+ * Returned by DelaySchedule, it refers to the timer until the timer fires
+ * or is cancelled, and is harmless to use after that
+ */
+class TimerHandle {
+ public:
+  TimerHandle() : node_(NULL), id_(0) {}
+
+  bool empty() const {
+    return node_ == NULL;
+  }
+
+ private:
+  friend class TimerWheel;
+  TimerHandle(TimerNode* node, uint64_t id) : node_(node), id_(id) {}
+
+  TimerNode* node_;
+  uint64_t id_;
+};
+
+/*
+ * Hierarchical timing wheel with 1ms ticks, 4 levels of 256 slots cover
+ * about 49 days, longer timers are parked in the last level and cascade
+ * again. Add, Cancel and Reschedule are O(1). Time is given by the
+ * caller in milliseconds, see NowMs() of pink_util. Not thread safe.
+ */
+class TimerWheel {
+ public:
+  explicit TimerWheel(uint64_t now_ms);
+  ~TimerWheel();
+
+  /*
+   * now_ms moves an empty wheel to the present, so the first Advance
+   * after an idle spell does not walk the idle ticks
+   */
+  TimerHandle Add(uint64_t now_ms, uint64_t expire_ms, BGTask&& task);
+
+  // Return false if the timer has fired or been cancelled
+  bool Cancel(const TimerHandle& handle);
+  bool Reschedule(const TimerHandle& handle, uint64_t expire_ms);
+
+  // Move the tasks of the timers expired by now_ms to expired
+  void Advance(uint64_t now_ms, std::vector<BGTask>* expired);
+
+  /*
+   * Milliseconds from now_ms to the next tick Advance should run at, the
+   * expiration of a near timer or a cascade of the upper levels.
+   * kNoTimer if the wheel is empty.
+   */
+  uint64_t NextTimeout(uint64_t now_ms) const;
+
+  size_t size() const {
+    return size_;
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  void Clear();
+
+  static const uint64_t kNoTimer = UINT64_MAX;
+
+ private:
+  static const int kLevels = 4;
+  static const int kSlotBits = 8;
+  static const int kSlots = 1 << kSlotBits;
+  static const uint64_t kSlotMask = kSlots - 1;
+
+  void Link(TimerNode* node);
+  void Unlink(TimerNode* node);
+  void Cascade(int level, uint64_t index);
+  TimerNode* AllocNode();
+  void FreeNode(TimerNode* node);
+
+  TimerNode* slots_[kLevels][kSlots];
+  uint64_t current_;    // the next tick to process
+  size_t size_;
+  uint64_t next_id_;
+  TimerNode* free_nodes_;
+  std::vector<TimerNode*> chunks_;
+
+  // No copying allowed
+  TimerWheel(const TimerWheel&);
+  void operator=(const TimerWheel&);
+};
+
+}  // namespace pink
+#endif  // PINK_INCLUDE_TIMER_WHEEL_H_
@@ -0,0 +1,256 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include "pink/include/async_cli.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "pink/src/pink_epoll.h"
+#include "pink/src/pink_util.h"
+
+namespace pink {
+
+// The longest a loop thread waits, connect timeouts are checked by it
+static const int kLoopInterval = 100;
+
+static void SetNonblock(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+AsyncCliBase::AsyncCliBase(const std::string& ip, int port)
+    : ip_(ip),
+      port_(port),
+      connect_timeout_(1000),
+      reconnect_interval_(1000),
+      pink_epoll_(new PinkEpoll()),
+      fd_(-1),
+      state_(kDisconnected),
+      writable_(false),
+      connect_time_(0),
+      next_connect_(0),
+      wbuf_pos_(0),
+      notified_(false),
+      pending_(0) {
+  int fds[2];
+  if (pipe(fds)) {
+    exit(-1);
+  }
+  notify_receive_fd_ = fds[0];
+  notify_send_fd_ = fds[1];
+  SetNonblock(notify_receive_fd_);
+  SetNonblock(notify_send_fd_);
+  pink_epoll_->PinkAddEvent(notify_receive_fd_, EPOLLIN | EPOLLERR | EPOLLHUP);
+}
+
+// The client has failed all its requests by AsyncCli::Close()
+AsyncCliBase::~AsyncCliBase() {
+  if (fd_ != -1) {
+    close(fd_);
+  }
+  close(notify_receive_fd_);
+  close(notify_send_fd_);
+  delete pink_epoll_;
+}
+
+int AsyncCliBase::StopThread() {
+  should_stop_ = true;
+  char bb = 0;
+  write(notify_send_fd_, &bb, 1);
+  return Thread::StopThread();
+}
+
+void AsyncCliBase::Notify() {
+  if (!notified_.exchange(true)) {
+    char bb = 0;
+    write(notify_send_fd_, &bb, 1);
+  }
+}
+
+void *AsyncCliBase::ThreadMain() {
+  while (!should_stop()) {
+    Poll(kLoopInterval);
+  }
+  return NULL;
+}
+
+void AsyncCliBase::Poll(int timeout) {
+  uint64_t now = NowMs();
+  if (state_ == kDisconnected) {
+    if (now >= next_connect_) {
+      StartConnect(now);
+    } else if (next_connect_ - now < static_cast<uint64_t>(timeout)) {
+      timeout = next_connect_ - now;
+    }
+  }
+
+  int nfds = pink_epoll_->PinkPoll(timeout);
+  for (int i = 0; i < nfds; i++) {
+    PinkFiredEvent* pfe = pink_epoll_->firedevent() + i;
+    if (pfe->fd == notify_receive_fd_) {
+      char bb[256];
+      while (read(notify_receive_fd_, bb, sizeof(bb)) > 0) {
+      }
+      continue;
+    }
+    if (pfe->fd != fd_) {
+      continue;
+    }
+    if (state_ == kConnecting) {
+      if (pfe->mask & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+        FinishConnect();
+      }
+      continue;
+    }
+    if (pfe->mask & EPOLLIN) {
+      HandleRead();
+    }
+    if (fd_ != -1 && (pfe->mask & (EPOLLERR | EPOLLHUP))) {
+      Disconnect(Status::IOError("connection broken"));
+    }
+    if (fd_ != -1 && (pfe->mask & EPOLLOUT)) {
+      Flush();
+    }
+  }
+
+  if (state_ == kConnecting &&
+      NowMs() - connect_time_ >= static_cast<uint64_t>(connect_timeout_)) {
+    Disconnect(Status::Timeout("connect timeout"));
+  }
+
+  // The requests of this iteration go out together
+  notified_ = false;
+  TakeSubmitted();
+  if (state_ == kConnected && wbuf_pos_ < wbuf_.size()) {
+    Flush();
+  }
+}
+
+void AsyncCliBase::StartConnect(uint64_t now) {
+  next_connect_ = now + reconnect_interval_;
+
+  char cport[6];
+  struct addrinfo hints, *servinfo;
+  snprintf(cport, sizeof(cport), "%d", port_);
+  memset(&hints, 0, sizeof(hints));
+  // We do not handle IPv6
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(ip_.c_str(), cport, &hints, &servinfo) != 0) {
+    return;
+  }
+  int fd = socket(servinfo->ai_family, servinfo->ai_socktype,
+                  servinfo->ai_protocol);
+  if (fd == -1) {
+    freeaddrinfo(servinfo);
+    return;
+  }
+  SetNonblock(fd);
+  int val = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+  int ret = connect(fd, servinfo->ai_addr, servinfo->ai_addrlen);
+  freeaddrinfo(servinfo);
+  if (ret == -1 && errno != EINPROGRESS) {
+    close(fd);
+    return;
+  }
+
+  fd_ = fd;
+  connect_time_ = now;
+  state_ = kConnecting;
+  writable_ = true;
+  pink_epoll_->PinkAddEvent(fd_, EPOLLOUT);
+}
+
+void AsyncCliBase::FinishConnect() {
+  int val = 0;
+  socklen_t lon = sizeof(val);
+  if (getsockopt(fd_, SOL_SOCKET, SO_ERROR, &val, &lon) == -1 || val != 0) {
+    Disconnect(Status::IOError("connect failed"));
+    return;
+  }
+  state_ = kConnected;
+  writable_ = false;
+  // PinkModEvent ors the old mask, so give the new mask only
+  pink_epoll_->PinkModEvent(fd_, 0, EPOLLIN);
+}
+
+void AsyncCliBase::Disconnect(const Status& s) {
+  if (fd_ != -1) {
+    pink_epoll_->PinkDelEvent(fd_);
+    close(fd_);
+    fd_ = -1;
+  }
+  state_ = kDisconnected;
+  writable_ = false;
+  wbuf_.clear();
+  wbuf_pos_ = 0;
+  Disconnected(s);
+}
+
+void AsyncCliBase::HandleRead() {
+  while (true) {
+    ssize_t nread = ReadReplies(fd_);
+    if (nread == 0) {
+      Disconnect(Status::IOError("connection closed by peer"));
+      return;
+    } else if (nread == -1) {
+      if (errno == EINTR) {
+        continue;
+      } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return;
+      }
+      Disconnect(Status::IOError("read error " + std::string(strerror(errno))));
+      return;
+    }
+    if (!HandleReplies()) {
+      return;
+    }
+  }
+}
+
+/*
+ * Write wbuf_ as much as the socket takes, return false if the
+ * connection is broken
+ */
+bool AsyncCliBase::Flush() {
+  while (wbuf_pos_ < wbuf_.size()) {
+    ssize_t nwritten = write(fd_, wbuf_.data() + wbuf_pos_,
+                             wbuf_.size() - wbuf_pos_);
+    if (nwritten == -1) {
+      if (errno == EINTR) {
+        continue;
+      } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        SetWritable(true);
+        return true;
+      }
+      Disconnect(Status::IOError("write error " +
+                                 std::string(strerror(errno))));
+      return false;
+    }
+    wbuf_pos_ += nwritten;
+  }
+  wbuf_.clear();
+  wbuf_pos_ = 0;
+  SetWritable(false);
+  return true;
+}
+
+void AsyncCliBase::SetWritable(bool writable) {
+  if (writable_ == writable) {
+    return;
+  }
+  writable_ = writable;
+  pink_epoll_->PinkModEvent(fd_, 0, writable ? EPOLLIN | EPOLLOUT : EPOLLIN);
+}
+
+}  // namespace pink
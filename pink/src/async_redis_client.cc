@@ -0,0 +1,94 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include "pink/include/async_redis_client.h"
+
+#include <string.h>
+
+#include <utility>
+
+#include "pink/src/redis_reader.h"
+
+namespace pink {
+
+AsyncRedisClient::AsyncRedisClient(const std::string& ip, int port)
+    : AsyncCli(ip, port),
+      reader_(new RedisReader()) {
+  set_thread_name("AsyncRedisClient");
+}
+
+AsyncRedisClient::~AsyncRedisClient() {
+  Close();
+  delete reader_;
+}
+
+void AsyncRedisClient::Send(const RedisCmdArgsType& argv,
+                            const RedisCallback& callback) {
+  std::string cmd;
+  SerializeRedisCommand(argv, &cmd);
+  Submit(std::move(cmd), RedisCallback(callback));
+}
+
+void AsyncRedisClient::SendSerialized(const std::string& cmd,
+                                      const RedisCallback& callback) {
+  Submit(std::string(cmd), RedisCallback(callback));
+}
+
+void AsyncRedisClient::Callback(const RedisCallback& callback,
+                                const Status& s,
+                                const RedisCmdArgsType& reply) {
+  Done();
+  if (callback) {
+    callback(s, reply);
+  }
+}
+
+void AsyncRedisClient::Sent(RedisCallback&& callback) {
+  inflight_.push_back(std::move(callback));
+}
+
+void AsyncRedisClient::Fail(RedisCallback* callback, const Status& s) {
+  Callback(*callback, s, RedisCmdArgsType());
+}
+
+void AsyncRedisClient::Disconnected(const Status& s) {
+  reader_->Reset();
+  std::deque<RedisCallback> inflight;
+  inflight.swap(inflight_);
+  for (auto& callback : inflight) {
+    Callback(callback, s, RedisCmdArgsType());
+  }
+}
+
+ssize_t AsyncRedisClient::ReadReplies(int fd) {
+  return reader_->Read(fd);
+}
+
+bool AsyncRedisClient::HandleReplies() {
+  RedisCmdArgsType reply;
+  int type;
+  int ret;
+  while ((ret = reader_->GetReply(&reply, &type)) == REDIS_OK) {
+    if (inflight_.empty()) {
+      Disconnect(Status::Corruption("unexpected reply"));
+      return false;
+    }
+    RedisCallback callback(std::move(inflight_.front()));
+    inflight_.pop_front();
+    if (type == REDIS_REPLY_ERROR) {
+      Callback(callback,
+               Status::Corruption(reply.empty() ? "" : reply[0]), reply);
+    } else {
+      Callback(callback, Status::OK(), reply);
+    }
+  }
+  if (ret != REDIS_HALF) {
+    Disconnect(Status::Corruption("invalid reply"));
+    return false;
+  }
+  return true;
+}
+
+}  // namespace pink
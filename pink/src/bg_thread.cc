@@ -4,108 +4,304 @@
 // of patent rights can be found in the PATENTS file in the same directory.
 
 #include "pink/include/bg_thread.h"
-#include <sys/time.h>
 
 #include "slash/include/slash_mutex.h"
 #include "slash/include/xdebug.h"
+#include "pink/src/pink_util.h"
 
 namespace pink {
 
+void BGThread::SetLanes(const std::vector<BGLaneOptions>& options) {
+  if (options.empty()) {
+    return;
+  }
+  slash::MutexLock l(&mu_);
+  for (size_t i = 0; i < options.size(); i++) {
+    if (i < lanes_.size()) {
+      lanes_[i]->options = options[i];
+    } else {
+      lanes_.push_back(new Lane(options[i]));
+    }
+  }
+  while (lanes_.size() > options.size()) {
+    Lane* lane = lanes_.back();
+    lanes_.pop_back();
+    while (!lane->queue.empty()) {
+      lanes_[0]->queue.push(std::move(lane->queue.front()));
+      lane->queue.pop();
+    }
+    delete lane;
+  }
+  for (auto lane : lanes_) {
+    if (lane->options.weight < 1) {
+      lane->options.weight = 1;
+    }
+    lane->current = 0;
+  }
+}
+
+int BGThread::lane_num() {
+  slash::MutexLock l(&mu_);
+  return lanes_.size();
+}
+
+// Called with mu_ held
+BGThread::Lane* BGThread::GetLane(int lane) {
+  if (lane < 0 || lane >= static_cast<int>(lanes_.size())) {
+    lane = 0;
+  }
+  return lanes_[lane];
+}
+
+// Called with mu_ held
+void BGThread::WaitForRoom() {
+  while (size_ >= full_ && !should_stop()) {
+    wsignal_.Wait();
+  }
+}
+
 void BGThread::Schedule(void (*function)(void*), void* arg) {
+  Schedule(0, BGTask(function, arg));
+}
+
+void BGThread::Schedule(BGTask&& task) {
+  Schedule(0, std::move(task));
+}
+
+void BGThread::Schedule(int lane, BGTask&& task, uint64_t timeout) {
+  uint64_t now = timing_ || timeout != 0 ? NowMicros() : 0;
+  uint64_t deadline = timeout == 0 ? 0 : now + timeout * 1000;
   mu_.Lock();
-  while (queue_.size() >= full_ && !should_stop()) {
-    wsignal_.Wait();
+  WaitForRoom();
+  if (!should_stop()) {
+    GetLane(lane)->queue.push(LaneItem(std::move(task), now, deadline));
+    size_++;
+    rsignal_.Signal();
   }
+  mu_.Unlock();
+}
+
+void BGThread::ScheduleBatch(std::vector<BGTask>* tasks, int lane) {
+  if (tasks->empty()) {
+    return;
+  }
+  uint64_t now = timing_ ? NowMicros() : 0;
+  mu_.Lock();
+  WaitForRoom();
   if (!should_stop()) {
-    queue_.push(BGItem(function, arg));
+    Lane* l = GetLane(lane);
+    for (auto& task : *tasks) {
+      l->queue.push(LaneItem(std::move(task), now, 0));
+    }
+    size_ += tasks->size();
     rsignal_.Signal();
   }
   mu_.Unlock();
+  tasks->clear();
+}
+
+/*
+ * Take the next task by smooth weighted round robin over the non-empty
+ * lanes, mu_ is held and size_ is not 0. Return false if the task is
+ * expired and dropped, it is still moved to task so that it's destroyed
+ * out of the lock.
+ */
+bool BGThread::TakeTask(BGTask* task) {
+  Lane* best = NULL;
+  int total = 0;
+  for (auto lane : lanes_) {
+    if (lane->queue.empty()) {
+      continue;
+    }
+    lane->current += lane->options.weight;
+    total += lane->options.weight;
+    if (best == NULL || lane->current > best->current) {
+      best = lane;
+    }
+  }
+  best->current -= total;
+
+  LaneItem& item = best->queue.front();
+  bool run = true;
+  BGLaneStats& stats = best->stats;
+  stats.dequeued++;
+  if (item.enqueue_us != 0) {
+    uint64_t now = NowMicros();
+    uint64_t wait = now > item.enqueue_us ? now - item.enqueue_us : 0;
+    stats.total_wait_us += wait;
+    if (wait > stats.max_wait_us) {
+      stats.max_wait_us = wait;
+    }
+    if (timing_) {
+      wait_histogram_.Add(wait);
+    }
+    if (item.deadline_us != 0 && now > item.deadline_us) {
+      stats.expired++;
+      if (best->options.drop_expired) {
+        stats.dropped++;
+        run = false;
+      }
+    }
+  }
+  *task = std::move(item.task);
+  best->queue.pop();
+  size_--;
+  wsignal_.Signal();
+  return run;
 }
 
 void BGThread::QueueSize(int* pri_size, int* qu_size) {
   slash::MutexLock l(&mu_);
-  *pri_size = timer_queue_.size();
-  *qu_size = queue_.size();
+  *pri_size = timer_wheel_.size();
+  *qu_size = size_;
+}
+
+void BGThread::QueueSize(std::vector<BGLaneStats>* lanes) {
+  slash::MutexLock l(&mu_);
+  lanes->clear();
+  for (auto lane : lanes_) {
+    lanes->push_back(lane->stats);
+    lanes->back().depth = lane->queue.size();
+  }
 }
 
 void BGThread::QueueClear() {
   slash::MutexLock l(&mu_);
-  std::queue<BGItem>().swap(queue_);
-  std::priority_queue<TimerItem>().swap(timer_queue_);
+  for (auto lane : lanes_) {
+    std::queue<LaneItem>().swap(lane->queue);
+  }
+  size_ = 0;
+  timer_wheel_.Clear();
+  wsignal_.SignalAll();
 }
 
 void BGThread::SwallowReadyTasks() {
   // it's safe to swallow all the remain tasks in ready and timer queue,
   // while the schedule function would stop to add any tasks.
   mu_.Lock();
-  while (!queue_.empty()) {
-    void (*function)(void*) = queue_.front().function;
-    void* arg = queue_.front().arg;
-    queue_.pop();
+  while (size_ != 0) {
+    BGTask task;
+    bool run = TakeTask(&task);
     mu_.Unlock();
-    (*function)(arg);
+    if (run) {
+      RunTask(&task);
+    }
+    task.Reset();
     mu_.Lock();
   }
   mu_.Unlock();
 
-  struct timeval now;
-  gettimeofday(&now, NULL);
-  uint64_t unow = now.tv_sec * 1000000 + now.tv_usec;
   mu_.Lock();
-  while(!timer_queue_.empty()) {
-    TimerItem top_item = timer_queue_.top();
-    if (unow / 1000 < top_item.exec_time / 1000) {
-      break;
+  RunExpiredTimers();
+  mu_.Unlock();
+}
+
+void BGThread::RunTask(BGTask* task) {
+  if (!timing_) {
+    (*task)();
+    return;
+  }
+  const void* key = task->key();
+  uint64_t start = NowMicros();
+  (*task)();
+  uint64_t elapsed = NowMicros() - start;
+  run_histogram_.Add(elapsed);
+
+  slash::MutexLock l(&timing_mu_);
+  LatencyHistogram*& histogram = task_timings_[key];
+  if (histogram == NULL) {
+    histogram = new LatencyHistogram();
+  }
+  histogram->Add(elapsed);
+}
+
+void BGThread::RegisterTaskName(const void* key, const std::string& name) {
+  slash::MutexLock l(&timing_mu_);
+  task_names_[key] = name;
+}
+
+void BGThread::TaskTimings(std::vector<BGTaskTiming>* timings) {
+  timings->clear();
+  slash::MutexLock l(&timing_mu_);
+  for (auto& item : task_timings_) {
+    BGTaskTiming timing;
+    timing.key = item.first;
+    auto name = task_names_.find(item.first);
+    if (name != task_names_.end()) {
+      timing.name = name->second;
     }
-    void (*function)(void*) = top_item.function;
-    void* arg = top_item.arg;
-    timer_queue_.pop();
-    // Don't lock while doing task
-    mu_.Unlock();
-    (*function)(arg);
-    mu_.Lock();
+    timing.count = item.second->count();
+    timing.total_us = item.second->sum();
+    timing.max_us = item.second->max();
+    timing.p99_us = item.second->Percentile(99);
+    timings->push_back(timing);
   }
+}
+
+void BGThread::ClearTimings() {
+  wait_histogram_.Clear();
+  run_histogram_.Clear();
+  slash::MutexLock l(&timing_mu_);
+  for (auto& item : task_timings_) {
+    item.second->Clear();
+  }
+}
+
+/*
+ * Run the expired timers in one batch, mu_ is held by the caller and
+ * released while the tasks run
+ */
+void BGThread::RunExpiredTimers() {
+  std::vector<BGTask> expired;
+  expired.swap(expired_);
+  timer_wheel_.Advance(NowMs(), &expired);
+  if (expired.empty()) {
+    expired_.swap(expired);
+    return;
+  }
+  // Don't lock while doing task
   mu_.Unlock();
+  for (auto& task : expired) {
+    RunTask(&task);
+  }
+  expired.clear();
+  mu_.Lock();
+  // Keep the capacity for the next batch
+  expired_.swap(expired);
 }
 
 void *BGThread::ThreadMain() {
   while (!should_stop()) {
     mu_.Lock();
-    while (queue_.empty() && timer_queue_.empty() && !should_stop()) {
+    while (size_ == 0 && timer_wheel_.empty() && !should_stop()) {
       rsignal_.Wait();
     }
     if (should_stop()) {
       mu_.Unlock();
       break;
     }
-    if (!timer_queue_.empty()) {
-      struct timeval now;
-      gettimeofday(&now, NULL);
-
-      TimerItem timer_item = timer_queue_.top();
-      uint64_t unow = now.tv_sec * 1000000 + now.tv_usec;
-      if (unow / 1000 >= timer_item.exec_time / 1000) {
-        void (*function)(void*) = timer_item.function;
-        void* arg = timer_item.arg;
-        timer_queue_.pop();
+    if (!timer_wheel_.empty()) {
+      uint64_t now = NowMs();
+      uint64_t timeout = timer_wheel_.NextTimeout(now);
+      if (timeout == 0) {
+        RunExpiredTimers();
         mu_.Unlock();
-        (*function)(arg);
         continue;
-      } else if (queue_.empty() && !should_stop()) {
-        rsignal_.TimedWait(
-            static_cast<uint32_t>((timer_item.exec_time - unow) / 1000));
+      } else if (size_ == 0 && !should_stop()) {
+        rsignal_.TimedWait(static_cast<uint32_t>(timeout));
         mu_.Unlock();
         continue;
       }
     }
-    if (!queue_.empty()) {
-      void (*function)(void*) = queue_.front().function;
-      void* arg = queue_.front().arg;
-      queue_.pop();
-      wsignal_.Signal();
+    if (size_ != 0) {
+      BGTask task;
+      bool run = TakeTask(&task);
+      mu_.Unlock();
+      if (run) {
+        RunTask(&task);
+      }
+    } else {
       mu_.Unlock();
-      (*function)(arg);
     }
   }
   // swalloc all the remain tasks in ready and timer queue
@@ -116,23 +312,37 @@ void *BGThread::ThreadMain() {
 /*
  * timeout is in millisecond
  */
-void BGThread::DelaySchedule(
+TimerHandle BGThread::DelaySchedule(
     uint64_t timeout, void (*function)(void *), void* arg) {
-  /*
-   * pthread_cond_timedwait api use absolute API
-   * so we need gettimeofday + timeout
-   */
-  struct timeval now;
-  gettimeofday(&now, NULL);
-  uint64_t exec_time;
-  exec_time = now.tv_sec * 1000000 + timeout * 1000 + now.tv_usec;
+  return DelaySchedule(timeout, BGTask(function, arg));
+}
+
+TimerHandle BGThread::DelaySchedule(uint64_t timeout, BGTask&& task) {
+  uint64_t now = NowMs();
 
+  TimerHandle handle;
   mu_.Lock();
   if (!should_stop()) {
-    timer_queue_.push(TimerItem(exec_time, function, arg));
+    handle = timer_wheel_.Add(now, now + timeout, std::move(task));
     rsignal_.Signal();
   }
   mu_.Unlock();
+  return handle;
+}
+
+bool BGThread::Cancel(const TimerHandle& handle) {
+  slash::MutexLock l(&mu_);
+  return timer_wheel_.Cancel(handle);
+}
+
+bool BGThread::Reschedule(const TimerHandle& handle, uint64_t timeout) {
+  slash::MutexLock l(&mu_);
+  bool ret = timer_wheel_.Reschedule(handle,
+                                     NowMs() + timeout);
+  if (ret) {
+    rsignal_.Signal();
+  }
+  return ret;
 }
 
 }  // namespace pink
@@ -0,0 +1,405 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include "pink/include/bg_thread_pool.h"
+
+#include <sched.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "pink/src/pink_util.h"
+#include "pink/src/work_stealing_deque.h"
+
+namespace pink {
+
+// Rounds an idle worker looks for tasks before it parks
+static const int kSpinRounds = 64;
+
+static const uint64_t kNoTimer = TimerWheel::kNoTimer;
+
+class BGThreadPool::Worker : public Thread {
+ public:
+  Worker(BGThreadPool* pool, int index)
+      : pool_(pool),
+        seed_(index * 2654435761u + 1) {
+    set_thread_name("BGThreadPool" + std::to_string(index));
+  }
+
+  BGThreadPool* pool() const {
+    return pool_;
+  }
+
+  // Start point of the victims to steal from
+  uint32_t NextVictim() {
+    seed_ ^= seed_ << 13;
+    seed_ ^= seed_ >> 17;
+    seed_ ^= seed_ << 5;
+    return seed_;
+  }
+
+  WorkStealingDeque<BGTask> deque_;
+
+  // The worker running on this thread, NULL out of any pool
+  static thread_local Worker* current_;
+
+ private:
+  BGThreadPool* pool_;
+  uint32_t seed_;
+
+  virtual void *ThreadMain() override;
+};
+
+thread_local BGThreadPool::Worker* BGThreadPool::Worker::current_ = NULL;
+
+void *BGThreadPool::Worker::ThreadMain() {
+  current_ = this;
+  int idle = 0;
+  while (!pool_->should_stop()) {
+    if (pool_->RunExpiredTimers()) {
+      idle = 0;
+      continue;
+    }
+    BGTask* task = pool_->TakeTask(this);
+    if (task != NULL) {
+      (*task)();
+      delete task;
+      idle = 0;
+      continue;
+    }
+    if (++idle < kSpinRounds) {
+      sched_yield();
+      continue;
+    }
+    pool_->Park();
+    idle = 0;
+  }
+  current_ = NULL;
+  return NULL;
+}
+
+BGThreadPool::BGThreadPool(int thread_num, int full)
+    : should_stop_(false),
+      full_(full),
+      pending_(0),
+      sleepers_(0),
+      waiters_(0),
+      mu_(),
+      rsignal_(&mu_),
+      wsignal_(&mu_),
+      timer_wheel_(NowMs()),
+      next_timer_(kNoTimer) {
+  if (thread_num < 1) {
+    thread_num = 1;
+  }
+  for (int i = 0; i < thread_num; i++) {
+    workers_.push_back(new Worker(this, i));
+  }
+}
+
+BGThreadPool::~BGThreadPool() {
+  StopThread();
+  QueueClear();
+  for (auto worker : workers_) {
+    delete worker;
+  }
+}
+
+int BGThreadPool::StartThread() {
+  should_stop_ = false;
+  for (auto worker : workers_) {
+    int ret = worker->StartThread();
+    if (ret != 0) {
+      return ret;
+    }
+  }
+  return 0;
+}
+
+int BGThreadPool::StopThread() {
+  bool running = workers_[0]->is_running();
+  should_stop_ = true;
+  mu_.Lock();
+  rsignal_.SignalAll();
+  wsignal_.SignalAll();
+  mu_.Unlock();
+
+  int result = 0;
+  for (auto worker : workers_) {
+    int ret = worker->StopThread();
+    if (ret != 0) {
+      result = ret;
+    }
+  }
+  if (running) {
+    // swalloc all the remain tasks in ready and timer queue
+    SwallowReadyTasks();
+  }
+  return result;
+}
+
+void BGThreadPool::Schedule(void (*function)(void*), void* arg) {
+  Schedule(BGTask(function, arg));
+}
+
+void BGThreadPool::Schedule(BGTask&& task) {
+  if (should_stop()) {
+    return;
+  }
+  BGTask* item = new BGTask(std::move(task));
+  PushTasks(&item, 1);
+}
+
+void BGThreadPool::ScheduleBatch(std::vector<BGTask>* tasks) {
+  if (tasks->empty() || should_stop()) {
+    tasks->clear();
+    return;
+  }
+  std::vector<BGTask*> items;
+  items.reserve(tasks->size());
+  for (auto& task : *tasks) {
+    items.push_back(new BGTask(std::move(task)));
+  }
+  tasks->clear();
+  PushTasks(items.data(), items.size());
+}
+
+/*
+ * Tasks not pushed because of stopping are deleted
+ */
+void BGThreadPool::PushTasks(BGTask** items, size_t num) {
+  Worker* worker = Worker::current_;
+  if (worker != NULL && worker->pool() == this) {
+    // A worker never waits for itself, push to its own deque
+    pending_ += num;
+    for (size_t i = 0; i < num; i++) {
+      worker->deque_.Push(items[i]);
+    }
+    WakeUp(num);
+    return;
+  }
+
+  if (pending_ >= full_) {
+    mu_.Lock();
+    waiters_++;
+    while (pending_ >= full_ && !should_stop()) {
+      wsignal_.Wait();
+    }
+    waiters_--;
+    mu_.Unlock();
+  }
+  if (should_stop()) {
+    for (size_t i = 0; i < num; i++) {
+      delete items[i];
+    }
+    return;
+  }
+  // Count before push, so a parking worker never misses the task
+  pending_ += num;
+  queue_mu_.Lock();
+  queue_.insert(queue_.end(), items, items + num);
+  queue_mu_.Unlock();
+  WakeUp(num);
+}
+
+/*
+ * timeout is in millisecond
+ */
+TimerHandle BGThreadPool::DelaySchedule(
+    uint64_t timeout, void (*function)(void *), void* arg) {
+  return DelaySchedule(timeout, BGTask(function, arg));
+}
+
+TimerHandle BGThreadPool::DelaySchedule(uint64_t timeout, BGTask&& task) {
+  uint64_t now = NowMs();
+
+  TimerHandle handle;
+  mu_.Lock();
+  if (!should_stop()) {
+    handle = timer_wheel_.Add(now, now + timeout, std::move(task));
+    UpdateNextTimer(now);
+  }
+  mu_.Unlock();
+  return handle;
+}
+
+bool BGThreadPool::Cancel(const TimerHandle& handle) {
+  slash::MutexLock l(&mu_);
+  bool ret = timer_wheel_.Cancel(handle);
+  if (ret) {
+    UpdateNextTimer(NowMs());
+  }
+  return ret;
+}
+
+bool BGThreadPool::Reschedule(const TimerHandle& handle, uint64_t timeout) {
+  uint64_t now = NowMs();
+  slash::MutexLock l(&mu_);
+  bool ret = timer_wheel_.Reschedule(handle, now + timeout);
+  if (ret) {
+    UpdateNextTimer(now);
+  }
+  return ret;
+}
+
+/*
+ * Called with mu_ held, a parked worker recomputes its timeout if the
+ * next tick moves earlier
+ */
+void BGThreadPool::UpdateNextTimer(uint64_t now) {
+  uint64_t timeout = timer_wheel_.NextTimeout(now);
+  uint64_t next = timeout == kNoTimer ? kNoTimer : now + timeout;
+  if (next < next_timer_) {
+    rsignal_.Signal();
+  }
+  next_timer_ = next;
+}
+
+void BGThreadPool::QueueSize(int* pri_size, int* qu_size) {
+  slash::MutexLock l(&mu_);
+  *pri_size = timer_wheel_.size();
+  *qu_size = pending_;
+}
+
+void BGThreadPool::QueueClear() {
+  size_t cleared = 0;
+  BGTask* item;
+  while ((item = TakeShared()) != NULL) {
+    delete item;
+    cleared++;
+  }
+  for (auto worker : workers_) {
+    while ((item = worker->deque_.Steal()) != NULL) {
+      delete item;
+      cleared++;
+    }
+  }
+  pending_ -= cleared;
+
+  slash::MutexLock l(&mu_);
+  timer_wheel_.Clear();
+  next_timer_ = kNoTimer;
+  wsignal_.SignalAll();
+}
+
+void BGThreadPool::SwallowReadyTasks() {
+  // it's safe to swallow all the remain tasks in ready and timer queue,
+  // while the schedule function would stop to add any tasks.
+  while (true) {
+    BGTask* task = TakeShared();
+    for (size_t i = 0; task == NULL && i < workers_.size(); i++) {
+      task = workers_[i]->deque_.Steal();
+    }
+    if (task == NULL) {
+      break;
+    }
+    pending_--;
+    (*task)();
+    delete task;
+  }
+
+  RunExpiredTimers();
+}
+
+BGTask* BGThreadPool::TakeShared() {
+  slash::MutexLock l(&queue_mu_);
+  if (queue_.empty()) {
+    return NULL;
+  }
+  BGTask* item = queue_.front();
+  queue_.pop_front();
+  return item;
+}
+
+/*
+ * Look for a task in the worker's own deque, then the shared queue, then
+ * the deques of the other workers
+ */
+BGTask* BGThreadPool::TakeTask(Worker* worker) {
+  if (pending_ == 0) {
+    return NULL;
+  }
+  BGTask* item = worker->deque_.Pop();
+  if (item == NULL) {
+    item = TakeShared();
+  }
+  if (item == NULL) {
+    size_t num = workers_.size();
+    size_t start = worker->NextVictim() % num;
+    for (size_t i = 0; item == NULL && i < num; i++) {
+      Worker* victim = workers_[(start + i) % num];
+      if (victim != worker) {
+        item = victim->deque_.Steal();
+      }
+    }
+  }
+  if (item != NULL) {
+    pending_--;
+    if (waiters_ > 0) {
+      slash::MutexLock l(&mu_);
+      wsignal_.Signal();
+    }
+  }
+  return item;
+}
+
+/*
+ * Advance the timer wheel and run the expired tasks in one batch, return
+ * false if no timer expired
+ */
+bool BGThreadPool::RunExpiredTimers() {
+  uint64_t next = next_timer_;
+  if (next == kNoTimer) {
+    return false;
+  }
+  uint64_t now = NowMs();
+  if (now < next) {
+    return false;
+  }
+
+  std::vector<BGTask> expired;
+  mu_.Lock();
+  timer_wheel_.Advance(now, &expired);
+  UpdateNextTimer(now);
+  // Don't lock while doing task
+  mu_.Unlock();
+  for (auto& task : expired) {
+    task();
+  }
+  return !expired.empty();
+}
+
+void BGThreadPool::Park() {
+  mu_.Lock();
+  // sleepers_ is raised before pending_ is checked, and Schedule() raises
+  // pending_ before it checks sleepers_, so one of them sees the other
+  sleepers_++;
+  if (pending_ == 0 && !should_stop()) {
+    uint64_t next = next_timer_;
+    if (next == kNoTimer) {
+      rsignal_.Wait();
+    } else {
+      uint64_t now = NowMs();
+      if (now < next) {
+        rsignal_.TimedWait(static_cast<uint32_t>(next - now));
+      }
+    }
+  }
+  sleepers_--;
+  mu_.Unlock();
+}
+
+void BGThreadPool::WakeUp(size_t tasks) {
+  if (sleepers_ > 0) {
+    slash::MutexLock l(&mu_);
+    if (tasks > 1) {
+      rsignal_.SignalAll();
+    } else {
+      rsignal_.Signal();
+    }
+  }
+}
+
+}  // namespace pink
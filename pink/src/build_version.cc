@@ -0,0 +1,4 @@
+#include "pink/include/build_version.h"
+const char* pink_build_git_sha = "pink_build_git_sha:6ca43530ae7f9f6902707c365e55d7b1d5940d28";
+const char* pink_build_git_date = "pink_build_git_date:2026-10-19";
+const char* pink_build_compile_date = __DATE__;
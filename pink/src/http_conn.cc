@@ -6,6 +6,8 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <stdio.h>
+#include <strings.h>
+#include <sys/sendfile.h>
 
 #include <string>
 #include <algorithm>
@@ -16,8 +18,18 @@
 
 namespace pink {
 
-static const uint32_t kHTTPMaxMessage = 1024 * 1024 * 8;
 static const uint32_t kHTTPMaxHeader = 1024 * 1024;
+// The most output gathered before it's sent, the pipelined requests after
+// it wait until it's written
+static const uint32_t kHTTPMaxPending = 64 * 1024;
+// The longest chunk size or trailer line of a chunked body
+static const uint32_t kHTTPMaxChunkLine = 4096;
+// The least room for the body after the header, a chunk line fits in it.
+// A header of the rest of a pooled chunk doesn't grow the input buffer.
+static const uint32_t kHTTPMinBodyRoom = 2 * kHTTPMaxChunkLine;
+// "xxxxxxxx\r\n" before the data of a chunk, and "\r\n" after
+static const uint32_t kChunkHeadSize = 10;
+static const uint32_t kChunkTailSize = 2;
 
 static const std::map<int, std::string> http_status_map = {
   {100, "Continue"},
@@ -33,6 +45,8 @@ static const std::map<int, std::string> http_status_map = {
   {206, "Partial Content"},
   {207, "Multi-Status"},
 
+  {304, "Not Modified"},
+
   {400, "Bad Request"},
   {401, "Unauthorized"},
   {402, ""},  // reserve
@@ -57,159 +71,106 @@ static const std::map<int, std::string> http_status_map = {
   {509, "Not Extended"},
 };
 
-inline int find_lf(const char* data, int size) {
-  const char* c = data;
-  int count = 0;
-  while (count < size) {
-    if (*c == '\n') {
-      break;
-    }
-    c++;
-    count++;
-  }
-  return count;
+static bool EqualIgnoreCase(const slash::Slice& a, const slash::Slice& b) {
+  return a.size() == b.size() &&
+    strncasecmp(a.data(), b.data(), a.size()) == 0;
 }
 
-bool HTTPRequest::ParseHeadLine(
-    const char* data, int line_start, int line_end) {
-  std::string param_key;
-  std::string param_value;
-  for (int i = line_start; i <= line_end; i++) {
-    switch (parse_status_) {
-      case kHeaderMethod:
-        if (data[i] != ' ') {
-          method_.push_back(data[i]);
-        } else {
-          parse_status_ = kHeaderPath;
-        }
-        break;
-      case kHeaderPath:
-        if (data[i] != ' ') {
-          url_.push_back(data[i]);
-        } else {
-          parse_status_ = kHeaderVersion;
-        }
-        break;
-      case kHeaderVersion:
-        if (data[i] != '\r' && data[i] != '\n') {
-          version_.push_back(data[i]);
-        } else if (data[i] == '\n') {
-          parse_status_ = kHeaderParamKey;
-        }
-        break;
-      case kHeaderParamKey:
-        if (data[i] != ':' && data[i] != ' ') {
-          param_key.push_back(data[i]);
-        } else if (data[i] == ' ') {
-          parse_status_ = kHeaderParamValue;
-        }
-        break;
-      case kHeaderParamValue:
-        if (data[i] != '\r' && data[i] != '\n') {
-          param_value.push_back(data[i]);
-        } else if (data[i] == '\r') {
-          headers_[slash::StringToLower(param_key)] = param_value;
-          parse_status_ = kHeaderParamKey;
-        }
-        break;
+static bool IsSpace(char c) {
+  return c == ' ' || c == '\t';
+}
 
-      default:
-        return false;
-    }
+static int HexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  } else if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  } else if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
   }
-  return true;
+  return -1;
 }
 
-bool HTTPRequest::ParseGetUrl() {
-  path_ = url_;
-  // Format path
-  if (headers_.count("host") &&
-      path_.find(headers_["host"]) != std::string::npos &&
-      path_.size() > (7 + headers_["host"].size())) {
-    // http://www.xxx.xxx/path_/to
-    path_.assign(path_.substr(7 + headers_["host"].size()));
-  }
-  size_t n = path_.find('?');
-  if (n == std::string::npos) {
-    return true;  // no parameter
+// The last coding of Transfer-Encoding is chunked
+static bool IsChunked(const slash::Slice& value) {
+  size_t size = value.size();
+  while (size > 0 && IsSpace(value[size - 1])) {
+    size--;
   }
-  if (!ParseParameters(path_, n + 1)) {
-    return false;
-  }
-  path_.resize(n);
-  return true;
+  return size >= 7 &&
+    strncasecmp(value.data() + size - 7, "chunked", 7) == 0 &&
+    (size == 7 || value[size - 8] == ',' || IsSpace(value[size - 8]));
 }
 
-// Parse query parameter from GET url or POST application/x-www-form-urlencoded
-// format: key1=value1&key2=value2&key3=value3
-bool HTTPRequest::ParseParameters(const std::string data, size_t line_start) {
-  size_t pre = line_start, mid, end;
-  while (pre < data.size()) {
-    mid = data.find('=', pre);
-    if (mid == std::string::npos) {
-      mid = data.size();
-    }
-    end = data.find('&', pre);
-    if (end == std::string::npos) {
-      end = data.size();
-    }
-    if (end <= mid) {
-      // empty value
-      query_params_[data.substr(pre, end - pre)] = std::string();
-      pre = end + 1;
-    } else {
-      query_params_[data.substr(pre, mid - pre)] =
-        data.substr(mid + 1, end - mid - 1);
-      pre = end + 1;
+const slash::Slice* HTTPFields::Find(const slash::Slice& key) const {
+  for (auto& field : fields_) {
+    if (ignore_case_ ? EqualIgnoreCase(field.first, key) : field.first == key) {
+      return &field.second;
     }
   }
-  return true;
+  return NULL;
 }
 
 int HTTPRequest::ParseHeader() {
-  rbuf_[rbuf_pos_] = '\0';  // Avoid strstr() parsing expire char
-  char *sep_pos = strstr(rbuf_, "\r\n\r\n");
-  if (!sep_pos) {
-    // Haven't find header
-    return 0;
-  }
-  int header_len = sep_pos - rbuf_ + 4;
-  int remain_size = header_len;
-  if (remain_size <= 5) {
-    // Header error
-    return -1;
-  }
-
-  // Parse header line
-  int line_start = 0;
-  int line_end = 0;
-  while (remain_size > 4) {
-    line_end += find_lf(rbuf_ + line_start, remain_size);
-    if (line_end < line_start) {
-      return -1;
+  int header_len = parser_.Parse(rbuf_.data(), rbuf_pos_);
+  if (header_len <= 0) {
+    return header_len;
+  }
+
+  // The views point into rbuf_, make room for the body before taking them,
+  // so that rbuf_ never moves while they are used. A request without a
+  // body needs no room, nor one whose header leaves enough in the chunk.
+  const char* rbuf = rbuf_.data();
+  bool has_body = false;
+  for (auto& field : parser_.fields()) {
+    slash::Slice key = HTTPParser::Get(rbuf, field.key);
+    if (EqualIgnoreCase(key, "content-length") ||
+        EqualIgnoreCase(key, "transfer-encoding")) {
+      has_body = true;
+      break;
     }
-    if (!ParseHeadLine(rbuf_, line_start, line_end)) {
+  }
+  if (has_body && rbuf_.capacity() < header_len + kHTTPMinBodyRoom) {
+    if (!rbuf_.Reserve(std::min<size_t>(header_len + PooledBuffer::kChunkSize,
+                                        rbuf_.max_size()))) {
       return -1;
     }
-    remain_size -= (line_end - line_start + 1);
-    line_start = ++line_end;
+    rbuf = rbuf_.data();
   }
-
-  // Parse query parameter from url
-  if (!ParseGetUrl()) {
-    return -1;
+  method_ = HTTPParser::Get(rbuf, parser_.method());
+  url_ = HTTPParser::Get(rbuf, parser_.url());
+  version_ = HTTPParser::Get(rbuf, parser_.version());
+  for (auto& field : parser_.fields()) {
+    headers_.Add(HTTPParser::Get(rbuf, field.key),
+                 HTTPParser::Get(rbuf, field.value));
   }
 
-  remain_recv_len_ = headers_.count("content-length") ?
-    std::stoul(headers_.at("content-length")) : 0;
+  slash::Slice query;
+  HTTPParser::SplitUrl(url_, &path_, &query);
+  HTTPParser::ParseParameters(query.data(), query.data() + query.size(),
+      [this](const slash::Slice& key, const slash::Slice& value) {
+        query_params_.Add(key, value);
+      });
 
-  if (headers_.count("content-type")) {
-    content_type_.assign(headers_.at("content-type"));
+  remain_recv_len_ = 0;
+  const slash::Slice* value = headers_.Find("transfer-encoding");
+  if (value != NULL) {
+    // Transfer-Encoding overrides Content-Length
+    if (!IsChunked(*value)) {
+      return -1;
+    }
+    chunked_ = true;
+  } else {
+    value = headers_.Find("content-length");
+    if (value != NULL &&
+        !HTTPParser::ParseContentLength(*value, &remain_recv_len_)) {
+      return -1;
+    }
   }
 
-  if (headers_.count("expect") &&
-      (headers_.at("expect") == "100-Continue" ||
-      headers_.at("expect") == "100-continue")) {
+  content_type_ = headers_.Get("content-type");
+
+  if (EqualIgnoreCase(headers_.Get("expect"), "100-continue")) {
     reply_100continue_ = true;
   }
 
@@ -217,53 +178,58 @@ int HTTPRequest::ParseHeader() {
 }
 
 void HTTPRequest::Dump() const {
-  std::cout << "Method:  " << method_ << std::endl;
-  std::cout << "Url:     " << url_ << std::endl;
-  std::cout << "Path:    " << path_ << std::endl;
-  std::cout << "Version: " << version_ << std::endl;
+  std::cout << "Method:  " << method_.ToString() << std::endl;
+  std::cout << "Url:     " << url_.ToString() << std::endl;
+  std::cout << "Path:    " << path_.ToString() << std::endl;
+  std::cout << "Version: " << version_.ToString() << std::endl;
   std::cout << "Headers: " << std::endl;
   for (auto& header : headers_) {
-    std::cout << "  ----- "
-      << header.first << ": " << header.second << std::endl;
+    std::cout << "  ----- " << header.first.ToString()
+      << ": " << header.second.ToString() << std::endl;
   }
   std::cout << "Query params: " << std::endl;
   for (auto& item : query_params_) {
-    std::cout << "  ----- " << item.first << ": " << item.second << std::endl;
+    std::cout << "  ----- " << item.first.ToString()
+      << ": " << item.second.ToString() << std::endl;
   }
 }
 
-// Return bytes actual be writen, should be less than size
-bool HTTPResponse::SerializeHeader() {
-  int serial_size = 0;
-  int ret;
+static char* Append(char* dst, const char* data, size_t size) {
+  memcpy(dst, data, size);
+  return dst + size;
+}
 
-  std::string reason_phrase = http_status_map.at(status_code_);
+bool HTTPResponse::SerializeHeader() {
+  const std::string& reason_phrase = http_status_map.at(status_code_);
 
-  // Serialize statues line
-  ret = snprintf(wbuf_, kHTTPMaxHeader, "HTTP/1.1 %d %s\r\n",
-                 status_code_, reason_phrase.c_str());
-  serial_size += ret;
-  if (ret < 0 || ret == static_cast<int>(kHTTPMaxHeader)) {
-    return false;
+  // "HTTP/1.1 200 OK\r\n", the headers and "\r\n"
+  size_t header_size = 15 + reason_phrase.size() + 2;
+  for (size_t i = 0; i < header_num_; i++) {
+    header_size += headers_[i].first.size() + headers_[i].second.size() + 4;
   }
-
-  for (auto &line : headers_) {
-    ret = snprintf(wbuf_ + serial_size, kHTTPMaxHeader - serial_size,
-                   "%s: %s\r\n",
-                   line.first.c_str(), line.second.c_str());
-    serial_size += ret;
-    if (ret < 0 || serial_size == static_cast<int>(kHTTPMaxHeader)) {
-      return false;
-    }
+  // Behind the responses before
+  if (!wbuf_.Reserve(buf_len_ + header_size)) {
+    return false;
   }
 
-  ret = snprintf(wbuf_ + serial_size, kHTTPMaxHeader - serial_size, "\r\n");
-  serial_size += ret;
-  if (ret < 0 || serial_size == static_cast<int>(kHTTPMaxHeader)) {
-    return false;
+  // Serialize statues line
+  char* dst = Append(wbuf_.data() + buf_len_, "HTTP/1.1 ", 9);
+  *dst++ = '0' + status_code_ / 100;
+  *dst++ = '0' + status_code_ / 10 % 10;
+  *dst++ = '0' + status_code_ % 10;
+  *dst++ = ' ';
+  dst = Append(dst, reason_phrase.data(), reason_phrase.size());
+  dst = Append(dst, "\r\n", 2);
+
+  for (size_t i = 0; i < header_num_; i++) {
+    dst = Append(dst, headers_[i].first.data(), headers_[i].first.size());
+    dst = Append(dst, ": ", 2);
+    dst = Append(dst, headers_[i].second.data(), headers_[i].second.size());
+    dst = Append(dst, "\r\n", 2);
   }
+  dst = Append(dst, "\r\n", 2);
 
-  buf_len_ = serial_size;
+  buf_len_ = dst - wbuf_.data();
   return true;
 }
 
@@ -289,65 +255,33 @@ HTTPConn::~HTTPConn() {
 HTTPRequest::HTTPRequest(HTTPConn* conn)
     : conn_(conn),
       reply_100continue_(false),
+      postform_params_(false),
+      query_params_(false),
+      headers_(true),
+      path_params_(false),
+      client_ip_port_(conn->ip_port()),
       req_status_(kNewRequest),
-      parse_status_(kHeaderMethod),
+      chunked_(false),
+      chunk_status_(kChunkSize),
+      // The header and a chunk of the body
+      rbuf_(kHTTPMaxHeader + PooledBuffer::kChunkSize),
       rbuf_pos_(0),
+      body_start_(0),
+      next_start_(0),
       remain_recv_len_(0) {
-  rbuf_ = new char[kHTTPMaxMessage];
 }
 
 HTTPRequest::~HTTPRequest() {
-  delete[] rbuf_;
-}
-
-const std::string HTTPRequest::url() const {
-  return url_;
-}
-
-const std::string HTTPRequest::path() const {
-  return path_;
-}
-
-const std::string HTTPRequest::query_value(const std::string& field) const {
-  if (query_params_.count(field)) {
-    return query_params_.at(field);
-  }
-  return "";
-}
-
-const std::string HTTPRequest::postform_value(const std::string& field) const {
-  if (postform_params_.count(field)) {
-    return postform_params_.at(field);
-  }
-  return "";
-}
-
-const std::string HTTPRequest::method() const {
-  return method_;
-}
-
-const std::string HTTPRequest::content_type() const {
-  return content_type_;
 }
 
-const std::map<std::string, std::string> HTTPRequest::query_params() const {
-  return query_params_;
-}
-
-const std::map<std::string, std::string> HTTPRequest::postform_params() const {
-  return postform_params_;
-}
-
-const std::map<std::string, std::string> HTTPRequest::headers() const {
-  return headers_;
-}
-
-const std::string HTTPRequest::client_ip_port() const {
+const std::string& HTTPRequest::client_ip_port() const {
   return client_ip_port_;
 }
 
+// The pipelined requests in rbuf_ are kept
 void HTTPRequest::Reset() {
-  rbuf_pos_ = 0;
+  body_start_ = 0;
+  next_start_ = 0;
   method_.clear();
   path_.clear();
   version_.clear();
@@ -355,19 +289,44 @@ void HTTPRequest::Reset() {
   content_type_.clear();
   remain_recv_len_ = 0;
   reply_100continue_ = false;
-  postform_params_.clear();
-  query_params_.clear();
-  headers_.clear();
-  parse_status_ = kHeaderMethod;
-  client_ip_port_ = conn_->ip_port();
+  chunked_ = false;
+  chunk_status_ = kChunkSize;
+  postform_params_.Clear();
+  query_params_.Clear();
+  headers_.Clear();
+  path_params_.Clear();
+  parser_.Reset();
 }
 
 ReadStatus HTTPRequest::DoRead() {
+  size_t size;
+  if (req_status_ == kBodyReceiving) {
+    // The body goes through the room after the header, reserved by
+    // ParseHeader(), rbuf_ must not move. The end of a chunked body is
+    // not known, the pipelined requests may be read with it.
+    size = rbuf_.capacity() - rbuf_pos_;
+    if (!chunked_) {
+      size = std::min<uint64_t>(size, remain_recv_len_);
+    }
+  } else {
+    // The header must be in the buffer at once, grow it if full
+    if (rbuf_.capacity() == rbuf_pos_ &&
+        !rbuf_.Reserve(std::min<size_t>(
+              std::max<size_t>(rbuf_.capacity() * 2, PooledBuffer::kChunkSize),
+              rbuf_.max_size()))) {
+      return kReadError;
+    }
+    size = rbuf_.capacity() - rbuf_pos_;
+  }
+  if (size == 0) {
+    return kReadError;
+  }
+
   ssize_t nread;
 #ifdef __ENABLE_SSL
   if (conn_->security_) {
-    nread = SSL_read(conn_->ssl(), rbuf_ + rbuf_pos_,
-                     static_cast<int>(kHTTPMaxMessage));
+    nread = SSL_read(conn_->ssl(), rbuf_.data() + rbuf_pos_,
+                     static_cast<int>(size));
     if (nread <= 0) {
       int sslerr = SSL_get_error(conn_->ssl(), static_cast<int>(nread));
       switch (sslerr) {
@@ -385,12 +344,11 @@ ReadStatus HTTPRequest::DoRead() {
   else
 #endif
   {
-    nread = read(conn_->fd(), rbuf_ + rbuf_pos_,
-                 kHTTPMaxMessage - rbuf_pos_);
+    nread = read(conn_->fd(), rbuf_.data() + rbuf_pos_, size);
   }
   if (nread > 0) {
     rbuf_pos_ += nread;
-    if (req_status_ == kBodyReceiving) {
+    if (req_status_ == kBodyReceiving && !chunked_) {
       remain_recv_len_ -= nread;
     }
   } else if (nread == -1 && errno == EAGAIN) {
@@ -402,12 +360,97 @@ ReadStatus HTTPRequest::DoRead() {
   return kOk;
 }
 
+ReadStatus HTTPRequest::Closed(ReadStatus status) {
+  if (status != kReadHalf) {
+    conn_->handles_->HandleConnClosed();
+  }
+  return status;
+}
+
+/*
+ * Decode the chunked body in rbuf_ from body_start_, the data of the chunks
+ * goes to HandleBodyData(), a partial line is kept at body_start_.
+ * Return 1 when the body ends, next_start_ is after it, 0 if more is
+ * needed, -1 on error.
+ */
+int HTTPRequest::DecodeChunked() {
+  char* data = rbuf_.data();
+  uint64_t pos = body_start_;
+  while (pos < rbuf_pos_) {
+    if (chunk_status_ == kChunkData) {
+      uint64_t size = std::min(remain_recv_len_, rbuf_pos_ - pos);
+      conn_->handles_->HandleBodyData(data + pos, size);
+      pos += size;
+      remain_recv_len_ -= size;
+      if (remain_recv_len_ == 0) {
+        chunk_status_ = kChunkDataEnd;
+      }
+      continue;
+    }
+
+    const char* line = data + pos;
+    const char* lf = static_cast<const char*>(
+        memchr(line, '\n', rbuf_pos_ - pos));
+    if (lf == NULL) {
+      if (rbuf_pos_ - pos > kHTTPMaxChunkLine) {
+        return -1;
+      }
+      break;
+    }
+    const char* line_end = (lf > line && lf[-1] == '\r') ? lf - 1 : lf;
+    pos = lf + 1 - data;
+
+    switch (chunk_status_) {
+      case kChunkSize: {
+        // chunk-size [ chunk-ext ]
+        uint64_t size = 0;
+        const char* c = line;
+        int digit;
+        while (c < line_end && (digit = HexValue(*c)) >= 0) {
+          if (size >> 60) {
+            return -1;
+          }
+          size = size * 16 + digit;
+          c++;
+        }
+        if (c == line || (c < line_end && *c != ';' && !IsSpace(*c))) {
+          return -1;
+        }
+        remain_recv_len_ = size;
+        chunk_status_ = size > 0 ? kChunkData : kChunkTrailer;
+        break;
+      }
+      case kChunkDataEnd:
+        if (line_end != line) {
+          return -1;
+        }
+        chunk_status_ = kChunkSize;
+        break;
+      case kChunkTrailer:
+        // The trailer fields are skipped, an empty line ends the body
+        if (line_end == line) {
+          next_start_ = pos;
+          return 1;
+        }
+        break;
+      default:
+        return -1;
+    }
+  }
+
+  // Keep the partial line
+  uint64_t remain = rbuf_pos_ - pos;
+  if (pos > body_start_) {
+    memmove(data + body_start_, data + pos, remain);
+  }
+  rbuf_pos_ = body_start_ + remain;
+  return 0;
+}
+
 ReadStatus HTTPRequest::ReadData() {
   if (req_status_ == kNewRequest) {
-    Reset();
-    if (conn_->response_->Finished()) {
-      conn_->response_->Reset();
-    } else {
+    if (!conn_->response_->Finished()) {
+      // The response before is not handed off yet
       return kReadHalf;
     }
     req_status_ = kHeaderReceiving;
@@ -418,62 +461,120 @@ ReadStatus HTTPRequest::ReadData() {
     int header_len = 0;
     switch (req_status_) {
       case kHeaderReceiving:
-        if ((s = DoRead()) != kOk) {
-          conn_->handles_->HandleConnClosed();
-          return s;
-        }
-        header_len = ParseHeader();
-        if (header_len < 0 ||
-            rbuf_pos_ > kHTTPMaxHeader) {
+        // A pipelined request may be in the buffer already
+        header_len = rbuf_pos_ > 0 ? ParseHeader() : 0;
+        if (header_len < 0) {
           // Parse header error
-          conn_->handles_->HandleConnClosed();
-          return kReadError;
-        } else if (header_len > 0) {
+          return Closed(kReadError);
+        } else if (header_len == 0) {
+          // Haven't find header
+          if (rbuf_pos_ > kHTTPMaxHeader) {
+            return Closed(kReadError);
+          }
+          if ((s = DoRead()) != kOk) {
+            return Closed(s);
+          }
+        } else {
           // Parse header success
           req_status_ = kBodyReceiving;
+          body_start_ = header_len;
           bool need_reply = conn_->handles_->HandleRequest(this);
           if (need_reply) {
+            next_start_ = body_start_;
             req_status_ = kBodyReceived;
             break;
           }
 
-          // Move remain body part to begin
-          memmove(rbuf_, rbuf_ + header_len, rbuf_pos_ - header_len);
-          remain_recv_len_ -= rbuf_pos_ - header_len;
-          rbuf_pos_ -= header_len;
+          if (chunked_) {
+            int ret = DecodeChunked();
+            if (ret < 0) {
+              return Closed(kReadError);
+            } else if (ret > 0) {
+              req_status_ = kBodyReceived;
+            } else if (reply_100continue_) {
+              if (!conn_->response_->AppendContinue()) {
+                return Closed(kReadError);
+              }
+              reply_100continue_ = false;
+            }
+            break;
+          }
+
+          // The body read with the header follows it, and the pipelined
+          // requests follow the body
+          uint64_t buffered = rbuf_pos_ - body_start_;
+          if (buffered >= remain_recv_len_) {
+            next_start_ = body_start_ + remain_recv_len_;
+            remain_recv_len_ = 0;
+          } else {
+            next_start_ = rbuf_pos_;
+            remain_recv_len_ -= buffered;
+          }
 
           if (reply_100continue_ && remain_recv_len_ != 0) {
-            conn_->response_->SetStatusCode(100);
+            if (!conn_->response_->AppendContinue()) {
+              return Closed(kReadError);
+            }
             reply_100continue_ = false;
-            return kReadAll;
           }
 
           if (remain_recv_len_ == 0) {
-            conn_->handles_->HandleBodyData(rbuf_, rbuf_pos_);
+            conn_->handles_->HandleBodyData(rbuf_.data() + body_start_,
+                                            next_start_ - body_start_);
             req_status_ = kBodyReceived;
           }
-        } else {
-          // Haven't find header
         }
         break;
       case kBodyReceiving:
+        if (chunked_) {
+          if ((s = DoRead()) != kOk) {
+            return Closed(s);
+          }
+          int ret = DecodeChunked();
+          if (ret < 0) {
+            return Closed(kReadError);
+          } else if (ret > 0) {
+            req_status_ = kBodyReceived;
+          }
+          break;
+        }
+        if (rbuf_pos_ > body_start_ && rbuf_pos_ == rbuf_.capacity()) {
+          // Filled by the body read with the header
+          conn_->handles_->HandleBodyData(rbuf_.data() + body_start_,
+                                          rbuf_pos_ - body_start_);
+          rbuf_pos_ = body_start_;
+        }
         if ((s = DoRead()) != kOk) {
-          conn_->handles_->HandleConnClosed();
-          return s;
+          return Closed(s);
         }
-        if (rbuf_pos_ == kHTTPMaxMessage ||
+        if (rbuf_pos_ == rbuf_.capacity() ||
             remain_recv_len_ == 0) {
-          conn_->handles_->HandleBodyData(rbuf_, rbuf_pos_);
-          rbuf_pos_ = 0;
+          conn_->handles_->HandleBodyData(rbuf_.data() + body_start_,
+                                          rbuf_pos_ - body_start_);
+          rbuf_pos_ = body_start_;
         }
         if (remain_recv_len_ == 0) {
+          next_start_ = rbuf_pos_;
           req_status_ = kBodyReceived;
         }
         break;
-      case kBodyReceived:
+      case kBodyReceived: {
         req_status_ = kNewRequest;
+        conn_->response_->Reset();
+        conn_->response_->head_ = method_ == "HEAD";
         conn_->handles_->PrepareResponse(conn_->response_);
+        // Keep the pipelined requests, the views of this one are gone
+        uint64_t remain = rbuf_pos_ - next_start_;
+        if (remain > 0) {
+          memmove(rbuf_.data(), rbuf_.data() + next_start_, remain);
+        }
+        Reset();
+        rbuf_pos_ = remain;
+        if (rbuf_pos_ == 0) {
+          rbuf_.Release();
+        }
         return kReadAll;
+      }
       default:
         break;
     }
@@ -482,9 +583,33 @@ ReadStatus HTTPRequest::ReadData() {
   assert(true);
 }
 
+bool HTTPRequest::HasPipelined() const {
+  return req_status_ == kNewRequest && rbuf_pos_ > 0;
+}
+
+/*
+ * Deal the requests in the buffer, and read the socket when more is needed.
+ * The next request is dealt only when the response before is all in the
+ * output, and the output is small.
+ */
+ReadStatus HTTPConn::ProcessRequests() {
+  ReadStatus status;
+  do {
+    status = request_->ReadData();
+    if (status != kReadAll) {
+      break;
+    }
+    if (!response_->Fill()) {
+      return kReadError;
+    }
+  } while (response_->Finished() && request_->HasPipelined() &&
+           response_->Pending() < kHTTPMaxPending);
+  return status;
+}
+
 ReadStatus HTTPConn::GetRequest() {
-  ReadStatus status = request_->ReadData();
-  if (status == kReadAll) {
+  ReadStatus status = ProcessRequests();
+  if (response_->Pending() > 0 || !response_->Finished()) {
     set_is_reply(true);
   }
   return status;
@@ -493,26 +618,33 @@ ReadStatus HTTPConn::GetRequest() {
 HTTPResponse::HTTPResponse(HTTPConn* conn)
     : conn_(conn),
       resp_status_(kPrepareHeader),
+      chunked_(false),
+      head_(false),
+      file_offset_(0),
+      // A large header, and the output gathered behind it
+      wbuf_(kHTTPMaxHeader + 2 * kHTTPMaxPending),
       buf_len_(0),
       wbuf_pos_(0),
       remain_send_len_(0),
       finished_(true),
-      status_code_(200) {
-  wbuf_ = new char[kHTTPMaxMessage];
+      status_code_(200),
+      header_num_(0) {
 }
 
 HTTPResponse::~HTTPResponse() {
-  delete[] wbuf_;
 }
 
+// The output of the responses before is kept
 void HTTPResponse::Reset() {
-  headers_.clear();
+  header_num_ = 0;
   status_code_ = 200;
   finished_ = false;
   remain_send_len_ = 0;
-  wbuf_pos_ = 0;
-  buf_len_ = 0;
   resp_status_ = kPrepareHeader;
+  chunked_ = false;
+  head_ = false;
+  body_file_.reset();
+  file_offset_ = 0;
 }
 
 bool HTTPResponse::Finished() {
@@ -522,6 +654,7 @@ bool HTTPResponse::Finished() {
 void HTTPResponse::SetStatusCode(int code) {
   assert((code >= 100 && code <= 102) ||
          (code >= 200 && code <= 207) ||
+         (code == 304) ||
          (code >= 400 && code <= 409) ||
          (code == 416) ||
          (code >= 500 && code <= 509));
@@ -529,101 +662,239 @@ void HTTPResponse::SetStatusCode(int code) {
 }
 
 void HTTPResponse::SetHeaders(
-    const std::string& key, const std::string& value) {
-  headers_[key] = value;
+    const slash::Slice& key, const slash::Slice& value) {
+  size_t i = 0;
+  while (i < header_num_ && !EqualIgnoreCase(headers_[i].first, key)) {
+    i++;
+  }
+  if (i == header_num_) {
+    if (header_num_ == headers_.size()) {
+      headers_.resize(header_num_ + 1);
+    }
+    headers_[i].first.assign(key.data(), key.size());
+    header_num_++;
+  }
+  headers_[i].second.assign(value.data(), value.size());
 }
 
-void HTTPResponse::SetHeaders(const std::string& key, const size_t value) {
-  headers_[key] = std::to_string(value);
+void HTTPResponse::SetHeaders(const slash::Slice& key, const size_t value) {
+  char buf[32];
+  int len = snprintf(buf, sizeof(buf), "%zu", value);
+  SetHeaders(key, slash::Slice(buf, len));
 }
 
 void HTTPResponse::SetContentLength(uint64_t size) {
   remain_send_len_ = size;
-  if (headers_.count("Content-Length") ||
-      headers_.count("content-length")) {
+  if (HasHeader("Content-Length")) {
     return;
   }
   SetHeaders("Content-Length", size);
 }
 
-bool HTTPResponse::Flush() {
+void HTTPResponse::SetBodyFile(const std::shared_ptr<HTTPFile>& file,
+                               uint64_t offset, uint64_t size) {
+  body_file_ = file;
+  file_offset_ = offset;
+  SetContentLength(size);
+}
+
+// sendfile() can't go through SSL, the file is read into the buffer then
+bool HTTPResponse::CanSendFile() const {
+#ifdef __ENABLE_SSL
+  return !conn_->security_;
+#else
+  return true;
+#endif
+}
+
+bool HTTPResponse::HasHeader(const slash::Slice& key) const {
+  for (size_t i = 0; i < header_num_; i++) {
+    if (EqualIgnoreCase(headers_[i].first, key)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool HTTPResponse::AppendContinue() {
+  static const char kContinue[] = "HTTP/1.1 100 Continue\r\n\r\n";
+  size_t size = sizeof(kContinue) - 1;
+  if (!wbuf_.Reserve(buf_len_ + size)) {
+    return false;
+  }
+  memcpy(wbuf_.data() + buf_len_, kContinue, size);
+  buf_len_ += size;
+  return true;
+}
+
+/*
+ * Put the header and the body of the response behind the output not sent,
+ * until the response is finished or the output is kHTTPMaxPending
+ */
+bool HTTPResponse::Fill() {
+  // Move the output not sent to the front
+  if (wbuf_pos_ > 0) {
+    memmove(wbuf_.data(), wbuf_.data() + wbuf_pos_, buf_len_ - wbuf_pos_);
+    buf_len_ -= wbuf_pos_;
+    wbuf_pos_ = 0;
+  }
   if (resp_status_ == kPrepareHeader) {
-    if (!SerializeHeader() ||
-        buf_len_ > kHTTPMaxHeader) {
+    // A body without Content-Length is chunked, the 1xx, 204 and 304
+    // responses and the response to HEAD have no body
+    if (status_code_ >= 200 && status_code_ != 204 && status_code_ != 304 &&
+        !head_ &&
+        !HasHeader("Content-Length") && !HasHeader("Transfer-Encoding")) {
+      chunked_ = true;
+      SetHeaders("Transfer-Encoding", "chunked");
+    }
+    if (!SerializeHeader()) {
       return false;
     }
-    resp_status_ = kSendingHeader;
-  }
-  if (resp_status_ == kSendingHeader) {
-    ssize_t nwritten;
-#ifdef __ENABLE_SSL
-    if (conn_->security_) {
-      nwritten = SSL_write(conn_->ssl(), wbuf_ + wbuf_pos_,
-                           static_cast<int>(buf_len_));
-      if (nwritten <= 0) {
-        // FIXME (gaodq)
-        int sslerr = SSL_get_error(conn_->ssl(), static_cast<int>(nwritten));
-        switch (sslerr) {
-          case SSL_ERROR_WANT_READ:
-          case SSL_ERROR_WANT_WRITE:
-            return true;
-          case SSL_ERROR_SYSCALL:
-            break;
-          case SSL_ERROR_SSL:
-          default:
-            return false;
-        }
-      }
+    if (head_) {
+      // Content-Length tells the size of the body of GET
+      remain_send_len_ = 0;
+      body_file_.reset();
     }
-    else
-#endif
-    {
-      nwritten = write(conn_->fd(), wbuf_ + wbuf_pos_, buf_len_);
+    resp_status_ = kSendingBody;
+  }
+  while ((remain_send_len_ > 0 || chunked_) &&
+         buf_len_ < kHTTPMaxPending) {
+    if (body_file_ && CanSendFile()) {
+      // Sent by Flush() after the output
+      break;
     }
-    if (nwritten == -1 && errno == EAGAIN) {
-      return true;
-    } else if (nwritten <= 0) {
-      // Connection close
+    // The body goes through the buffer in chunks
+    size_t overhead = chunked_ ? kChunkHeadSize + kChunkTailSize : 0;
+    if (wbuf_.capacity() - buf_len_ <= overhead &&
+        !wbuf_.Reserve(buf_len_ + PooledBuffer::kChunkSize)) {
       return false;
-    } else if (nwritten == static_cast<ssize_t>(buf_len_)) {
-      // Complete sending header
-      wbuf_pos_ = 0;
-      buf_len_ = 0;
-      if (status_code_ == 100) {
-        // Sending 100-continue, no body
-        resp_status_ = kPrepareHeader;
-        finished_ = true;
-        return true;
+    }
+    if (chunked_) {
+      if (!FillChunk()) {
+        return false;
       }
-      resp_status_ = kSendingBody;
-    } else {
-      wbuf_pos_ += nwritten;
-      buf_len_ -= nwritten;
+      continue;
     }
-  }
-  if (resp_status_ == kSendingBody) {
-    if (remain_send_len_ == 0) {
-      // Complete response
-      finished_ = true;
-      resp_status_ = kPrepareHeader;
-      return true;
+    size_t needed_size = std::min<uint64_t>(wbuf_.capacity() - buf_len_,
+                                            remain_send_len_);
+    ssize_t ret;
+    if (body_file_) {
+      ret = pread(body_file_->fd(), wbuf_.data() + buf_len_, needed_size,
+                  file_offset_);
+      file_offset_ += ret > 0 ? ret : 0;
+    } else {
+      ret = conn_->handles_->WriteResponseBody(wbuf_.data() + buf_len_,
+                                               needed_size);
     }
-    if (buf_len_ == 0) {
-      size_t remain_buf = static_cast<uint64_t>(kHTTPMaxMessage) - wbuf_pos_;
-      size_t needed_size = std::min(remain_buf, remain_send_len_);
-      buf_len_ = conn_->handles_->WriteResponseBody(
-          wbuf_ + wbuf_pos_, needed_size);
+    if (ret <= 0 || static_cast<size_t>(ret) > needed_size) {
+      return false;
     }
+    buf_len_ += ret;
+    remain_send_len_ -= ret;
+  }
+  if (remain_send_len_ == 0 && !chunked_) {
+    // Handed off, the next response may follow
+    finished_ = true;
+    resp_status_ = kPrepareHeader;
+    body_file_.reset();
+  }
+  return true;
+}
+
+/*
+ * Send the body file from file_offset_ by sendfile(), return false on
+ * error. It's finished when all is sent.
+ */
+bool HTTPResponse::SendFile() {
+  off_t offset = file_offset_;
+  ssize_t nwritten = sendfile(conn_->fd(), body_file_->fd(), &offset,
+                              std::min<uint64_t>(remain_send_len_, 1 << 30));
+  if (nwritten == -1 && errno == EAGAIN) {
+    return true;
+  } else if (nwritten <= 0) {
+    // Connection close, or the file is truncated
+    return false;
+  }
+  file_offset_ += nwritten;
+  remain_send_len_ -= nwritten;
+  if (remain_send_len_ == 0) {
+    finished_ = true;
+    resp_status_ = kPrepareHeader;
+    body_file_.reset();
+  }
+  return true;
+}
 
-    if (buf_len_ == -1) {
+/*
+ * Put a chunk of the body, the size is written in fixed width before the
+ * data, so that the data is not moved
+ */
+bool HTTPResponse::FillChunk() {
+  char* head = wbuf_.data() + buf_len_;
+  size_t needed_size = wbuf_.capacity() - buf_len_ -
+    kChunkHeadSize - kChunkTailSize;
+  int ret = conn_->handles_->WriteResponseBody(head + kChunkHeadSize,
+                                               needed_size);
+  if (ret == 0 || ret == -2) {
+    // The last chunk and an empty trailer
+    static const char kLastChunk[] = "0\r\n\r\n";
+    size_t size = sizeof(kLastChunk) - 1;
+    if (!wbuf_.Reserve(buf_len_ + size)) {
       return false;
     }
+    memcpy(wbuf_.data() + buf_len_, kLastChunk, size);
+    buf_len_ += size;
+    chunked_ = false;
+    return true;
+  }
+  if (ret < 0 || static_cast<size_t>(ret) > needed_size) {
+    return false;
+  }
+  static const char kHex[] = "0123456789abcdef";
+  for (int i = 7; i >= 0; i--) {
+    head[7 - i] = kHex[(static_cast<uint32_t>(ret) >> (i * 4)) & 0xf];
+  }
+  head[8] = '\r';
+  head[9] = '\n';
+  memcpy(head + kChunkHeadSize + ret, "\r\n", kChunkTailSize);
+  buf_len_ += kChunkHeadSize + ret + kChunkTailSize;
+  return true;
+}
+
+/*
+ * Send the output until EAGAIN, filling the rest of the response when all
+ * is sent. Several small responses go out by one write.
+ */
+bool HTTPResponse::Flush() {
+  while (true) {
+    if (wbuf_pos_ == buf_len_) {
+      if (body_file_ && resp_status_ == kSendingBody && CanSendFile()) {
+        uint64_t remain = remain_send_len_;
+        if (!SendFile()) {
+          return false;
+        }
+        if (remain_send_len_ == remain) {
+          // EAGAIN
+          return true;
+        }
+        continue;
+      }
+      if (finished_) {
+        wbuf_pos_ = 0;
+        buf_len_ = 0;
+        wbuf_.Release();
+        return true;
+      }
+      if (!Fill()) {
+        return false;
+      }
+    }
 
     ssize_t nwritten;
 #ifdef __ENABLE_SSL
     if (conn_->security_) {
-      nwritten = SSL_write(conn_->ssl(), wbuf_ + wbuf_pos_,
-                           static_cast<int>(buf_len_));
+      nwritten = SSL_write(conn_->ssl(), wbuf_.data() + wbuf_pos_,
+                           static_cast<int>(buf_len_ - wbuf_pos_));
       if (nwritten <= 0) {
         // FIXME (gaodq)
         int sslerr = SSL_get_error(conn_->ssl(), static_cast<int>(nwritten));
@@ -642,35 +913,46 @@ bool HTTPResponse::Flush() {
     else
 #endif
     {
-      nwritten = write(conn_->fd(), wbuf_ + wbuf_pos_, buf_len_);
+      nwritten = write(conn_->fd(), wbuf_.data() + wbuf_pos_,
+                       buf_len_ - wbuf_pos_);
     }
     if (nwritten == -1 && errno == EAGAIN) {
       return true;
     } else if (nwritten <= 0) {
       // Connection close
       return false;
-    } else {
-      wbuf_pos_ += nwritten;
-      if (wbuf_pos_ == kHTTPMaxMessage) {
-        wbuf_pos_ = 0;
-      }
-      buf_len_ -= nwritten;
-      remain_send_len_ -= nwritten;
     }
+    wbuf_pos_ += nwritten;
   }
+}
 
-  // Continue
-  return true;
+HTTPFile::~HTTPFile() {
+  close(fd_);
 }
 
 WriteStatus HTTPConn::SendReply() {
-  if (!response_->Flush()) {
-    return kWriteError;
-  }
-  if (response_->Finished()) {
-    return kWriteAll;
+  while (true) {
+    if (!response_->Flush()) {
+      return kWriteError;
+    }
+    // A file blocked by EAGAIN has nothing in the output, but is not
+    // finished, wait for EPOLLOUT to go on
+    if (response_->Pending() > 0 || !response_->Finished()) {
+      return kWriteHalf;
+    }
+    if (!request_->HasPipelined()) {
+      // The worker may call again after all is sent
+      return kWriteAll;
+    }
+    // All sent, go on with the pipelined requests
+    ReadStatus status = ProcessRequests();
+    if (status != kReadAll && status != kReadHalf) {
+      return kWriteError;
+    }
+    if (response_->Pending() == 0 && response_->Finished()) {
+      return kWriteAll;
+    }
   }
-  return kWriteHalf;
 }
 
 }  // namespace pink
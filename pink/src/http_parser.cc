@@ -0,0 +1,265 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include "pink/src/http_parser.h"
+
+#include <strings.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace pink {
+
+// tchar of RFC 7230, the chars of a method or a header name
+static struct TokenChars {
+  bool chars[256];
+
+  TokenChars() {
+    memset(chars, 0, sizeof(chars));
+    for (int c = '0'; c <= '9'; c++) {
+      chars[c] = true;
+    }
+    for (int c = 'a'; c <= 'z'; c++) {
+      chars[c] = true;
+      chars[c - 'a' + 'A'] = true;
+    }
+    for (const char* c = "!#$%&'*+-.^_`|~"; *c != '\0'; c++) {
+      chars[static_cast<unsigned char>(*c)] = true;
+    }
+  }
+} kTokenChars;
+
+static bool IsTokenChar(char c) {
+  return kTokenChars.chars[static_cast<unsigned char>(c)];
+}
+
+static bool IsSpace(char c) {
+  return c == ' ' || c == '\t';
+}
+
+HTTPParser::HTTPParser() {
+  Reset();
+}
+
+// Keep the capacity of fields_ for the next message
+void HTTPParser::Reset() {
+  state_ = kRequestLine;
+  line_start_ = 0;
+  scan_ = 0;
+  header_len_ = 0;
+  content_length_ = -1;
+  method_ = url_ = version_ = Span{0, 0};
+  fields_.clear();
+}
+
+const char* HTTPParser::FindControl(const char* data, const char* end) {
+#if defined(__SSE2__)
+  // A byte is a CTL if min(byte, 0x1f) is itself
+  const __m128i ctl_max = _mm_set1_epi8(0x1f);
+  const __m128i del = _mm_set1_epi8(0x7f);
+  auto controls = [&](const char* p) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    return _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(bytes, ctl_max), bytes),
+                        _mm_cmpeq_epi8(bytes, del));
+  };
+  // 64 bytes a branch
+  while (end - data >= 64) {
+    uint64_t mask =
+      static_cast<uint64_t>(_mm_movemask_epi8(controls(data))) |
+      static_cast<uint64_t>(_mm_movemask_epi8(controls(data + 16))) << 16 |
+      static_cast<uint64_t>(_mm_movemask_epi8(controls(data + 32))) << 32 |
+      static_cast<uint64_t>(_mm_movemask_epi8(controls(data + 48))) << 48;
+    if (mask != 0) {
+      return data + __builtin_ctzll(mask);
+    }
+    data += 64;
+  }
+  while (end - data >= 16) {
+    int mask = _mm_movemask_epi8(controls(data));
+    if (mask != 0) {
+      return data + __builtin_ctz(mask);
+    }
+    data += 16;
+  }
+#endif
+  while (data < end) {
+    unsigned char c = static_cast<unsigned char>(*data);
+    if (c < 0x20 || c == 0x7f) {
+      return data;
+    }
+    data++;
+  }
+  return end;
+}
+
+int HTTPParser::Parse(const char* data, size_t size) {
+  if (state_ == kDone) {
+    return header_len_;
+  }
+  if (size > UINT32_MAX) {
+    return -1;
+  }
+
+  while (scan_ < size) {
+    const char* c = FindControl(data + scan_, data + size);
+    if (c == data + size) {
+      scan_ = size;
+      break;
+    }
+    size_t pos = c - data;
+    size_t line_end = pos;
+    if (*c == '\t') {
+      // Checked by the line parsers
+      scan_ = pos + 1;
+      continue;
+    } else if (*c == '\n') {
+      scan_ = pos + 1;
+    } else if (*c == '\r') {
+      if (pos + 1 == size) {
+        // Look at it again with the LF
+        scan_ = pos;
+        break;
+      } else if (c[1] != '\n') {
+        return -1;
+      }
+      scan_ = pos + 2;
+    } else {
+      return -1;
+    }
+
+    size_t line_start = line_start_;
+    line_start_ = scan_;
+    if (line_end == line_start) {
+      if (state_ == kRequestLine) {
+        continue;
+      }
+      // The empty line ends the header
+      state_ = kDone;
+      header_len_ = static_cast<uint32_t>(scan_);
+      return header_len_;
+    }
+    if (state_ == kRequestLine) {
+      if (!ParseRequestLine(data, line_start, line_end)) {
+        return -1;
+      }
+      state_ = kHeaderLine;
+    } else if (!ParseHeaderLine(data, line_start, line_end)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// METHOD SP URL SP HTTP/1.x
+bool HTTPParser::ParseRequestLine(const char* data, size_t start,
+                                  size_t end) {
+  size_t pos = start;
+  while (pos < end && IsTokenChar(data[pos])) {
+    pos++;
+  }
+  if (pos == start || pos == end || data[pos] != ' ') {
+    return false;
+  }
+  method_ = Span{static_cast<uint32_t>(start),
+                 static_cast<uint32_t>(pos - start)};
+
+  size_t url_start = pos + 1;
+  const char* sp = static_cast<const char*>(
+      memchr(data + url_start, ' ', end - url_start));
+  if (sp == NULL || sp == data + url_start ||
+      memchr(data + url_start, '\t', sp - data - url_start) != NULL) {
+    return false;
+  }
+  pos = sp - data;
+  url_ = Span{static_cast<uint32_t>(url_start),
+              static_cast<uint32_t>(pos - url_start)};
+
+  const char* version = data + pos + 1;
+  if (end - pos - 1 != 8 || memcmp(version, "HTTP/1.", 7) != 0 ||
+      version[7] < '0' || version[7] > '9') {
+    return false;
+  }
+  version_ = Span{static_cast<uint32_t>(pos + 1), 8};
+  return true;
+}
+
+// KEY ":" OWS VALUE OWS
+bool HTTPParser::ParseHeaderLine(const char* data, size_t start,
+                                 size_t end) {
+  size_t pos = start;
+  while (pos < end && IsTokenChar(data[pos])) {
+    pos++;
+  }
+  // A folded line starts with a space, which is not a token char either
+  if (pos == start || pos == end || data[pos] != ':') {
+    return false;
+  }
+  Field field;
+  field.key = Span{static_cast<uint32_t>(start),
+                   static_cast<uint32_t>(pos - start)};
+
+  pos++;
+  while (pos < end && IsSpace(data[pos])) {
+    pos++;
+  }
+  while (end > pos && IsSpace(data[end - 1])) {
+    end--;
+  }
+  field.value = Span{static_cast<uint32_t>(pos),
+                     static_cast<uint32_t>(end - pos)};
+
+  // The same Content-Length again is allowed, RFC 7230 3.3.2
+  if (field.key.size == 14 &&
+      strncasecmp(data + start, "content-length", 14) == 0) {
+    if (content_length_ < 0) {
+      content_length_ = static_cast<int>(fields_.size());
+    } else if (Get(data, fields_[content_length_].value) !=
+               Get(data, field.value)) {
+      return false;
+    }
+  }
+  fields_.push_back(field);
+  return true;
+}
+
+void HTTPParser::SplitUrl(const slash::Slice& url, slash::Slice* path,
+                          slash::Slice* query) {
+  const char* data = url.data();
+  const char* end = data + url.size();
+  if (url.starts_with("http://") || url.starts_with("https://")) {
+    const char* authority = static_cast<const char*>(
+        memchr(data, ':', end - data)) + 3;
+    const char* slash = static_cast<const char*>(
+        memchr(authority, '/', end - authority));
+    data = slash != NULL ? slash : end;
+  }
+  const char* mark = static_cast<const char*>(memchr(data, '?', end - data));
+  if (mark == NULL) {
+    *path = slash::Slice(data, end - data);
+    *query = slash::Slice();
+  } else {
+    *path = slash::Slice(data, mark - data);
+    *query = slash::Slice(mark + 1, end - mark - 1);
+  }
+}
+
+bool HTTPParser::ParseContentLength(const slash::Slice& value,
+                                    uint64_t* length) {
+  if (value.empty() || value.size() > 19) {
+    return false;
+  }
+  uint64_t result = 0;
+  for (size_t i = 0; i < value.size(); i++) {
+    if (value[i] < '0' || value[i] > '9') {
+      return false;
+    }
+    result = result * 10 + (value[i] - '0');
+  }
+  *length = result;
+  return true;
+}
+
+}  // namespace pink
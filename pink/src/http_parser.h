@@ -0,0 +1,136 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef PINK_SRC_HTTP_PARSER_H_
+#define PINK_SRC_HTTP_PARSER_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include "slash/include/slash_slice.h"
+
+namespace pink {
+
+/*
+ * HTTPParser parses the header of an HTTP/1.x request as it comes. The
+ * buffer is given again after each read, with more bytes behind, and the
+ * parse goes on from where it stopped, so that a byte is looked at once.
+ * The buffer may move between the calls, the parts are kept as offsets
+ * from the start of the message, see Get().
+ *
+ * The control chars and the line ends are found 64 bytes a branch with
+ * SSE2, a byte at a time without it. A request line or a header line that
+ * doesn't follow RFC 7230 fails the parse, as a bare CR, a CTL in a line,
+ * a header name not a token, a space before the colon or a folded line.
+ * So do Content-Length fields of different values, which would let the
+ * peers split the messages differently.
+ * A bare LF ends a line as CRLF does, the empty lines before the request
+ * line are skipped.
+ */
+class HTTPParser {
+ public:
+  struct Span {
+    uint32_t offset;
+    uint32_t size;
+  };
+  struct Field {
+    Span key;
+    Span value;
+  };
+
+  HTTPParser();
+
+  /*
+   * data is the message from its start and size the bytes read. Return the
+   * header length, with the empty line, when it's all parsed, 0 if more is
+   * needed, -1 if malformed. Reset() before the next message.
+   */
+  int Parse(const char* data, size_t size);
+  void Reset();
+
+  static slash::Slice Get(const char* data, const Span& span) {
+    return slash::Slice(data + span.offset, span.size);
+  }
+
+  const Span& method() const {
+    return method_;
+  }
+  const Span& url() const {
+    return url_;
+  }
+  const Span& version() const {
+    return version_;
+  }
+  const std::vector<Field>& fields() const {
+    return fields_;
+  }
+
+  /*
+   * Split a request target into the path and the query, the authority of
+   * the absolute form, http://www.xxx.xxx/path/to, is skipped
+   */
+  static void SplitUrl(const slash::Slice& url, slash::Slice* path,
+                       slash::Slice* query);
+
+  /*
+   * Parse the query of a url or a form urlencoded body,
+   * key1=value1&key2=value2, add(key, value) is called in order
+   */
+  template <typename Add>
+  static void ParseParameters(const char* data, const char* end, Add add);
+
+  // Digits only
+  static bool ParseContentLength(const slash::Slice& value, uint64_t* length);
+
+  // The first byte in [data, end) that is a CTL or DEL, end if none
+  static const char* FindControl(const char* data, const char* end);
+
+ private:
+  enum State {
+    kRequestLine,
+    kHeaderLine,
+    kDone
+  };
+
+  bool ParseRequestLine(const char* data, size_t start, size_t end);
+  bool ParseHeaderLine(const char* data, size_t start, size_t end);
+
+  State state_;
+  size_t line_start_;   // the line being read
+  size_t scan_;         // checked up to it in the line
+  uint32_t header_len_;
+  int content_length_;  // the field index of the first Content-Length
+
+  Span method_;
+  Span url_;
+  Span version_;
+  std::vector<Field> fields_;
+};
+
+template <typename Add>
+void HTTPParser::ParseParameters(const char* data, const char* end, Add add) {
+  while (data < end) {
+    const char* amp = static_cast<const char*>(memchr(data, '&', end - data));
+    if (amp == NULL) {
+      amp = end;
+    }
+    if (amp > data) {
+      const char* eq = static_cast<const char*>(memchr(data, '=', amp - data));
+      if (eq == NULL) {
+        // empty value
+        add(slash::Slice(data, amp - data), slash::Slice());
+      } else {
+        add(slash::Slice(data, eq - data),
+            slash::Slice(eq + 1, amp - eq - 1));
+      }
+    }
+    data = amp + 1;
+  }
+}
+
+}  // namespace pink
+#endif  // PINK_SRC_HTTP_PARSER_H_
@@ -0,0 +1,379 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include "pink/include/http_router.h"
+
+#include <string.h>
+
+#include <utility>
+
+#include "pink/include/pink_histogram.h"
+#include "pink/src/pink_util.h"
+
+namespace pink {
+
+struct HTTPRouter::Route {
+  std::string method;
+  std::string pattern;
+  HTTPHandlesFactory factory;
+  LatencyHistogram latency;
+  std::atomic<uint64_t> errors;
+
+  Route(const std::string& _method, const std::string& _pattern,
+        const HTTPHandlesFactory& _factory)
+      : method(_method), pattern(_pattern), factory(_factory), errors(0) {}
+};
+
+/*
+ * A static node matches its text, a param node a segment, and a wildcard
+ * node the rest of the path
+ */
+struct HTTPRouter::Node {
+  std::string text;               // the static text, or the param name
+  std::vector<Node*> children;    // static, of different first chars
+  Node* param;
+  Node* wildcard;
+  std::vector<std::pair<std::string, int>> routes;    // method, route id
+
+  Node() : param(NULL), wildcard(NULL) {}
+};
+
+HTTPRouter::HTTPRouter()
+    : root_(new Node()),
+      unmatched_(0) {
+}
+
+HTTPRouter::~HTTPRouter() {
+  DeleteNode(root_);
+  for (auto route : routes_) {
+    delete route;
+  }
+}
+
+void HTTPRouter::DeleteNode(Node* node) {
+  if (node == NULL) {
+    return;
+  }
+  for (auto child : node->children) {
+    DeleteNode(child);
+  }
+  DeleteNode(node->param);
+  DeleteNode(node->wildcard);
+  delete node;
+}
+
+/*
+ * Return the node matching text after node, the node sharing a prefix with
+ * text is split
+ */
+HTTPRouter::Node* HTTPRouter::InsertStatic(Node* node, const char* text,
+                                           size_t size) {
+  while (size > 0) {
+    Node* next = NULL;
+    for (auto& child : node->children) {
+      if (child->text[0] != text[0]) {
+        continue;
+      }
+      size_t common = 1;
+      while (common < size && common < child->text.size() &&
+             child->text[common] == text[common]) {
+        common++;
+      }
+      if (common < child->text.size()) {
+        Node* prefix = new Node();
+        prefix->text.assign(child->text, 0, common);
+        child->text.erase(0, common);
+        prefix->children.push_back(child);
+        child = prefix;
+      }
+      next = child;
+      text += common;
+      size -= common;
+      break;
+    }
+    if (next == NULL) {
+      next = new Node();
+      next->text.assign(text, size);
+      node->children.push_back(next);
+      return next;
+    }
+    node = next;
+  }
+  return node;
+}
+
+bool HTTPRouter::AddRoute(const std::string& method,
+                          const std::string& pattern,
+                          const HTTPHandlesFactory& factory) {
+  if (method.empty() || pattern.empty() || pattern[0] != '/') {
+    return false;
+  }
+  Node* node = root_;
+  const char* data = pattern.data();
+  const char* end = data + pattern.size();
+  while (data < end) {
+    // The static text until a param or wildcard at the start of a segment
+    const char* special = data;
+    while (special < end &&
+           !((*special == ':' || *special == '*') && special[-1] == '/')) {
+      special++;
+    }
+    node = InsertStatic(node, data, special - data);
+    if (special == end) {
+      break;
+    }
+
+    const char* name_end = static_cast<const char*>(
+        memchr(special, '/', end - special));
+    if (name_end == NULL) {
+      name_end = end;
+    }
+    std::string name(special + 1, name_end - special - 1);
+    if (name.empty()) {
+      return false;
+    }
+    Node** child = *special == ':' ? &node->param : &node->wildcard;
+    if (*special == '*' && name_end != end) {
+      // A wildcard is the last
+      return false;
+    }
+    if (*child == NULL) {
+      *child = new Node();
+      (*child)->text = name;
+    } else if ((*child)->text != name) {
+      return false;
+    }
+    node = *child;
+    data = name_end;
+  }
+
+  for (auto& item : node->routes) {
+    if (item.first == method) {
+      return false;
+    }
+  }
+  int id = static_cast<int>(routes_.size());
+  routes_.push_back(new Route(method, pattern, factory));
+  node->routes.push_back(std::make_pair(method, id));
+  return true;
+}
+
+int HTTPRouter::FindRoute(const Node* node, const slash::Slice& method) {
+  int any = -1;
+  for (auto& item : node->routes) {
+    if (method == item.first) {
+      return item.second;
+    } else if (item.first == "*") {
+      any = item.second;
+    }
+  }
+  return any;
+}
+
+/*
+ * Match the path after the text of node, try the static children first,
+ * then the param, then the wildcard, the params of a failed try are
+ * removed
+ */
+int HTTPRouter::MatchNode(const Node* node, const slash::Slice& method,
+                          const char* path, const char* end,
+                          HTTPFields* params, bool* method_allowed) const {
+  if (path == end) {
+    int id = FindRoute(node, method);
+    if (id < 0 && !node->routes.empty() && method_allowed != NULL) {
+      *method_allowed = false;
+    }
+    if (id >= 0 || node->wildcard == NULL) {
+      return id;
+    }
+  }
+
+  for (auto child : node->children) {
+    size_t size = child->text.size();
+    if (static_cast<size_t>(end - path) >= size &&
+        memcmp(path, child->text.data(), size) == 0) {
+      int id = MatchNode(child, method, path + size, end, params,
+                         method_allowed);
+      if (id >= 0) {
+        return id;
+      }
+      // The first chars of the children differ, no other child matches
+      break;
+    }
+  }
+
+  size_t num = params->size();
+  if (node->param != NULL && path < end && *path != '/') {
+    const char* segment_end = static_cast<const char*>(
+        memchr(path, '/', end - path));
+    if (segment_end == NULL) {
+      segment_end = end;
+    }
+    params->Add(node->param->text, slash::Slice(path, segment_end - path));
+    int id = MatchNode(node->param, method, segment_end, end, params,
+                       method_allowed);
+    if (id >= 0) {
+      return id;
+    }
+    params->Truncate(num);
+  }
+
+  if (node->wildcard != NULL) {
+    int id = FindRoute(node->wildcard, method);
+    if (id >= 0) {
+      params->Add(node->wildcard->text, slash::Slice(path, end - path));
+      return id;
+    }
+    if (!node->wildcard->routes.empty() && method_allowed != NULL) {
+      *method_allowed = false;
+    }
+  }
+  return -1;
+}
+
+int HTTPRouter::Match(const slash::Slice& method, const slash::Slice& path,
+                      HTTPFields* params, bool* method_allowed) const {
+  bool allowed = true;
+  int id = MatchNode(root_, method, path.data(), path.data() + path.size(),
+                     params, &allowed);
+  if (method_allowed != NULL) {
+    *method_allowed = id >= 0 || allowed;
+  }
+  return id;
+}
+
+void HTTPRouter::AllowedMethods(const slash::Slice& path,
+                                std::string* allow) const {
+  allow->clear();
+  HTTPFields params(false);
+  for (auto route : routes_) {
+    if (route->method == "*" ||
+        allow->find(route->method) != std::string::npos) {
+      continue;
+    }
+    params.Clear();
+    if (MatchNode(root_, route->method, path.data(),
+                  path.data() + path.size(), &params, NULL) >= 0) {
+      if (!allow->empty()) {
+        allow->append(", ");
+      }
+      allow->append(route->method);
+    }
+  }
+}
+
+void HTTPRouter::RouteStats(std::vector<HTTPRouteStats>* stats) const {
+  stats->clear();
+  for (auto route : routes_) {
+    HTTPRouteStats stat;
+    stat.method = route->method;
+    stat.pattern = route->pattern;
+    stat.count = route->latency.count();
+    stat.errors = route->errors;
+    stat.total_us = route->latency.sum();
+    stat.max_us = route->latency.max();
+    stat.p99_us = route->latency.Percentile(99);
+    stats->push_back(stat);
+  }
+}
+
+void HTTPRouter::ClearStats() {
+  for (auto route : routes_) {
+    route->latency.Clear();
+    route->errors = 0;
+  }
+  unmatched_ = 0;
+}
+
+/*
+ * The handles of a connection, it passes the calls to the handles of the
+ * route matched
+ */
+class HTTPRouterHandles : public HTTPHandles {
+ public:
+  explicit HTTPRouterHandles(const HTTPRouter* router)
+      : router_(router),
+        handles_(router->routes_.size()),
+        route_(-1),
+        status_code_(404),
+        start_us_(0) {}
+
+  virtual bool HandleRequest(const HTTPRequest* req) override {
+    start_us_ = NowMicros();
+    bool method_allowed;
+    route_ = router_->Match(req->method(), req->path(), &req->path_params_,
+                            &method_allowed);
+    if (route_ < 0) {
+      router_->unmatched_++;
+      status_code_ = method_allowed ? 404 : 405;
+      if (!method_allowed) {
+        router_->AllowedMethods(req->path(), &allow_);
+      }
+      return false;
+    }
+    std::shared_ptr<HTTPHandles>& handles = handles_[route_];
+    if (!handles) {
+      handles = router_->routes_[route_]->factory();
+      handles->worker_specific_data_ = worker_specific_data_;
+    }
+    return handles->HandleRequest(req);
+  }
+
+  virtual void HandleBodyData(const char* data, size_t data_size) override {
+    if (route_ >= 0) {
+      handles_[route_]->HandleBodyData(data, data_size);
+    }
+  }
+
+  virtual void PrepareResponse(HTTPResponse* resp) override {
+    if (route_ < 0) {
+      resp->SetStatusCode(status_code_);
+      if (status_code_ == 405) {
+        resp->SetHeaders("Allow", allow_);
+      }
+      resp->SetContentLength(0);
+      return;
+    }
+    handles_[route_]->PrepareResponse(resp);
+    HTTPRouter::Route* route = router_->routes_[route_];
+    route->latency.Add(NowMicros() - start_us_);
+    if (resp->status_code() >= 500) {
+      route->errors++;
+    }
+  }
+
+  virtual int WriteResponseBody(char* buf, size_t max_size) override {
+    if (route_ < 0) {
+      return -2;
+    }
+    return handles_[route_]->WriteResponseBody(buf, max_size);
+  }
+
+  virtual void HandleConnClosed() override {
+    for (auto& handles : handles_) {
+      if (handles) {
+        handles->HandleConnClosed();
+      }
+    }
+  }
+
+ private:
+  const HTTPRouter* router_;
+  std::vector<std::shared_ptr<HTTPHandles>> handles_;   // by route id
+  int route_;
+  int status_code_;
+  std::string allow_;
+  uint64_t start_us_;
+};
+
+PinkConn* HTTPRouter::NewPinkConn(int connfd, const std::string &ip_port,
+                                  ServerThread *server_thread,
+                                  void* worker_private_data) const {
+  return new HTTPConn(connfd, ip_port, server_thread,
+                      std::make_shared<HTTPRouterHandles>(this),
+                      worker_private_data);
+}
+
+}  // namespace pink
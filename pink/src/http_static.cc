@@ -0,0 +1,427 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include "pink/include/http_static.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pink/src/pink_util.h"
+
+namespace pink {
+
+static const struct {
+  const char* ext;
+  const char* type;
+} kContentTypes[] = {
+  {"html", "text/html"},
+  {"htm", "text/html"},
+  {"css", "text/css"},
+  {"js", "application/javascript"},
+  {"json", "application/json"},
+  {"txt", "text/plain"},
+  {"xml", "application/xml"},
+  {"png", "image/png"},
+  {"jpg", "image/jpeg"},
+  {"jpeg", "image/jpeg"},
+  {"gif", "image/gif"},
+  {"svg", "image/svg+xml"},
+  {"ico", "image/x-icon"},
+  {"pdf", "application/pdf"},
+  {"wasm", "application/wasm"},
+  {"mp4", "video/mp4"},
+};
+
+static const char* ContentType(const std::string& path) {
+  size_t dot = path.rfind('.');
+  if (dot != std::string::npos && path.find('/', dot) == std::string::npos) {
+    const char* ext = path.c_str() + dot + 1;
+    for (auto& item : kContentTypes) {
+      if (strcasecmp(ext, item.ext) == 0) {
+        return item.type;
+      }
+    }
+  }
+  return "application/octet-stream";
+}
+
+HTTPFileCache::HTTPFileCache(size_t capacity, uint64_t check_interval_ms)
+    : capacity_(capacity > 0 ? capacity : 1),
+      check_interval_ms_(check_interval_ms) {
+}
+
+HTTPFileCache::~HTTPFileCache() {
+}
+
+slash::Status HTTPFileCache::Get(const std::string& path,
+                                 std::shared_ptr<const Entry>* entry) {
+  uint64_t now = NowMs();
+  std::shared_ptr<const Entry> cached;
+  {
+    slash::MutexLock l(&mu_);
+    auto iter = index_.find(path);
+    if (iter != index_.end()) {
+      NodeList::iterator node = iter->second;
+      lru_.splice(lru_.begin(), lru_, node);
+      if (now < node->checked_ms + check_interval_ms_) {
+        *entry = node->entry;
+        return slash::Status::OK();
+      }
+      cached = node->entry;
+    }
+  }
+
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+    Erase(path);
+    return slash::Status::NotFound(path);
+  }
+  if (cached && cached->size == static_cast<uint64_t>(st.st_size) &&
+      cached->mtime == st.st_mtime && cached->ino == st.st_ino) {
+    // Not changed
+    Put(path, cached, now);
+    *entry = cached;
+    return slash::Status::OK();
+  }
+
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    Erase(path);
+    return slash::Status::NotFound(path, strerror(errno));
+  }
+  std::shared_ptr<HTTPFile> file(new HTTPFile(fd));
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    Erase(path);
+    return slash::Status::NotFound(path);
+  }
+
+  Entry* e = new Entry();
+  e->file = file;
+  e->size = st.st_size;
+  e->mtime = st.st_mtime;
+  e->ino = st.st_ino;
+  char buf[64];
+  snprintf(buf, sizeof(buf), "\"%lx-%lx\"",
+           static_cast<unsigned long>(st.st_mtime),
+           static_cast<unsigned long>(st.st_size));
+  e->etag.assign(buf);
+  struct tm tm;
+  gmtime_r(&st.st_mtime, &tm);
+  strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  e->last_modified.assign(buf);
+  e->content_type = ContentType(path);
+
+  entry->reset(e);
+  Put(path, *entry, now);
+  return slash::Status::OK();
+}
+
+void HTTPFileCache::Put(const std::string& path,
+                        const std::shared_ptr<const Entry>& entry,
+                        uint64_t now_ms) {
+  slash::MutexLock l(&mu_);
+  auto iter = index_.find(path);
+  if (iter != index_.end()) {
+    NodeList::iterator node = iter->second;
+    node->entry = entry;
+    node->checked_ms = now_ms;
+    lru_.splice(lru_.begin(), lru_, node);
+    return;
+  }
+  Node node;
+  node.path = path;
+  node.entry = entry;
+  node.checked_ms = now_ms;
+  lru_.push_front(node);
+  index_[path] = lru_.begin();
+  // The file of an evicted entry is closed after the responses sending it
+  while (lru_.size() > capacity_) {
+    index_.erase(lru_.back().path);
+    lru_.pop_back();
+  }
+}
+
+void HTTPFileCache::Erase(const std::string& path) {
+  slash::MutexLock l(&mu_);
+  auto iter = index_.find(path);
+  if (iter != index_.end()) {
+    lru_.erase(iter->second);
+    index_.erase(iter);
+  }
+}
+
+size_t HTTPFileCache::size() {
+  slash::MutexLock l(&mu_);
+  return lru_.size();
+}
+
+void HTTPFileCache::Clear() {
+  slash::MutexLock l(&mu_);
+  index_.clear();
+  lru_.clear();
+}
+
+static int HexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  } else if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  } else if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+static bool ParseNumber(const char* data, const char* end, uint64_t* value) {
+  if (data == end || end - data > 19) {
+    return false;
+  }
+  uint64_t result = 0;
+  for (; data < end; data++) {
+    if (*data < '0' || *data > '9') {
+      return false;
+    }
+    result = result * 10 + (*data - '0');
+  }
+  *value = result;
+  return true;
+}
+
+/*
+ * Parse "bytes=first-last", "bytes=first-" or "bytes=-suffix" of a file of
+ * size. Return 1 if satisfiable, 0 to ignore the header, as a multiple
+ * range, -1 if not satisfiable.
+ */
+static int ParseRange(const slash::Slice& value, uint64_t size,
+                      uint64_t* start, uint64_t* len) {
+  if (!value.starts_with("bytes=")) {
+    return 0;
+  }
+  const char* data = value.data() + 6;
+  const char* end = value.data() + value.size();
+  const char* dash = static_cast<const char*>(memchr(data, '-', end - data));
+  if (dash == NULL || memchr(data, ',', end - data) != NULL) {
+    return 0;
+  }
+  uint64_t first, last;
+  if (dash == data) {
+    // The last bytes
+    if (!ParseNumber(dash + 1, end, &last)) {
+      return 0;
+    }
+    if (last == 0 || size == 0) {
+      return -1;
+    }
+    first = last < size ? size - last : 0;
+    last = size - 1;
+  } else {
+    if (!ParseNumber(data, dash, &first)) {
+      return 0;
+    }
+    if (dash + 1 == end) {
+      last = size - 1;
+    } else if (!ParseNumber(dash + 1, end, &last) || last < first) {
+      return 0;
+    }
+    if (first >= size) {
+      return -1;
+    }
+    if (last >= size) {
+      last = size - 1;
+    }
+  }
+  *start = first;
+  *len = last - first + 1;
+  return 1;
+}
+
+// If-None-Match is "*" or a list of tags
+static bool MatchETag(const slash::Slice& value, const std::string& etag) {
+  if (value.size() == 1 && value[0] == '*') {
+    return true;
+  }
+  const char* data = value.data();
+  const char* end = data + value.size();
+  while (data < end) {
+    const char* comma = static_cast<const char*>(memchr(data, ',', end - data));
+    if (comma == NULL) {
+      comma = end;
+    }
+    while (data < comma && (*data == ' ' || *data == '\t')) {
+      data++;
+    }
+    const char* tag_end = comma;
+    while (tag_end > data && (tag_end[-1] == ' ' || tag_end[-1] == '\t')) {
+      tag_end--;
+    }
+    // The weak comparison
+    if (tag_end - data > 2 && data[0] == 'W' && data[1] == '/') {
+      data += 2;
+    }
+    if (static_cast<size_t>(tag_end - data) == etag.size() &&
+        memcmp(data, etag.data(), etag.size()) == 0) {
+      return true;
+    }
+    data = comma + 1;
+  }
+  return false;
+}
+
+HTTPStaticHandles::HTTPStaticHandles(const std::string& root,
+                                     std::shared_ptr<HTTPFileCache> cache)
+    : root_(root),
+      cache_(cache),
+      status_code_(404),
+      head_(false),
+      range_start_(0),
+      range_len_(0) {
+  while (!root_.empty() && root_.back() == '/') {
+    root_.pop_back();
+  }
+}
+
+/*
+ * Decode the url path into path_ under root_, the ".." segments are not
+ * allowed
+ */
+bool HTTPStaticHandles::ResolvePath(const slash::Slice& path) {
+  if (path.empty() || path[0] != '/') {
+    return false;
+  }
+  path_.assign(root_);
+  size_t segment = path_.size();
+  for (size_t i = 0; i < path.size(); i++) {
+    char c = path[i];
+    if (c == '%') {
+      int high, low;
+      if (i + 2 >= path.size() || (high = HexValue(path[i + 1])) < 0 ||
+          (low = HexValue(path[i + 2])) < 0) {
+        return false;
+      }
+      c = static_cast<char>(high * 16 + low);
+      i += 2;
+    }
+    if (c == '\0') {
+      return false;
+    }
+    if (c == '/') {
+      if (path_.compare(segment, std::string::npos, "/..") == 0) {
+        return false;
+      }
+      segment = path_.size();
+    }
+    path_.push_back(c);
+  }
+  if (path_.compare(segment, std::string::npos, "/..") == 0) {
+    return false;
+  }
+  if (path_.back() == '/') {
+    path_.append("index.html");
+  }
+  return true;
+}
+
+bool HTTPStaticHandles::HandleRequest(const HTTPRequest* req) {
+  entry_.reset();
+  range_start_ = 0;
+  range_len_ = 0;
+  head_ = req->method() == "HEAD";
+  if (req->method() != "GET" && !head_) {
+    status_code_ = 405;
+    return false;
+  }
+  if (!ResolvePath(req->path())) {
+    status_code_ = 400;
+    return false;
+  }
+  if (!cache_->Get(path_, &entry_).ok()) {
+    status_code_ = 404;
+    return false;
+  }
+
+  const HTTPFields& headers = req->headers();
+  const slash::Slice* value = headers.Find("if-none-match");
+  if (value != NULL) {
+    if (MatchETag(*value, entry_->etag)) {
+      status_code_ = 304;
+      return false;
+    }
+  } else {
+    value = headers.Find("if-modified-since");
+    if (value != NULL && *value == entry_->last_modified) {
+      status_code_ = 304;
+      return false;
+    }
+  }
+
+  status_code_ = 200;
+  range_len_ = entry_->size;
+  value = headers.Find("range");
+  if (value != NULL) {
+    int ret = ParseRange(*value, entry_->size, &range_start_, &range_len_);
+    if (ret > 0) {
+      status_code_ = 206;
+    } else if (ret < 0) {
+      status_code_ = 416;
+    }
+  }
+  return false;
+}
+
+void HTTPStaticHandles::HandleBodyData(const char* data, size_t data_size) {
+}
+
+void HTTPStaticHandles::PrepareResponse(HTTPResponse* resp) {
+  resp->SetStatusCode(status_code_);
+  if (!entry_) {
+    if (status_code_ == 405) {
+      resp->SetHeaders("Allow", "GET, HEAD");
+    }
+    resp->SetContentLength(0);
+    return;
+  }
+
+  resp->SetHeaders("ETag", entry_->etag);
+  resp->SetHeaders("Last-Modified", entry_->last_modified);
+  char buf[64];
+  if (status_code_ == 304) {
+    entry_.reset();
+    return;
+  } else if (status_code_ == 416) {
+    int len = snprintf(buf, sizeof(buf), "bytes */%lu",
+                       static_cast<unsigned long>(entry_->size));
+    resp->SetHeaders("Content-Range", slash::Slice(buf, len));
+    resp->SetContentLength(0);
+    entry_.reset();
+    return;
+  }
+
+  resp->SetHeaders("Accept-Ranges", "bytes");
+  resp->SetHeaders("Content-Type", entry_->content_type);
+  if (status_code_ == 206) {
+    int len = snprintf(buf, sizeof(buf), "bytes %lu-%lu/%lu",
+                       static_cast<unsigned long>(range_start_),
+                       static_cast<unsigned long>(range_start_ + range_len_ - 1),
+                       static_cast<unsigned long>(entry_->size));
+    resp->SetHeaders("Content-Range", slash::Slice(buf, len));
+  }
+  if (head_) {
+    // The length without the body
+    resp->SetHeaders("Content-Length", range_len_);
+  } else {
+    resp->SetBodyFile(entry_->file, range_start_, range_len_);
+  }
+  entry_.reset();
+}
+
+int HTTPStaticHandles::WriteResponseBody(char* buf, size_t max_size) {
+  // The body is a file always
+  return -1;
+}
+
+}  // namespace pink
@@ -0,0 +1,240 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include "pink/src/pattern_index.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace pink {
+
+GlobMatcher::GlobMatcher(const std::string& pattern)
+    : min_remain_len_(0) {
+  const char* p = pattern.data();
+  size_t n = pattern.size();
+  bool in_prefix = true;
+  Op op;
+  op.c = 0;
+  op.char_class = 0;
+  for (size_t i = 0; i < n; i++) {
+    switch (p[i]) {
+      case '*':
+        while (i + 1 < n && p[i + 1] == '*') {
+          i++;
+        }
+        op.type = kAnyString;
+        ops_.push_back(op);
+        in_prefix = false;
+        continue;
+      case '?':
+        op.type = kAnyChar;
+        ops_.push_back(op);
+        in_prefix = false;
+        continue;
+      case '[': {
+        // Same rules as slash::stringmatchlen, an unterminated class
+        // takes the rest of the pattern
+        std::bitset<256> char_class;
+        bool negate = false;
+        i++;
+        if (i < n && p[i] == '^') {
+          negate = true;
+          i++;
+        }
+        while (i < n && p[i] != ']') {
+          if (p[i] == '\\' && i + 1 < n) {
+            i++;
+            char_class.set(static_cast<unsigned char>(p[i]));
+          } else if (i + 2 < n && p[i + 1] == '-') {
+            unsigned char start = p[i], end = p[i + 2];
+            if (start > end) {
+              std::swap(start, end);
+            }
+            for (unsigned int c = start; c <= end; c++) {
+              char_class.set(c);
+            }
+            i += 2;
+          } else {
+            char_class.set(static_cast<unsigned char>(p[i]));
+          }
+          i++;
+        }
+        if (negate) {
+          char_class.flip();
+        }
+        op.type = kCharClass;
+        op.char_class = classes_.size();
+        classes_.push_back(char_class);
+        ops_.push_back(op);
+        in_prefix = false;
+        continue;
+      }
+      case '\\':
+        if (i + 1 < n) {
+          i++;
+        }
+        break;
+      default:
+        break;
+    }
+    if (in_prefix) {
+      prefix_.push_back(p[i]);
+    } else {
+      op.type = kLiteral;
+      op.c = p[i];
+      ops_.push_back(op);
+    }
+  }
+
+  for (auto& item : ops_) {
+    if (item.type != kAnyString) {
+      min_remain_len_++;
+    }
+  }
+}
+
+bool GlobMatcher::Match(const char* str, size_t len) const {
+  if (len < prefix_.size() ||
+      memcmp(str, prefix_.data(), prefix_.size()) != 0) {
+    return false;
+  }
+  return MatchRemain(str + prefix_.size(), len - prefix_.size());
+}
+
+bool GlobMatcher::MatchRemain(const char* str, size_t len) const {
+  if (len < min_remain_len_) {
+    return false;
+  }
+  // Every op except '*' consumes exactly one char, so on mismatch we only
+  // need to retry from the last '*' with one more char swallowed by it
+  size_t op_pos = 0, str_pos = 0;
+  size_t star_op = ops_.size(), star_str = 0;
+  while (str_pos < len) {
+    if (op_pos < ops_.size()) {
+      const Op& op = ops_[op_pos];
+      if (op.type == kAnyString) {
+        star_op = op_pos++;
+        star_str = str_pos;
+        continue;
+      }
+      if (OpMatch(op, static_cast<unsigned char>(str[str_pos]))) {
+        op_pos++;
+        str_pos++;
+        continue;
+      }
+    }
+    if (star_op == ops_.size()) {
+      return false;
+    }
+    op_pos = star_op + 1;
+    str_pos = ++star_str;
+  }
+  while (op_pos < ops_.size() && ops_[op_pos].type == kAnyString) {
+    op_pos++;
+  }
+  return op_pos == ops_.size();
+}
+
+PatternIndex::Node::~Node() {
+  for (auto& child : children) {
+    delete child.second;
+  }
+  for (auto entry : entries) {
+    delete entry;
+  }
+}
+
+PatternIndex::PatternIndex()
+    : root_(new Node()),
+      size_(0) {
+}
+
+PatternIndex::~PatternIndex() {
+  delete root_;
+}
+
+bool PatternIndex::Add(const std::string& pattern) {
+  Entry* entry = new Entry(pattern);
+  Node* node = root_;
+  for (unsigned char c : entry->matcher.prefix()) {
+    Node*& child = node->children[c];
+    if (child == nullptr) {
+      child = new Node();
+    }
+    node = child;
+  }
+  for (auto item : node->entries) {
+    if (item->pattern == pattern) {
+      delete entry;
+      return false;
+    }
+  }
+  node->entries.push_back(entry);
+  size_++;
+  return true;
+}
+
+bool PatternIndex::Remove(const std::string& pattern) {
+  GlobMatcher matcher(pattern);
+  if (Remove(root_, pattern, matcher.prefix(), 0)) {
+    size_--;
+    return true;
+  }
+  return false;
+}
+
+bool PatternIndex::Remove(Node* node, const std::string& pattern,
+                          const std::string& prefix, size_t depth) {
+  if (depth == prefix.size()) {
+    for (auto iter = node->entries.begin();
+         iter != node->entries.end(); iter++) {
+      if ((*iter)->pattern == pattern) {
+        delete *iter;
+        node->entries.erase(iter);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  auto child = node->children.find(prefix[depth]);
+  if (child == node->children.end() ||
+      !Remove(child->second, pattern, prefix, depth + 1)) {
+    return false;
+  }
+  // Prune the branch nobody hangs on
+  if (child->second->entries.empty() && child->second->children.empty()) {
+    delete child->second;
+    node->children.erase(child);
+  }
+  return true;
+}
+
+void PatternIndex::Match(const std::string& channel,
+                         std::vector<const std::string*>* result) const {
+  const char* str = channel.data();
+  size_t len = channel.size();
+  const Node* node = root_;
+  size_t depth = 0;
+  while (true) {
+    for (auto entry : node->entries) {
+      if (entry->matcher.MatchRemain(str + depth, len - depth)) {
+        result->push_back(&entry->pattern);
+      }
+    }
+    if (depth == len) {
+      break;
+    }
+    auto child = node->children.find(str[depth]);
+    if (child == node->children.end()) {
+      break;
+    }
+    node = child->second;
+    depth++;
+  }
+}
+
+}  // namespace pink
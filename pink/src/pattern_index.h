@@ -0,0 +1,127 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef PINK_SRC_PATTERN_INDEX_H_
+#define PINK_SRC_PATTERN_INDEX_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+#include <bitset>
+
+namespace pink {
+
+/*
+ * GlobMatcher compiles a redis style glob pattern ('*', '?', '[...]' and
+ * '\' escape) once, the literal prefix is split out and the rest becomes a
+ * list of single char ops, so matching needs neither recursion nor
+ * re-parsing the pattern.
+ */
+class GlobMatcher {
+ public:
+  explicit GlobMatcher(const std::string& pattern);
+
+  bool Match(const char* str, size_t len) const;
+  bool Match(const std::string& str) const {
+    return Match(str.data(), str.size());
+  }
+
+  /*
+   * Match the part of str after the literal prefix, the caller has
+   * checked the prefix already
+   */
+  bool MatchRemain(const char* str, size_t len) const;
+
+  // The chars before the first wildcard
+  const std::string& prefix() const {
+    return prefix_;
+  }
+
+ private:
+  enum OpType {
+    kLiteral,
+    kAnyChar,
+    kAnyString,
+    kCharClass,
+  };
+
+  struct Op {
+    OpType type;
+    unsigned char c;
+    uint32_t char_class;  // index of classes_ when type is kCharClass
+  };
+
+  bool OpMatch(const Op& op, unsigned char c) const {
+    switch (op.type) {
+      case kLiteral:
+        return op.c == c;
+      case kAnyChar:
+        return true;
+      case kCharClass:
+        return classes_[op.char_class].test(c);
+      default:
+        return false;
+    }
+  }
+
+  std::string prefix_;
+  std::vector<Op> ops_;
+  std::vector<std::bitset<256>> classes_;
+  size_t min_remain_len_;  // chars needed by ops_ besides '*'
+};
+
+/*
+ * PatternIndex groups patterns by literal prefix in a trie, a channel only
+ * walks its own chars down the trie and evaluates the patterns hanging on
+ * the visited nodes, instead of all of the patterns.
+ */
+class PatternIndex {
+ public:
+  PatternIndex();
+  ~PatternIndex();
+
+  // Return false if the pattern is already in the index
+  bool Add(const std::string& pattern);
+
+  // Return false if the pattern is not in the index
+  bool Remove(const std::string& pattern);
+
+  // Append the patterns matching channel to result
+  void Match(const std::string& channel,
+             std::vector<const std::string*>* result) const;
+
+  size_t size() const {
+    return size_;
+  }
+
+ private:
+  struct Entry {
+    std::string pattern;
+    GlobMatcher matcher;
+    explicit Entry(const std::string& _pattern)
+      : pattern(_pattern), matcher(_pattern) {}
+  };
+
+  struct Node {
+    std::map<unsigned char, Node*> children;
+    std::vector<Entry*> entries;
+    ~Node();
+  };
+
+  bool Remove(Node* node, const std::string& pattern,
+              const std::string& prefix, size_t depth);
+
+  Node* root_;
+  size_t size_;
+
+  // No copying allowed
+  PatternIndex(const PatternIndex&);
+  void operator=(const PatternIndex&);
+};
+
+}  // namespace pink
+#endif  // PINK_SRC_PATTERN_INDEX_H_
@@ -0,0 +1,144 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include "pink/include/pb_async_cli.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include <utility>
+
+#include "pink/include/pink_define.h"
+#include "pink/src/pb_frame.h"
+
+namespace pink {
+
+// The least room for a read() in rbuf_
+static const size_t kReadChunk = 16 * 1024;
+
+PbAsyncCli::PbAsyncCli(const std::string& ip, int port)
+    : AsyncCli(ip, port),
+      rbuf_len_(0),
+      next_request_id_(1) {
+  set_thread_name("PbAsyncCli");
+}
+
+PbAsyncCli::~PbAsyncCli() {
+  Close();
+}
+
+void PbAsyncCli::Send(const google::protobuf::Message& req,
+                      google::protobuf::Message* res, const PbDone& done) {
+  Submit(req, 0, 0, res, done);
+}
+
+void PbAsyncCli::Call(uint32_t method_id,
+                      const google::protobuf::Message& req,
+                      google::protobuf::Message* res, const PbDone& done) {
+  Submit(req, kPbFlagMethod, method_id, res, done);
+}
+
+void PbAsyncCli::Submit(const google::protobuf::Message& req, uint32_t flags,
+                        uint32_t method_id, google::protobuf::Message* res,
+                        const PbDone& done) {
+  PbAsyncCall call;
+  call.request_id = next_request_id_++;
+  call.res = res;
+  call.done = done;
+
+  PbFrameHeader header;
+  header.ext = true;
+  header.request_id = call.request_id;
+  header.flags = flags;
+  header.method_id = method_id;
+  header.body_len = req.ByteSizeLong();
+  std::string frame(header.size() + header.body_len, '\0');
+  EncodePbHeader(header, &frame[0]);
+  req.SerializeWithCachedSizesToArray(
+      reinterpret_cast<uint8_t*>(&frame[header.size()]));
+  AsyncCli::Submit(std::move(frame), std::move(call));
+}
+
+void PbAsyncCli::Callback(const PbDone& done, const Status& s) {
+  Done();
+  if (done) {
+    done(s);
+  }
+}
+
+void PbAsyncCli::Sent(PbAsyncCall&& call) {
+  uint64_t request_id = call.request_id;
+  inflight_[request_id] = std::move(call);
+}
+
+void PbAsyncCli::Fail(PbAsyncCall* call, const Status& s) {
+  Callback(call->done, s);
+}
+
+void PbAsyncCli::Disconnected(const Status& s) {
+  rbuf_len_ = 0;
+  std::unordered_map<uint64_t, PbAsyncCall> inflight;
+  inflight.swap(inflight_);
+  for (auto& item : inflight) {
+    Callback(item.second.done, s);
+  }
+}
+
+ssize_t PbAsyncCli::ReadReplies(int fd) {
+  if (rbuf_.size() - rbuf_len_ < kReadChunk) {
+    rbuf_.resize(rbuf_len_ + kReadChunk);
+  }
+  ssize_t nread = read(fd, &rbuf_[rbuf_len_], rbuf_.size() - rbuf_len_);
+  if (nread > 0) {
+    rbuf_len_ += nread;
+  }
+  return nread;
+}
+
+/*
+ * Call back the requests of the complete frames in rbuf_, and keep the
+ * partial one. Return false if the connection is closed for a bad frame.
+ */
+bool PbAsyncCli::HandleReplies() {
+  size_t pos = 0;
+  PbFrameHeader header;
+  size_t header_len;
+  while ((header_len = DecodePbHeader(rbuf_.data() + pos,
+                                      rbuf_len_ - pos, &header)) != 0) {
+    if (!header.ext ||
+        header.body_len > kProtoMaxMessage - kPbExtHeaderLength) {
+      Disconnect(Status::Corruption("invalid frame"));
+      return false;
+    }
+    if (rbuf_len_ - pos < header_len + header.body_len) {
+      break;
+    }
+    const char* body = rbuf_.data() + pos + header_len;
+    pos += header_len + header.body_len;
+
+    auto iter = inflight_.find(header.request_id);
+    if (iter == inflight_.end()) {
+      Disconnect(Status::Corruption("unexpected reply"));
+      return false;
+    }
+    PbAsyncCall call(std::move(iter->second));
+    inflight_.erase(iter);
+    if (header.flags & kPbFlagError) {
+      Callback(call.done, Status::Corruption(
+          std::string(body, header.body_len)));
+    } else if (!call.res->ParseFromArray(body, header.body_len)) {
+      Callback(call.done, Status::Corruption("parse reply failed"));
+    } else {
+      Callback(call.done, Status::OK());
+    }
+  }
+  if (pos > 0) {
+    memmove(&rbuf_[0], rbuf_.data() + pos, rbuf_len_ - pos);
+    rbuf_len_ -= pos;
+  }
+  return true;
+}
+
+}  // namespace pink
@@ -6,13 +6,143 @@
 #include "pink/include/pb_conn.h"
 
 #include <arpa/inet.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <algorithm>
 #include <string>
+#include <vector>
+
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
 
 #include "slash/include/xdebug.h"
+#include "slash/include/slash_mutex.h"
 #include "pink/include/pink_define.h"
+#include "pink/src/pb_frame.h"
+#include "pink/src/worker_thread.h"
 
 namespace pink {
 
+// Max frames gathered by one writev() in SendReply()
+static const int kMaxReplyIov = 64;
+
+// The output segments, a reply larger than kSegmentSize has its own one
+static const size_t kSegmentSize = 64 * 1024;
+static const size_t kMaxPooledSegment = 4 * kSegmentSize;
+static const size_t kMaxPooledSegments = 256;
+
+/*
+ * Free output segments shared by all the connections, the buffer of a
+ * segment is kept by clear()
+ */
+class SegmentPool {
+ public:
+  void Take(size_t size, std::string* segment) {
+    {
+    slash::MutexLock l(&mu_);
+    if (!free_.empty()) {
+      segment->swap(free_.back());
+      free_.pop_back();
+    }
+    }
+    segment->reserve(size);
+  }
+
+  void Give(std::string* segment) {
+    if (segment->capacity() < kSegmentSize ||
+        segment->capacity() > kMaxPooledSegment) {
+      return;
+    }
+    segment->clear();
+    slash::MutexLock l(&mu_);
+    if (free_.size() < kMaxPooledSegments) {
+      free_.push_back(std::string());
+      free_.back().swap(*segment);
+    }
+  }
+
+ private:
+  slash::Mutex mu_;
+  std::vector<std::string> free_;
+};
+
+static SegmentPool segment_pool;
+
+/*
+ * The replies of a connection, shared by the connection and its
+ * PbRepliers. closed is set when the connection is destroyed.
+ *
+ * While the worker deals the requests read, dealing points to the output
+ * of the connection. A reply given by the worker then goes there, one of
+ * another thread to frames, both without a notification, GetRequest()
+ * sees them when the pass ends.
+ */
+struct PbReplyQueue {
+  slash::Mutex mu;
+  std::deque<std::string> frames;
+  WorkerThread* worker;
+  int fd;
+  bool closed;
+  bool notified;    // the worker is notified and not yet taken the frames
+  std::deque<std::string>* dealing;
+  pthread_t dealer;
+
+  PbReplyQueue(WorkerThread* _worker, int _fd)
+      : worker(_worker), fd(_fd), closed(false), notified(false),
+        dealing(NULL) {}
+};
+
+bool PbReplier::Reply(const google::protobuf::Message& res) {
+  if (queue_ == nullptr) {
+    return false;
+  }
+  PbFrameHeader header;
+  header.body_len = res.ByteSizeLong();
+  header.ext = ext_;
+  header.request_id = request_id_;
+  std::string frame(header.size() + header.body_len, '\0');
+  EncodePbHeader(header, &frame[0]);
+  res.SerializeWithCachedSizesToArray(
+      reinterpret_cast<uint8_t*>(&frame[header.size()]));
+  return Reply(&frame);
+}
+
+bool PbReplier::ReplyError(const std::string& error) {
+  if (queue_ == nullptr) {
+    return false;
+  }
+  PbFrameHeader header;
+  header.body_len = error.size();
+  header.ext = ext_;
+  header.request_id = request_id_;
+  header.flags = kPbFlagError;
+  std::string frame(header.size(), '\0');
+  EncodePbHeader(header, &frame[0]);
+  frame.append(error);
+  return Reply(&frame);
+}
+
+bool PbReplier::Reply(std::string* frame) {
+  slash::MutexLock l(&queue_->mu);
+  if (queue_->closed) {
+    return false;
+  }
+  if (queue_->dealing != NULL) {
+    if (pthread_equal(queue_->dealer, pthread_self())) {
+      queue_->dealing->push_back(std::move(*frame));
+    } else {
+      queue_->frames.push_back(std::move(*frame));
+    }
+    return true;
+  }
+  queue_->frames.push_back(std::move(*frame));
+  if (!queue_->notified) {
+    queue_->notified = true;
+    queue_->worker->NotifyWrite(queue_->fd);
+  }
+  return true;
+}
+
 PbConn::PbConn(const int fd, const std::string &ip_port, ServerThread *thread) :
   PinkConn(fd, ip_port, thread),
   header_len_(-1),
@@ -20,111 +150,168 @@ PbConn::PbConn(const int fd, const std::string &ip_port, ServerThread *thread) :
   rbuf_len_(0),
   remain_packet_len_(0),
   connStatus_(kHeader),
-  wbuf_len_(0),
+  res_(NULL),
+  ext_frame_(false),
+  request_id_(0),
+  frame_flags_(0),
+  method_id_(0),
+  deferred_(false),
   wbuf_pos_(0) {
   rbuf_ = reinterpret_cast<char *>(malloc(sizeof(char) * kProtoMaxMessage));
-  wbuf_ = reinterpret_cast<char *>(malloc(sizeof(char) * kProtoMaxMessage));
 }
 
 PbConn::~PbConn() {
   free(rbuf_);
-  free(wbuf_);
+  if (queue_ != nullptr) {
+    slash::MutexLock l(&queue_->mu);
+    queue_->closed = true;
+    queue_->dealing = NULL;
+  }
 }
 
-// Msg is [ length(COMMAND_HEADER_LENGTH) | body(length bytes) ]
-//   step 1. kHeader, we read COMMAND_HEADER_LENGTH bytes;
-//   step 2. kPacket, we read header_len bytes;
+PbReplier PbConn::DeferReply() {
+  PbReplier replier;
+  if (worker_thread() == NULL) {
+    return replier;
+  }
+  if (queue_ == nullptr) {
+    queue_ = std::make_shared<PbReplyQueue>(worker_thread(), fd());
+  }
+  {
+  slash::MutexLock l(&queue_->mu);
+  queue_->dealing = &frames_;
+  queue_->dealer = pthread_self();
+  }
+  replier.queue_ = queue_;
+  replier.request_id_ = request_id_;
+  replier.ext_ = ext_frame_;
+  deferred_ = true;
+  return replier;
+}
+
+bool PbConn::ParseRequest(google::protobuf::Message* req) {
+  google::protobuf::io::ArrayInputStream input(
+      rbuf_ + cur_pos_ - header_len_, header_len_);
+  return req->ParseFromZeroCopyStream(&input);
+}
+
+// Msg is [ length(COMMAND_HEADER_LENGTH) | body(length bytes) ], or the
+// extended frame [ length | request id | flags | body ], see kPbExtFrame
+//
+// We read as much as the socket has into rbuf_, then deal all the complete
+// frames in it one by one, and keep the partial one at the beginning of
+// rbuf_ for the next read. For the frame being dealt, its body is the
+// header_len_ bytes ending at rbuf_ + cur_pos_.
 ReadStatus PbConn::GetRequest() {
-  while (true) {
-    switch (connStatus_) {
-      case kHeader: {
-        ssize_t nread = read(
-            fd(), rbuf_ + rbuf_len_, COMMAND_HEADER_LENGTH - rbuf_len_);
-        if (nread == -1) {
-          if (errno == EAGAIN) {
-            return kReadHalf;
-          } else {
-            return kReadError;
-          }
-        } else if (nread == 0) {
-          return kReadClose;
-        } else {
-          rbuf_len_ += nread;
-          if (rbuf_len_ - cur_pos_ == COMMAND_HEADER_LENGTH) {
-            uint32_t integer = 0;
-            memcpy(reinterpret_cast<char*>(&integer),
-                   rbuf_ + cur_pos_, sizeof(uint32_t));
-            header_len_ = ntohl(integer);
-            remain_packet_len_ = header_len_;
-            cur_pos_ += COMMAND_HEADER_LENGTH;
-            connStatus_ = kPacket;
-            continue;
-          }
-          return kReadHalf;
-        }
-      }
-      case kPacket: {
-        if (header_len_ >= kProtoMaxMessage - COMMAND_HEADER_LENGTH) {
-          return kFullError;
-        } else {
-          // read msg body
-          ssize_t nread = read(fd(), rbuf_ + rbuf_len_, remain_packet_len_);
-          if (nread == -1) {
-            if (errno == EAGAIN) {
-              return kReadHalf;
-            } else {
-              return kReadError;
-            }
-          } else if (nread == 0) {
-            return kReadClose;
-          }
-
-          rbuf_len_ += nread;
-          remain_packet_len_ -= nread;
-          if (remain_packet_len_ == 0) {
-            cur_pos_ = rbuf_len_;
-            connStatus_ = kComplete;
-            continue;
-          }
-          return kReadHalf;
-        }
-      }
-      case kComplete: {
-        if (DealMessage() != 0) {
-          return kDealError;
-        }
-        connStatus_ = kHeader;
-        cur_pos_ = 0;
-        rbuf_len_ = 0;
-        return kReadAll;
-      }
-      // Add this switch case just for delete compile warning
-      case kBuildObuf:
-        break;
-
-      case kWriteObuf:
-        break;
+  if (rbuf_len_ == static_cast<uint32_t>(kProtoMaxMessage)) {
+    return kFullError;
+  }
+  ssize_t nread = read(fd(), rbuf_ + rbuf_len_, kProtoMaxMessage - rbuf_len_);
+  if (nread == -1) {
+    if (errno == EAGAIN) {
+      return kReadHalf;
+    } else {
+      return kReadError;
     }
+  } else if (nread == 0) {
+    return kReadClose;
   }
+  rbuf_len_ += nread;
 
-  return kReadHalf;
+  uint32_t pos = 0;
+  bool dealt = false;
+  PbFrameHeader header;
+  size_t len;
+  while ((len = DecodePbHeader(rbuf_ + pos, rbuf_len_ - pos, &header)) != 0) {
+    if (header.body_len > kProtoMaxMessage - len) {
+      return kFullError;
+    }
+    if (rbuf_len_ - pos < len + header.body_len) {
+      connStatus_ = kPacket;
+      remain_packet_len_ = len + header.body_len - (rbuf_len_ - pos);
+      break;
+    }
+    header_len_ = header.body_len;
+    ext_frame_ = header.ext;
+    request_id_ = header.request_id;
+    frame_flags_ = header.flags;
+    method_id_ = header.method_id;
+    pos += len + header.body_len;
+    cur_pos_ = pos;
+    connStatus_ = kComplete;
+
+    deferred_ = false;
+    set_is_reply(false);
+    if (DealMessage() != 0) {
+      return kDealError;
+    }
+    if (!deferred_ && is_reply() && !BuildObuf().ok()) {
+      return kDealError;
+    }
+    dealt = true;
+  }
+  if (len == 0) {
+    connStatus_ = kHeader;
+    remain_packet_len_ = 0;
+  }
+
+  // Keep the partial frame
+  if (pos > 0) {
+    memmove(rbuf_, rbuf_ + pos, rbuf_len_ - pos);
+    rbuf_len_ -= pos;
+  }
+  cur_pos_ = 0;
+  // The deferred replies given during the pass go out with the others
+  bool queued = false;
+  if (queue_ != nullptr) {
+    slash::MutexLock l(&queue_->mu);
+    queue_->dealing = NULL;
+    queued = !queue_->frames.empty();
+  }
+  set_is_reply(queued || !frames_.empty());
+  if (!is_reply()) {
+    arena_.Reset();
+  }
+  return dealt && rbuf_len_ == 0 ? kReadAll : kReadHalf;
 }
 
 WriteStatus PbConn::SendReply() {
-  if (!BuildObuf().ok()) {
-    return kWriteError;
+  if (queue_ != nullptr) {
+    slash::MutexLock l(&queue_->mu);
+    for (auto& frame : queue_->frames) {
+      frames_.push_back(std::move(frame));
+    }
+    queue_->frames.clear();
+    queue_->notified = false;
   }
+
+  struct iovec iov[kMaxReplyIov];
   ssize_t nwritten = 0;
-  while (wbuf_len_ > 0) {
-    nwritten = write(fd(), wbuf_ + wbuf_pos_, wbuf_len_ - wbuf_pos_);
+  while (!frames_.empty()) {
+    // The first frame may be partially sent
+    int iovcnt = 0;
+    size_t offset = wbuf_pos_;
+    for (auto iter = frames_.begin();
+         iter != frames_.end() && iovcnt < kMaxReplyIov; iter++) {
+      iov[iovcnt].iov_base = const_cast<char*>(iter->data()) + offset;
+      iov[iovcnt].iov_len = iter->size() - offset;
+      offset = 0;
+      iovcnt++;
+    }
+    nwritten = writev(fd(), iov, iovcnt);
     if (nwritten <= 0) {
       break;
     }
-    wbuf_pos_ += nwritten;
-    if (wbuf_pos_ == wbuf_len_) {
-      wbuf_len_ = 0;
+
+    size_t consumed = nwritten;
+    while (!frames_.empty() &&
+           consumed >= frames_.front().size() - wbuf_pos_) {
+      consumed -= frames_.front().size() - wbuf_pos_;
+      segment_pool.Give(&frames_.front());
+      frames_.pop_front();
       wbuf_pos_ = 0;
     }
+    wbuf_pos_ += consumed;
   }
   if (nwritten == -1) {
     if (errno == EAGAIN) {
@@ -134,23 +321,43 @@ WriteStatus PbConn::SendReply() {
       return kWriteError;
     }
   }
-  if (wbuf_len_ == 0) {
+  if (frames_.empty()) {
+    arena_.Reset();
     return kWriteAll;
   } else {
     return kWriteHalf;
   }
 }
 
+/*
+ * Serialize res_ as the reply of the request just dealt, at the end of
+ * the last output segment if it has room
+ */
 Status PbConn::BuildObuf() {
-  wbuf_len_ = res_->ByteSize();
-  if (wbuf_len_ > kProtoMaxMessage - 4
-      || !(res_->SerializeToArray(wbuf_ + 4, wbuf_len_))) {
+  if (res_ == NULL) {
+    return Status::Corruption("No reply to build");
+  }
+  PbFrameHeader header;
+  size_t body_len = res_->ByteSizeLong();
+  if (body_len > static_cast<size_t>(kProtoMaxMessage - kPbExtHeaderLength)) {
     return Status::Corruption("Serialize to buffer failed");
   }
-  uint32_t u;
-  u = htonl(wbuf_len_);
-  memcpy(wbuf_, &u, sizeof(uint32_t));
-  wbuf_len_ += COMMAND_HEADER_LENGTH;
+  header.body_len = body_len;
+  header.ext = ext_frame_;
+  header.request_id = request_id_;
+  size_t frame_len = header.size() + body_len;
+  if (frames_.empty() ||
+      frames_.back().capacity() - frames_.back().size() < frame_len) {
+    frames_.push_back(std::string());
+    segment_pool.Take(std::max(frame_len, kSegmentSize), &frames_.back());
+  }
+
+  std::string& segment = frames_.back();
+  size_t offset = segment.size();
+  segment.resize(offset + frame_len);
+  EncodePbHeader(header, &segment[offset]);
+  res_->SerializeWithCachedSizesToArray(
+      reinterpret_cast<uint8_t*>(&segment[offset + header.size()]));
 
   return Status::OK();
 }
@@ -0,0 +1,99 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef PINK_SRC_PB_FRAME_H_
+#define PINK_SRC_PB_FRAME_H_
+
+#include <endian.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "pink/include/pink_define.h"
+
+namespace pink {
+
+/*
+ * The header of a pb frame, plain or extended, see kPbExtFrame
+ */
+struct PbFrameHeader {
+  uint32_t body_len;
+  bool ext;
+  uint64_t request_id;
+  uint32_t flags;
+  uint32_t method_id;   // with kPbFlagMethod
+
+  PbFrameHeader()
+      : body_len(0), ext(false), request_id(0), flags(0), method_id(0) {}
+
+  size_t size() const {
+    if (!ext) {
+      return COMMAND_HEADER_LENGTH;
+    }
+    return (flags & kPbFlagMethod) ?
+      kPbExtHeaderLength + kPbMethodIdLength : kPbExtHeaderLength;
+  }
+};
+
+/*
+ * Decode the header at buf, return its length, or 0 if len bytes are not
+ * enough for it
+ */
+inline size_t DecodePbHeader(const char* buf, size_t len,
+                             PbFrameHeader* header) {
+  if (len < COMMAND_HEADER_LENGTH) {
+    return 0;
+  }
+  uint32_t u32;
+  memcpy(&u32, buf, sizeof(u32));
+  u32 = be32toh(u32);
+  header->body_len = u32 & ~kPbExtFrame;
+  header->ext = (u32 & kPbExtFrame) != 0;
+  if (!header->ext) {
+    header->request_id = 0;
+    header->flags = 0;
+    header->method_id = 0;
+    return COMMAND_HEADER_LENGTH;
+  }
+  if (len < static_cast<size_t>(kPbExtHeaderLength)) {
+    return 0;
+  }
+  uint64_t u64;
+  memcpy(&u64, buf + 4, sizeof(u64));
+  header->request_id = be64toh(u64);
+  memcpy(&u32, buf + 12, sizeof(u32));
+  header->flags = be32toh(u32);
+  header->method_id = 0;
+  if (!(header->flags & kPbFlagMethod)) {
+    return kPbExtHeaderLength;
+  }
+  if (len < static_cast<size_t>(kPbExtHeaderLength + kPbMethodIdLength)) {
+    return 0;
+  }
+  memcpy(&u32, buf + kPbExtHeaderLength, sizeof(u32));
+  header->method_id = be32toh(u32);
+  return kPbExtHeaderLength + kPbMethodIdLength;
+}
+
+// buf has room for header.size() bytes
+inline size_t EncodePbHeader(const PbFrameHeader& header, char* buf) {
+  uint32_t u32 = htobe32(header.body_len | (header.ext ? kPbExtFrame : 0));
+  memcpy(buf, &u32, sizeof(u32));
+  if (!header.ext) {
+    return COMMAND_HEADER_LENGTH;
+  }
+  uint64_t u64 = htobe64(header.request_id);
+  memcpy(buf + 4, &u64, sizeof(u64));
+  u32 = htobe32(header.flags);
+  memcpy(buf + 12, &u32, sizeof(u32));
+  if (!(header.flags & kPbFlagMethod)) {
+    return kPbExtHeaderLength;
+  }
+  u32 = htobe32(header.method_id);
+  memcpy(buf + kPbExtHeaderLength, &u32, sizeof(u32));
+  return kPbExtHeaderLength + kPbMethodIdLength;
+}
+
+}  // namespace pink
+#endif  // PINK_SRC_PB_FRAME_H_
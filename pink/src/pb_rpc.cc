@@ -0,0 +1,219 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include "pink/include/pb_rpc.h"
+
+#include <atomic>
+#include <set>
+
+#include "pink/include/pb_conn.h"
+#include "pink/include/pink_histogram.h"
+#include "pink/src/pink_util.h"
+
+namespace pink {
+
+uint32_t PbMethodId(const std::string& full_name) {
+  uint32_t hash = 2166136261u;
+  for (unsigned char c : full_name) {
+    hash ^= c;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+uint32_t PbMethodId(const google::protobuf::MethodDescriptor* method) {
+  return PbMethodId(method->full_name());
+}
+
+void PbRpcController::Reset() {
+  failed_ = false;
+  reason_.clear();
+}
+
+void PbRpcController::SetFailed(const std::string& reason) {
+  failed_ = true;
+  reason_ = reason;
+}
+
+struct PbRpcServer::Method {
+  google::protobuf::Service* service;
+  const google::protobuf::MethodDescriptor* descriptor;
+  LatencyHistogram latency;
+  std::atomic<uint64_t> errors;
+
+  Method(google::protobuf::Service* _service,
+         const google::protobuf::MethodDescriptor* _descriptor)
+      : service(_service), descriptor(_descriptor), errors(0) {}
+};
+
+/*
+ * The closure of a call, it replies and deletes itself when run
+ */
+class PbRpcCall : public google::protobuf::Closure {
+ public:
+  PbRpcCall(PbRpcServer::Method* method, const PbReplier& replier,
+            google::protobuf::Message* request,
+            google::protobuf::Message* response)
+      : method_(method),
+        replier_(replier),
+        request_(request),
+        response_(response),
+        start_us_(NowMicros()) {}
+
+  virtual ~PbRpcCall() {
+    delete request_;
+    delete response_;
+  }
+
+  PbRpcController* controller() {
+    return &controller_;
+  }
+
+  void Run() override {
+    if (controller_.Failed()) {
+      method_->errors++;
+      replier_.ReplyError(controller_.ErrorText());
+    } else {
+      replier_.Reply(*response_);
+    }
+    method_->latency.Add(NowMicros() - start_us_);
+    delete this;
+  }
+
+ private:
+  PbRpcServer::Method* method_;
+  PbReplier replier_;
+  PbRpcController controller_;
+  google::protobuf::Message* request_;
+  google::protobuf::Message* response_;
+  uint64_t start_us_;
+};
+
+class PbRpcConn : public PbConn {
+ public:
+  PbRpcConn(int fd, const std::string& ip_port, ServerThread* thread,
+            const PbRpcServer* server)
+      : PbConn(fd, ip_port, thread),
+        server_(server) {}
+
+ protected:
+  int DealMessage() override;
+
+ private:
+  const PbRpcServer* server_;
+};
+
+int PbRpcConn::DealMessage() {
+  if (!ext_frame() || !(frame_flags() & kPbFlagMethod)) {
+    // Not a rpc request, we can't trust the rest of the stream
+    return -1;
+  }
+  PbReplier replier = DeferReply();
+  if (!replier.valid()) {
+    // Not served by a worker thread
+    return -1;
+  }
+  PbRpcServer::Method* method = server_->FindMethod(method_id());
+  if (method == NULL) {
+    replier.ReplyError("unknown method");
+    return 0;
+  }
+
+  // Not on the arena, the call may outlive the requests read together
+  google::protobuf::Service* service = method->service;
+  google::protobuf::Message* request =
+    service->GetRequestPrototype(method->descriptor).New();
+  if (!ParseRequest(request)) {
+    delete request;
+    method->errors++;
+    replier.ReplyError("parse request failed");
+    return 0;
+  }
+  google::protobuf::Message* response =
+    service->GetResponsePrototype(method->descriptor).New();
+  PbRpcCall* call = new PbRpcCall(method, replier, request, response);
+  service->CallMethod(method->descriptor, call->controller(),
+                      request, response, call);
+  return 0;
+}
+
+PbRpcServer::PbRpcServer() {
+}
+
+PbRpcServer::~PbRpcServer() {
+  for (auto& item : methods_) {
+    delete item.second;
+  }
+}
+
+bool PbRpcServer::AddService(google::protobuf::Service* service) {
+  const google::protobuf::ServiceDescriptor* descriptor =
+    service->GetDescriptor();
+  // The methods of the service may collide with each other too
+  std::set<uint32_t> ids;
+  for (int i = 0; i < descriptor->method_count(); i++) {
+    uint32_t id = PbMethodId(descriptor->method(i));
+    if (methods_.find(id) != methods_.end() || !ids.insert(id).second) {
+      return false;
+    }
+  }
+  for (int i = 0; i < descriptor->method_count(); i++) {
+    const google::protobuf::MethodDescriptor* method = descriptor->method(i);
+    methods_[PbMethodId(method)] = new Method(service, method);
+  }
+  return true;
+}
+
+PbRpcServer::Method* PbRpcServer::FindMethod(uint32_t method_id) const {
+  auto iter = methods_.find(method_id);
+  return iter == methods_.end() ? NULL : iter->second;
+}
+
+void PbRpcServer::MethodStats(std::vector<PbMethodStats>* stats) const {
+  stats->clear();
+  for (auto& item : methods_) {
+    Method* method = item.second;
+    PbMethodStats stat;
+    stat.name = method->descriptor->full_name();
+    stat.count = method->latency.count();
+    stat.errors = method->errors;
+    stat.total_us = method->latency.sum();
+    stat.max_us = method->latency.max();
+    stat.p99_us = method->latency.Percentile(99);
+    stats->push_back(stat);
+  }
+}
+
+void PbRpcServer::ClearStats() {
+  for (auto& item : methods_) {
+    item.second->latency.Clear();
+    item.second->errors = 0;
+  }
+}
+
+PinkConn* PbRpcServer::NewPinkConn(int connfd, const std::string &ip_port,
+                                   ServerThread *server_thread,
+                                   void* worker_private_data) const {
+  return new PbRpcConn(connfd, ip_port, server_thread, this);
+}
+
+void PbRpcChannel::CallMethod(
+    const google::protobuf::MethodDescriptor* method,
+    google::protobuf::RpcController* controller,
+    const google::protobuf::Message* request,
+    google::protobuf::Message* response,
+    google::protobuf::Closure* done) {
+  cli_->Call(PbMethodId(method), *request, response,
+             [controller, done](const Status& s) {
+    if (!s.ok() && controller != NULL) {
+      controller->SetFailed(s.ToString());
+    }
+    if (done != NULL) {
+      done->Run();
+    }
+  });
+}
+
+}  // namespace pink
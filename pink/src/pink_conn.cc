@@ -22,7 +22,8 @@ PinkConn::PinkConn(const int fd,
 #ifdef __ENABLE_SSL
       ssl_(nullptr),
 #endif
-      server_thread_(thread) {
+      server_thread_(thread),
+      worker_thread_(nullptr) {
   gettimeofday(&last_interaction_, nullptr);
 }
 
@@ -0,0 +1,89 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include "pink/include/pink_histogram.h"
+
+#include <stdio.h>
+
+namespace pink {
+
+static int BucketOf(uint64_t value) {
+  if (value == 0) {
+    return 0;
+  }
+  int bucket = 64 - __builtin_clzll(value);
+  return bucket < LatencyHistogram::kBuckets ?
+    bucket : LatencyHistogram::kBuckets - 1;
+}
+
+LatencyHistogram::LatencyHistogram() {
+  Clear();
+}
+
+void LatencyHistogram::Add(uint64_t value) {
+  buckets_[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+  uint64_t max = max_.load(std::memory_order_relaxed);
+  while (value > max &&
+         !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+  }
+}
+
+void LatencyHistogram::Clear() {
+  for (int i = 0; i < kBuckets; i++) {
+    buckets_[i].store(0, std::memory_order_relaxed);
+  }
+  count_.store(0, std::memory_order_relaxed);
+  sum_.store(0, std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+}
+
+double LatencyHistogram::Average() const {
+  uint64_t n = count();
+  return n == 0 ? 0 : static_cast<double>(sum()) / n;
+}
+
+uint64_t LatencyHistogram::Percentile(double percentile) const {
+  uint64_t counts[kBuckets];
+  uint64_t total = 0;
+  // The buckets may move while we read, count on the snapshot
+  for (int i = 0; i < kBuckets; i++) {
+    counts[i] = bucket(i);
+    total += counts[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+  uint64_t rank = static_cast<uint64_t>(total * percentile / 100);
+  if (rank >= total) {
+    rank = total - 1;
+  }
+  uint64_t seen = 0;
+  uint64_t bound = 0;
+  for (int i = 0; i < kBuckets; i++) {
+    seen += counts[i];
+    if (seen > rank) {
+      bound = i == 0 ? 0 : (1ULL << i) - 1;
+      break;
+    }
+  }
+  uint64_t m = max();
+  return bound < m ? bound : m;
+}
+
+std::string LatencyHistogram::ToString() const {
+  char buf[256];
+  snprintf(buf, sizeof(buf),
+           "count=%lu avg=%.1f p50=%lu p99=%lu p999=%lu max=%lu",
+           static_cast<unsigned long>(count()), Average(),
+           static_cast<unsigned long>(Percentile(50)),
+           static_cast<unsigned long>(Percentile(99)),
+           static_cast<unsigned long>(Percentile(99.9)),
+           static_cast<unsigned long>(max()));
+  return std::string(buf);
+}
+
+}  // namespace pink
@@ -5,7 +5,8 @@
 
 #include <vector>
 #include <algorithm>
-#include <sstream>
+#include <functional>
+#include <string>
 
 #include "pink/src/worker_thread.h"
 
@@ -16,24 +17,38 @@
 
 namespace pink {
 
-static std::string ConstructPublishResp(const std::string& subscribe_channel,
-                           const std::string& publish_channel,
-                           const std::string& msg,
-                           const bool pattern) {
-  std::stringstream resp;
-  std::string common_msg = "message";
-  std::string pattern_msg = "pmessage";
+static void AppendBulkString(const std::string& value, std::string* resp) {
+  resp->append("$");
+  resp->append(std::to_string(value.size()));
+  resp->append("\r\n");
+  resp->append(value);
+  resp->append("\r\n");
+}
+
+/*
+ * Build the message frame once, it is shared by all the subscribers of
+ * the channel or pattern
+ */
+static SharedResp ConstructPublishResp(const std::string& subscribe_channel,
+                                       const std::string& publish_channel,
+                                       const std::string& msg,
+                                       const bool pattern) {
+  static const std::string common_msg = "message";
+  static const std::string pattern_msg = "pmessage";
+  std::shared_ptr<std::string> resp = std::make_shared<std::string>();
+  resp->reserve(64 + (pattern ? subscribe_channel.size() : 0)
+                + publish_channel.size() + msg.size());
   if (pattern) {
-    resp << "*4\r\n" << "$" << pattern_msg.length()       << "\r\n" << pattern_msg       << "\r\n" <<
-                        "$" << subscribe_channel.length() << "\r\n" << subscribe_channel << "\r\n" <<
-                        "$" << publish_channel.length()   << "\r\n" << publish_channel   << "\r\n" <<
-                        "$" << msg.length()               << "\r\n" << msg               << "\r\n";
+    resp->append("*4\r\n");
+    AppendBulkString(pattern_msg, resp.get());
+    AppendBulkString(subscribe_channel, resp.get());
   } else {
-    resp << "*3\r\n" << "$" << common_msg.length()        << "\r\n" << common_msg        << "\r\n" <<
-                        "$" << publish_channel.length()   << "\r\n" << publish_channel   << "\r\n" <<
-                        "$" << msg.length()               << "\r\n" << msg               << "\r\n";
+    resp->append("*3\r\n");
+    AppendBulkString(common_msg, resp.get());
   }
-  return resp.str();
+  AppendBulkString(publish_channel, resp.get());
+  AppendBulkString(msg, resp.get());
+  return resp;
 }
 
 void CloseFd(PinkConn* conn) {
@@ -41,8 +56,12 @@ void CloseFd(PinkConn* conn) {
 }
 
 PubSubThread::PubSubThread()
-      : receiver_rsignal_(&receiver_mutex_),
-        receivers_(-1)  {
+      : group_(NULL),
+        receiver_rsignal_(&receiver_mutex_),
+        receivers_(-1),
+        max_pending_bytes_(0),
+        max_pending_msgs_(0),
+        slow_policy_(kSubscriberDisconnect) {
   pink_epoll_ = new PinkEpoll();
   if (pipe(msg_pfd_)) {
     exit(-1);
@@ -53,42 +72,385 @@ PubSubThread::PubSubThread()
     exit(-1);
   }
   pink_epoll_->PinkAddEvent(notify_pfd_[0], EPOLLIN | EPOLLERR | EPOLLHUP);
+
+  if (pipe(inbox_pfd_)) {
+    exit(-1);
+  }
+  pink_epoll_->PinkAddEvent(inbox_pfd_[0], EPOLLIN | EPOLLERR | EPOLLHUP);
 }
 
 PubSubThread::~PubSubThread() {
   delete(pink_epoll_);
+  close(msg_pfd_[0]);
+  close(msg_pfd_[1]);
+  close(notify_pfd_[0]);
+  close(notify_pfd_[1]);
+  close(inbox_pfd_[0]);
+  close(inbox_pfd_[1]);
 }
 
 void PubSubThread::RemoveConn(PinkConn* conn) {
-  pattern_mutex_.Lock();
-  for (auto it = pubsub_pattern_.begin(); it != pubsub_pattern_.end(); it++) {
-    for (auto conn_ptr = it->second.begin();
-              conn_ptr != it->second.end();
-              conn_ptr++) {
-      if ((*conn_ptr) == conn) {
-        conn_ptr = it->second.erase(conn_ptr);
-        break;
-      }
+  if (group_ != NULL) {
+    // The subscriptions of conn are spread over the shards
+    group_->RemoveConn(conn);
+    return;
+  }
+  DropAllSubscriptions(conn);
+  DetachConn(conn);
+}
+
+void PubSubThread::AttachConn(PinkConn* conn) {
+  {
+    slash::WriteLock l(&rwlock_);
+    conns_[conn->fd()] = conn;
+  }
+
+  {
+    slash::MutexLock l(&mutex_);
+    fd_queue_.push(conn->fd());
+    write(notify_pfd_[1], "", 1);
+  }
+}
+
+/*
+ * Called when conn has no subscription left, the messages not sent to it
+ * are dropped
+ */
+void PubSubThread::DetachConn(PinkConn* conn) {
+  {
+    slash::MutexLock l(&inbox_mutex_);
+    inbox_.erase(std::remove_if(inbox_.begin(), inbox_.end(),
+                                [conn](const Delivery& delivery) {
+                                  return delivery.conn == conn;
+                                }),
+                 inbox_.end());
+  }
+
+  pending_mutex_.Lock();
+  pending_.erase(conn);
+  pending_mutex_.Unlock();
+
+  pink_epoll_->PinkDelEvent(conn->fd());
+  slash::MutexLock l(&mutex_);
+  conns_.erase(conn->fd());
+}
+
+void PubSubThread::CloseConns(const std::unordered_set<PinkConn*>& conns) {
+  for (auto conn : conns) {
+    RemoveConn(conn);
+    CloseFd(conn);
+    delete conn;
+  }
+}
+
+/*
+ * The caller should hold pattern_mutex_ if pattern is true, otherwise
+ * channel_mutex_. Return false if the conn has subscribed already.
+ */
+bool PubSubThread::AddSubscription(PinkConn* conn, const std::string& name,
+                                   const bool pattern, PubSubThread* home) {
+  SubscriptionMap& client_map = pattern ? client_patterns_ : client_channels_;
+  if (!client_map[conn].insert(name).second) {
+    return false;
+  }
+  SubscriberMap& subscriber_map = pattern ? pubsub_pattern_ : pubsub_channel_;
+  Subscribers& conns = subscriber_map[name];
+  if (conns.empty() && pattern) {   // the pattern first subscribed
+    pattern_index_.Add(name);
+  }
+  conns[conn] = home;
+  return true;
+}
+
+void PubSubThread::EraseSubscriber(PinkConn* conn, const std::string& name,
+                                   const bool pattern) {
+  SubscriberMap& subscriber_map = pattern ? pubsub_pattern_ : pubsub_channel_;
+  auto it = subscriber_map.find(name);
+  if (it == subscriber_map.end()) {
+    return;
+  }
+  it->second.erase(conn);
+  if (it->second.empty()) {
+    if (pattern) {
+      pattern_index_.Remove(name);
     }
+    subscriber_map.erase(it);
+  }
+}
+
+/*
+ * Return false if the conn has not subscribed the name, the caller should
+ * hold the lock as AddSubscription
+ */
+bool PubSubThread::DropSubscription(PinkConn* conn, const std::string& name,
+                                    const bool pattern) {
+  SubscriptionMap& client_map = pattern ? client_patterns_ : client_channels_;
+  auto client = client_map.find(conn);
+  if (client == client_map.end() || client->second.erase(name) == 0) {
+    return false;
+  }
+  if (client->second.empty()) {
+    client_map.erase(client);
   }
+  EraseSubscriber(conn, name, pattern);
+  return true;
+}
+
+/*
+ * Drop all the channels or patterns of conn, their names are appended to
+ * removed if it is not NULL, the caller should hold the lock as
+ * AddSubscription
+ */
+void PubSubThread::DropSubscriptions(PinkConn* conn, const bool pattern,
+                                     std::vector<std::string>* removed) {
+  SubscriptionMap& client_map = pattern ? client_patterns_ : client_channels_;
+  auto client = client_map.find(conn);
+  if (client == client_map.end()) {
+    return;
+  }
+  for (auto& name : client->second) {
+    EraseSubscriber(conn, name, pattern);
+    if (removed != NULL) {
+      removed->push_back(name);
+    }
+  }
+  client_map.erase(client);
+}
+
+void PubSubThread::DropAllSubscriptions(PinkConn* conn) {
+  pattern_mutex_.Lock();
+  DropSubscriptions(conn, true, NULL);
   pattern_mutex_.Unlock();
 
   channel_mutex_.Lock();
-  for (auto it = pubsub_channel_.begin(); it != pubsub_channel_.end(); it++) {
-    for (auto conn_ptr = it->second.begin();
-              conn_ptr != it->second.end();
-              conn_ptr++) {
-      if ((*conn_ptr) == conn) {
-        conn_ptr = it->second.erase(conn_ptr);
-        break;
+  DropSubscriptions(conn, false, NULL);
+  channel_mutex_.Unlock();
+}
+
+/*
+ * Write the shared frame to every subscriber of this thread, the frames
+ * for the subscribers of other homes are added to remote. Connections
+ * failed to write are added to closed_conns, they should be removed by
+ * the caller. The caller should hold the lock of conns, till remote is
+ * delivered.
+ */
+int PubSubThread::SendToSubscribers(const Subscribers& conns,
+                                    const SharedResp& resp,
+                                    const std::string& channel,
+                                    std::unordered_set<PinkConn*>* closed_conns,
+                                    Deliveries* remote) {
+  int receivers = 0;
+  for (auto& subscriber : conns) {
+    if (subscriber.second != this) {
+      (*remote)[subscriber.second].push_back(
+          Delivery(subscriber.first, resp, channel));
+      receivers++;
+    } else if (SendToSubscriber(subscriber.first, resp, channel,
+                                closed_conns)) {
+      receivers++;
+    }
+  }
+  return receivers;
+}
+
+/*
+ * Return true if the frame is written out, the conns already in
+ * closed_conns are skipped
+ */
+bool PubSubThread::SendToSubscriber(PinkConn* conn, const SharedResp& resp,
+                                    const std::string& channel,
+                                    std::unordered_set<PinkConn*>* closed_conns) {
+  if (closed_conns->find(conn) != closed_conns->end()) {
+    return false;
+  }
+  if (IsBlocked(conn)) {
+    // Wait behind the reply being written instead of growing its buffer
+    if (!QueueMessage(conn, resp, channel)) {
+      closed_conns->insert(conn);
+    }
+    return false;
+  }
+  conn->WriteSharedResp(resp);
+  WriteStatus write_status = conn->SendReply();
+  if (write_status == kWriteHalf) {
+    pink_epoll_->PinkModEvent(conn->fd(), EPOLLIN, EPOLLOUT);
+    MarkBlocked(conn);
+  } else if (write_status == kWriteError) {
+    closed_conns->insert(conn);
+  }
+  return write_status == kWriteAll;
+}
+
+void PubSubThread::Deliver(std::vector<Delivery>* deliveries) {
+  if (deliveries->empty()) {
+    return;
+  }
+  slash::MutexLock l(&inbox_mutex_);
+  if (inbox_.empty()) {
+    write(inbox_pfd_[1], "", 1);
+  }
+  inbox_.insert(inbox_.end(),
+                std::make_move_iterator(deliveries->begin()),
+                std::make_move_iterator(deliveries->end()));
+  deliveries->clear();
+}
+
+/*
+ * Send the deliveries under inbox_mutex_, so a conn is not detached while
+ * it is written
+ */
+void PubSubThread::DrainInbox() {
+  std::unordered_set<PinkConn*> closed_conns;
+  {
+    slash::MutexLock l(&inbox_mutex_);
+    for (auto& delivery : inbox_) {
+      SendToSubscriber(delivery.conn, delivery.resp, delivery.channel,
+                       &closed_conns);
+    }
+    inbox_.clear();
+  }
+  CloseConns(closed_conns);
+}
+
+/*
+ * The messages published before conn unsubscribed are counted as
+ * received, so they go out ahead of the unsubscribe reply. A write error
+ * is left to the owner of conn.
+ */
+void PubSubThread::FlushInbox(PinkConn* conn) {
+  std::unordered_set<PinkConn*> closed_conns;
+  slash::MutexLock l(&inbox_mutex_);
+  auto last = std::stable_partition(inbox_.begin(), inbox_.end(),
+                                    [conn](const Delivery& delivery) {
+                                      return delivery.conn != conn;
+                                    });
+  for (auto iter = last; iter != inbox_.end(); ++iter) {
+    SendToSubscriber(conn, iter->resp, iter->channel, &closed_conns);
+  }
+  inbox_.erase(last, inbox_.end());
+}
+
+void PubSubThread::SetSubscriberLimit(size_t max_bytes, size_t max_msgs,
+                                      SlowSubscriberPolicy policy) {
+  max_pending_bytes_ = max_bytes;
+  max_pending_msgs_ = max_msgs;
+  slow_policy_ = policy;
+}
+
+bool PubSubThread::IsBlocked(PinkConn* conn) {
+  slash::MutexLock l(&pending_mutex_);
+  return pending_.find(conn) != pending_.end();
+}
+
+void PubSubThread::MarkBlocked(PinkConn* conn) {
+  slash::MutexLock l(&pending_mutex_);
+  pending_[conn];
+}
+
+bool PubSubThread::QueueMessage(PinkConn* conn, const SharedResp& resp,
+                                const std::string& channel) {
+  size_t max_bytes = max_pending_bytes_;
+  size_t max_msgs = max_pending_msgs_;
+  int policy = slow_policy_;
+
+  slash::MutexLock l(&pending_mutex_);
+  SubscriberQueue& queue = pending_[conn];
+  auto full = [&]() {
+    return (max_msgs != 0 && queue.msgs.size() + 1 > max_msgs)
+      || (max_bytes != 0 && queue.bytes + resp->size() > max_bytes);
+  };
+
+  if (full()) {
+    if (policy == kSubscriberDisconnect) {
+      // The queued messages are lost together with the connection
+      RecordDrop(channel, 1);
+      for (auto& msg : queue.msgs) {
+        RecordDrop(msg.channel, 1);
+      }
+      pending_.erase(conn);
+      return false;
+    }
+    if (policy == kSubscriberDropOldest) {
+      while (!queue.msgs.empty() && full()) {
+        queue.bytes -= queue.msgs.front().resp->size();
+        RecordDrop(queue.msgs.front().channel, 1);
+        queue.msgs.pop_front();
       }
     }
+    if (full()) {   // kSubscriberDropNewest, or the message alone is too big
+      RecordDrop(channel, 1);
+      return true;
+    }
   }
-  channel_mutex_.Unlock();
 
-  pink_epoll_->PinkDelEvent(conn->fd());
-  slash::MutexLock l(&mutex_);
-  conns_.erase(conn->fd());
+  PendingMessage msg;
+  msg.resp = resp;
+  msg.channel = channel;
+  queue.msgs.push_back(msg);
+  queue.bytes += resp->size();
+  return true;
+}
+
+/*
+ * Hand the queued messages of conn to the connection, ahead of any reply
+ * it makes next, return false if none is queued. conn is not blocked
+ * any more.
+ */
+bool PubSubThread::TakePending(PinkConn* conn) {
+  std::deque<PendingMessage> msgs;
+  {
+    slash::MutexLock l(&pending_mutex_);
+    auto iter = pending_.find(conn);
+    if (iter == pending_.end()) {
+      return false;
+    }
+    msgs.swap(iter->second.msgs);
+    pending_.erase(iter);
+  }
+  for (auto& msg : msgs) {
+    conn->WriteSharedResp(msg.resp);
+  }
+  return !msgs.empty();
+}
+
+/*
+ * Called when the reply of conn has been written out, send the queued
+ * messages
+ */
+WriteStatus PubSubThread::FlushPending(PinkConn* conn) {
+  if (!TakePending(conn)) {
+    return kWriteAll;
+  }
+  WriteStatus write_status = conn->SendReply();
+  if (write_status == kWriteHalf) {
+    MarkBlocked(conn);
+  }
+  return write_status;
+}
+
+/*
+ * Only the first kMaxDroppedChannels channels are counted by name, the
+ * drops of the others are counted under the empty channel name
+ */
+void PubSubThread::RecordDrop(const std::string& channel, uint64_t count) {
+  slash::MutexLock l(&dropped_mutex_);
+  auto iter = dropped_.find(channel);
+  if (iter == dropped_.end()) {
+    if (dropped_.size() >= kMaxDroppedChannels) {
+      dropped_[""] += count;
+      return;
+    }
+    iter = dropped_.insert(std::make_pair(channel, 0)).first;
+  }
+  iter->second += count;
+}
+
+void PubSubThread::PubSubDropped(
+    std::vector<std::pair<std::string, uint64_t>>* result) {
+  slash::MutexLock l(&dropped_mutex_);
+  for (auto& channel : dropped_) {
+    result->push_back(channel);
+  }
 }
 
 int PubSubThread::Publish(const std::string& channel, const std::string &msg) {
@@ -118,24 +480,16 @@ int PubSubThread::ClientChannelSize(PinkConn* conn) {
   int subscribed = 0;
 
   channel_mutex_.Lock();
-  for (auto& channel : pubsub_channel_) {
-    auto conn_ptr = std::find(channel.second.begin(),
-                              channel.second.end(),
-                              conn);
-    if (conn_ptr != channel.second.end()) {
-      subscribed++;
-    }
+  auto channels = client_channels_.find(conn);
+  if (channels != client_channels_.end()) {
+    subscribed += channels->second.size();
   }
   channel_mutex_.Unlock();
 
   pattern_mutex_.Lock();
-  for (auto& channel : pubsub_pattern_) {
-    auto conn_ptr = std::find(channel.second.begin(),
-                              channel.second.end(),
-                              conn);
-    if (conn_ptr != channel.second.end()) {
-      subscribed++;
-    }
+  auto patterns = client_patterns_.find(conn);
+  if (patterns != client_patterns_.end()) {
+    subscribed += patterns->second.size();
   }
   pattern_mutex_.Unlock();
 
@@ -149,53 +503,17 @@ void PubSubThread::Subscribe(PinkConn *conn,
   int subscribed = ClientChannelSize(conn);
   bool exist = (subscribed != 0);
 
+  slash::Mutex* mu = pattern ? &pattern_mutex_ : &channel_mutex_;
   for (size_t i = 0; i < channels.size(); i++) {
-    if (pattern) {  // if pattern mode, register channel to map
-      slash::MutexLock channel_lock(&pattern_mutex_);
-      if (pubsub_pattern_.find(channels[i]) != pubsub_pattern_.end()) {
-        auto conn_ptr = std::find(pubsub_pattern_[channels[i]].begin(),
-                                  pubsub_pattern_[channels[i]].end(),
-                                  conn);
-        if (conn_ptr == pubsub_pattern_[channels[i]].end()) {   // the connection first subscrbied
-          pubsub_pattern_[channels[i]].push_back(conn);
-          ++subscribed;
-        }
-      } else {    // the channel first subscribed
-        std::vector<PinkConn *> conns = {conn};
-        pubsub_pattern_[channels[i]] = conns;
-        ++subscribed;
-      }
-      result->push_back(std::make_pair(channels[i], subscribed));
-    } else {    // if general mode, reigster channel to map
-      slash::MutexLock channel_lock(&channel_mutex_);
-      if (pubsub_channel_.find(channels[i]) != pubsub_channel_.end()) {
-        auto conn_ptr = std::find(pubsub_channel_[channels[i]].begin(),
-                                  pubsub_channel_[channels[i]].end(),
-                                  conn);
-        if (conn_ptr == pubsub_channel_[channels[i]].end()) {   // the connection first subscribed
-          pubsub_channel_[channels[i]].push_back(conn);
-          ++subscribed;
-        }
-      } else {    // the channel first subscribed
-        std::vector<PinkConn *> conns = {conn};
-        pubsub_channel_[channels[i]] = conns;
-        ++subscribed;
-      }
-      result->push_back(std::make_pair(channels[i], subscribed));
+    slash::MutexLock l(mu);
+    if (AddSubscription(conn, channels[i], pattern, this)) {
+      ++subscribed;
     }
+    result->push_back(std::make_pair(channels[i], subscribed));
   }
 
   if (!exist) {
-    {
-      slash::WriteLock l(&rwlock_);
-      conns_[conn->fd()] = conn;
-    }
-
-    {
-      slash::MutexLock l(&mutex_);
-      fd_queue_.push(conn->fd());
-      write(notify_pfd_[1], "", 1);
-    }
+    AttachConn(conn);
   }
 }
 
@@ -208,79 +526,24 @@ int PubSubThread::UnSubscribe(PinkConn *conn,
                               const bool pattern,
                               std::vector<std::pair<std::string, int>>* result) {
   int subscribed = ClientChannelSize(conn);
-  bool exist = true;
-  if (subscribed == 0) {
-    exist = false;
-  }
+  bool exist = (subscribed != 0);
+  slash::Mutex* mu = pattern ? &pattern_mutex_ : &channel_mutex_;
   if (channels.size() == 0) {       // if client want to unsubscribe all of channels
-    if (pattern) {                  // all of pattern channels
-      slash::MutexLock l(&pattern_mutex_);
-      for (auto& channel : pubsub_pattern_) {
-        auto conn_ptr = std::find(channel.second.begin(),
-                                channel.second.end(),
-                                conn);
-        if (conn_ptr != channel.second.end()) {
-          result->push_back(std::make_pair(channel.first, --subscribed));
-        }
-      }
-    } else {
-      slash::MutexLock l(&channel_mutex_);
-      for (auto& channel : pubsub_channel_) {
-        auto conn_ptr = std::find(channel.second.begin(),
-                                channel.second.end(),
-                                conn);
-        if (conn_ptr != channel.second.end()) {
-          result->push_back(std::make_pair(channel.first, --subscribed));
-        }
-      }
+    std::vector<std::string> removed;
+    {
+      slash::MutexLock l(mu);
+      DropSubscriptions(conn, pattern, &removed);
     }
-    if (exist) {
-      RemoveConn(conn);
+    for (auto& channel : removed) {
+      result->push_back(std::make_pair(channel, --subscribed));
     }
-    return 0;
-  }
-
-  for (size_t i = 0; i < channels.size(); i++) {
-    if (pattern) {      // if pattern mode, unsubscribe the channels of specified
-      slash::MutexLock l(&pattern_mutex_);
-      auto channel_ptr = pubsub_pattern_.find(channels[i]);
-      if (channel_ptr != pubsub_pattern_.end()) {
-        auto it = std::find(channel_ptr->second.begin(),
-                            channel_ptr->second.end(),
-                            conn);
-        if (it != channel_ptr->second.end()) {
-          channel_ptr->second.erase(std::remove(
-                                                channel_ptr->second.begin(),
-                                                channel_ptr->second.end(),
-                                                conn),
-                                      channel_ptr->second.end());
-          result->push_back(std::make_pair(channels[i], --subscribed));
-        } else {
-          result->push_back(std::make_pair(channels[i], subscribed));
-        }
-      } else {
-        result->push_back(std::make_pair(channels[i], 0));
-      }
-    } else {            // if general mode, unsubscribe the channels of specified
-      slash::MutexLock l(&channel_mutex_);
-      auto channel_ptr = pubsub_channel_.find(channels[i]);
-      if (channel_ptr != pubsub_channel_.end()) {
-        auto it = std::find(channel_ptr->second.begin(),
-                            channel_ptr->second.end(),
-                            conn);
-        if (it != channel_ptr->second.end()) {
-          channel_ptr->second.erase(std::remove(
-                                  channel_ptr->second.begin(),
-                                  channel_ptr->second.end(),
-                                  conn),
-                                channel_ptr->second.end());
-          result->push_back(std::make_pair(channels[i], --subscribed));
-        } else {
-          result->push_back(std::make_pair(channels[i], subscribed));
-        }
-      } else {
-        result->push_back(std::make_pair(channels[i], 0));
+  } else {
+    for (size_t i = 0; i < channels.size(); i++) {
+      slash::MutexLock l(mu);
+      if (DropSubscription(conn, channels[i], pattern)) {
+        --subscribed;
       }
+      result->push_back(std::make_pair(channels[i], subscribed));
     }
   }
   // The number of channels this client currently subscibred
@@ -297,18 +560,14 @@ void PubSubThread::PubSubChannels(const std::string& pattern,
   if (pattern == "") {
     slash::MutexLock l(&channel_mutex_);
     for (auto& channel : pubsub_channel_) {
-      if (channel.second.size() != 0) {
-        result->push_back(channel.first);
-      }
+      result->push_back(channel.first);
     }
   } else {
+    GlobMatcher matcher(pattern);
     slash::MutexLock l(&channel_mutex_);
     for (auto& channel : pubsub_channel_) {
-      if (slash::stringmatchlen(channel.first.c_str(), channel.first.size(),
-                                pattern.c_str(), pattern.size(), 0)) {
-        if (channel.second.size() != 0) {
-          result->push_back(channel.first);
-        }
+      if (matcher.Match(channel.first)) {
+        result->push_back(channel.first);
       }
     }
   }
@@ -316,14 +575,12 @@ void PubSubThread::PubSubChannels(const std::string& pattern,
 
 void PubSubThread::PubSubNumSub(const std::vector<std::string> & channels,
                                 std::vector<std::pair<std::string, int>>* result) {
-  int subscribed;
   slash::MutexLock l(&channel_mutex_);
   for (size_t i = 0; i < channels.size(); i++) {
-    subscribed = 0;
-    for (auto& channel : pubsub_channel_) {
-      if (channel.first == channels[i]) {
-        subscribed = channel.second.size();
-      }
+    auto channel = pubsub_channel_.find(channels[i]);
+    int subscribed = 0;
+    if (channel != pubsub_channel_.end()) {
+      subscribed = channel->second.size();
     }
     result->push_back(std::make_pair(channels[i], subscribed));
   }
@@ -346,7 +603,7 @@ void *PubSubThread::ThreadMain() {
   char triger[1];
 
   while (!should_stop()) {
-    nfds = pink_epoll_->PinkPoll(-1);
+    nfds = pink_epoll_->PinkPoll(PINK_CRON_INTERVAL);
     for (int i = 0; i < nfds; i++) {
       pfe = (pink_epoll_->firedevent()) + i;
       if (pfe->fd == notify_pfd_[0]) {        // New connection comming
@@ -356,11 +613,22 @@ void *PubSubThread::ThreadMain() {
             slash::MutexLock l(&mutex_);
             int new_fd = fd_queue_.front();
             fd_queue_.pop();
-            pink_epoll_->PinkAddEvent(new_fd, EPOLLIN);
+            // A message may have blocked the conn before it is polled
+            auto iter = conns_.find(new_fd);
+            bool blocked = iter != conns_.end() && IsBlocked(iter->second);
+            pink_epoll_->PinkAddEvent(new_fd,
+                                      blocked ? EPOLLIN | EPOLLOUT : EPOLLIN);
           }
           continue;
         }
       }
+      if (pfe->fd == inbox_pfd_[0]) {         // Messages of other shards
+        if (pfe->mask & EPOLLIN) {
+          read(inbox_pfd_[0], triger, 1);
+          DrainInbox();
+        }
+        continue;
+      }
       if (pfe->fd == msg_pfd_[0]) {           // Publish message
         if (pfe->mask & EPOLLIN) {
           read(msg_pfd_[0], triger, 1);
@@ -372,56 +640,42 @@ void *PubSubThread::ThreadMain() {
           message_.clear();
 
           // Send message to clients
+          std::unordered_set<PinkConn*> closed_conns;
+          Deliveries remote;
           channel_mutex_.Lock();
-          for (auto it = pubsub_channel_.begin(); it != pubsub_channel_.end(); it++) {
-            if (channel == it->first) {
-              for (size_t i = 0; i < it->second.size(); i++) {
-                std::string resp = ConstructPublishResp(it->first, channel, msg, false);
-                it->second[i]->WriteResp(resp);
-                WriteStatus write_status = it->second[i]->SendReply();
-                if (write_status == kWriteHalf) {
-                  pink_epoll_->PinkModEvent(it->second[i]->fd(),
-                                            EPOLLIN, EPOLLOUT);
-                } else if (write_status == kWriteError) {
-                  channel_mutex_.Unlock();
-                  RemoveConn(it->second[i]);
-                  channel_mutex_.Lock();
-                  CloseFd(it->second[i]);
-                  delete(it->second[i]);
-                } else if (write_status == kWriteAll) {
-                  receivers++;
-                }
-              }
-            }
+          auto channel_ptr = pubsub_channel_.find(channel);
+          if (channel_ptr != pubsub_channel_.end()) {
+            SharedResp resp = ConstructPublishResp(channel_ptr->first,
+                                                   channel, msg, false);
+            receivers += SendToSubscribers(channel_ptr->second, resp,
+                                           channel, &closed_conns, &remote);
+          }
+          for (auto& home : remote) {
+            home.first->Deliver(&home.second);
           }
           channel_mutex_.Unlock();
 
           // Send message to clients
+          std::vector<const std::string*> patterns;
           pattern_mutex_.Lock();
-          for (auto it = pubsub_pattern_.begin(); it != pubsub_pattern_.end(); it++) {
-            if (slash::stringmatchlen(it->first.c_str(), it->first.size(),
-                                      channel.c_str(), channel.size(), 0)) {
-              for (size_t i = 0; i < it->second.size(); i++) {
-                std::string resp = ConstructPublishResp(it->first, channel, msg, true);
-                it->second[i]->WriteResp(resp);
-                WriteStatus write_status = it->second[i]->SendReply();
-                if (write_status == kWriteHalf) {
-                  pink_epoll_->PinkModEvent(it->second[i]->fd(),
-                                            EPOLLIN, EPOLLOUT);
-                } else if (write_status == kWriteError) {
-                  pattern_mutex_.Unlock();
-                  RemoveConn(it->second[i]);
-                  pattern_mutex_.Lock();
-                  CloseFd(it->second[i]);
-                  delete(it->second[i]);
-                } else if (write_status == kWriteAll) {
-                  receivers++;
-                }
-              }
+          pattern_index_.Match(channel, &patterns);
+          for (auto pattern : patterns) {
+            auto it = pubsub_pattern_.find(*pattern);
+            if (it != pubsub_pattern_.end()) {
+              SharedResp resp = ConstructPublishResp(it->first, channel,
+                                                     msg, true);
+              receivers += SendToSubscribers(it->second, resp, channel,
+                                             &closed_conns, &remote);
             }
           }
+          for (auto& home : remote) {
+            home.first->Deliver(&home.second);
+          }
           pattern_mutex_.Unlock();
 
+          // Remove the broken subscribers after the iteration
+          CloseConns(closed_conns);
+
           receiver_mutex_.Lock();
           receivers_ = receivers;
           receiver_rsignal_.Signal();
@@ -442,6 +696,9 @@ void *PubSubThread::ThreadMain() {
         // Send reply
         if (pfe->mask & EPOLLOUT && in_conn->is_reply()) {
           WriteStatus write_status = in_conn->SendReply();
+          if (write_status == kWriteAll) {
+            write_status = FlushPending(in_conn);
+          }
           if (write_status == kWriteAll) {
             in_conn->set_is_reply(false);
             pink_epoll_->PinkModEvent(pfe->fd, 0, EPOLLIN);  // Remove EPOLLOUT
@@ -456,6 +713,8 @@ void *PubSubThread::ThreadMain() {
 
         // Client request again
         if (!should_close && pfe->mask & EPOLLIN) {
+          // The reply goes after the messages queued for the client
+          TakePending(in_conn);
           ReadStatus getRes = in_conn->GetRequest();
           if (getRes != kReadAll && getRes != kReadHalf) {
             // kReadError kReadClose kFullError kParseError kDealError
@@ -466,6 +725,7 @@ void *PubSubThread::ThreadMain() {
               in_conn->set_is_reply(false);
             } else if (write_status == kWriteHalf) {
               pink_epoll_->PinkModEvent(pfe->fd, EPOLLIN, EPOLLOUT);
+              MarkBlocked(in_conn);
             } else if (write_status == kWriteError) {
               should_close = 1;
             }
@@ -496,4 +756,212 @@ void PubSubThread::Cleanup() {
   conns_.clear();
 }
 
+ShardedPubSub::ShardedPubSub(int shard_num)
+    : next_home_(0) {
+  if (shard_num < 1) {
+    shard_num = 1;
+  }
+  for (int i = 0; i < shard_num; i++) {
+    PubSubThread* shard = new PubSubThread();
+    shard->set_thread_name("PubSubShard" + std::to_string(i));
+    shard->group_ = this;
+    shards_.push_back(shard);
+  }
+}
+
+ShardedPubSub::~ShardedPubSub() {
+  StopThread();
+  for (auto shard : shards_) {
+    delete shard;
+  }
+}
+
+int ShardedPubSub::StartThread() {
+  for (auto shard : shards_) {
+    int ret = shard->StartThread();
+    if (ret != 0) {
+      return ret;
+    }
+  }
+  return 0;
+}
+
+int ShardedPubSub::StopThread() {
+  int result = 0;
+  for (auto shard : shards_) {
+    int ret = shard->StopThread();
+    if (ret != 0) {
+      result = ret;
+    }
+  }
+  return result;
+}
+
+/*
+ * Called by the home of conn when it closes conn, the home holds none of
+ * the locks of the shards
+ */
+void ShardedPubSub::RemoveConn(PinkConn* conn) {
+  slash::MutexLock l(&conns_mutex_);
+  auto iter = conns_.find(conn);
+  if (iter == conns_.end()) {
+    return;
+  }
+  PubSubThread* home = iter->second.home;
+  for (auto shard : shards_) {
+    shard->DropAllSubscriptions(conn);
+  }
+  conns_.erase(iter);
+  home->DetachConn(conn);
+}
+
+int ShardedPubSub::Publish(const std::string& channel,
+                           const std::string& msg) {
+  return ChannelShard(channel)->Publish(channel, msg);
+}
+
+void ShardedPubSub::Subscribe(PinkConn* conn,
+                              const std::vector<std::string>& channels,
+                              const bool pattern,
+                              std::vector<std::pair<std::string, int>>* result) {
+  slash::MutexLock l(&conns_mutex_);
+  auto iter = conns_.find(conn);
+  bool exist = (iter != conns_.end());
+  if (!exist) {
+    ConnInfo info;
+    info.home = shards_[next_home_++ % shards_.size()];
+    info.subscribed = 0;
+    iter = conns_.insert(std::make_pair(conn, info)).first;
+  }
+  ConnInfo& info = iter->second;
+
+  for (auto& name : channels) {
+    bool added = false;
+    if (pattern) {
+      for (auto shard : shards_) {
+        slash::MutexLock l(&shard->pattern_mutex_);
+        added = shard->AddSubscription(conn, name, true, info.home);
+      }
+    } else {
+      PubSubThread* shard = ChannelShard(name);
+      slash::MutexLock l(&shard->channel_mutex_);
+      added = shard->AddSubscription(conn, name, false, info.home);
+    }
+    if (added) {
+      ++info.subscribed;
+    }
+    result->push_back(std::make_pair(name, info.subscribed));
+  }
+
+  if (!exist) {
+    if (info.subscribed == 0) {
+      conns_.erase(iter);
+    } else {
+      info.home->AttachConn(conn);
+    }
+  }
+}
+
+int ShardedPubSub::UnSubscribe(PinkConn* conn,
+                               const std::vector<std::string>& channels,
+                               const bool pattern,
+                               std::vector<std::pair<std::string, int>>* result) {
+  slash::MutexLock l(&conns_mutex_);
+  auto iter = conns_.find(conn);
+  if (iter == conns_.end()) {
+    for (auto& name : channels) {
+      result->push_back(std::make_pair(name, 0));
+    }
+    return 0;
+  }
+  ConnInfo& info = iter->second;
+
+  if (channels.size() == 0) {       // if client want to unsubscribe all of channels
+    std::vector<std::string> removed;
+    for (size_t i = 0; i < shards_.size(); i++) {
+      PubSubThread* shard = shards_[i];
+      if (pattern) {
+        // Every shard has the same patterns
+        slash::MutexLock l(&shard->pattern_mutex_);
+        shard->DropSubscriptions(conn, true, i == 0 ? &removed : NULL);
+      } else {
+        slash::MutexLock l(&shard->channel_mutex_);
+        shard->DropSubscriptions(conn, false, &removed);
+      }
+    }
+    for (auto& name : removed) {
+      result->push_back(std::make_pair(name, --info.subscribed));
+    }
+  } else {
+    for (auto& name : channels) {
+      bool dropped = false;
+      if (pattern) {
+        for (auto shard : shards_) {
+          slash::MutexLock l(&shard->pattern_mutex_);
+          dropped = shard->DropSubscription(conn, name, true);
+        }
+      } else {
+        PubSubThread* shard = ChannelShard(name);
+        slash::MutexLock l(&shard->channel_mutex_);
+        dropped = shard->DropSubscription(conn, name, false);
+      }
+      if (dropped) {
+        --info.subscribed;
+      }
+      result->push_back(std::make_pair(name, info.subscribed));
+    }
+  }
+
+  int subscribed = info.subscribed;
+  if (subscribed == 0) {
+    PubSubThread* home = info.home;
+    conns_.erase(iter);
+    home->FlushInbox(conn);
+    home->DetachConn(conn);
+  }
+  return subscribed;
+}
+
+void ShardedPubSub::PubSubChannels(const std::string& pattern,
+                                   std::vector<std::string >* result) {
+  // A channel is only in its own shard
+  for (auto shard : shards_) {
+    shard->PubSubChannels(pattern, result);
+  }
+}
+
+void ShardedPubSub::PubSubNumSub(const std::vector<std::string>& channels,
+                                 std::vector<std::pair<std::string, int>>* result) {
+  for (auto& channel : channels) {
+    ChannelShard(channel)->PubSubNumSub(std::vector<std::string>(1, channel),
+                                        result);
+  }
+}
+
+int ShardedPubSub::PubSubNumPat() {
+  // Every shard has the same patterns
+  return shards_[0]->PubSubNumPat();
+}
+
+void ShardedPubSub::SetSubscriberLimit(size_t max_bytes, size_t max_msgs,
+                                       SlowSubscriberPolicy policy) {
+  for (auto shard : shards_) {
+    shard->SetSubscriberLimit(max_bytes, max_msgs, policy);
+  }
+}
+
+void ShardedPubSub::PubSubDropped(
+    std::vector<std::pair<std::string, uint64_t>>* result) {
+  // The drops are counted by the home of the subscribers
+  std::map<std::string, uint64_t> dropped;
+  for (auto shard : shards_) {
+    std::vector<std::pair<std::string, uint64_t>> shard_result;
+    shard->PubSubDropped(&shard_result);
+    for (auto& channel : shard_result) {
+      dropped[channel.first] += channel.second;
+    }
+  }
+  result->insert(result->end(), dropped.begin(), dropped.end());
+}
+
 };  // namespace pink
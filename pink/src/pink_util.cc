@@ -6,6 +6,7 @@
 #include <fcntl.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "pink/include/pink_define.h"
@@ -26,4 +27,14 @@ int Setnonblocking(int sockfd) {
   return flags;
 }
 
+uint64_t NowMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t NowMs() {
+  return NowMicros() / 1000;
+}
+
 }  // namespace pink
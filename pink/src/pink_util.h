@@ -6,10 +6,16 @@
 #ifndef PINK_SRC_PINK_UTIL_H_
 #define PINK_SRC_PINK_UTIL_H_
 
+#include <stdint.h>
+
 namespace pink {
 
 int Setnonblocking(int sockfd);
 
+// The monotonic clock, for the deadlines and the latencies
+uint64_t NowMicros();
+uint64_t NowMs();
+
 }  // namespace pink
 
 #endif  //  PINK_SRC_PINK_UTIL_H_
@@ -0,0 +1,100 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include "pink/src/pooled_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "slash/include/slash_mutex.h"
+
+namespace pink {
+
+const size_t PooledBuffer::kChunkSize;
+
+// Free chunks kept at most, 64MB
+static const size_t kMaxFreeChunks = 4096;
+
+static slash::Mutex chunks_mu;
+static std::vector<char*> free_chunks;
+
+static char* TakeChunk() {
+  {
+  slash::MutexLock l(&chunks_mu);
+  if (!free_chunks.empty()) {
+    char* chunk = free_chunks.back();
+    free_chunks.pop_back();
+    return chunk;
+  }
+  }
+  return static_cast<char*>(malloc(PooledBuffer::kChunkSize));
+}
+
+static void GiveChunk(char* chunk) {
+  {
+  slash::MutexLock l(&chunks_mu);
+  if (free_chunks.size() < kMaxFreeChunks) {
+    free_chunks.push_back(chunk);
+    return;
+  }
+  }
+  free(chunk);
+}
+
+bool PooledBuffer::Reserve(size_t size) {
+  if (size <= capacity_) {
+    return true;
+  }
+  if (size > max_size_) {
+    return false;
+  }
+  if (data_ == NULL && size <= kChunkSize) {
+    data_ = TakeChunk();
+    capacity_ = data_ == NULL ? 0 : kChunkSize;
+    return data_ != NULL;
+  }
+
+  size_t capacity = capacity_ == 0 ? kChunkSize : capacity_;
+  while (capacity < size) {
+    capacity *= 2;
+  }
+  if (capacity > max_size_) {
+    capacity = max_size_;
+  }
+  char* data;
+  if (capacity_ == kChunkSize) {
+    // Don't realloc a pooled chunk, it goes back to the pool
+    data = static_cast<char*>(malloc(capacity));
+    if (data != NULL) {
+      memcpy(data, data_, capacity_);
+      GiveChunk(data_);
+    }
+  } else {
+    data = static_cast<char*>(realloc(data_, capacity));
+  }
+  if (data == NULL) {
+    return false;
+  }
+  data_ = data;
+  capacity_ = capacity;
+  return true;
+}
+
+void PooledBuffer::Release() {
+  if (data_ == NULL) {
+    return;
+  }
+  if (capacity_ == kChunkSize) {
+    GiveChunk(data_);
+  } else {
+    free(data_);
+  }
+  data_ = NULL;
+  capacity_ = 0;
+}
+
+}  // namespace pink
@@ -0,0 +1,54 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef PINK_SRC_POOLED_BUFFER_H_
+#define PINK_SRC_POOLED_BUFFER_H_
+
+#include <stddef.h>
+
+namespace pink {
+
+/*
+ * PooledBuffer takes a kChunkSize chunk from a pool shared by all the
+ * connections when it's first reserved, and grows by realloc only when a
+ * message needs more, up to max_size. Release() gives a chunk back to the
+ * pool, a grown buffer is freed. An idle connection holds no memory.
+ */
+class PooledBuffer {
+ public:
+  static const size_t kChunkSize = 16 * 1024;
+
+  explicit PooledBuffer(size_t max_size)
+      : data_(NULL), capacity_(0), max_size_(max_size) {}
+  ~PooledBuffer() {
+    Release();
+  }
+
+  char* data() {
+    return data_;
+  }
+  size_t capacity() const {
+    return capacity_;
+  }
+  size_t max_size() const {
+    return max_size_;
+  }
+
+  // Return false if size is over max_size or no memory
+  bool Reserve(size_t size);
+  void Release();
+
+ private:
+  char* data_;
+  size_t capacity_;
+  size_t max_size_;
+
+  // No copying allowed
+  PooledBuffer(const PooledBuffer&);
+  void operator=(const PooledBuffer&);
+};
+
+}  // namespace pink
+#endif  // PINK_SRC_POOLED_BUFFER_H_
@@ -16,74 +16,16 @@
 
 #include "pink/include/pink_define.h"
 #include "pink/include/pink_cli.h"
+#include "pink/src/redis_reader.h"
 
 
 namespace pink {
 
-class RedisCli : public PinkCli {
- public:
-  RedisCli();
-  virtual ~RedisCli();
-
-  // msg should have been parsed
-  virtual Status Send(void *msg);
-
-  // Read, parse and store the reply
-  virtual Status Recv(void *result = NULL);
-
- private:
-  RedisCmdArgsType argv_;   // The parsed result
-
-  char *rbuf_;
-  int32_t rbuf_size_;
-  int32_t rbuf_pos_;
-  int32_t rbuf_offset_;
-  int elements_;    // the elements number of this current reply
-  int err_;
-
-  int GetReply();
-  int GetReplyFromReader();
-
-  int ProcessLineItem();
-  int ProcessBulkItem();
-  int ProcessMultiBulkItem();
-
-  ssize_t BufferRead();
-  char* ReadBytes(unsigned int bytes);
-  char* ReadLine(int *_len);
-
-  // No copyable
-  RedisCli(const RedisCli&);
-  void operator=(const RedisCli&);
-};
-
-enum REDIS_STATUS {
-  REDIS_ETIMEOUT = -5,
-  REDIS_EREAD_NULL = -4,
-  REDIS_EREAD = -3,     // errno is set
-  REDIS_EPARSE_TYPE = -2,
-  REDIS_ERR = -1,
-  REDIS_OK = 0,
-  REDIS_HALF,
-  REDIS_REPLY_STRING,
-  REDIS_REPLY_ARRAY,
-  REDIS_REPLY_INTEGER,
-  REDIS_REPLY_NIL,
-  REDIS_REPLY_STATUS,
-  REDIS_REPLY_ERROR
-};
-
-RedisCli::RedisCli()
-    : rbuf_size_(REDIS_IOBUF_LEN),
-      rbuf_pos_(0),
-      rbuf_offset_(0),
-      err_(REDIS_OK) {
-  rbuf_ = reinterpret_cast<char*>(malloc(sizeof(char) * rbuf_size_));
-
+RedisCli::RedisCli() : reader_(new RedisReader()) {
 }
 
 RedisCli::~RedisCli() {
-  free(rbuf_);
+  delete reader_;
 }
 
 // We use passed-in send buffer here
@@ -120,15 +62,9 @@ Status RedisCli::Send(void *msg) {
   return s;
 }
 
-// The result is useless
-Status RedisCli::Recv(void *trival) {
-  argv_.clear();
-  int result = GetReply();
+static Status ReplyStatus(int result) {
   switch (result) {
     case REDIS_OK:
-      if (trival != nullptr) {
-        *static_cast<RedisCmdArgsType*>(trival) = argv_;
-      }
       return Status::OK();
     case REDIS_ETIMEOUT:
       return Status::Timeout("");
@@ -144,251 +80,48 @@ Status RedisCli::Recv(void *trival) {
   }
 }
 
-ssize_t RedisCli::BufferRead() {
-  // memmove the remain chars to rbuf begin
-  if (rbuf_pos_ > 0) {
-    if (rbuf_offset_ > 0) {
-      memmove(rbuf_, rbuf_ + rbuf_pos_, rbuf_offset_);
-    }
-    rbuf_pos_ = 0;
+// The result is useless
+Status RedisCli::Recv(void *trival) {
+  argv_.clear();
+  int result = GetReply(&argv_);
+  if (result == REDIS_OK && trival != nullptr) {
+    *static_cast<RedisCmdArgsType*>(trival) = argv_;
   }
+  return ReplyStatus(result);
+}
 
-  ssize_t nread;
+Status RedisCli::RecvBatch(size_t n, std::vector<RedisCmdArgsType>* replies) {
+  replies->clear();
+  replies->reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    replies->push_back(RedisCmdArgsType());
+    int result = GetReply(&replies->back());
+    if (result != REDIS_OK) {
+      replies->pop_back();
+      return ReplyStatus(result);
+    }
+  }
+  return Status::OK();
+}
 
+int RedisCli::GetReply(RedisCmdArgsType* argv) {
   while (true) {
-    nread = read(fd(), rbuf_ + rbuf_offset_, rbuf_size_ - rbuf_offset_);
+    int result = reader_->GetReply(argv, NULL);
+    if (result != REDIS_HALF) {
+      return result;
+    }
 
+    ssize_t nread = reader_->Read(fd());
     if (nread == -1) {
-      if (errno == EINTR) {
-        continue;
       // blocking fd after setting setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO,...)
       // will return EAGAIN for timeout
-      } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
         return REDIS_ETIMEOUT;
-      } else {
-        return REDIS_EREAD;
       }
+      return REDIS_EREAD;
     } else if (nread == 0) {    // we consider read null an error
       return REDIS_EREAD_NULL;
     }
-
-    rbuf_offset_ += nread;
-    return nread;
-  }
-}
-
-/* Find pointer to \r\n. */
-static char *seekNewline(char *s, size_t len) {
-  int pos = 0;
-  int _len = len - 1;
-
-  /* Position should be < len-1 because the character at "pos" should be
-   * followed by a \n. Note that strchr cannot be used because it doesn't
-   * allow to search a limited length and the buffer that is being searched
-   * might not have a trailing NULL character. */
-  while (pos < _len) {
-    while (pos < _len && s[pos] != '\r') pos++;
-    if (s[pos] != '\r' || pos >= _len) {
-      /* Not found. */
-      return NULL;
-    } else {
-      if (s[pos+1] == '\n') {
-        /* Found. */
-        return s+pos;
-      } else {
-        /* Continue searching. */
-        pos++;
-      }
-    }
-  }
-  return NULL;
-}
-
-/* Read a long long value starting at *s, under the assumption that it will be
- * terminated by \r\n. Ambiguously returns -1 for unexpected input. */
-static long long readLongLong(char *s) {
-  long long v = 0;
-  int dec, mult = 1;
-  char c;
-
-  if (*s == '-') {
-    mult = -1;
-    s++;
-  } else if (*s == '+') {
-    mult = 1;
-    s++;
-  }
-
-  while ((c = *(s++)) != '\r') {
-    dec = c - '0';
-    if (dec >= 0 && dec < 10) {
-      v *= 10;
-      v += dec;
-    } else {
-      /* Should not happen... */
-      return -1;
-    }
-  }
-
-  return mult*v;
-}
-
-int RedisCli::ProcessLineItem() {
-  char *p;
-  int len;
-
-  if ((p = ReadLine(&len)) == NULL) {
-    return REDIS_HALF;
-  }
-
-  std::string arg(p, len);
-  argv_.push_back(arg);
-  elements_--;
-
-  return REDIS_OK;
-}
-
-int RedisCli::ProcessBulkItem() {
-  char *p, *s;
-  int len;
-  int bytelen;
-
-  p = rbuf_ + rbuf_pos_;
-  s = seekNewline(p, rbuf_offset_);
-  if (s != NULL) {
-    bytelen = s - p + 2; /* include \r\n */
-    len = readLongLong(p);
-
-    if (len == -1) {
-      elements_--;
-
-      rbuf_pos_ += bytelen; /* case '$-1\r\n' */
-      rbuf_offset_ -= bytelen;
-      return REDIS_OK;
-    } else if (len + 2 <= rbuf_offset_) {
-      argv_.push_back(std::string(p + bytelen, len));
-      elements_--;
-
-      bytelen += len + 2;   /* include \r\n */
-      rbuf_pos_ += bytelen;
-      rbuf_offset_ -= bytelen;
-      return REDIS_OK;
-    }
-  }
-
-  return REDIS_HALF;
-}
-
-int RedisCli::ProcessMultiBulkItem() {
-  char *p;
-  int len;
-
-  if ((p = ReadLine(&len)) != NULL) {
-    elements_ = readLongLong(p);
-    return REDIS_OK;
-  }
-
-  return REDIS_HALF;
-}
-
-int RedisCli::GetReply() {
-  int result = REDIS_OK;
-
-  elements_ = 1;
-  while (elements_ > 0) {
-    // Should read again
-    if (rbuf_offset_ == 0 || result == REDIS_HALF) {
-      if ((result = BufferRead()) < 0) {
-        return result;
-      }
-    }
-
-    // stop if error occured.
-    if ((result = GetReplyFromReader()) < REDIS_OK) {
-      break;
-    }
-  }
-
-  return result;
-}
-
-char* RedisCli::ReadBytes(unsigned int bytes) {
-  char *p = NULL;
-  if ((unsigned int)rbuf_offset_ >= bytes) {
-    p = rbuf_ + rbuf_pos_;
-    rbuf_pos_ += bytes;
-    rbuf_offset_ -= bytes;
-  }
-  return p;
-}
-
-char *RedisCli::ReadLine(int *_len) {
-  char *p, *s;
-  int len;
-
-  p = rbuf_ + rbuf_pos_;
-  s = seekNewline(p, rbuf_offset_);
-  if (s != NULL) {
-    len = s - (rbuf_ + rbuf_pos_);
-    rbuf_pos_ += len + 2; /* skip \r\n */
-    rbuf_offset_ -= len + 2;
-    if (_len) *_len = len;
-    return p;
-  }
-  return NULL;
-}
-
-int RedisCli::GetReplyFromReader() {
-  // if (err_) {
-  //   return REDIS_ERR;
-  // }
-
-  if (rbuf_offset_ == 0) {
-    return REDIS_HALF;
-  }
-
-  char *p;
-  if ((p = ReadBytes(1)) == NULL) {
-    return REDIS_HALF;
-  }
-
-  int type;
-  // Check reply type
-  switch (*p) {
-    case '-':
-      type = REDIS_REPLY_ERROR;
-      break;
-    case '+':
-      type = REDIS_REPLY_STATUS;
-      break;
-    case ':':
-      type = REDIS_REPLY_INTEGER;
-      break;
-    case '$':
-      type = REDIS_REPLY_STRING;
-      break;
-    case '*':
-      type = REDIS_REPLY_ARRAY;
-      break;
-    default:
-      return REDIS_EPARSE_TYPE;
-  }
-
-  switch (type) {
-    case REDIS_REPLY_ERROR:
-    case REDIS_REPLY_STATUS:
-    case REDIS_REPLY_INTEGER:
-      // elements_ = 1;
-      return ProcessLineItem();
-    case REDIS_REPLY_STRING:
-      // need processBulkItem();
-      // elements_ = 1;
-      return ProcessBulkItem();
-    case REDIS_REPLY_ARRAY:
-      // need processMultiBulkItem();
-      return ProcessMultiBulkItem();
-    default:
-      return REDIS_EPARSE_TYPE;  // Avoid warning.
   }
 }
 
@@ -632,4 +365,31 @@ int SerializeRedisCommand(RedisCmdArgsType argv, std::string *cmd)  {
   return redisFormatCommandArgv(argv, cmd);
 }
 
+// Serialize the commands as redisFormatCommandArgv, into one buffer
+Status RedisCli::SendBatch(const std::vector<RedisCmdArgsType>& cmds) {
+  size_t totlen = 0;
+  for (auto& argv : cmds) {
+    totlen += 1 + intlen(argv.size()) + 2;
+    for (auto& arg : argv) {
+      totlen += bulklen(arg.size());
+    }
+  }
+
+  std::string wbuf;
+  wbuf.reserve(totlen);
+  for (auto& argv : cmds) {
+    wbuf.append(1, '*');
+    wbuf.append(std::to_string(argv.size()));
+    wbuf.append("\r\n");
+    for (auto& arg : argv) {
+      wbuf.append(1, '$');
+      wbuf.append(std::to_string(arg.size()));
+      wbuf.append("\r\n");
+      wbuf.append(arg);
+      wbuf.append("\r\n");
+    }
+  }
+  return Send(&wbuf);
+}
+
 };  // namespace pink
@@ -7,6 +7,7 @@
 
 #include <stdlib.h>
 #include <limits.h>
+#include <sys/uio.h>
 
 #include <string>
 #include <sstream>
@@ -16,6 +17,9 @@
 
 namespace pink {
 
+// Max buffers gathered by one writev() in SendReply()
+static const int kMaxReplyIov = 64;
+
 static bool IsHexDigit(char ch) {
   return (ch>='0' && ch<='9') || (ch>='a' && ch<='f') || (ch>='A' && ch<'F');
 }
@@ -317,24 +321,45 @@ ReadStatus RedisConn::GetRequest() {
 }
 
 WriteStatus RedisConn::SendReply() {
+  struct iovec iov[kMaxReplyIov];
   ssize_t nwritten = 0;
-  size_t wbuf_len = response_.size();
-  while (wbuf_len > 0) {
-    nwritten = write(fd(), response_.data() + wbuf_pos_, wbuf_len - wbuf_pos_);
+  while (!shared_resp_.empty() || !response_.empty()) {
+    // Gather the pending buffers, the first one may be partially sent
+    int iovcnt = 0;
+    size_t offset = wbuf_pos_;
+    for (auto iter = shared_resp_.begin();
+         iter != shared_resp_.end() && iovcnt < kMaxReplyIov; iter++) {
+      iov[iovcnt].iov_base = const_cast<char*>((*iter)->data()) + offset;
+      iov[iovcnt].iov_len = (*iter)->size() - offset;
+      offset = 0;
+      iovcnt++;
+    }
+    if (iovcnt < kMaxReplyIov && !response_.empty()) {
+      iov[iovcnt].iov_base = const_cast<char*>(response_.data()) + offset;
+      iov[iovcnt].iov_len = response_.size() - offset;
+      iovcnt++;
+    }
+    nwritten = writev(fd(), iov, iovcnt);
     if (nwritten <= 0) {
       break;
     }
-    wbuf_pos_ += nwritten;
-    if (wbuf_pos_ == wbuf_len) {
+
+    size_t consumed = nwritten;
+    while (!shared_resp_.empty() &&
+           consumed >= shared_resp_.front()->size() - wbuf_pos_) {
+      consumed -= shared_resp_.front()->size() - wbuf_pos_;
+      shared_resp_.pop_front();
+      wbuf_pos_ = 0;
+    }
+    wbuf_pos_ += consumed;
+    if (shared_resp_.empty() && wbuf_pos_ == response_.size()) {
       // Have sended all response data
-      if (wbuf_len > DEFAULT_WBUF_SIZE) {
+      if (response_.size() > DEFAULT_WBUF_SIZE) {
         std::string buf;
         buf.reserve(DEFAULT_WBUF_SIZE);
         response_.swap(buf);
       }
       response_.clear();
-
-      wbuf_len = 0;
       wbuf_pos_ = 0;
     }
   }
@@ -346,7 +371,7 @@ WriteStatus RedisConn::SendReply() {
       return kWriteError;
     }
   }
-  if (wbuf_len == 0) {
+  if (shared_resp_.empty() && response_.empty()) {
     return kWriteAll;
   } else {
     return kWriteHalf;
@@ -358,6 +383,19 @@ void RedisConn::WriteResp(const std::string& resp) {
   set_is_reply(true);
 }
 
+void RedisConn::WriteSharedResp(const SharedResp& resp) {
+  // response_ is always sent after the shared replies, so move the pending
+  // part into the queue to keep the reply order
+  if (!response_.empty()) {
+    shared_resp_.push_back(std::make_shared<std::string>(std::move(response_)));
+    response_.clear();
+  }
+  if (!resp->empty()) {
+    shared_resp_.push_back(resp);
+  }
+  set_is_reply(true);
+}
+
 void RedisConn::TryResizeBuffer() {
   log_info("Current buffer size: %d", rbuf_len_);
   struct timeval now;
@@ -0,0 +1,219 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include "pink/src/redis_reader.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "pink/include/pink_define.h"
+
+namespace pink {
+
+/* Find pointer to \r\n. */
+static char *seekNewline(char *s, size_t len) {
+  int pos = 0;
+  int _len = len - 1;
+
+  /* Position should be < len-1 because the character at "pos" should be
+   * followed by a \n. Note that strchr cannot be used because it doesn't
+   * allow to search a limited length and the buffer that is being searched
+   * might not have a trailing NULL character. */
+  while (pos < _len) {
+    while (pos < _len && s[pos] != '\r') pos++;
+    if (s[pos] != '\r' || pos >= _len) {
+      /* Not found. */
+      return NULL;
+    } else {
+      if (s[pos+1] == '\n') {
+        /* Found. */
+        return s+pos;
+      } else {
+        /* Continue searching. */
+        pos++;
+      }
+    }
+  }
+  return NULL;
+}
+
+/* Read a long long value starting at *s, under the assumption that it will be
+ * terminated by \r\n. Ambiguously returns -1 for unexpected input. */
+static long long readLongLong(char *s) {
+  long long v = 0;
+  int dec, mult = 1;
+  char c;
+
+  if (*s == '-') {
+    mult = -1;
+    s++;
+  } else if (*s == '+') {
+    mult = 1;
+    s++;
+  }
+
+  while ((c = *(s++)) != '\r') {
+    dec = c - '0';
+    if (dec >= 0 && dec < 10) {
+      v *= 10;
+      v += dec;
+    } else {
+      /* Should not happen... */
+      return -1;
+    }
+  }
+
+  return mult*v;
+}
+
+RedisReader::RedisReader()
+    : rbuf_size_(REDIS_IOBUF_LEN),
+      rbuf_pos_(0),
+      rbuf_offset_(0),
+      type_(0) {
+  rbuf_ = reinterpret_cast<char*>(malloc(sizeof(char) * rbuf_size_));
+}
+
+RedisReader::~RedisReader() {
+  free(rbuf_);
+}
+
+void RedisReader::Reset() {
+  rbuf_pos_ = 0;
+  rbuf_offset_ = 0;
+  type_ = 0;
+  elements_.clear();
+  argv_.clear();
+}
+
+/*
+ * Move the remain bytes to rbuf begin and make room for len more
+ */
+void RedisReader::Reserve(size_t len) {
+  if (rbuf_pos_ > 0) {
+    if (rbuf_offset_ > 0) {
+      memmove(rbuf_, rbuf_ + rbuf_pos_, rbuf_offset_);
+    }
+    rbuf_pos_ = 0;
+  }
+  if (rbuf_size_ - rbuf_offset_ < len) {
+    while (rbuf_size_ - rbuf_offset_ < len) {
+      rbuf_size_ *= 2;
+    }
+    rbuf_ = reinterpret_cast<char*>(realloc(rbuf_, rbuf_size_));
+  }
+}
+
+ssize_t RedisReader::Read(int fd) {
+  // A bulk larger than the buffer grows it
+  Reserve(rbuf_offset_ == rbuf_size_ ? rbuf_size_ : 1);
+  ssize_t nread;
+  do {
+    nread = read(fd, rbuf_ + rbuf_offset_, rbuf_size_ - rbuf_offset_);
+  } while (nread == -1 && errno == EINTR);
+  if (nread > 0) {
+    rbuf_offset_ += nread;
+  }
+  return nread;
+}
+
+void RedisReader::Feed(const char* data, size_t len) {
+  Reserve(len);
+  memcpy(rbuf_ + rbuf_offset_, data, len);
+  rbuf_offset_ += len;
+}
+
+/*
+ * An item is parsed, count it to the arrays it belongs to, return true
+ * if the reply is complete
+ */
+bool RedisReader::FinishItem() {
+  while (!elements_.empty()) {
+    if (--elements_.back() > 0) {
+      return false;
+    }
+    // The array is complete, which is an item of its parent
+    elements_.pop_back();
+  }
+  return true;
+}
+
+int RedisReader::GetReply(RedisCmdArgsType* argv, int* type) {
+  while (rbuf_offset_ > 0) {
+    char *p = rbuf_ + rbuf_pos_;
+    char *s = seekNewline(p, rbuf_offset_);
+    if (s == NULL) {
+      return REDIS_HALF;
+    }
+    size_t linelen = s - p + 2;   /* include \r\n */
+
+    int item_type;
+    switch (*p) {
+      case '-':
+        item_type = REDIS_REPLY_ERROR;
+        break;
+      case '+':
+        item_type = REDIS_REPLY_STATUS;
+        break;
+      case ':':
+        item_type = REDIS_REPLY_INTEGER;
+        break;
+      case '$':
+        item_type = REDIS_REPLY_STRING;
+        break;
+      case '*':
+        item_type = REDIS_REPLY_ARRAY;
+        break;
+      default:
+        return REDIS_EPARSE_TYPE;
+    }
+
+    bool done = true;
+    if (item_type == REDIS_REPLY_STRING) {
+      long long len = readLongLong(p + 1);
+      if (len < 0) {
+        item_type = REDIS_REPLY_NIL;    /* case '$-1\r\n' */
+      } else if (linelen + len + 2 <= rbuf_offset_) {
+        argv_.push_back(std::string(s + 2, len));
+        linelen += len + 2;   /* include \r\n */
+      } else {
+        return REDIS_HALF;
+      }
+    } else if (item_type == REDIS_REPLY_ARRAY) {
+      long long len = readLongLong(p + 1);
+      if (len < 0) {
+        item_type = REDIS_REPLY_NIL;
+      } else if (len > 0) {
+        elements_.push_back(len);
+        done = false;
+      }
+    } else {
+      argv_.push_back(std::string(p + 1, s - p - 1));
+    }
+
+    if (type_ == 0) {
+      type_ = item_type;
+    }
+    rbuf_pos_ += linelen;
+    rbuf_offset_ -= linelen;
+
+    if (done && FinishItem()) {
+      argv->swap(argv_);
+      argv_.clear();
+      if (type != NULL) {
+        *type = type_;
+      }
+      type_ = 0;
+      return REDIS_OK;
+    }
+  }
+  return REDIS_HALF;
+}
+
+}  // namespace pink
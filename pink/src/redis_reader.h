@@ -0,0 +1,82 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef PINK_SRC_REDIS_READER_H_
+#define PINK_SRC_REDIS_READER_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <vector>
+
+#include "pink/include/redis_cli.h"
+
+namespace pink {
+
+enum REDIS_STATUS {
+  REDIS_ETIMEOUT = -5,
+  REDIS_EREAD_NULL = -4,
+  REDIS_EREAD = -3,     // errno is set
+  REDIS_EPARSE_TYPE = -2,
+  REDIS_ERR = -1,
+  REDIS_OK = 0,
+  REDIS_HALF,
+  REDIS_REPLY_STRING,
+  REDIS_REPLY_ARRAY,
+  REDIS_REPLY_INTEGER,
+  REDIS_REPLY_NIL,
+  REDIS_REPLY_STATUS,
+  REDIS_REPLY_ERROR
+};
+
+/*
+ * RedisReader parses the replies from the bytes read from a socket, the
+ * elements of the arrays are flattened into one RedisCmdArgsType and a nil
+ * adds no element. A partial reply is kept between the calls, so each
+ * item is parsed once however the bytes arrive.
+ */
+class RedisReader {
+ public:
+  RedisReader();
+  ~RedisReader();
+
+  // read() once into the buffer, return what read() returns
+  ssize_t Read(int fd);
+  void Feed(const char* data, size_t len);
+
+  /*
+   * Return REDIS_OK with argv and type set when a reply is complete,
+   * REDIS_HALF if more bytes are needed, or REDIS_EPARSE_TYPE. type is
+   * the REDIS_REPLY_* of the top level.
+   */
+  int GetReply(RedisCmdArgsType* argv, int* type);
+
+  // Drop the buffered bytes and the partial reply
+  void Reset();
+
+  size_t buffered() const {
+    return rbuf_offset_;
+  }
+
+ private:
+  void Reserve(size_t len);
+  bool FinishItem();
+
+  char* rbuf_;
+  size_t rbuf_size_;
+  size_t rbuf_pos_;
+  size_t rbuf_offset_;    // bytes not parsed from rbuf_pos_
+
+  int type_;                          // 0 before the reply begins
+  std::vector<long long> elements_;   // remain elements of the arrays
+  RedisCmdArgsType argv_;
+
+  // No copying allowed
+  RedisReader(const RedisReader&);
+  void operator=(const RedisReader&);
+};
+
+}  // namespace pink
+#endif  // PINK_SRC_REDIS_READER_H_
@@ -17,7 +17,6 @@
 
 namespace pink {
 
-static const uint32_t kHTTPMaxMessage = 1024 * 1024 * 8;
 static const uint32_t kHTTPMaxHeader = 1024 * 64;
 
 static const std::map<int, std::string> http_status_map = {
@@ -63,151 +62,31 @@ Request::Request():
   path("/index") {
 }
 
-inline int find_lf(const char* data, int size) {
-  const char* c = data;
-  int count = 0;
-  while (count < size) {
-    if (*c == '\n') {
-      break;
-    }
-    c++;
-    count++;
+void Request::BuildHeader(const char* data, const HTTPParser& parser) {
+  method = HTTPParser::Get(data, parser.method()).ToString();
+  version = HTTPParser::Get(data, parser.version()).ToString();
+  for (auto& field : parser.fields()) {
+    headers[slash::StringToLower(
+        HTTPParser::Get(data, field.key).ToString())] =
+      HTTPParser::Get(data, field.value).ToString();
   }
-  return count;
-}
-
-bool Request::ParseHeadLine(const char* data, int line_start,
-    int line_end, ParseStatus* parseStatus) {
-  std::string param_key;
-  std::string param_value;
-  for (int i = line_start; i <= line_end; i++) {
-    switch (*parseStatus) {
-      case kHeaderMethod:
-        if (data[i] != ' ') {
-          method.push_back(data[i]);
-        } else {
-          *parseStatus = kHeaderPath;
-        }
-        break;
-      case kHeaderPath:
-        if (data[i] != ' ') {
-          path.push_back(data[i]);
-        } else {
-          *parseStatus = kHeaderVersion;
-        }
-        break;
-      case kHeaderVersion:
-        if (data[i] != '\r' && data[i] != '\n') {
-          version.push_back(data[i]);
-        } else if (data[i] == '\n') {
-          *parseStatus = kHeaderParamKey;
-        }
-        break;
-      case kHeaderParamKey:
-        if (data[i] != ':' && data[i] != ' ') {
-          param_key.push_back(data[i]);
-        } else if (data[i] == ' ') {
-          *parseStatus = kHeaderParamValue;
-        }
-        break;
-      case kHeaderParamValue:
-        if (data[i] != '\r' && data[i] != '\n') {
-          param_value.push_back(data[i]);
-        } else if (data[i] == '\r') {
-          headers[slash::StringToLower(param_key)] = param_value;
-          *parseStatus = kHeaderParamKey;
-        }
-        break;
 
-      default:
-        return false;
-    }
-  }
-  return true;
-}
-
-bool Request::ParseGetUrl() {
-  // Format path
-  if (path.find(headers["host"]) != std::string::npos &&
-      path.size() > (7 + headers["host"].size())) {
-    // http://www.xxx.xxx/path/to
-    path.assign(path.substr(7 + headers["host"].size()));
-  }
-  size_t n = path.find('?');
-  if (n == std::string::npos) {
-    return true;  // no parameter
-  }
-  if (!ParseParameters(path, n + 1)) {
-    return false;
-  }
-  path.resize(n);
-  return true;
-}
-
-// Parse query parameter from GET url or POST application/x-www-form-urlencoded
-// format: key1=value1&key2=value2&key3=value3
-bool Request::ParseParameters(const std::string data,
-    size_t line_start, bool from_url) {
-  size_t pre = line_start, mid, end;
-  while (pre < data.size()) {
-    mid = data.find('=', pre);
-    if (mid == std::string::npos) {
-      mid = data.size();
-    }
-    end = data.find('&', pre);
-    if (end == std::string::npos) {
-      end = data.size();
-    }
-    if (end <= mid) {
-      // empty value
-      if (from_url) {
-        query_params[data.substr(pre, end - pre)]
-          = std::string();
-      } else {
-        post_params[data.substr(pre, end - pre)]
-          = std::string();
-      }
-      pre = end + 1;
-    } else {
-      if (from_url) {
-        query_params[data.substr(pre, mid - pre)]
-          = data.substr(mid + 1, end - mid - 1);
-      } else {
-        post_params[data.substr(pre, mid - pre)]
-          = data.substr(mid + 1, end - mid - 1);
-      }
-      pre = end + 1;
-    }
-  }
-  return true;
+  // Parse query parameter from url
+  slash::Slice url_path, query;
+  HTTPParser::SplitUrl(HTTPParser::Get(data, parser.url()), &url_path, &query);
+  path = url_path.ToString();
+  HTTPParser::ParseParameters(query.data(), query.data() + query.size(),
+      [this](const slash::Slice& key, const slash::Slice& value) {
+        query_params[key.ToString()] = value.ToString();
+      });
 }
 
 bool Request::ParseHeadFromArray(const char* data, const int size) {
-  int remain_size = size;
-  if (remain_size <= 5) {
-    return false;
-  }
-
-  // Parse header line
-  int line_start = 0;
-  int line_end = 0;
-  ParseStatus parseStatus = kHeaderMethod;
-  while (remain_size > 4) {
-    line_end += find_lf(data + line_start, remain_size);
-    if (line_end < line_start) {
-      return false;
-    }
-    if (!ParseHeadLine(data, line_start, line_end, &parseStatus)) {
-      return false;
-    }
-    remain_size -= (line_end - line_start + 1);
-    line_start = ++line_end;
-  }
-
-  // Parse query parameter from url
-  if (!ParseGetUrl()) {
+  HTTPParser parser;
+  if (parser.Parse(data, size) <= 0) {
     return false;
   }
+  BuildHeader(data, parser);
   return true;
 }
 
@@ -215,7 +94,11 @@ bool Request::ParseBodyFromArray(const char* data, const int size) {
   content.append(data, size);
   if (method == "POST" &&
       headers["content-type"] == "application/x-www-form-urlencoded") {
-    return ParseParameters(content, 0, false);
+    HTTPParser::ParseParameters(content.data(),
+        content.data() + content.size(),
+        [this](const slash::Slice& key, const slash::Slice& value) {
+          post_params[key.ToString()] = value.ToString();
+        });
   }
   return true;
 }
@@ -245,8 +128,8 @@ int Response::SerializeHeaderToArray(char* data, size_t size) {
   // Serialize statues line
   ret = snprintf(data, size, "HTTP/1.1 %d %s\r\n",
                  status_code_, reason_phrase_.c_str());
-  if (ret < 0 || ret == static_cast<int>(size)) {
-    return ret;
+  if (ret < 0 || ret >= static_cast<int>(size)) {
+    return -1;
   }
   serial_size += ret;
 
@@ -257,16 +140,16 @@ int Response::SerializeHeaderToArray(char* data, size_t size) {
   for (auto &line : headers_) {
     ret = snprintf(data + serial_size, size - serial_size, "%s: %s\r\n",
                    line.first.c_str(), line.second.c_str());
-    if (ret < 0) {
-      return ret;
+    if (ret < 0 || ret >= static_cast<int>(size) - serial_size) {
+      return -1;
     }
     serial_size += ret;
-    if (serial_size == static_cast<int>(size)) {
-      return serial_size;
-    }
   }
 
   ret = snprintf(data + serial_size, size - serial_size, "\r\n");
+  if (ret < 0 || ret >= static_cast<int>(size) - serial_size) {
+    return -1;
+  }
   serial_size += ret;
   return serial_size;
 }
@@ -297,21 +180,19 @@ SimpleHTTPConn::SimpleHTTPConn(const int fd, const std::string &ip_port,
                                ServerThread *thread)
     : PinkConn(fd, ip_port, thread),
       conn_status_(kHeader),
+      rbuf_(kHTTPMaxHeader),
       rbuf_pos_(0),
+      wbuf_(kHTTPMaxHeader),
       wbuf_len_(0),
       wbuf_pos_(0),
       header_len_(0),
       remain_packet_len_(0),
       response_pos_(-1) {
-  rbuf_ = reinterpret_cast<char*>(malloc(sizeof(char) * kHTTPMaxMessage));
-  wbuf_ = reinterpret_cast<char*>(malloc(sizeof(char) * kHTTPMaxMessage));
   request_ = new Request();
   response_ = new Response();
 }
 
 SimpleHTTPConn::~SimpleHTTPConn() {
-  free(rbuf_);
-  free(wbuf_);
   delete request_;
   delete response_;
 }
@@ -321,19 +202,12 @@ SimpleHTTPConn::~SimpleHTTPConn() {
  */
 bool SimpleHTTPConn::BuildRequestHeader() {
   request_->Clear();
-  if (!request_->ParseHeadFromArray(rbuf_, header_len_)) {
-    return false;
-  }
+  request_->BuildHeader(rbuf_.data(), parser_);
   auto iter = request_->headers.find("content-length");
-  if (iter == request_->headers.end()) {
-    remain_packet_len_ = 0;
-  } else {
-    long tmp = 0;
-    if (slash::string2l(iter->second.data(), iter->second.size(), &tmp)) {
-      remain_packet_len_ = tmp;
-    } else {
-      remain_packet_len_ = 0;
-    }
+  remain_packet_len_ = 0;
+  if (iter != request_->headers.end() &&
+      !HTTPParser::ParseContentLength(iter->second, &remain_packet_len_)) {
+    return false;
   }
 
   if (rbuf_pos_ > header_len_) {
@@ -343,7 +217,13 @@ bool SimpleHTTPConn::BuildRequestHeader() {
 }
 
 bool SimpleHTTPConn::AppendRequestBody() {
-  return request_->ParseBodyFromArray(rbuf_ + header_len_,
+  if (remain_packet_len_ > 0) {
+    // Parse the whole body with the last chunk
+    request_->content.append(rbuf_.data() + header_len_,
+                             rbuf_pos_ - header_len_);
+    return true;
+  }
+  return request_->ParseBodyFromArray(rbuf_.data() + header_len_,
       rbuf_pos_  - header_len_);
 }
 
@@ -358,20 +238,30 @@ ReadStatus SimpleHTTPConn::GetRequest() {
   while (true) {
     switch (conn_status_) {
       case kHeader: {
-        nread = read(fd(), rbuf_ + rbuf_pos_, kHTTPMaxHeader - rbuf_pos_);
+        // The header must be in the buffer at once, grow it if full
+        // Header too large if it can't grow
+        if (rbuf_.capacity() == rbuf_pos_ &&
+            !rbuf_.Reserve(std::min<size_t>(
+                  std::max<size_t>(rbuf_.capacity() * 2,
+                                   PooledBuffer::kChunkSize),
+                  rbuf_.max_size()))) {
+          return kReadError;
+        }
+        nread = read(fd(), rbuf_.data() + rbuf_pos_,
+                     rbuf_.capacity() - rbuf_pos_);
         if (nread == -1 && errno == EAGAIN) {
           return kReadHalf;
         } else if (nread <= 0) {
           return kReadClose;
         } else {
           rbuf_pos_ += nread;
-          // So that strstr will not parse the expire char
-          rbuf_[rbuf_pos_] = '\0';
-          char *sep_pos = strstr(rbuf_, "\r\n\r\n");
-          if (!sep_pos) {
+          int header_len = parser_.Parse(rbuf_.data(), rbuf_pos_);
+          if (header_len < 0) {
+            return kReadError;
+          } else if (header_len == 0) {
             break;
           }
-          header_len_ = sep_pos - rbuf_ + 4;
+          header_len_ = header_len;
           if (!BuildRequestHeader()) {
             return kReadError;
           }
@@ -392,10 +282,10 @@ ReadStatus SimpleHTTPConn::GetRequest() {
         break;
       }
       case kPacket: {
-        if (remain_packet_len_ > 0) {
-          nread = read(fd(), rbuf_ + rbuf_pos_,
-              (kHTTPMaxMessage - rbuf_pos_ > remain_packet_len_)
-              ? remain_packet_len_ : kHTTPMaxMessage - rbuf_pos_);
+        if (remain_packet_len_ > 0 && rbuf_pos_ < rbuf_.capacity()) {
+          nread = read(fd(), rbuf_.data() + rbuf_pos_,
+              (rbuf_.capacity() - rbuf_pos_ > remain_packet_len_)
+              ? remain_packet_len_ : rbuf_.capacity() - rbuf_pos_);
           if (nread == -1 && errno == EAGAIN) {
             return kReadHalf;
           } else if (nread <= 0) {
@@ -406,7 +296,7 @@ ReadStatus SimpleHTTPConn::GetRequest() {
           }
         }
         if (remain_packet_len_ == 0 ||  // no more content
-            rbuf_pos_ == kHTTPMaxMessage) {  // buffer full
+            rbuf_pos_ == rbuf_.capacity()) {  // buffer full
           AppendRequestBody();
           if (remain_packet_len_ == 0) {
             conn_status_ = kComplete;
@@ -420,6 +310,8 @@ ReadStatus SimpleHTTPConn::GetRequest() {
         HandleMessage();
         conn_status_ = kHeader;
         rbuf_pos_ = 0;
+        parser_.Reset();
+        rbuf_.Release();
         return kReadAll;
       }
       default: {
@@ -431,21 +323,26 @@ ReadStatus SimpleHTTPConn::GetRequest() {
 }
 
 bool SimpleHTTPConn::FillResponseBuf() {
+  if (!wbuf_.Reserve(PooledBuffer::kChunkSize)) {
+    return false;
+  }
   if (response_pos_ < 0) {
-    // Not ever serialize response header
-    int actual = response_->SerializeHeaderToArray(wbuf_ + wbuf_len_,
-        kHTTPMaxMessage - wbuf_len_);
-    if (actual < 0) {
-      return false;
+    // Not ever serialize response header, grow wbuf_ until it fits
+    int actual;
+    while ((actual = response_->SerializeHeaderToArray(
+                wbuf_.data() + wbuf_len_, wbuf_.capacity() - wbuf_len_)) < 0) {
+      if (!wbuf_.Reserve(wbuf_.capacity() * 2)) {
+        return false;
+      }
     }
     wbuf_len_ += actual;
     response_pos_ = 0;  // Serialize body next time
   }
   while (response_->HasMoreBody(response_pos_)
-      && wbuf_len_ < kHTTPMaxMessage) {
+      && wbuf_len_ < wbuf_.capacity()) {
     // Has more body and more space in wbuf_
-    wbuf_len_ += response_->SerializeBodyToArray(wbuf_ + wbuf_len_,
-        kHTTPMaxMessage - wbuf_len_, &response_pos_);
+    wbuf_len_ += response_->SerializeBodyToArray(wbuf_.data() + wbuf_len_,
+        wbuf_.capacity() - wbuf_len_, &response_pos_);
   }
   return true;
 }
@@ -458,7 +355,7 @@ WriteStatus SimpleHTTPConn::SendReply() {
 
   ssize_t nwritten = 0;
   while (wbuf_len_ > 0) {
-    nwritten = write(fd(), wbuf_ + wbuf_pos_, wbuf_len_ - wbuf_pos_);
+    nwritten = write(fd(), wbuf_.data() + wbuf_pos_, wbuf_len_ - wbuf_pos_);
     if (nwritten == -1 && errno == EAGAIN) {
       return kWriteHalf;
     } else if (nwritten <= 0) {
@@ -475,6 +372,7 @@ WriteStatus SimpleHTTPConn::SendReply() {
     }
   }
   response_pos_ = -1;  // fill header first next time
+  wbuf_.Release();
 
   return kWriteAll;
 }
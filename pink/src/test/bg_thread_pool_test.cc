@@ -0,0 +1,112 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include "pink/include/bg_thread_pool.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "gmock/gmock.h"
+
+static std::atomic<int> counter(0);
+
+struct SpawnArg {
+  pink::BGThreadPool* pool;
+  int children;
+};
+
+static void Count(void* arg) {
+  (void)arg;
+  counter++;
+}
+
+static void Spawn(void* arg) {
+  SpawnArg* spawn = static_cast<SpawnArg*>(arg);
+  for (int i = 0; i < spawn->children; i++) {
+    spawn->pool->Schedule(Count, NULL);
+  }
+  counter++;
+}
+
+static void Sleep(void* arg) {
+  (void)arg;
+  usleep(200000);
+}
+
+TEST(BGThreadPoolTest, ScheduleAndSteal) {
+  counter = 0;
+  pink::BGThreadPool pool(4, 1000);
+  EXPECT_EQ(0, pool.StartThread());
+
+  // A long task holds one worker only
+  pool.Schedule(Sleep, NULL);
+  SpawnArg spawn = {&pool, 100};
+  for (int i = 0; i < 100; i++) {
+    pool.Schedule(Spawn, &spawn);
+  }
+  for (int i = 0; i < 100 && counter < 100 * 101; i++) {
+    usleep(10000);
+  }
+  EXPECT_EQ(100 * 101, counter);
+
+  pool.StopThread();
+}
+
+TEST(BGThreadPoolTest, DelayScheduleAndSwallow) {
+  counter = 0;
+  pink::BGThreadPool pool(2);
+  EXPECT_EQ(0, pool.StartThread());
+
+  pool.DelaySchedule(50, Count, NULL);
+  pool.DelaySchedule(100000, Count, NULL);
+  usleep(200000);
+  EXPECT_EQ(1, counter);
+
+  int pri_size, qu_size;
+  pool.QueueSize(&pri_size, &qu_size);
+  EXPECT_EQ(1, pri_size);
+
+  // The ready tasks are swallowed on stop, the pending timer is not
+  for (int i = 0; i < 2; i++) {
+    pool.Schedule(Sleep, NULL);
+  }
+  for (int i = 0; i < 10; i++) {
+    pool.Schedule(Count, NULL);
+  }
+  pool.StopThread();
+  EXPECT_EQ(11, counter);
+}
+
+// Bigger than the inline buffer of BGTask
+struct BigTask {
+  char padding[128];
+  std::unique_ptr<int> value;
+  void operator()() {
+    counter += *value;
+  }
+};
+
+TEST(BGThreadPoolTest, ClosureAndBatch) {
+  counter = 0;
+  pink::BGThreadPool pool(2);
+  EXPECT_EQ(0, pool.StartThread());
+
+  std::vector<pink::BGTask> tasks;
+  for (int i = 1; i <= 10; i++) {
+    tasks.emplace_back([i]() { counter += i; });
+  }
+  BigTask big;
+  big.value.reset(new int(100));
+  tasks.emplace_back(std::move(big));
+  pool.ScheduleBatch(&tasks);
+  EXPECT_TRUE(tasks.empty());
+
+  pool.Schedule([]() { counter += 1000; });
+  pool.StopThread();
+  EXPECT_EQ(55 + 100 + 1000, counter);
+}
@@ -0,0 +1,170 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include "pink/include/bg_thread.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+
+TEST(BGThreadTest, WeightedLanes) {
+  pink::BGThread thread;
+  std::vector<pink::BGLaneOptions> options;
+  options.push_back(pink::BGLaneOptions(3));
+  options.push_back(pink::BGLaneOptions(1, true));
+  thread.SetLanes(options);
+  EXPECT_EQ(2, thread.lane_num());
+
+  // Queue before start so the order only depends on the lanes
+  std::string order;
+  for (int i = 0; i < 6; i++) {
+    thread.Schedule(0, [&order]() { order += 'h'; });
+    thread.Schedule(1, [&order]() { order += 'l'; });
+  }
+  // Expired before the thread starts
+  thread.Schedule(1, [&order]() { order += 'x'; }, 1);
+  usleep(5000);
+
+  int pri_size, qu_size;
+  thread.QueueSize(&pri_size, &qu_size);
+  EXPECT_EQ(13, qu_size);
+
+  thread.StartThread();
+  while (true) {
+    thread.QueueSize(&pri_size, &qu_size);
+    if (qu_size == 0) {
+      break;
+    }
+    usleep(1000);
+  }
+  thread.StopThread();
+
+  // 3:1 while both lanes have tasks, the low lane is not starved
+  EXPECT_EQ("hhlhhhlhllll", order);
+
+  std::vector<pink::BGLaneStats> stats;
+  thread.QueueSize(&stats);
+  ASSERT_EQ(2u, stats.size());
+  EXPECT_EQ(0u, stats[0].depth);
+  EXPECT_EQ(6u, stats[0].dequeued);
+  EXPECT_EQ(7u, stats[1].dequeued);
+  EXPECT_EQ(1u, stats[1].expired);
+  EXPECT_EQ(1u, stats[1].dropped);
+  EXPECT_GE(stats[1].max_wait_us, 5000u);
+}
+
+static void SleepTask(void* arg) {
+  usleep(*static_cast<int*>(arg));
+}
+
+TEST(BGThreadTest, Timing) {
+  pink::LatencyHistogram histogram;
+  for (uint64_t i = 1; i <= 1000; i++) {
+    histogram.Add(i);
+  }
+  EXPECT_EQ(1000u, histogram.count());
+  EXPECT_EQ(1000u, histogram.max());
+  EXPECT_EQ(511u, histogram.Percentile(50));
+  EXPECT_EQ(1000u, histogram.Percentile(99));
+
+  pink::BGThread thread;
+  thread.EnableTiming(true);
+  thread.RegisterTaskName(SleepTask, "sleep");
+  int sleep_us = 2000;
+  for (int i = 0; i < 5; i++) {
+    thread.Schedule(SleepTask, &sleep_us);
+  }
+  int counter = 0;
+  auto incr = [&counter]() { counter++; };
+  thread.RegisterTaskName(pink::BGTask::KeyOf<decltype(incr)>(), "incr");
+  thread.Schedule(incr);
+  thread.StartThread();
+  thread.StopThread();
+
+  EXPECT_EQ(1, counter);
+  EXPECT_EQ(6u, thread.wait_histogram().count());
+  EXPECT_EQ(6u, thread.run_histogram().count());
+  // The last task waited for the sleeping ones
+  EXPECT_GE(thread.wait_histogram().max(), 10000u);
+
+  std::vector<pink::BGTaskTiming> timings;
+  thread.TaskTimings(&timings);
+  ASSERT_EQ(2u, timings.size());
+  for (auto& timing : timings) {
+    if (timing.name == "sleep") {
+      EXPECT_EQ(5u, timing.count);
+      EXPECT_GE(timing.total_us, 10000u);
+    } else {
+      EXPECT_EQ("incr", timing.name);
+      EXPECT_EQ(1u, timing.count);
+    }
+  }
+}
+
+// Holds a unique_ptr, so only movable
+struct MoveOnlyTask {
+  std::unique_ptr<int> value;
+  std::vector<int>* out;
+  void operator()() {
+    out->push_back(*value);
+  }
+};
+
+// Too big to be stored in the queue, it takes the heap
+struct OversizedTask {
+  char pad[pink::BGTask::kInlineSize * 2];
+  int value;
+  std::vector<int>* out;
+  void operator()() {
+    out->push_back(value + pad[0]);
+  }
+};
+
+TEST(BGThreadTest, CallablesAndBatch) {
+  static_assert(sizeof(OversizedTask) > pink::BGTask::kInlineSize,
+                "OversizedTask must not fit inline");
+  pink::BGThread thread;
+  std::vector<int> out;
+
+  MoveOnlyTask move_only;
+  move_only.value.reset(new int(1));
+  move_only.out = &out;
+  thread.Schedule(std::move(move_only));
+
+  OversizedTask oversized;
+  memset(oversized.pad, 0, sizeof(oversized.pad));
+  oversized.value = 2;
+  oversized.out = &out;
+  thread.Schedule(std::move(oversized));
+
+  std::vector<pink::BGTask> tasks;
+  for (int i = 3; i <= 10; i++) {
+    tasks.emplace_back([&out, i]() { out.push_back(i); });
+  }
+  std::atomic<bool> done(false);
+  tasks.emplace_back([&done]() { done = true; });
+  thread.ScheduleBatch(&tasks);
+  EXPECT_TRUE(tasks.empty());
+
+  thread.StartThread();
+  for (int i = 0; i < 1000 && !done; i++) {
+    usleep(1000);
+  }
+  thread.StopThread();
+
+  ASSERT_TRUE(done);
+  std::vector<int> expected;
+  for (int i = 1; i <= 10; i++) {
+    expected.push_back(i);
+  }
+  EXPECT_EQ(expected, out);
+}
@@ -0,0 +1,128 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "pink/include/framed_conn.h"
+#include "pink/include/server_thread.h"
+#include "gmock/gmock.h"
+
+static const int kPort = 19251;
+
+/*
+ * [ type (2) | reserved (2) | body length (4, big endian) | body ]
+ */
+struct TestCodec {
+  static const size_t kHeaderSize = 8;
+  static const size_t kMaxBody = 1 << 20;
+
+  static size_t BodyLength(const char* header) {
+    uint32_t len;
+    memcpy(&len, header + 4, sizeof(len));
+    return ntohl(len);
+  }
+};
+
+static std::string Frame(uint16_t type, const std::string& body) {
+  char header[TestCodec::kHeaderSize];
+  uint16_t t = htons(type);
+  uint32_t len = htonl(body.size());
+  memcpy(header, &t, sizeof(t));
+  memset(header + 2, 0, 2);
+  memcpy(header + 4, &len, sizeof(len));
+  return std::string(header, sizeof(header)) + body;
+}
+
+// Echo the frames, the large ones without copy
+class EchoFramedConn : public pink::FramedConn<TestCodec> {
+ public:
+  EchoFramedConn(int fd, const std::string& ip_port,
+                 pink::ServerThread* thread)
+      : FramedConn(fd, ip_port, thread) {}
+
+ protected:
+  int DealFrame(const pink::FrameView& frame) override {
+    if (frame.body_len > 8192) {
+      Reply(std::string(frame.header, TestCodec::kHeaderSize + frame.body_len));
+    } else {
+      Reply(frame.header, TestCodec::kHeaderSize + frame.body_len);
+    }
+    return 0;
+  }
+};
+
+class EchoFramedConnFactory : public pink::ConnFactory {
+ public:
+  virtual pink::PinkConn *NewPinkConn(int connfd, const std::string &ip_port,
+                                      pink::ServerThread *thread,
+                                      void*) const {
+    return new EchoFramedConn(connfd, ip_port, thread);
+  }
+};
+
+static int Connect(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr),
+              sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+TEST(FramedConnTest, Echo) {
+  EchoFramedConnFactory factory;
+  pink::ServerThread* server = pink::NewDispatchThread(kPort, 1, &factory);
+  ASSERT_EQ(0, server->StartThread());
+  int fd = Connect(kPort);
+  ASSERT_NE(-1, fd);
+
+  // Small frames, an empty one and a large one, written in odd pieces
+  std::string data;
+  for (int i = 0; i < 300; i++) {
+    data += Frame(i, std::string(i % 50, 'a' + i % 26));
+  }
+  data += Frame(1, "");
+  data += Frame(2, std::string(100000, 'z'));
+  for (size_t pos = 0; pos < data.size(); pos += 7777) {
+    size_t len = std::min<size_t>(7777, data.size() - pos);
+    ASSERT_EQ(static_cast<ssize_t>(len), write(fd, data.data() + pos, len));
+    usleep(1000);
+  }
+
+  std::string replies;
+  char buf[4096];
+  while (replies.size() < data.size()) {
+    ssize_t nread = read(fd, buf, sizeof(buf));
+    ASSERT_GT(nread, 0);
+    replies.append(buf, nread);
+  }
+  EXPECT_EQ(data, replies);
+  close(fd);
+
+  // A frame over kMaxBody closes the connection
+  fd = Connect(kPort);
+  ASSERT_NE(-1, fd);
+  std::string header = Frame(3, "").substr(0, 4);
+  uint32_t len = htonl(TestCodec::kMaxBody + 1);
+  header.append(reinterpret_cast<char*>(&len), sizeof(len));
+  ASSERT_EQ(8, write(fd, header.data(), header.size()));
+  EXPECT_EQ(0, read(fd, buf, sizeof(buf)));
+  close(fd);
+
+  server->StopThread();
+  delete server;
+}
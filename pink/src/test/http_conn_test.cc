@@ -0,0 +1,637 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pink/include/http_conn.h"
+#include "pink/include/http_static.h"
+#include "pink/include/server_thread.h"
+#include "pink/src/pooled_buffer.h"
+#include "gmock/gmock.h"
+
+using pink::HTTPHandles;
+
+static const int kPort = 19261;
+
+typedef std::function<std::shared_ptr<HTTPHandles>()> HandlesFactory;
+
+class TestConnFactory : public pink::ConnFactory {
+ public:
+  explicit TestConnFactory(const HandlesFactory& factory)
+      : factory_(factory) {}
+
+  virtual pink::PinkConn *NewPinkConn(int connfd, const std::string &ip_port,
+                                      pink::ServerThread *thread,
+                                      void* worker_specific_data) const {
+    return new pink::HTTPConn(connfd, ip_port, thread, factory_(),
+                              worker_specific_data);
+  }
+
+ private:
+  HandlesFactory factory_;
+};
+
+/*
+ * Reply the body with Content-Length, or in chunks for "?chunked=1", with
+ * the status code of "status", "X-Path" tells the path
+ */
+class EchoHandles : public HTTPHandles {
+ public:
+  EchoHandles() : chunked_(false), status_(0), pos_(0) {}
+
+  virtual bool HandleRequest(const pink::HTTPRequest* req) override {
+    path_ = req->path().ToString();
+    chunked_ = req->query_value("chunked") == "1";
+    status_ = atoi(req->query_value("status").ToString().c_str());
+    body_.clear();
+    return false;
+  }
+  virtual void HandleBodyData(const char* data, size_t data_size) override {
+    body_.append(data, data_size);
+  }
+  virtual void PrepareResponse(pink::HTTPResponse* resp) override {
+    pos_ = 0;
+    if (status_ != 0) {
+      resp->SetStatusCode(status_);
+    }
+    resp->SetHeaders("X-Path", path_);
+    if (!chunked_) {
+      resp->SetContentLength(body_.size());
+    }
+  }
+  virtual int WriteResponseBody(char* buf, size_t max_size) override {
+    size_t size = std::min(max_size, body_.size() - pos_);
+    memcpy(buf, body_.data() + pos_, size);
+    pos_ += size;
+    return size == 0 ? -2 : static_cast<int>(size);
+  }
+
+ private:
+  std::string path_;
+  bool chunked_;
+  int status_;
+  std::string body_;
+  size_t pos_;
+};
+
+/*
+ * Check that the views taken in HandleRequest() stay while the body comes
+ * and in PrepareResponse(), "X-Views" tells
+ */
+class ViewHandles : public HTTPHandles {
+ public:
+  ViewHandles() : body_size_(0), same_(true) {}
+
+  virtual bool HandleRequest(const pink::HTTPRequest* req) override {
+    path_ = req->path();
+    path_copy_ = path_.ToString();
+    agent_ = req->headers().Get("User-Agent");
+    agent_copy_ = agent_.ToString();
+    query_ = req->query_value("q");
+    query_copy_ = query_.ToString();
+    body_size_ = 0;
+    same_ = true;
+    return false;
+  }
+  virtual void HandleBodyData(const char*, size_t data_size) override {
+    body_size_ += data_size;
+    same_ = same_ && Same();
+  }
+  virtual void PrepareResponse(pink::HTTPResponse* resp) override {
+    same_ = same_ && Same();
+    resp->SetHeaders("X-Views", same_ ? "same" : "changed");
+    resp->SetHeaders("X-Body", body_size_);
+    resp->SetContentLength(0);
+  }
+  virtual int WriteResponseBody(char*, size_t) override {
+    return -2;
+  }
+
+ private:
+  bool Same() const {
+    return path_ == path_copy_ && agent_ == agent_copy_ &&
+      query_ == query_copy_;
+  }
+
+  slash::Slice path_, agent_, query_;
+  std::string path_copy_, agent_copy_, query_copy_;
+  size_t body_size_;
+  bool same_;
+};
+
+class HTTPConnTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    signal(SIGPIPE, SIG_IGN);
+    char root[] = "/tmp/http_conn_test.XXXXXX";
+    ASSERT_TRUE(mkdtemp(root) != NULL);
+    root_ = root;
+    factory_ = NULL;
+    server_ = NULL;
+  }
+
+  virtual void TearDown() {
+    if (server_ != NULL) {
+      server_->StopThread();
+      delete server_;
+    }
+    delete factory_;
+    system(("rm -rf " + root_).c_str());
+  }
+
+  void Start(const HandlesFactory& factory) {
+    factory_ = new TestConnFactory(factory);
+    server_ = pink::NewDispatchThread(kPort, 1, factory_);
+    ASSERT_EQ(0, server_->StartThread());
+  }
+
+  void StartEcho() {
+    Start([] {
+      return std::make_shared<EchoHandles>();
+    });
+  }
+
+  // Serve the files under dir of the test root
+  void StartStatic(const std::string& dir = "") {
+    std::string root = root_ + dir;
+    auto cache = std::make_shared<pink::HTTPFileCache>();
+    Start([root, cache] {
+      return std::make_shared<pink::HTTPStaticHandles>(root, cache);
+    });
+  }
+
+  void WriteFile(const std::string& name, const std::string& data) {
+    FILE* file = fopen((root_ + "/" + name).c_str(), "w");
+    ASSERT_TRUE(file != NULL);
+    ASSERT_EQ(data.size(), fwrite(data.data(), 1, data.size(), file));
+    fclose(file);
+  }
+
+  // A read blocked over timeout_ms fails instead of hanging the test
+  static int Connect(int rcvbuf = 0, int timeout_ms = 5000) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (rcvbuf > 0) {
+      setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    struct timeval tv = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kPort);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr),
+                sizeof(addr)) != 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  static bool WriteAll(int fd, const std::string& data) {
+    size_t pos = 0;
+    while (pos < data.size()) {
+      ssize_t nwritten = write(fd, data.data() + pos, data.size() - pos);
+      if (nwritten <= 0) {
+        return false;
+      }
+      pos += nwritten;
+    }
+    return true;
+  }
+
+  /*
+   * Read a response, the body by Content-Length or decoded from chunks,
+   * return false if the peer closes or times out first
+   */
+  static bool ReadResponse(int fd, std::string* header, std::string* body,
+                           bool head = false) {
+    header->clear();
+    body->clear();
+    while (header->size() < 4 ||
+           header->compare(header->size() - 4, 4, "\r\n\r\n") != 0) {
+      std::string byte = ReadSize(fd, 1);
+      if (byte.empty()) {
+        return false;
+      }
+      *header += byte;
+    }
+    size_t pos = header->find("Content-Length: ");
+    if (pos != std::string::npos) {
+      size_t size = strtoull(header->c_str() + pos + 16, NULL, 10);
+      if (!head) {
+        *body = ReadSize(fd, size);
+      }
+      return body->size() == (head ? 0 : size);
+    }
+    if (header->find("Transfer-Encoding: chunked\r\n") == std::string::npos) {
+      return true;
+    }
+    while (true) {
+      std::string line;
+      while (line.size() < 2 || line.compare(line.size() - 2, 2, "\r\n")) {
+        std::string byte = ReadSize(fd, 1);
+        if (byte.empty()) {
+          return false;
+        }
+        line += byte;
+      }
+      size_t size = strtoull(line.c_str(), NULL, 16);
+      std::string data = ReadSize(fd, size + 2);
+      if (data.size() != size + 2) {
+        return false;
+      }
+      if (size == 0) {
+        return true;
+      }
+      body->append(data, 0, size);
+    }
+  }
+
+  // Read until size bytes or the peer closes or times out
+  static std::string ReadSize(int fd, size_t size) {
+    std::string data;
+    char buf[65536];
+    while (data.size() < size) {
+      ssize_t nread = read(fd, buf, std::min(sizeof(buf), size - data.size()));
+      if (nread <= 0) {
+        break;
+      }
+      data.append(buf, nread);
+    }
+    return data;
+  }
+
+  std::string root_;
+  TestConnFactory* factory_;
+  pink::ServerThread* server_;
+};
+
+// The file is over the socket buffers, sendfile() meets EAGAIN many times
+TEST_F(HTTPConnTest, SendFileToSlowReader) {
+  std::string data(16 << 20, '\0');
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = static_cast<char>('a' + i % 251 % 26);
+  }
+  WriteFile("big", data);
+  StartStatic();
+
+  int fd = Connect(64 << 10);
+  ASSERT_NE(-1, fd);
+  ASSERT_TRUE(WriteAll(fd, "GET /big HTTP/1.1\r\n\r\n"));
+  // Let the buffers fill up before reading
+  usleep(200000);
+  std::string header;
+  while (header.find("\r\n\r\n") == std::string::npos) {
+    std::string byte = ReadSize(fd, 1);
+    ASSERT_EQ(1u, byte.size());
+    header += byte;
+  }
+  EXPECT_THAT(header, ::testing::StartsWith("HTTP/1.1 200 OK\r\n"));
+  EXPECT_THAT(header, ::testing::HasSubstr("Content-Length: 16777216\r\n"));
+
+  std::string body;
+  while (body.size() < data.size()) {
+    size_t size = std::min<size_t>(1 << 20, data.size() - body.size());
+    std::string part = ReadSize(fd, size);
+    ASSERT_FALSE(part.empty()) << "stalled at " << body.size();
+    body += part;
+    usleep(1000);
+  }
+  EXPECT_TRUE(body == data);
+
+  // The connection serves the next request
+  ASSERT_TRUE(WriteAll(fd, "HEAD /big HTTP/1.1\r\n\r\n"));
+  header = ReadSize(fd, 1);
+  EXPECT_EQ("H", header);
+  close(fd);
+}
+
+// The body has room after a header filling most of a pooled chunk
+TEST_F(HTTPConnTest, BodyAfterLargeHeader) {
+  StartEcho();
+  int fd = Connect();
+  ASSERT_NE(-1, fd);
+  std::string header, body;
+  size_t pads[] = {0, 12000, 16000, 40000};
+  for (size_t pad : pads) {
+    std::string data(100000 + pad, 'b');
+    std::string req = "POST /p HTTP/1.1\r\nX-Pad: " + std::string(pad, 'x') +
+      "\r\nContent-Length: " + std::to_string(data.size()) + "\r\n\r\n";
+    ASSERT_TRUE(WriteAll(fd, req + data));
+    ASSERT_TRUE(ReadResponse(fd, &header, &body)) << pad;
+    EXPECT_TRUE(body == data) << pad;
+
+    // The chunk lines after the header too
+    req = "POST /p HTTP/1.1\r\nX-Pad: " + std::string(pad, 'x') +
+      "\r\nTransfer-Encoding: chunked\r\n\r\n";
+    req += "5;" + std::string(3000, 'e') + "\r\nhello\r\n";
+    req += "186a0\r\n" + data.substr(0, 100000) + "\r\n0\r\n\r\n";
+    ASSERT_TRUE(WriteAll(fd, req));
+    ASSERT_TRUE(ReadResponse(fd, &header, &body)) << pad;
+    EXPECT_TRUE(body == "hello" + data.substr(0, 100000)) << pad;
+  }
+  close(fd);
+}
+
+TEST(PooledBufferTest, GrowAndRelease) {
+  const size_t kChunkSize = pink::PooledBuffer::kChunkSize;
+  pink::PooledBuffer buf(100000);
+  EXPECT_EQ(0u, buf.capacity());
+  EXPECT_TRUE(buf.data() == NULL);
+
+  // A small buffer is a chunk of the pool
+  ASSERT_TRUE(buf.Reserve(100));
+  EXPECT_EQ(kChunkSize, buf.capacity());
+  char* chunk = buf.data();
+  for (size_t i = 0; i < kChunkSize; i++) {
+    buf.data()[i] = static_cast<char>(i % 251);
+  }
+
+  // It doubles, up to max_size, and keeps the data
+  ASSERT_TRUE(buf.Reserve(kChunkSize + 1));
+  EXPECT_EQ(2 * kChunkSize, buf.capacity());
+  ASSERT_TRUE(buf.Reserve(70000));
+  EXPECT_EQ(100000u, buf.capacity());
+  EXPECT_FALSE(buf.Reserve(100001));
+  EXPECT_EQ(100000u, buf.capacity());
+  for (size_t i = 0; i < kChunkSize; i++) {
+    ASSERT_EQ(static_cast<char>(i % 251), buf.data()[i]) << i;
+  }
+
+  buf.Release();
+  EXPECT_EQ(0u, buf.capacity());
+  EXPECT_TRUE(buf.data() == NULL);
+
+  // The chunk went back to the pool when the buffer grew
+  pink::PooledBuffer other(100000);
+  ASSERT_TRUE(other.Reserve(1));
+  EXPECT_EQ(chunk, other.data());
+  other.Release();
+  ASSERT_TRUE(buf.Reserve(kChunkSize));
+  EXPECT_EQ(chunk, buf.data());
+}
+
+// The views are not moved by the buffer growing or the body streaming
+TEST_F(HTTPConnTest, ViewLifetime) {
+  Start([] {
+    return std::make_shared<ViewHandles>();
+  });
+  int fd = Connect();
+  ASSERT_NE(-1, fd);
+  std::string body(300000, 'b');
+  std::string pad(40000, 'x');
+  std::string reqs;
+  reqs += "GET /a?q=1 HTTP/1.1\r\nUser-Agent: small\r\n\r\n";
+  reqs += "POST /b?q=2 HTTP/1.1\r\nX-Pad: " + pad +
+    "\r\nUser-Agent: large\r\nContent-Length: " +
+    std::to_string(body.size()) + "\r\n\r\n" + body;
+  reqs += "POST /c?q=3 HTTP/1.1\r\nUser-Agent: chunked\r\n"
+    "Transfer-Encoding: chunked\r\n\r\n";
+  for (size_t pos = 0; pos < body.size(); pos += 10000) {
+    reqs += "2710\r\n" + body.substr(pos, 10000) + "\r\n";
+  }
+  reqs += "0\r\n\r\n";
+  ASSERT_TRUE(WriteAll(fd, reqs));
+
+  const char* sizes[] = {"0", "300000", "300000"};
+  std::string header, data;
+  for (const char* size : sizes) {
+    ASSERT_TRUE(ReadResponse(fd, &header, &data)) << size;
+    EXPECT_THAT(header, ::testing::HasSubstr("X-Views: same\r\n"));
+    EXPECT_THAT(header, ::testing::HasSubstr(
+          std::string("X-Body: ") + size + "\r\n"));
+  }
+  close(fd);
+}
+
+// The pipelined requests are answered in order, however they are split
+TEST_F(HTTPConnTest, Pipelined) {
+  StartEcho();
+  std::string reqs;
+  std::vector<std::string> bodies;
+  for (int i = 0; i < 30; i++) {
+    // Empty, small, and over the pending output, some of them chunked
+    std::string body(i % 3 == 0 ? 0 : (i % 3 == 1 ? 10 : 100000),
+                     static_cast<char>('a' + i % 26));
+    std::string path = "/" + std::to_string(i);
+    if (i % 4 == 0) {
+      path += "?chunked=1";
+    }
+    reqs += "POST " + path + " HTTP/1.1\r\nContent-Length: " +
+      std::to_string(body.size()) + "\r\n\r\n" + body;
+    bodies.push_back(body);
+  }
+
+  size_t splits[] = {reqs.size(), 1000, 7};
+  for (size_t split : splits) {
+    int fd = Connect();
+    ASSERT_NE(-1, fd);
+    // Written while the responses are read, neither side waits the other
+    std::thread writer([fd, split, &reqs] {
+      for (size_t pos = 0; pos < reqs.size(); pos += split) {
+        if (!WriteAll(fd, reqs.substr(pos, split))) {
+          break;
+        }
+        if (split < reqs.size() && pos % (split * 1000) == 0) {
+          usleep(1000);
+        }
+      }
+    });
+    std::string header, body;
+    for (int i = 0; i < 30; i++) {
+      EXPECT_TRUE(ReadResponse(fd, &header, &body)) << split << " " << i;
+      EXPECT_THAT(header, ::testing::HasSubstr(
+            "X-Path: /" + std::to_string(i) + "\r\n"));
+      EXPECT_TRUE(body == bodies[i]) << split << " " << i;
+    }
+    writer.join();
+    close(fd);
+  }
+}
+
+// A chunked request body is decoded however it comes
+TEST_F(HTTPConnTest, ChunkedRequest) {
+  StartEcho();
+  int fd = Connect();
+  ASSERT_NE(-1, fd);
+  std::string req = "POST /p HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+    "5;name=value\r\nhello\r\n"
+    "1A\r\nabcdefghijklmnopqrstuvwxyz\r\n"
+    "0000000001\r\n!\r\n"
+    "0\r\nX-Trailer: 1\r\nX-Other: 2\r\n\r\n";
+  std::string expected = "hello" "abcdefghijklmnopqrstuvwxyz" "!";
+  std::string header, body;
+
+  ASSERT_TRUE(WriteAll(fd, req));
+  ASSERT_TRUE(ReadResponse(fd, &header, &body));
+  EXPECT_EQ(expected, body);
+
+  // One byte a write
+  for (size_t i = 0; i < req.size(); i++) {
+    ASSERT_TRUE(WriteAll(fd, req.substr(i, 1)));
+    usleep(100);
+  }
+  ASSERT_TRUE(ReadResponse(fd, &header, &body));
+  EXPECT_EQ(expected, body);
+
+  // A bad chunk size closes the connection
+  ASSERT_TRUE(WriteAll(fd, "POST /p HTTP/1.1\r\n"
+                       "Transfer-Encoding: chunked\r\n\r\nzz\r\n"));
+  EXPECT_EQ("", ReadSize(fd, 1));
+  close(fd);
+}
+
+// A body without Content-Length goes in chunks, but none for 204, 304 and HEAD
+TEST_F(HTTPConnTest, ChunkedResponse) {
+  StartEcho();
+  int fd = Connect();
+  ASSERT_NE(-1, fd);
+  std::string data(20000, 'c');
+  std::string header, body;
+
+  std::string req = "POST /p?chunked=1 HTTP/1.1\r\nContent-Length: " +
+    std::to_string(data.size()) + "\r\n\r\n" + data;
+  ASSERT_TRUE(WriteAll(fd, req));
+  ASSERT_TRUE(ReadResponse(fd, &header, &body));
+  EXPECT_THAT(header, ::testing::HasSubstr("Transfer-Encoding: chunked\r\n"));
+  EXPECT_THAT(header, ::testing::Not(::testing::HasSubstr("Content-Length")));
+  EXPECT_TRUE(body == data);
+
+  // An empty body is the last chunk only
+  ASSERT_TRUE(WriteAll(fd, "GET /p?chunked=1 HTTP/1.1\r\n\r\n"));
+  ASSERT_TRUE(ReadResponse(fd, &header, &body));
+  EXPECT_THAT(header, ::testing::HasSubstr("Transfer-Encoding: chunked\r\n"));
+  EXPECT_EQ("", body);
+
+  // Pipelined, a stray byte of any of them breaks the ones after
+  ASSERT_TRUE(WriteAll(fd, "GET /204?chunked=1&status=204 HTTP/1.1\r\n\r\n"
+                       "GET /304?chunked=1&status=304 HTTP/1.1\r\n\r\n"
+                       "HEAD /head?chunked=1 HTTP/1.1\r\n\r\n"
+                       "HEAD /length HTTP/1.1\r\nContent-Length: 5\r\n\r\n"
+                       "hello"
+                       "GET /last HTTP/1.1\r\n\r\n"));
+  ASSERT_TRUE(ReadResponse(fd, &header, &body));
+  EXPECT_THAT(header, ::testing::StartsWith("HTTP/1.1 204 "));
+  EXPECT_THAT(header,
+              ::testing::Not(::testing::HasSubstr("Transfer-Encoding")));
+  ASSERT_TRUE(ReadResponse(fd, &header, &body));
+  EXPECT_THAT(header, ::testing::StartsWith("HTTP/1.1 304 "));
+  EXPECT_THAT(header,
+              ::testing::Not(::testing::HasSubstr("Transfer-Encoding")));
+  ASSERT_TRUE(ReadResponse(fd, &header, &body, true));
+  EXPECT_THAT(header, ::testing::HasSubstr("X-Path: /head\r\n"));
+  EXPECT_THAT(header,
+              ::testing::Not(::testing::HasSubstr("Transfer-Encoding")));
+  // The Content-Length of HEAD tells the body not sent
+  ASSERT_TRUE(ReadResponse(fd, &header, &body, true));
+  EXPECT_THAT(header, ::testing::HasSubstr("X-Path: /length\r\n"));
+  EXPECT_THAT(header, ::testing::HasSubstr("Content-Length: 5\r\n"));
+  ASSERT_TRUE(ReadResponse(fd, &header, &body));
+  EXPECT_THAT(header, ::testing::StartsWith("HTTP/1.1 200 "));
+  EXPECT_THAT(header, ::testing::HasSubstr("X-Path: /last\r\n"));
+  close(fd);
+}
+
+static std::string HeaderValue(const std::string& header,
+                               const std::string& key) {
+  size_t pos = header.find("\r\n" + key + ": ");
+  if (pos == std::string::npos) {
+    return "";
+  }
+  pos += key.size() + 4;
+  return header.substr(pos, header.find("\r\n", pos) - pos);
+}
+
+TEST_F(HTTPConnTest, StaticFiles) {
+  std::string data;
+  for (int i = 0; i < 1000; i++) {
+    data.push_back(static_cast<char>('a' + i % 26));
+  }
+  ASSERT_EQ(0, mkdir((root_ + "/www").c_str(), 0755));
+  ASSERT_EQ(0, mkdir((root_ + "/www/sub").c_str(), 0755));
+  WriteFile("www/f", data);
+  WriteFile("www/sub/index.html", "index");
+  WriteFile("secret", "secret");
+  StartStatic("/www");
+  int fd = Connect();
+  ASSERT_NE(-1, fd);
+  std::string header, body;
+  auto get = [&](const std::string& path, const std::string& fields) {
+    return WriteAll(fd, "GET " + path + " HTTP/1.1\r\n" + fields + "\r\n") &&
+      ReadResponse(fd, &header, &body);
+  };
+
+  ASSERT_TRUE(get("/f", ""));
+  EXPECT_THAT(header, ::testing::StartsWith("HTTP/1.1 200 "));
+  EXPECT_EQ(data, body);
+  std::string etag = HeaderValue(header, "ETag");
+  std::string last_modified = HeaderValue(header, "Last-Modified");
+  ASSERT_NE("", etag);
+  ASSERT_NE("", last_modified);
+  ASSERT_TRUE(get("/sub/", ""));
+  EXPECT_EQ("index", body);
+
+  // Range
+  ASSERT_TRUE(get("/f", "Range: bytes=100-199\r\n"));
+  EXPECT_THAT(header, ::testing::StartsWith("HTTP/1.1 206 "));
+  EXPECT_EQ("bytes 100-199/1000", HeaderValue(header, "Content-Range"));
+  EXPECT_EQ(data.substr(100, 100), body);
+  ASSERT_TRUE(get("/f", "Range: bytes=-100\r\n"));
+  EXPECT_EQ("bytes 900-999/1000", HeaderValue(header, "Content-Range"));
+  EXPECT_EQ(data.substr(900), body);
+  ASSERT_TRUE(get("/f", "Range: bytes=950-2000\r\n"));
+  EXPECT_EQ("bytes 950-999/1000", HeaderValue(header, "Content-Range"));
+  EXPECT_EQ(data.substr(950), body);
+  // A range not understood is ignored
+  ASSERT_TRUE(get("/f", "Range: bytes=5-1\r\n"));
+  EXPECT_THAT(header, ::testing::StartsWith("HTTP/1.1 200 "));
+  EXPECT_EQ(data, body);
+  ASSERT_TRUE(get("/f", "Range: bytes=1000-\r\n"));
+  EXPECT_THAT(header, ::testing::StartsWith("HTTP/1.1 416 "));
+  EXPECT_EQ("bytes */1000", HeaderValue(header, "Content-Range"));
+  EXPECT_EQ("", body);
+
+  // Conditional GET
+  ASSERT_TRUE(get("/f", "If-None-Match: " + etag + "\r\n"));
+  EXPECT_THAT(header, ::testing::StartsWith("HTTP/1.1 304 "));
+  EXPECT_EQ(etag, HeaderValue(header, "ETag"));
+  EXPECT_EQ("", body);
+  ASSERT_TRUE(get("/f", "If-None-Match: \"other\", " + etag + "\r\n"));
+  EXPECT_THAT(header, ::testing::StartsWith("HTTP/1.1 304 "));
+  ASSERT_TRUE(get("/f", "If-None-Match: \"other\"\r\n"));
+  EXPECT_THAT(header, ::testing::StartsWith("HTTP/1.1 200 "));
+  EXPECT_EQ(data, body);
+  ASSERT_TRUE(get("/f", "If-Modified-Since: " + last_modified + "\r\n"));
+  EXPECT_THAT(header, ::testing::StartsWith("HTTP/1.1 304 "));
+  EXPECT_EQ("", body);
+
+  // Nothing out of the root
+  const char* paths[] = {"/../secret", "/sub/../../secret", "/%2e%2e/secret",
+                         "/sub%2f..%2f..%2fsecret", "/..", "/f%00"};
+  for (const char* path : paths) {
+    ASSERT_TRUE(get(path, "")) << path;
+    EXPECT_THAT(header, ::testing::StartsWith("HTTP/1.1 400 ")) << path;
+    EXPECT_EQ("", body) << path;
+  }
+  ASSERT_TRUE(get("/nothing", ""));
+  EXPECT_THAT(header, ::testing::StartsWith("HTTP/1.1 404 "));
+  close(fd);
+}
@@ -0,0 +1,200 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include "pink/src/http_parser.h"
+#include "gmock/gmock.h"
+
+using pink::HTTPParser;
+
+static const char kRequest[] =
+  "POST http://example.com/a/b?x=1&y=&z HTTP/1.1\r\n"
+  "Host: example.com\r\n"
+  "Content-Length:  12 \r\n"
+  "X-Empty:\r\n"
+  "X-Tab:\tv1\tv2\t\r\n"
+  "X-Obs-Text: caf\xc3\xa9\r\n"
+  "\r\n"
+  "hello world!";
+
+static std::string Get(const std::string& data, const HTTPParser::Span& span) {
+  return HTTPParser::Get(data.data(), span).ToString();
+}
+
+static void CheckRequest(const std::string& data, const HTTPParser& parser) {
+  EXPECT_EQ("POST", Get(data, parser.method()));
+  EXPECT_EQ("http://example.com/a/b?x=1&y=&z", Get(data, parser.url()));
+  EXPECT_EQ("HTTP/1.1", Get(data, parser.version()));
+  ASSERT_EQ(5u, parser.fields().size());
+  EXPECT_EQ("Host", Get(data, parser.fields()[0].key));
+  EXPECT_EQ("example.com", Get(data, parser.fields()[0].value));
+  EXPECT_EQ("12", Get(data, parser.fields()[1].value));
+  EXPECT_EQ("", Get(data, parser.fields()[2].value));
+  EXPECT_EQ("v1\tv2", Get(data, parser.fields()[3].value));
+  EXPECT_EQ("caf\xc3\xa9", Get(data, parser.fields()[4].value));
+}
+
+TEST(HTTPParserTest, Whole) {
+  std::string data(kRequest);
+  HTTPParser parser;
+  int header_len = parser.Parse(data.data(), data.size());
+  EXPECT_EQ(data.size() - 12, static_cast<size_t>(header_len));
+  CheckRequest(data, parser);
+  // Parsed already
+  EXPECT_EQ(header_len, parser.Parse(data.data(), data.size()));
+}
+
+// A byte a read, and the buffer moves after each read
+TEST(HTTPParserTest, Resume) {
+  std::string all(kRequest);
+  size_t header_len = all.size() - 12;
+  HTTPParser parser;
+  std::string data;
+  for (size_t i = 0; i < header_len - 1; i++) {
+    data = all.substr(0, i + 1);
+    ASSERT_EQ(0, parser.Parse(data.data(), data.size())) << i;
+  }
+  data = all;
+  EXPECT_EQ(static_cast<int>(header_len),
+            parser.Parse(data.data(), data.size()));
+  CheckRequest(data, parser);
+
+  parser.Reset();
+  EXPECT_EQ(static_cast<int>(header_len),
+            parser.Parse(data.data(), data.size()));
+}
+
+TEST(HTTPParserTest, Lenient) {
+  // Bare LF, the empty lines before the request line
+  std::string data("\r\n\nGET / HTTP/1.0\nA: b\n\n");
+  HTTPParser parser;
+  EXPECT_EQ(static_cast<int>(data.size()),
+            parser.Parse(data.data(), data.size()));
+  EXPECT_EQ("GET", Get(data, parser.method()));
+  EXPECT_EQ("HTTP/1.0", Get(data, parser.version()));
+  ASSERT_EQ(1u, parser.fields().size());
+  EXPECT_EQ("b", Get(data, parser.fields()[0].value));
+}
+
+TEST(HTTPParserTest, Malformed) {
+  static const char* kCorpus[] = {
+    "GET\r\n\r\n",
+    "GET /\r\n\r\n",
+    " GET / HTTP/1.1\r\n\r\n",
+    "GET  / HTTP/1.1\r\n\r\n",
+    "GET / HTTP/1.1 \r\n\r\n",
+    "GET / HTTP/2.0\r\n\r\n",
+    "GET / HTTP/1.10\r\n\r\n",
+    "GET / http/1.1\r\n\r\n",
+    "GET / HTTP/1.x\r\n\r\n",
+    "G(T / HTTP/1.1\r\n\r\n",
+    "GET /a\tb HTTP/1.1\r\n\r\n",
+    "GET\t/ HTTP/1.1\r\n\r\n",
+    "GET / HTTP/1.1\rX: y\r\n\r\n",
+    "GET / HTTP/1.1\r\nHost : x\r\n\r\n",
+    "GET / HTTP/1.1\r\n: x\r\n\r\n",
+    "GET / HTTP/1.1\r\nHost\r\n\r\n",
+    "GET / HTTP/1.1\r\nHo st: x\r\n\r\n",
+    "GET / HTTP/1.1\r\nA: b\r\n folded\r\n\r\n",
+    "GET / HTTP/1.1\r\nA: b\r\n\tfolded\r\n\r\n",
+    "GET / HTTP/1.1\r\nA: b\rc\r\n\r\n",
+    "GET / HTTP/1.1\r\nA: b\x01\r\n\r\n",
+    "GET / HTTP/1.1\r\nA: b\x7f\r\n\r\n",
+    "GET / HTTP/1.1\r\nA: b\r\n\r\r\n",
+    "POST / HTTP/1.1\r\nContent-Length: 5\r\ncontent-length: 50\r\n\r\n",
+    "POST / HTTP/1.1\r\nContent-Length: 5\r\nA: b\r\n"
+      "Content-Length:\r\n\r\n",
+  };
+  std::vector<std::string> corpus(kCorpus,
+                                  kCorpus + sizeof(kCorpus) / sizeof(char*));
+  corpus.push_back(std::string("GET /\0 HTTP/1.1\r\n\r\n", 20));
+
+  for (auto& data : corpus) {
+    size_t size = data.size();
+    HTTPParser parser;
+    EXPECT_EQ(-1, parser.Parse(data.data(), data.size())) << data;
+
+    // Fails at some read when it comes a byte a read
+    parser.Reset();
+    int ret = 0;
+    for (size_t i = 1; i <= size && ret == 0; i++) {
+      ret = parser.Parse(data.data(), i);
+    }
+    EXPECT_EQ(-1, ret) << data;
+  }
+}
+
+TEST(HTTPParserTest, ContentLength) {
+  std::string data("POST / HTTP/1.1\r\nContent-Length: 5\r\n"
+                   "CONTENT-LENGTH:  5 \r\n\r\n");
+  HTTPParser parser;
+  EXPECT_EQ(static_cast<int>(data.size()),
+            parser.Parse(data.data(), data.size()));
+  EXPECT_EQ(2u, parser.fields().size());
+}
+
+TEST(HTTPParserTest, FindControl) {
+  srand(301);
+  std::string data(200, 'a');
+  for (int round = 0; round < 10000; round++) {
+    for (auto& c : data) {
+      // Mostly printable and obs-text, a CTL or DEL in about 50 bytes
+      int r = rand() % 100;
+      if (r == 0) {
+        c = static_cast<char>(rand() % 32);
+      } else if (r == 1) {
+        c = '\x7f';
+      } else {
+        c = static_cast<char>(r % 2 == 0 ? 0x20 + rand() % 95
+                                         : 0x80 + rand() % 128);
+      }
+    }
+    size_t begin = rand() % 50;
+    size_t end = begin + rand() % 150;
+    const char* expect = data.data() + end;
+    for (size_t i = begin; i < end; i++) {
+      unsigned char c = static_cast<unsigned char>(data[i]);
+      if (c < 0x20 || c == 0x7f) {
+        expect = data.data() + i;
+        break;
+      }
+    }
+    ASSERT_EQ(expect, HTTPParser::FindControl(data.data() + begin,
+                                              data.data() + end));
+  }
+}
+
+TEST(HTTPParserTest, Helpers) {
+  slash::Slice path, query;
+  HTTPParser::SplitUrl("https://a.com:80/p/q?k=v", &path, &query);
+  EXPECT_EQ("/p/q", path.ToString());
+  EXPECT_EQ("k=v", query.ToString());
+  HTTPParser::SplitUrl("http://a.com", &path, &query);
+  EXPECT_EQ("", path.ToString());
+  HTTPParser::SplitUrl("/x", &path, &query);
+  EXPECT_EQ("/x", path.ToString());
+  EXPECT_TRUE(query.empty());
+
+  std::string params("a=1&&b&c=");
+  std::vector<std::string> result;
+  HTTPParser::ParseParameters(params.data(), params.data() + params.size(),
+      [&result](const slash::Slice& key, const slash::Slice& value) {
+        result.push_back(key.ToString() + ":" + value.ToString());
+      });
+  EXPECT_THAT(result, ::testing::ElementsAre("a:1", "b:", "c:"));
+
+  uint64_t length = 0;
+  EXPECT_TRUE(HTTPParser::ParseContentLength("1234", &length));
+  EXPECT_EQ(1234u, length);
+  EXPECT_FALSE(HTTPParser::ParseContentLength("", &length));
+  EXPECT_FALSE(HTTPParser::ParseContentLength("-1", &length));
+  EXPECT_FALSE(HTTPParser::ParseContentLength("1 2", &length));
+  EXPECT_FALSE(HTTPParser::ParseContentLength("99999999999999999999",
+                                              &length));
+}
@@ -0,0 +1,90 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include <memory>
+#include <string>
+
+#include "pink/include/http_router.h"
+#include "gmock/gmock.h"
+
+using pink::HTTPFields;
+using pink::HTTPHandles;
+using pink::HTTPRouter;
+
+static std::shared_ptr<HTTPHandles> NoHandles() {
+  return std::shared_ptr<HTTPHandles>();
+}
+
+class HTTPRouterTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    ASSERT_TRUE(router_.AddRoute("GET", "/", NoHandles));                  // 0
+    ASSERT_TRUE(router_.AddRoute("GET", "/users", NoHandles));             // 1
+    ASSERT_TRUE(router_.AddRoute("GET", "/users/me", NoHandles));          // 2
+    ASSERT_TRUE(router_.AddRoute("GET", "/users/:id", NoHandles));         // 3
+    ASSERT_TRUE(router_.AddRoute("PUT", "/users/:id", NoHandles));         // 4
+    ASSERT_TRUE(router_.AddRoute("GET", "/users/:id/posts/:post",
+                                 NoHandles));                              // 5
+    ASSERT_TRUE(router_.AddRoute("GET", "/files/*path", NoHandles));       // 6
+    ASSERT_TRUE(router_.AddRoute("*", "/health", NoHandles));              // 7
+    ASSERT_TRUE(router_.AddRoute("GET", "/user", NoHandles));              // 8
+  }
+
+  int Match(const std::string& method, const std::string& path,
+            bool* method_allowed = NULL) {
+    params_ = HTTPFields(false);
+    path_ = path;
+    return router_.Match(method, path_, &params_, method_allowed);
+  }
+
+  HTTPRouter router_;
+  HTTPFields params_{false};
+  std::string path_;
+};
+
+TEST_F(HTTPRouterTest, Static) {
+  EXPECT_EQ(0, Match("GET", "/"));
+  EXPECT_EQ(1, Match("GET", "/users"));
+  EXPECT_EQ(8, Match("GET", "/user"));
+  EXPECT_EQ(2, Match("GET", "/users/me"));
+  EXPECT_EQ(0u, params_.size());
+  EXPECT_EQ(7, Match("DELETE", "/health"));
+  EXPECT_EQ(-1, Match("GET", "/usersx"));
+}
+
+TEST_F(HTTPRouterTest, Params) {
+  EXPECT_EQ(3, Match("GET", "/users/42"));
+  EXPECT_EQ("42", params_.Get("id").ToString());
+  EXPECT_EQ(4, Match("PUT", "/users/mex"));
+  EXPECT_EQ("mex", params_.Get("id").ToString());
+  EXPECT_EQ(5, Match("GET", "/users/me/posts/7"));
+  EXPECT_EQ("me", params_.Get("id").ToString());
+  EXPECT_EQ("7", params_.Get("post").ToString());
+  EXPECT_EQ(-1, Match("GET", "/users/42/posts"));
+  EXPECT_EQ(0u, params_.size());
+}
+
+TEST_F(HTTPRouterTest, Wildcard) {
+  EXPECT_EQ(6, Match("GET", "/files/a/b.txt"));
+  EXPECT_EQ("a/b.txt", params_.Get("path").ToString());
+  EXPECT_EQ(6, Match("GET", "/files/"));
+  EXPECT_EQ("", params_.Get("path").ToString());
+}
+
+TEST_F(HTTPRouterTest, NotAllowed) {
+  bool allowed;
+  EXPECT_EQ(-1, Match("POST", "/users/42", &allowed));
+  EXPECT_FALSE(allowed);
+  EXPECT_EQ(-1, Match("GET", "/nothing", &allowed));
+  EXPECT_TRUE(allowed);
+}
+
+TEST_F(HTTPRouterTest, Conflicts) {
+  EXPECT_FALSE(router_.AddRoute("GET", "/users", NoHandles));
+  EXPECT_FALSE(router_.AddRoute("GET", "/users/:name", NoHandles));
+  EXPECT_FALSE(router_.AddRoute("GET", "/files/*path/x", NoHandles));
+  EXPECT_FALSE(router_.AddRoute("GET", "users", NoHandles));
+  EXPECT_FALSE(router_.AddRoute("GET", "/a/:", NoHandles));
+}
@@ -0,0 +1,82 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include "pink/src/pattern_index.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "slash/include/slash_string.h"
+#include "gmock/gmock.h"
+
+static const char* kPatterns[] = {
+  "*", "news.*", "news.?", "news.[abc]*", "news.[^abc]*", "news.[a-c]",
+  "news.[c-a]", "n*s.*", "*.sport", "news\\*", "news.\\?", "h?llo",
+  "h[ae]llo", "h[^e]llo", "h*llo", "a*b*c", "[", "news.[abc", "foo",
+  "", "**", "news.*.*", "*[",
+};
+
+static const char* kChannels[] = {
+  "", "news", "news.", "news.a", "news.b", "news.d", "news.sport",
+  "news.it.sport", "news*", "news.?", "news.x", "hello", "hallo",
+  "hxllo", "heeeello", "hllo", "abc", "aXbYc", "acb", "[", "foo",
+  "news.abc", "*[", "x[",
+};
+
+TEST(PatternIndexTest, GlobMatcherSameAsStringMatch) {
+  for (auto pattern : kPatterns) {
+    pink::GlobMatcher matcher(pattern);
+    for (auto channel : kChannels) {
+      bool expect = slash::stringmatchlen(pattern, strlen(pattern),
+                                          channel, strlen(channel), 0);
+      EXPECT_EQ(expect, matcher.Match(channel))
+        << "pattern: " << pattern << " channel: " << channel;
+    }
+  }
+}
+
+TEST(PatternIndexTest, AddRemoveMatch) {
+  pink::PatternIndex index;
+  for (auto pattern : kPatterns) {
+    EXPECT_TRUE(index.Add(pattern));
+  }
+  EXPECT_FALSE(index.Add("news.*"));
+  EXPECT_EQ(sizeof(kPatterns) / sizeof(kPatterns[0]), index.size());
+
+  for (int round = 0; round < 2; round++) {
+    for (auto channel : kChannels) {
+      std::vector<std::string> expect;
+      for (auto pattern : kPatterns) {
+        if (round == 1 && std::string(pattern).compare(0, 4, "news") == 0) {
+          continue;
+        }
+        if (slash::stringmatchlen(pattern, strlen(pattern),
+                                  channel, strlen(channel), 0)) {
+          expect.push_back(pattern);
+        }
+      }
+      std::vector<const std::string*> result;
+      index.Match(channel, &result);
+      std::vector<std::string> got;
+      for (auto pattern : result) {
+        got.push_back(*pattern);
+      }
+      std::sort(expect.begin(), expect.end());
+      std::sort(got.begin(), got.end());
+      EXPECT_EQ(expect, got) << "channel: " << channel;
+    }
+
+    // Drop the news patterns and match again
+    for (auto pattern : kPatterns) {
+      if (round == 0 && std::string(pattern).compare(0, 4, "news") == 0) {
+        EXPECT_TRUE(index.Remove(pattern));
+        EXPECT_FALSE(index.Remove(pattern));
+      }
+    }
+  }
+}
@@ -0,0 +1,197 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "google/protobuf/wrappers.pb.h"
+#include "slash/include/slash_mutex.h"
+#include "pink/include/pb_async_cli.h"
+#include "pink/include/pb_conn.h"
+#include "pink/include/pink_cli.h"
+#include "pink/include/server_thread.h"
+#include "pink/src/pb_frame.h"
+#include "gmock/gmock.h"
+
+using google::protobuf::StringValue;
+
+static const int kPort = 19231;
+
+/*
+ * Echo the request, "slow" is replied 100ms later by another thread,
+ * "error" is replied with an error
+ */
+class EchoPbConn : public pink::PbConn {
+ public:
+  EchoPbConn(int fd, const std::string& ip_port, pink::ServerThread* thread)
+      : PbConn(fd, ip_port, thread) {}
+
+ protected:
+  int DealMessage() override {
+    StringValue* req = NewMessage<StringValue>();
+    if (!ParseRequest(req)) {
+      return -1;
+    }
+    if (req->value() == "slow") {
+      pink::PbReplier replier = DeferReply();
+      std::thread([replier]() mutable {
+        usleep(100000);
+        StringValue res;
+        res.set_value("slow");
+        replier.Reply(res);
+      }).detach();
+    } else if (req->value() == "error") {
+      DeferReply().ReplyError("bad request");
+    } else {
+      StringValue* res = NewMessage<StringValue>();
+      res->set_value(req->value());
+      res_ = res;
+      set_is_reply(true);
+    }
+    return 0;
+  }
+};
+
+class EchoPbConnFactory : public pink::ConnFactory {
+ public:
+  virtual pink::PinkConn *NewPinkConn(int connfd, const std::string &ip_port,
+                                      pink::ServerThread *thread,
+                                      void*) const {
+    return new EchoPbConn(connfd, ip_port, thread);
+  }
+};
+
+TEST(PbConnTest, OutOfOrderReplies) {
+  EchoPbConnFactory factory;
+  pink::ServerThread* server = pink::NewDispatchThread(kPort, 1, &factory);
+  ASSERT_EQ(0, server->StartThread());
+
+  pink::PbAsyncCli cli("127.0.0.1", kPort);
+  cli.set_reconnect_interval(20);
+  cli.StartThread();
+
+  slash::Mutex mu;
+  std::vector<std::string> done;
+  const int kRequests = 100;
+  StringValue slow_res, error_res;
+  std::vector<StringValue> res(kRequests);
+  StringValue req;
+  req.set_value("slow");
+  cli.Send(req, &slow_res, [&](const pink::Status& s) {
+    slash::MutexLock l(&mu);
+    done.push_back(s.ok() ? slow_res.value() : s.ToString());
+  });
+  req.set_value("error");
+  std::string error;
+  cli.Send(req, &error_res, [&](const pink::Status& s) {
+    slash::MutexLock l(&mu);
+    done.push_back("error");
+    error = s.ToString();
+  });
+  for (int i = 0; i < kRequests; i++) {
+    req.set_value(std::to_string(i));
+    StringValue* r = &res[i];
+    cli.Send(req, r, [&, r](const pink::Status& s) {
+      slash::MutexLock l(&mu);
+      done.push_back(s.ok() ? r->value() : s.ToString());
+    });
+  }
+
+  for (int i = 0; i < 300 && cli.pending() != 0; i++) {
+    usleep(10000);
+  }
+  EXPECT_EQ(0u, cli.pending());
+  cli.StopThread();
+
+  // The slow one doesn't block the others
+  ASSERT_EQ(static_cast<size_t>(kRequests + 2), done.size());
+  EXPECT_EQ("slow", done.back());
+  EXPECT_NE(std::string::npos, error.find("bad request"));
+  std::vector<std::string> fast(done.begin(), done.end() - 1);
+  for (int i = 0; i < kRequests; i++) {
+    EXPECT_NE(fast.end(), std::find(fast.begin(), fast.end(),
+                                    std::to_string(i)));
+  }
+
+  // The plain frames still work
+  pink::PinkCli* pb_cli = pink::NewPbCli();
+  pb_cli->set_recv_timeout(3000);
+  ASSERT_TRUE(pb_cli->Connect("127.0.0.1", kPort).ok());
+  req.set_value("plain");
+  ASSERT_TRUE(pb_cli->Send(&req).ok());
+  StringValue plain_res;
+  ASSERT_TRUE(pb_cli->Recv(&plain_res).ok());
+  EXPECT_EQ("plain", plain_res.value());
+  delete pb_cli;
+
+  server->StopThread();
+  delete server;
+}
+
+static std::string PlainFrame(const std::string& value) {
+  StringValue req;
+  req.set_value(value);
+  std::string body = req.SerializeAsString();
+  pink::PbFrameHeader header;
+  header.body_len = body.size();
+  std::string frame(header.size(), '\0');
+  pink::EncodePbHeader(header, &frame[0]);
+  return frame + body;
+}
+
+TEST(PbConnTest, PipelinedFrames) {
+  EchoPbConnFactory factory;
+  pink::ServerThread* server = pink::NewDispatchThread(kPort + 1, 1, &factory);
+  ASSERT_EQ(0, server->StartThread());
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(kPort + 1);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(0, connect(fd, reinterpret_cast<struct sockaddr*>(&addr),
+                       sizeof(addr)));
+
+  // Many frames in one write, the last one split in the middle of header,
+  // the replies need more than one output segment
+  const int kRequests = 200;
+  std::string data, expected;
+  for (int i = 0; i < kRequests; i++) {
+    data += PlainFrame(std::string(i % 3 == 0 ? 1000 : 10, 'a') +
+                       std::to_string(i));
+  }
+  data += PlainFrame(std::string(100000, 'b'));
+  expected = data;
+  std::string last = PlainFrame(std::string(1000, 'x'));
+  expected += last;
+  data += last.substr(0, 2);
+  ASSERT_EQ(static_cast<ssize_t>(data.size()),
+            write(fd, data.data(), data.size()));
+  usleep(20000);
+  ASSERT_EQ(static_cast<ssize_t>(last.size() - 2),
+            write(fd, last.data() + 2, last.size() - 2));
+
+  // The replies echo the requests
+  std::string replies;
+  char buf[4096];
+  while (replies.size() < expected.size()) {
+    ssize_t nread = read(fd, buf, sizeof(buf));
+    ASSERT_GT(nread, 0);
+    replies.append(buf, nread);
+  }
+  EXPECT_EQ(expected, replies);
+
+  close(fd);
+  server->StopThread();
+  delete server;
+}
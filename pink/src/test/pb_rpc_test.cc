@@ -0,0 +1,191 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "google/protobuf/descriptor.pb.h"
+#include "google/protobuf/wrappers.pb.h"
+#include "slash/include/slash_mutex.h"
+#include "pink/include/pb_rpc.h"
+#include "pink/include/server_thread.h"
+#include "gmock/gmock.h"
+
+using google::protobuf::StringValue;
+
+static const int kPort = 19241;
+
+// test.Echo with the methods Echo, Slow and Fail of StringValue
+static const google::protobuf::ServiceDescriptor* EchoDescriptor() {
+  static google::protobuf::DescriptorPool pool(
+      google::protobuf::DescriptorPool::generated_pool());
+  static const google::protobuf::ServiceDescriptor* descriptor = NULL;
+  if (descriptor == NULL) {
+    StringValue::default_instance();
+    google::protobuf::FileDescriptorProto file;
+    file.set_name("pb_rpc_test.proto");
+    file.set_package("test");
+    file.add_dependency("google/protobuf/wrappers.proto");
+    google::protobuf::ServiceDescriptorProto* service = file.add_service();
+    service->set_name("Echo");
+    for (const char* name : {"Echo", "Slow", "Fail"}) {
+      google::protobuf::MethodDescriptorProto* method = service->add_method();
+      method->set_name(name);
+      method->set_input_type(".google.protobuf.StringValue");
+      method->set_output_type(".google.protobuf.StringValue");
+    }
+    descriptor = pool.BuildFile(file)->service(0);
+  }
+  return descriptor;
+}
+
+class EchoService : public google::protobuf::Service {
+ public:
+  const google::protobuf::ServiceDescriptor* GetDescriptor() override {
+    return EchoDescriptor();
+  }
+
+  void CallMethod(const google::protobuf::MethodDescriptor* method,
+                  google::protobuf::RpcController* controller,
+                  const google::protobuf::Message* request,
+                  google::protobuf::Message* response,
+                  google::protobuf::Closure* done) override {
+    const StringValue* req = static_cast<const StringValue*>(request);
+    StringValue* res = static_cast<StringValue*>(response);
+    if (method->name() == "Echo") {
+      res->set_value(req->value());
+      done->Run();
+    } else if (method->name() == "Slow") {
+      // Reply later from another thread
+      std::thread([req, res, done]() {
+        usleep(100000);
+        res->set_value(req->value());
+        done->Run();
+      }).detach();
+    } else {
+      controller->SetFailed("failed " + req->value());
+      done->Run();
+    }
+  }
+
+  const google::protobuf::Message& GetRequestPrototype(
+      const google::protobuf::MethodDescriptor*) const override {
+    return StringValue::default_instance();
+  }
+  const google::protobuf::Message& GetResponsePrototype(
+      const google::protobuf::MethodDescriptor*) const override {
+    return StringValue::default_instance();
+  }
+};
+
+/*
+ * A closure recording the result of a call
+ */
+class Done : public google::protobuf::Closure {
+ public:
+  Done(slash::Mutex* mu, std::vector<std::string>* results)
+      : mu_(mu), results_(results) {}
+
+  void Run() override {
+    slash::MutexLock l(mu_);
+    results_->push_back(controller.Failed() ? "error: " +
+                        controller.ErrorText() : response.value());
+  }
+
+  pink::PbRpcController controller;
+  StringValue request;
+  StringValue response;
+
+ private:
+  slash::Mutex* mu_;
+  std::vector<std::string>* results_;
+};
+
+TEST(PbRpcTest, ServiceCalls) {
+  EchoService service;
+  pink::PbRpcServer rpc;
+  ASSERT_TRUE(rpc.AddService(&service));
+  ASSERT_FALSE(rpc.AddService(&service));
+  pink::ServerThread* server = pink::NewDispatchThread(kPort, 1, &rpc);
+  ASSERT_EQ(0, server->StartThread());
+
+  pink::PbAsyncCli cli("127.0.0.1", kPort);
+  cli.set_reconnect_interval(20);
+  cli.StartThread();
+  pink::PbRpcChannel channel(&cli);
+
+  const google::protobuf::ServiceDescriptor* descriptor = EchoDescriptor();
+  slash::Mutex mu;
+  std::vector<std::string> results;
+  const int kCalls = 100;
+  std::vector<Done*> calls;
+  for (int i = 0; i < kCalls + 2; i++) {
+    calls.push_back(new Done(&mu, &results));
+  }
+
+  calls[0]->request.set_value("slow");
+  channel.CallMethod(descriptor->FindMethodByName("Slow"),
+                     &calls[0]->controller, &calls[0]->request,
+                     &calls[0]->response, calls[0]);
+  calls[1]->request.set_value("x");
+  channel.CallMethod(descriptor->FindMethodByName("Fail"),
+                     &calls[1]->controller, &calls[1]->request,
+                     &calls[1]->response, calls[1]);
+  for (int i = 2; i < kCalls + 2; i++) {
+    calls[i]->request.set_value(std::to_string(i));
+    channel.CallMethod(descriptor->FindMethodByName("Echo"),
+                       &calls[i]->controller, &calls[i]->request,
+                       &calls[i]->response, calls[i]);
+  }
+  // Unknown method
+  std::string unknown;
+  StringValue req, res;
+  cli.Call(12345, req, &res, [&](const pink::Status& s) {
+    slash::MutexLock l(&mu);
+    unknown = s.ToString();
+  });
+
+  for (int i = 0; i < 300 && cli.pending() != 0; i++) {
+    usleep(10000);
+  }
+  EXPECT_EQ(0u, cli.pending());
+  cli.StopThread();
+
+  // The slow call doesn't block the others
+  ASSERT_EQ(static_cast<size_t>(kCalls + 2), results.size());
+  EXPECT_EQ("slow", results.back());
+  EXPECT_TRUE(calls[1]->controller.Failed());
+  EXPECT_NE(std::string::npos,
+            calls[1]->controller.ErrorText().find("failed x"));
+  for (int i = 2; i < kCalls + 2; i++) {
+    EXPECT_EQ(std::to_string(i), calls[i]->response.value());
+  }
+  EXPECT_NE(std::string::npos, unknown.find("unknown method"));
+
+  std::vector<pink::PbMethodStats> stats;
+  rpc.MethodStats(&stats);
+  ASSERT_EQ(3u, stats.size());
+  for (auto& stat : stats) {
+    if (stat.name == "test.Echo.Echo") {
+      EXPECT_EQ(static_cast<uint64_t>(kCalls), stat.count);
+      EXPECT_EQ(0u, stat.errors);
+    } else if (stat.name == "test.Echo.Slow") {
+      EXPECT_EQ(1u, stat.count);
+      EXPECT_GE(stat.max_us, 100000u);
+    } else {
+      EXPECT_EQ("test.Echo.Fail", stat.name);
+      EXPECT_EQ(1u, stat.errors);
+    }
+  }
+
+  for (auto call : calls) {
+    delete call;
+  }
+  server->StopThread();
+  delete server;
+}
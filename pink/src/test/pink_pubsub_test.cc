@@ -0,0 +1,675 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "pink/include/pink_pubsub.h"
+#include "pink/include/redis_conn.h"
+#include "gmock/gmock.h"
+
+// Replies "+PONG" to PING, as a subscriber's own command
+class TestConn : public pink::RedisConn {
+ public:
+  explicit TestConn(int fd) : pink::RedisConn(fd, "test", NULL) {}
+
+  virtual int DealMessage(pink::RedisCmdArgsType& argv,
+                          std::string* response) override {
+    if (!argv.empty() && argv[0] == "PING") {
+      response->append("+PONG\r\n");
+    }
+    return 0;
+  }
+};
+
+// The message of the id, large enough to fill the socket buffers soon
+static std::string Message(int id) {
+  return std::to_string(id) + ":" + std::string(2000, 'm');
+}
+
+static uint64_t Dropped(pink::PubSubThread* pubsub) {
+  std::vector<std::pair<std::string, uint64_t>> dropped;
+  pubsub->PubSubDropped(&dropped);
+  uint64_t count = 0;
+  for (auto& channel : dropped) {
+    count += channel.second;
+  }
+  return count;
+}
+
+class PubSubTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    signal(SIGPIPE, SIG_IGN);
+    pubsub_ = new pink::PubSubThread();
+    ASSERT_EQ(0, pubsub_->StartThread());
+  }
+
+  virtual void TearDown() {
+    pubsub_->StopThread();
+    delete pubsub_;
+    for (auto fd : fds_) {
+      close(fd);
+    }
+  }
+
+  /*
+   * A subscriber over a socketpair, with small buffers if slow, the thread
+   * owns the conn, the test reads the returned fd
+   */
+  int NewSubscriber(pink::PinkConn** conn, bool slow = true) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+      return -1;
+    }
+    if (slow) {
+      int size = 4096;
+      setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+      setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    struct timeval tv = {2, 0};
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    fds_.push_back(fds[1]);
+    *conn = new TestConn(fds[0]);
+    return fds[1];
+  }
+
+  void Subscribe(pink::PinkConn* conn, const std::string& name,
+                 bool pattern = false) {
+    std::vector<std::pair<std::string, int>> result;
+    pubsub_->Subscribe(conn, std::vector<std::string>(1, name), pattern,
+                       &result);
+    // Let the thread poll the conn
+    usleep(50000);
+  }
+
+  /*
+   * Publish until the subscriber takes less than receivers, return the
+   * number published
+   */
+  int FillUp(const std::string& channel, int receivers = 1) {
+    for (int i = 0; i < 10000; i++) {
+      if (pubsub_->Publish(channel, Message(i)) < receivers) {
+        return i + 1;
+      }
+    }
+    return -1;
+  }
+
+  /*
+   * Read the replies until count of them or the peer closes or times
+   * out, a message gives its last element, a status reply its line
+   */
+  static std::vector<std::string> ReadReplies(int fd, size_t count) {
+    std::vector<std::string> replies;
+    std::string buf;
+    size_t pos = 0;
+    char data[65536];
+    while (replies.size() < count) {
+      std::string reply;
+      size_t next = ParseReply(buf, pos, &reply);
+      if (next != std::string::npos) {
+        replies.push_back(reply);
+        pos = next;
+        continue;
+      }
+      ssize_t nread = read(fd, data, sizeof(data));
+      if (nread <= 0) {
+        break;
+      }
+      buf.append(data, nread);
+    }
+    return replies;
+  }
+
+  /*
+   * The whole replies received until nothing comes for quiet ms, 0 for
+   * what is received so far
+   */
+  static std::vector<std::string> ReadAvailable(int fd, int quiet = 0) {
+    std::string buf;
+    char data[65536];
+    ssize_t nread;
+    struct pollfd pfd = {fd, POLLIN, 0};
+    do {
+      while ((nread = recv(fd, data, sizeof(data), MSG_DONTWAIT)) > 0) {
+        buf.append(data, nread);
+      }
+    } while (nread != 0 && poll(&pfd, 1, quiet) > 0);
+    std::vector<std::string> replies;
+    size_t pos = 0;
+    std::string reply;
+    size_t next;
+    while ((next = ParseReply(buf, pos, &reply)) != std::string::npos) {
+      replies.push_back(buf.substr(pos, next - pos));
+      pos = next;
+    }
+    return replies;
+  }
+
+  // Return the position after the reply at pos, npos if it is incomplete
+  static size_t ParseReply(const std::string& buf, size_t pos,
+                           std::string* reply) {
+    if (pos >= buf.size()) {
+      return std::string::npos;
+    }
+    size_t end = buf.find("\r\n", pos);
+    if (end == std::string::npos) {
+      return std::string::npos;
+    }
+    if (buf[pos] != '*') {
+      *reply = buf.substr(pos, end - pos);
+      return end + 2;
+    }
+    int elements = atoi(buf.c_str() + pos + 1);
+    pos = end + 2;
+    for (int i = 0; i < elements; i++) {
+      end = buf.find("\r\n", pos);
+      if (end == std::string::npos) {
+        return std::string::npos;
+      }
+      size_t size = atoi(buf.c_str() + pos + 1);
+      pos = end + 2;
+      if (buf.size() < pos + size + 2) {
+        return std::string::npos;
+      }
+      *reply = buf.substr(pos, size);
+      pos += size + 2;
+    }
+    return pos;
+  }
+
+  static int Id(const std::string& reply) {
+    return atoi(reply.c_str());
+  }
+
+  struct Outcome {
+    std::vector<std::vector<std::pair<std::string, int>>> results;
+    std::vector<int> receivers;
+    std::vector<std::string> channels;
+    std::vector<std::pair<std::string, int>> numsub;
+    int numpat;
+    // The frames of each subscriber by the channel published
+    std::vector<std::map<std::string, std::vector<std::string>>> frames;
+  };
+
+  /*
+   * Subscribe channels and patterns by 8 subscribers, publish, drop some
+   * subscriptions and publish again
+   */
+  template <typename PubSub>
+  void RunWorkload(PubSub* pubsub, Outcome* outcome) {
+    const int kSubscribers = 8;
+    std::vector<pink::PinkConn*> conns;
+    std::vector<int> fds;
+    std::vector<std::pair<std::string, int>> result;
+    for (int k = 0; k < kSubscribers; k++) {
+      pink::PinkConn* conn;
+      fds.push_back(NewSubscriber(&conn, false));
+      conns.push_back(conn);
+      std::vector<std::string> channels;
+      channels.push_back("ch" + std::to_string(k % 5));
+      channels.push_back("ch" + std::to_string((k + 1) % 5));
+      result.clear();
+      pubsub->Subscribe(conn, channels, false, &result);
+      outcome->results.push_back(result);
+      std::vector<std::string> patterns;
+      if (k % 3 == 0) {
+        patterns.push_back("ch*");
+      }
+      if (k % 4 == 1) {
+        patterns.push_back("ch[12]");
+      }
+      result.clear();
+      pubsub->Subscribe(conn, patterns, true, &result);
+      outcome->results.push_back(result);
+    }
+    usleep(50000);
+
+    auto publish = [&](int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        std::string channel = "ch" + std::to_string(i % 6);
+        outcome->receivers.push_back(
+            pubsub->Publish(channel, channel + ":" + std::to_string(i)));
+      }
+    };
+    publish(0, 100);
+
+    // Subscriber 7 has channels only, it is detached by the pubsub
+    int unsubscribes[] = {0, 7};
+    for (int k : unsubscribes) {
+      result.clear();
+      outcome->receivers.push_back(pubsub->UnSubscribe(
+          conns[k], std::vector<std::string>(), false, &result));
+      // The channels come in any order, the counts go down one by one
+      std::vector<std::string> names;
+      std::vector<int> counts;
+      for (auto& channel : result) {
+        names.push_back(channel.first);
+        counts.push_back(channel.second);
+      }
+      std::sort(names.begin(), names.end());
+      for (size_t i = 0; i < result.size(); i++) {
+        result[i] = std::make_pair(names[i], counts[i]);
+      }
+      outcome->results.push_back(result);
+    }
+    result.clear();
+    outcome->receivers.push_back(pubsub->UnSubscribe(
+        conns[3], std::vector<std::string>(), true, &result));
+    outcome->results.push_back(result);
+    result.clear();
+    outcome->receivers.push_back(pubsub->UnSubscribe(
+        conns[1], std::vector<std::string>(1, "ch1"), false, &result));
+    outcome->results.push_back(result);
+    publish(100, 150);
+
+    pubsub->PubSubChannels("", &outcome->channels);
+    std::sort(outcome->channels.begin(), outcome->channels.end());
+    std::vector<std::string> channels;
+    for (int i = 0; i < 6; i++) {
+      channels.push_back("ch" + std::to_string(i));
+    }
+    pubsub->PubSubNumSub(channels, &outcome->numsub);
+    outcome->numpat = pubsub->PubSubNumPat();
+
+    for (int k = 0; k < kSubscribers; k++) {
+      std::map<std::string, std::vector<std::string>> frames;
+      for (auto& frame : ReadAvailable(fds[k], 200)) {
+        size_t end = frame.rfind(':');
+        size_t begin = frame.rfind('\n', end) + 1;
+        frames[frame.substr(begin, end - begin)].push_back(frame);
+      }
+      outcome->frames.push_back(frames);
+    }
+    close(conns[7]->fd());
+    delete conns[7];
+  }
+
+  pink::PubSubThread* pubsub_;
+  std::vector<int> fds_;
+};
+
+TEST_F(PubSubTest, DropOldest) {
+  pink::PinkConn* conn;
+  int fd = NewSubscriber(&conn);
+  ASSERT_NE(-1, fd);
+  pubsub_->SetSubscriberLimit(0, 4, pink::kSubscriberDropOldest);
+  Subscribe(conn, "news");
+  int sent = FillUp("news");
+  ASSERT_GT(sent, 0);
+  for (int i = sent; i < sent + 10; i++) {
+    EXPECT_EQ(0, pubsub_->Publish("news", Message(i)));
+  }
+  EXPECT_EQ(6u, Dropped(pubsub_));
+
+  // The newest 4 are kept behind the ones already sent
+  std::vector<std::string> replies = ReadReplies(fd, sent + 4);
+  ASSERT_EQ(static_cast<size_t>(sent + 4), replies.size());
+  for (int i = 0; i < sent; i++) {
+    EXPECT_EQ(i, Id(replies[i]));
+  }
+  for (int i = 0; i < 4; i++) {
+    EXPECT_EQ(sent + 6 + i, Id(replies[sent + i]));
+  }
+}
+
+TEST_F(PubSubTest, DropNewest) {
+  pink::PinkConn* conn;
+  int fd = NewSubscriber(&conn);
+  ASSERT_NE(-1, fd);
+  pubsub_->SetSubscriberLimit(0, 4, pink::kSubscriberDropNewest);
+  Subscribe(conn, "news");
+  int sent = FillUp("news");
+  ASSERT_GT(sent, 0);
+  for (int i = sent; i < sent + 10; i++) {
+    EXPECT_EQ(0, pubsub_->Publish("news", Message(i)));
+  }
+  std::vector<std::pair<std::string, uint64_t>> dropped;
+  pubsub_->PubSubDropped(&dropped);
+  ASSERT_EQ(1u, dropped.size());
+  EXPECT_EQ("news", dropped[0].first);
+  EXPECT_EQ(6u, dropped[0].second);
+
+  std::vector<std::string> replies = ReadReplies(fd, sent + 4);
+  ASSERT_EQ(static_cast<size_t>(sent + 4), replies.size());
+  for (int i = 0; i < sent + 4; i++) {
+    EXPECT_EQ(i, Id(replies[i]));
+  }
+}
+
+// The messages of both the channel and the pattern count to the limit
+TEST_F(PubSubTest, Disconnect) {
+  pink::PinkConn* conn;
+  int fd = NewSubscriber(&conn);
+  ASSERT_NE(-1, fd);
+  pubsub_->SetSubscriberLimit(0, 4, pink::kSubscriberDisconnect);
+  Subscribe(conn, "news");
+  Subscribe(conn, "n*", true);
+  ASSERT_GT(FillUp("news", 2), 0);
+  for (int i = 0; i < 10 && pubsub_->PubSubNumPat() != 0; i++) {
+    pubsub_->Publish("news", Message(i));
+  }
+  EXPECT_EQ(0, pubsub_->PubSubNumPat());
+  std::vector<std::pair<std::string, int>> numsub;
+  pubsub_->PubSubNumSub(std::vector<std::string>(1, "news"), &numsub);
+  EXPECT_EQ(0, numsub[0].second);
+  // The 4 queued and the one over the limit
+  EXPECT_EQ(5u, Dropped(pubsub_));
+
+  // The thread closes the connection
+  ReadReplies(fd, 100000);
+  char c;
+  EXPECT_EQ(0, read(fd, &c, 1));
+}
+
+// The reply to a command of a subscriber goes after its queued messages
+TEST_F(PubSubTest, ReplyAfterQueued) {
+  pink::PinkConn* conn;
+  int fd = NewSubscriber(&conn);
+  ASSERT_NE(-1, fd);
+  pubsub_->SetSubscriberLimit(0, 100, pink::kSubscriberDropOldest);
+  Subscribe(conn, "news");
+  int sent = FillUp("news");
+  ASSERT_GT(sent, 0);
+  for (int i = sent; i < sent + 10; i++) {
+    pubsub_->Publish("news", Message(i));
+  }
+  ASSERT_EQ(10, write(fd, "PING\r\nPING", 10));
+  usleep(50000);
+  ASSERT_EQ(2, write(fd, "\r\n", 2));
+  usleep(50000);
+
+  std::vector<std::string> replies = ReadReplies(fd, sent + 12);
+  ASSERT_EQ(static_cast<size_t>(sent + 12), replies.size());
+  for (int i = 0; i < sent + 10; i++) {
+    EXPECT_EQ(i, Id(replies[i]));
+  }
+  EXPECT_EQ("+PONG", replies[sent + 10]);
+  EXPECT_EQ("+PONG", replies[sent + 11]);
+  EXPECT_EQ(0u, Dropped(pubsub_));
+}
+
+// The queued messages are still sent first after the limit is lifted
+TEST_F(PubSubTest, LimitLifted) {
+  pink::PinkConn* conn;
+  int fd = NewSubscriber(&conn);
+  ASSERT_NE(-1, fd);
+  pubsub_->SetSubscriberLimit(0, 100, pink::kSubscriberDropOldest);
+  Subscribe(conn, "news");
+  int sent = FillUp("news");
+  ASSERT_GT(sent, 0);
+  for (int i = sent; i < sent + 10; i++) {
+    pubsub_->Publish("news", Message(i));
+  }
+  pubsub_->SetSubscriberLimit(0, 0, pink::kSubscriberDropOldest);
+  for (int i = sent + 10; i < sent + 20; i++) {
+    pubsub_->Publish("news", Message(i));
+  }
+
+  std::vector<std::string> replies = ReadReplies(fd, sent + 20);
+  ASSERT_EQ(static_cast<size_t>(sent + 20), replies.size());
+  for (int i = 0; i < sent + 20; i++) {
+    EXPECT_EQ(i, Id(replies[i]));
+  }
+}
+
+// The drops of the channels past the bound are counted together
+TEST_F(PubSubTest, DroppedChannelsBounded) {
+  pink::PinkConn* conn;
+  int fd = NewSubscriber(&conn);
+  ASSERT_NE(-1, fd);
+  pubsub_->SetSubscriberLimit(0, 1, pink::kSubscriberDropNewest);
+  Subscribe(conn, "*", true);
+  ASSERT_GT(FillUp("news"), 0);
+  pubsub_->Publish("news", "queued");
+  for (int i = 0; i < 5000; i++) {
+    pubsub_->Publish("c" + std::to_string(i), "dropped");
+  }
+
+  std::vector<std::pair<std::string, uint64_t>> dropped;
+  pubsub_->PubSubDropped(&dropped);
+  EXPECT_EQ(4097u, dropped.size());
+  uint64_t count = 0;
+  for (auto& channel : dropped) {
+    count += channel.second;
+  }
+  EXPECT_EQ(5000u, count);
+}
+
+// The shards deliver what one thread does, in the order of each channel
+TEST_F(PubSubTest, ShardedMatchesSingle) {
+  Outcome single;
+  RunWorkload(pubsub_, &single);
+
+  pink::ShardedPubSub sharded(4);
+  ASSERT_EQ(0, sharded.StartThread());
+  Outcome outcome;
+  RunWorkload(&sharded, &outcome);
+  sharded.StopThread();
+
+  EXPECT_EQ(single.results, outcome.results);
+  EXPECT_EQ(single.receivers, outcome.receivers);
+  EXPECT_EQ(single.channels, outcome.channels);
+  EXPECT_EQ(single.numsub, outcome.numsub);
+  EXPECT_EQ(single.numpat, outcome.numpat);
+  ASSERT_EQ(single.frames.size(), outcome.frames.size());
+  for (size_t k = 0; k < single.frames.size(); k++) {
+    EXPECT_EQ(single.frames[k], outcome.frames[k]) << k;
+  }
+  EXPECT_EQ(5u, single.channels.size());
+  EXPECT_FALSE(single.frames[2].empty());
+}
+
+// A slow subscriber of a channel on another shard is limited by its home
+TEST_F(PubSubTest, ShardedDropOldest) {
+  pink::ShardedPubSub sharded(2);
+  ASSERT_EQ(0, sharded.StartThread());
+  sharded.SetSubscriberLimit(0, 4, pink::kSubscriberDropOldest);
+  // The first subscriber is homed on shard 0, the channel is on shard 1
+  std::string channel = "news";
+  while (std::hash<std::string>()(channel) % 2 != 1) {
+    channel += "!";
+  }
+  pink::PinkConn* conn;
+  int fd = NewSubscriber(&conn);
+  ASSERT_NE(-1, fd);
+  std::vector<std::pair<std::string, int>> result;
+  sharded.Subscribe(conn, std::vector<std::string>(1, channel), false,
+                    &result);
+  usleep(50000);
+  for (int i = 0; i < 200; i++) {
+    EXPECT_EQ(1, sharded.Publish(channel, Message(i)));
+  }
+  usleep(100000);
+
+  std::vector<std::pair<std::string, uint64_t>> dropped;
+  sharded.PubSubDropped(&dropped);
+  ASSERT_EQ(1u, dropped.size());
+  EXPECT_EQ(channel, dropped[0].first);
+  EXPECT_LT(0u, dropped[0].second);
+  std::vector<std::string> replies = ReadReplies(fd, 200 - dropped[0].second);
+  ASSERT_EQ(200 - dropped[0].second, replies.size());
+  for (size_t i = 1; i < replies.size(); i++) {
+    EXPECT_LT(Id(replies[i - 1]), Id(replies[i]));
+  }
+  EXPECT_EQ(199, Id(replies.back()));
+  sharded.StopThread();
+}
+
+// Every subscriber gets the same frame, built once for the channel
+TEST_F(PubSubTest, SharedFrames) {
+  std::vector<int> fds;
+  for (int i = 0; i < 4; i++) {
+    pink::PinkConn* conn;
+    fds.push_back(NewSubscriber(&conn, false));
+    ASSERT_NE(-1, fds.back());
+    if (i < 3) {
+      Subscribe(conn, "news");
+    } else {
+      Subscribe(conn, "n*", true);
+    }
+  }
+  EXPECT_EQ(4, pubsub_->Publish("news", "hello"));
+  usleep(50000);
+
+  std::string message = "*3\r\n$7\r\nmessage\r\n$4\r\nnews\r\n$5\r\nhello\r\n";
+  std::string pmessage =
+    "*4\r\n$8\r\npmessage\r\n$2\r\nn*\r\n$4\r\nnews\r\n$5\r\nhello\r\n";
+  for (int i = 0; i < 4; i++) {
+    std::vector<std::string> frames = ReadAvailable(fds[i]);
+    ASSERT_EQ(1u, frames.size()) << i;
+    EXPECT_EQ(i < 3 ? message : pmessage, frames[0]) << i;
+  }
+}
+
+// The shared frames and the own replies of a conn go out in written order
+TEST_F(PubSubTest, SharedRespOrder) {
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  int size = 4096;
+  setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+  fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+  fds_.push_back(fds[0]);
+  fds_.push_back(fds[1]);
+  TestConn conn(fds[0]);
+
+  std::string expected;
+  auto resp = [&](const std::string& data) {
+    conn.WriteResp(data);
+    expected += data;
+  };
+  auto shared = [&](const std::string& data) {
+    conn.WriteSharedResp(std::make_shared<std::string>(data));
+    expected += data;
+  };
+  std::string received;
+  auto drain = [&]() {
+    char buf[1024];
+    ssize_t nread = recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT);
+    if (nread > 0) {
+      received.append(buf, nread);
+    }
+  };
+
+  // A reply partly sent is moved ahead of the shared frames after it
+  resp(std::string(100000, 'a'));
+  EXPECT_EQ(pink::kWriteHalf, conn.SendReply());
+  drain();
+  shared(std::string(50000, 'b'));
+  resp("+c\r\n");
+  shared(std::string(30000, 'd'));
+  EXPECT_EQ(pink::kWriteHalf, conn.SendReply());
+  drain();
+  resp("+e\r\n");
+  shared("");
+  shared("+f\r\n");
+  resp(std::string(20000, 'g'));
+
+  pink::WriteStatus write_status;
+  while ((write_status = conn.SendReply()) == pink::kWriteHalf) {
+    drain();
+  }
+  EXPECT_EQ(pink::kWriteAll, write_status);
+  // All written is in the socket already
+  size_t last;
+  do {
+    last = received.size();
+    drain();
+  } while (received.size() > last);
+  EXPECT_TRUE(received == expected);
+}
+
+// The reverse index follows SUBSCRIBE, UNSUBSCRIBE and PUNSUBSCRIBE
+TEST_F(PubSubTest, ReverseIndex) {
+  pink::PinkConn* conn;
+  int fd = NewSubscriber(&conn, false);
+  ASSERT_NE(-1, fd);
+  pink::PinkConn* other;
+  int other_fd = NewSubscriber(&other, false);
+  ASSERT_NE(-1, other_fd);
+  Subscribe(other, "a");
+
+  typedef std::vector<std::pair<std::string, int>> Result;
+  Result result;
+  std::vector<std::string> channels = {"a", "b", "c", "b"};
+  pubsub_->Subscribe(conn, channels, false, &result);
+  EXPECT_EQ(Result({{"a", 1}, {"b", 2}, {"c", 3}, {"b", 3}}), result);
+  result.clear();
+  pubsub_->Subscribe(conn, {"p*", "q*"}, true, &result);
+  EXPECT_EQ(Result({{"p*", 4}, {"q*", 5}}), result);
+  EXPECT_EQ(5, pubsub_->ClientChannelSize(conn));
+  usleep(50000);
+
+  result.clear();
+  pubsub_->PubSubNumSub({"a", "b", "c"}, &result);
+  EXPECT_EQ(Result({{"a", 2}, {"b", 1}, {"c", 1}}), result);
+  EXPECT_EQ(2, pubsub_->PubSubNumPat());
+
+  // UNSUBSCRIBE without channels, the other subscriber of a stays
+  result.clear();
+  EXPECT_EQ(2, pubsub_->UnSubscribe(conn, {}, false, &result));
+  ASSERT_EQ(3u, result.size());
+  std::vector<std::string> removed;
+  for (size_t i = 0; i < result.size(); i++) {
+    removed.push_back(result[i].first);
+    EXPECT_EQ(4 - static_cast<int>(i), result[i].second);
+  }
+  std::sort(removed.begin(), removed.end());
+  EXPECT_EQ(std::vector<std::string>({"a", "b", "c"}), removed);
+  result.clear();
+  pubsub_->PubSubNumSub({"a", "b", "c"}, &result);
+  EXPECT_EQ(Result({{"a", 1}, {"b", 0}, {"c", 0}}), result);
+  std::vector<std::string> names;
+  pubsub_->PubSubChannels("", &names);
+  EXPECT_EQ(std::vector<std::string>({"a"}), names);
+  EXPECT_EQ(2, pubsub_->ClientChannelSize(conn));
+
+  // The patterns still deliver
+  EXPECT_EQ(1, pubsub_->Publish("pub", "1"));
+  EXPECT_EQ(1, pubsub_->Publish("a", "2"));
+
+  result.clear();
+  EXPECT_EQ(1, pubsub_->UnSubscribe(conn, {"p*", "x*"}, true, &result));
+  EXPECT_EQ(Result({{"p*", 1}, {"x*", 1}}), result);
+  EXPECT_EQ(0, pubsub_->Publish("pub", "3"));
+  EXPECT_EQ(1, pubsub_->PubSubNumPat());
+
+  // The last PUNSUBSCRIBE gives the conn back
+  result.clear();
+  EXPECT_EQ(0, pubsub_->UnSubscribe(conn, {}, true, &result));
+  EXPECT_EQ(Result({{"q*", 0}}), result);
+  EXPECT_EQ(0, pubsub_->ClientChannelSize(conn));
+  EXPECT_EQ(0, pubsub_->PubSubNumPat());
+  EXPECT_EQ(0, pubsub_->Publish("qa", "4"));
+  usleep(50000);
+  std::vector<std::string> frames = ReadAvailable(fd);
+  ASSERT_EQ(1u, frames.size());
+  EXPECT_THAT(frames[0], ::testing::HasSubstr("$3\r\npub\r\n$1\r\n1\r\n"));
+  close(conn->fd());
+  delete conn;
+
+  // A subscriber closed by the peer leaves no subscription
+  fds_.erase(std::find(fds_.begin(), fds_.end(), other_fd));
+  close(other_fd);
+  usleep(50000);
+  result.clear();
+  pubsub_->PubSubNumSub({"a"}, &result);
+  EXPECT_EQ(Result({{"a", 0}}), result);
+  EXPECT_EQ(0, pubsub_->Publish("a", "5"));
+}
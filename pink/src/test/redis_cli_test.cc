@@ -0,0 +1,287 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pink/include/async_redis_client.h"
+#include "pink/include/pink_cli_pool.h"
+#include "pink/include/redis_conn.h"
+#include "pink/include/server_thread.h"
+#include "pink/src/pink_util.h"
+#include "pink/src/redis_reader.h"
+#include "gmock/gmock.h"
+
+using pink::RedisCmdArgsType;
+
+static const int kPort = 19221;
+
+class EchoConn : public pink::RedisConn {
+ public:
+  EchoConn(int fd, const std::string& ip_port, pink::ServerThread* thread)
+      : RedisConn(fd, ip_port, thread) {}
+
+ protected:
+  int DealMessage(RedisCmdArgsType& argv, std::string* response) override {
+    if (argv[0] == "echo" && argv.size() == 2) {
+      response->append("$" + std::to_string(argv[1].size()) + "\r\n");
+      response->append(argv[1] + "\r\n");
+    } else {
+      response->append("-ERR unknown command\r\n");
+    }
+    return 0;
+  }
+};
+
+class EchoConnFactory : public pink::ConnFactory {
+ public:
+  virtual pink::PinkConn *NewPinkConn(int connfd, const std::string &ip_port,
+                                      pink::ServerThread *thread,
+                                      void*) const {
+    return new EchoConn(connfd, ip_port, thread);
+  }
+};
+
+TEST(RedisCliTest, ReaderFragments) {
+  std::string data = "+OK\r\n:12\r\n$-1\r\n*2\r\n$3\r\nfoo\r\n"
+                     "*2\r\n:1\r\n$0\r\n\r\n-ERR bad\r\n$5\r\nhello\r\n";
+  // Any split gives the same replies
+  for (size_t step = 1; step <= data.size(); step++) {
+    pink::RedisReader reader;
+    std::vector<RedisCmdArgsType> replies;
+    std::vector<int> types;
+    for (size_t pos = 0; pos < data.size(); pos += step) {
+      reader.Feed(data.data() + pos, std::min(step, data.size() - pos));
+      RedisCmdArgsType argv;
+      int type;
+      int ret;
+      while ((ret = reader.GetReply(&argv, &type)) == pink::REDIS_OK) {
+        replies.push_back(argv);
+        types.push_back(type);
+      }
+      ASSERT_EQ(pink::REDIS_HALF, ret);
+    }
+    ASSERT_EQ(6u, replies.size());
+    EXPECT_EQ("OK", replies[0][0]);
+    EXPECT_EQ("12", replies[1][0]);
+    EXPECT_EQ(pink::REDIS_REPLY_NIL, types[2]);
+    EXPECT_TRUE(replies[2].empty());
+    EXPECT_EQ(pink::REDIS_REPLY_ARRAY, types[3]);
+    ASSERT_EQ(3u, replies[3].size());
+    EXPECT_EQ("foo", replies[3][0]);
+    EXPECT_EQ("1", replies[3][1]);
+    EXPECT_EQ("", replies[3][2]);
+    EXPECT_EQ(pink::REDIS_REPLY_ERROR, types[4]);
+    EXPECT_EQ("ERR bad", replies[4][0]);
+    EXPECT_EQ("hello", replies[5][0]);
+  }
+}
+
+TEST(RedisCliTest, AsyncPipelineAndReconnect) {
+  pink::AsyncRedisClient client("127.0.0.1", kPort);
+  client.set_reconnect_interval(20);
+  client.StartThread();
+
+  // Sent before the server is up, they wait for the reconnect
+  const int kCommands = 2000;
+  std::vector<std::string> replies;
+  std::atomic<int> errors(0);
+  for (int i = 0; i < kCommands; i++) {
+    RedisCmdArgsType argv;
+    argv.push_back("echo");
+    argv.push_back(std::to_string(i));
+    client.Send(argv, [&replies](const pink::Status& s,
+                                 const RedisCmdArgsType& reply) {
+      replies.push_back(s.ok() && !reply.empty() ? reply[0] : "");
+    });
+  }
+  RedisCmdArgsType bad;
+  bad.push_back("nosuch");
+  client.Send(bad, [&errors](const pink::Status& s,
+                             const RedisCmdArgsType&) {
+    if (s.IsCorruption()) {
+      errors++;
+    }
+  });
+
+  usleep(50000);
+  EchoConnFactory factory;
+  pink::ServerThread* server = pink::NewHolyThread(kPort, &factory);
+  ASSERT_EQ(0, server->StartThread());
+
+  for (int i = 0; i < 500 && client.pending() != 0; i++) {
+    usleep(10000);
+  }
+  EXPECT_EQ(0u, client.pending());
+  EXPECT_TRUE(client.connected());
+  client.StopThread();
+  server->StopThread();
+  delete server;
+
+  ASSERT_EQ(static_cast<size_t>(kCommands), replies.size());
+  for (int i = 0; i < kCommands; i++) {
+    EXPECT_EQ(std::to_string(i), replies[i]);
+  }
+  EXPECT_EQ(1, errors.load());
+}
+
+TEST(RedisCliTest, Batch) {
+  EchoConnFactory factory;
+  pink::ServerThread* server = pink::NewHolyThread(kPort + 1, &factory);
+  ASSERT_EQ(0, server->StartThread());
+
+  pink::RedisCli cli;
+  ASSERT_TRUE(cli.Connect("127.0.0.1", kPort + 1).ok());
+  cli.set_recv_timeout(3000);
+
+  const size_t kCommands = 1000;
+  std::vector<RedisCmdArgsType> cmds;
+  for (size_t i = 0; i < kCommands; i++) {
+    RedisCmdArgsType argv;
+    argv.push_back("echo");
+    argv.push_back(std::string(i % 100, 'a') + std::to_string(i));
+    cmds.push_back(argv);
+  }
+  ASSERT_TRUE(cli.SendBatch(cmds).ok());
+  std::vector<RedisCmdArgsType> replies;
+  ASSERT_TRUE(cli.RecvBatch(kCommands, &replies).ok());
+  ASSERT_EQ(kCommands, replies.size());
+  for (size_t i = 0; i < kCommands; i++) {
+    ASSERT_EQ(1u, replies[i].size());
+    EXPECT_EQ(cmds[i][1], replies[i][0]);
+  }
+
+  // Recv after a batch is still in step
+  std::string ping;
+  RedisCmdArgsType argv;
+  argv.push_back("echo");
+  argv.push_back("last");
+  pink::SerializeRedisCommand(argv, &ping);
+  ASSERT_TRUE(cli.Send(&ping).ok());
+  RedisCmdArgsType reply;
+  ASSERT_TRUE(cli.Recv(&reply).ok());
+  EXPECT_EQ("last", reply[0]);
+
+  cli.Close();
+  server->StopThread();
+  delete server;
+}
+
+TEST(RedisCliTest, CliPool) {
+  EchoConnFactory factory;
+  pink::ServerThread* server = pink::NewHolyThread(kPort + 2, &factory);
+  ASSERT_EQ(0, server->StartThread());
+
+  pink::PinkCliPoolOptions options;
+  options.size = 2;
+  options.recv_timeout = 3000;
+  options.check_interval = 20;
+  pink::PinkCliPool<pink::RedisCli> pool(options);
+  pool.AddEndpoint("127.0.0.1", kPort + 2);
+  pool.Start();
+
+  int idle = 0, leased = 0;
+  for (int i = 0; i < 100 && idle < 2; i++) {
+    usleep(10000);
+    pool.Size("127.0.0.1", kPort + 2, &idle, &leased);
+  }
+  ASSERT_EQ(2, idle);
+
+  {
+    auto cli1 = pool.Get("127.0.0.1", kPort + 2);
+    auto cli2 = pool.Get("127.0.0.1", kPort + 2);
+    ASSERT_TRUE(static_cast<bool>(cli1));
+    ASSERT_TRUE(static_cast<bool>(cli2));
+    EXPECT_FALSE(static_cast<bool>(pool.Get("127.0.0.1", kPort + 2, 10)));
+    EXPECT_FALSE(static_cast<bool>(pool.Get("127.0.0.1", kPort + 3)));
+
+    std::string cmd;
+    pink::SerializeRedisCommand(&cmd, "echo pooled");
+    ASSERT_TRUE(cli1->Send(&cmd).ok());
+    RedisCmdArgsType reply;
+    ASSERT_TRUE(cli1->Recv(&reply).ok());
+    EXPECT_EQ("pooled", reply[0]);
+
+    // Broken, it's replaced in the background
+    cli2.Invalidate();
+  }
+
+  for (int i = 0; i < 100; i++) {
+    pool.Size("127.0.0.1", kPort + 2, &idle, &leased);
+    if (idle == 2) {
+      break;
+    }
+    usleep(10000);
+  }
+  EXPECT_EQ(2, idle);
+  EXPECT_EQ(0, leased);
+
+  pool.Stop();
+  server->StopThread();
+  delete server;
+}
+
+// A client given back wakes a waiter of its own endpoint, not another's
+TEST(RedisCliTest, CliPoolWakesItsEndpoint) {
+  EchoConnFactory factory;
+  pink::ServerThread* server_a = pink::NewHolyThread(kPort + 4, &factory);
+  pink::ServerThread* server_b = pink::NewHolyThread(kPort + 5, &factory);
+  ASSERT_EQ(0, server_a->StartThread());
+  ASSERT_EQ(0, server_b->StartThread());
+
+  pink::PinkCliPoolOptions options;
+  options.size = 1;
+  // No periodic check to wake the waiters
+  options.check_interval = 100000;
+  pink::PinkCliPool<pink::RedisCli> pool(options);
+  pool.AddEndpoint("127.0.0.1", kPort + 4);
+  pool.AddEndpoint("127.0.0.1", kPort + 5);
+  pool.Start();
+
+  int idle_a = 0, idle_b = 0, leased = 0;
+  for (int i = 0; i < 100 && (idle_a < 1 || idle_b < 1); i++) {
+    usleep(10000);
+    pool.Size("127.0.0.1", kPort + 4, &idle_a, &leased);
+    pool.Size("127.0.0.1", kPort + 5, &idle_b, &leased);
+  }
+  ASSERT_EQ(1, idle_a);
+  ASSERT_EQ(1, idle_b);
+
+  auto lease_a = pool.Get("127.0.0.1", kPort + 4);
+  auto lease_b = pool.Get("127.0.0.1", kPort + 5);
+  ASSERT_TRUE(static_cast<bool>(lease_a));
+  ASSERT_TRUE(static_cast<bool>(lease_b));
+
+  bool got_a = true;
+  std::thread waiter_a([&pool, &got_a]() {
+    got_a = static_cast<bool>(pool.Get("127.0.0.1", kPort + 4, 1500));
+  });
+  usleep(20000);
+  bool got_b = false;
+  uint64_t waited_b = 0;
+  std::thread waiter_b([&pool, &got_b, &waited_b]() {
+    uint64_t start = pink::NowMs();
+    got_b = static_cast<bool>(pool.Get("127.0.0.1", kPort + 5, 1500));
+    waited_b = pink::NowMs() - start;
+  });
+  usleep(100000);
+  lease_b.Release();
+  waiter_b.join();
+  EXPECT_TRUE(got_b);
+  EXPECT_LT(waited_b, 1000u);
+  waiter_a.join();
+  EXPECT_FALSE(got_a);
+
+  lease_a.Release();
+  pool.Stop();
+  server_a->StopThread();
+  server_b->StopThread();
+  delete server_a;
+  delete server_b;
+}
@@ -0,0 +1,133 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include "pink/include/timer_wheel.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <utility>
+#include <vector>
+
+#include "pink/include/bg_thread.h"
+#include "pink/src/pink_util.h"
+#include "gmock/gmock.h"
+
+TEST(TimerWheelTest, FireCancelReschedule) {
+  const uint64_t start = 1000000;
+  const int kTimers = 20000;
+  pink::TimerWheel wheel(start);
+
+  std::vector<uint64_t> expire(kTimers);
+  std::vector<uint64_t> fired(kTimers, 0);
+  std::vector<uint64_t> fired_at(kTimers, 0);
+  std::vector<pink::TimerHandle> handles(kTimers);
+  uint64_t now = start;
+  srand(0);
+  for (int i = 0; i < kTimers; i++) {
+    // Spread over all the levels
+    uint64_t delay = rand() % (i % 4 == 0 ? 300 : i % 4 == 1 ? 70000 : 20000000);
+    expire[i] = start + delay;
+    uint64_t* count = &fired[i];
+    uint64_t* at = &fired_at[i];
+    uint64_t* clock = &now;
+    pink::BGTask task([count, at, clock]() {
+      *count += 1;
+      *at = *clock;
+    });
+    handles[i] = wheel.Add(start, expire[i], std::move(task));
+  }
+  EXPECT_EQ(static_cast<size_t>(kTimers), wheel.size());
+
+  // Cancel every 10th, move every 7th
+  for (int i = 0; i < kTimers; i += 10) {
+    EXPECT_TRUE(wheel.Cancel(handles[i]));
+    EXPECT_FALSE(wheel.Cancel(handles[i]));
+    expire[i] = 0;
+  }
+  for (int i = 3; i < kTimers; i += 7) {
+    if (expire[i] != 0) {
+      expire[i] = start + rand() % 5000000;
+      EXPECT_TRUE(wheel.Reschedule(handles[i], expire[i]));
+    }
+  }
+
+  std::vector<pink::BGTask> expired;
+  uint64_t last = now;
+  while (!wheel.empty()) {
+    uint64_t timeout = wheel.NextTimeout(now);
+    ASSERT_NE(pink::TimerWheel::kNoTimer, timeout);
+    // Jump to the next tick, sometimes further
+    now += timeout + (rand() % 3 == 0 ? rand() % 50 : 0);
+    wheel.Advance(now, &expired);
+    for (auto& task : expired) {
+      task();
+    }
+    expired.clear();
+    last = now;
+  }
+  for (int i = 0; i < kTimers; i++) {
+    if (expire[i] == 0) {
+      EXPECT_EQ(0u, fired[i]) << "timer " << i;
+      continue;
+    }
+    EXPECT_EQ(1u, fired[i]) << "timer " << i;
+    // Not early, and not later than the first Advance passing it
+    EXPECT_LE(expire[i], fired_at[i]) << "timer " << i;
+    EXPECT_LE(fired_at[i], expire[i] + 50) << "timer " << i;
+  }
+  EXPECT_EQ(last, now);
+  // Stale handles are ignored
+  EXPECT_FALSE(wheel.Cancel(handles[1]));
+  EXPECT_FALSE(wheel.Reschedule(handles[1], now));
+}
+
+// A timer added after a week idle does not walk the idle ticks
+TEST(TimerWheelTest, AddAfterIdle) {
+  const uint64_t start = 1000000;
+  pink::TimerWheel wheel(start);
+  std::vector<pink::BGTask> expired;
+  int fired = 0;
+  wheel.Add(start, start + 5, pink::BGTask([&fired]() { fired++; }));
+  wheel.Advance(start + 5, &expired);
+  ASSERT_EQ(1u, expired.size());
+  expired.clear();
+
+  // Not on a slot boundary, so the next tick is the timer itself
+  uint64_t now = start + 7 * 24 * 3600 * 1000ULL + 100;
+  ASSERT_NE(0u, now & 0xff);
+  uint64_t begin_us = pink::NowMicros();
+  wheel.Add(now, now + 10, pink::BGTask([&fired]() { fired++; }));
+  EXPECT_EQ(10u, wheel.NextTimeout(now));
+  wheel.Advance(now + 9, &expired);
+  EXPECT_TRUE(expired.empty());
+  wheel.Advance(now + 10, &expired);
+  ASSERT_EQ(1u, expired.size());
+  // Walking the week of ticks takes seconds
+  EXPECT_LT(pink::NowMicros() - begin_us, 10000u);
+  for (auto& task : expired) {
+    task();
+  }
+  EXPECT_EQ(1, fired);
+  EXPECT_TRUE(wheel.empty());
+}
+
+TEST(TimerWheelTest, BGThreadDelaySchedule) {
+  std::atomic<int> fired(0);
+  pink::BGThread thread;
+  thread.StartThread();
+
+  pink::TimerHandle handle = thread.DelaySchedule(30, [&fired]() { fired += 1; });
+  pink::TimerHandle cancelled = thread.DelaySchedule(30, [&fired]() { fired += 10; });
+  pink::TimerHandle moved = thread.DelaySchedule(100000, [&fired]() { fired += 100; });
+  EXPECT_TRUE(thread.Cancel(cancelled));
+  EXPECT_TRUE(thread.Reschedule(moved, 10));
+  usleep(200000);
+  EXPECT_EQ(101, fired);
+  EXPECT_FALSE(thread.Cancel(handle));
+
+  thread.StopThread();
+}
@@ -0,0 +1,214 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#include "pink/include/timer_wheel.h"
+
+#include <string.h>
+
+#include <utility>
+
+namespace pink {
+
+// Nodes are allocated in chunks and recycled, a stale handle is detected
+// by the id changed
+static const int kNodeChunk = 256;
+
+const uint64_t TimerWheel::kNoTimer;
+
+struct TimerNode {
+  TimerNode* next;
+  TimerNode** pprev;    // the pointer pointing to this node
+  uint64_t expire;
+  uint64_t id;          // 0 when the node is free
+  BGTask task;
+};
+
+TimerWheel::TimerWheel(uint64_t now_ms)
+    : current_(now_ms),
+      size_(0),
+      next_id_(1),
+      free_nodes_(NULL) {
+  memset(slots_, 0, sizeof(slots_));
+}
+
+TimerWheel::~TimerWheel() {
+  Clear();
+  for (auto chunk : chunks_) {
+    delete[] chunk;
+  }
+}
+
+TimerNode* TimerWheel::AllocNode() {
+  if (free_nodes_ == NULL) {
+    TimerNode* chunk = new TimerNode[kNodeChunk];
+    chunks_.push_back(chunk);
+    for (int i = 0; i < kNodeChunk; i++) {
+      chunk[i].id = 0;
+      chunk[i].next = free_nodes_;
+      free_nodes_ = &chunk[i];
+    }
+  }
+  TimerNode* node = free_nodes_;
+  free_nodes_ = node->next;
+  node->id = next_id_++;
+  return node;
+}
+
+void TimerWheel::FreeNode(TimerNode* node) {
+  node->task.Reset();
+  node->id = 0;
+  node->pprev = NULL;
+  node->next = free_nodes_;
+  free_nodes_ = node;
+}
+
+/*
+ * Put the node into the slot of its expire time, relative to current_
+ */
+void TimerWheel::Link(TimerNode* node) {
+  uint64_t expire = node->expire;
+  if (expire < current_) {
+    expire = current_;
+  }
+  uint64_t delta = expire - current_;
+  int level = 0;
+  while (level < kLevels - 1 &&
+         delta >= (static_cast<uint64_t>(1) << (kSlotBits * (level + 1)))) {
+    level++;
+  }
+  if (level == kLevels - 1 &&
+      delta >= (static_cast<uint64_t>(1) << (kSlotBits * kLevels))) {
+    // Too far, wait in the last slot reachable and cascade again
+    expire = current_ + (static_cast<uint64_t>(1) << (kSlotBits * kLevels)) - 1;
+  }
+  uint64_t index = (expire >> (kSlotBits * level)) & kSlotMask;
+
+  TimerNode** head = &slots_[level][index];
+  node->next = *head;
+  if (*head != NULL) {
+    (*head)->pprev = &node->next;
+  }
+  node->pprev = head;
+  *head = node;
+}
+
+void TimerWheel::Unlink(TimerNode* node) {
+  *node->pprev = node->next;
+  if (node->next != NULL) {
+    node->next->pprev = node->pprev;
+  }
+  node->next = NULL;
+  node->pprev = NULL;
+}
+
+TimerHandle TimerWheel::Add(uint64_t now_ms, uint64_t expire_ms,
+                            BGTask&& task) {
+  if (size_ == 0 && now_ms > current_) {
+    current_ = now_ms;
+  }
+  TimerNode* node = AllocNode();
+  node->expire = expire_ms;
+  node->task = std::move(task);
+  Link(node);
+  size_++;
+  return TimerHandle(node, node->id);
+}
+
+bool TimerWheel::Cancel(const TimerHandle& handle) {
+  TimerNode* node = handle.node_;
+  if (node == NULL || node->id != handle.id_) {
+    return false;
+  }
+  Unlink(node);
+  FreeNode(node);
+  size_--;
+  return true;
+}
+
+bool TimerWheel::Reschedule(const TimerHandle& handle, uint64_t expire_ms) {
+  TimerNode* node = handle.node_;
+  if (node == NULL || node->id != handle.id_) {
+    return false;
+  }
+  Unlink(node);
+  node->expire = expire_ms;
+  Link(node);
+  return true;
+}
+
+// Move the timers of an upper level slot down to the lower levels
+void TimerWheel::Cascade(int level, uint64_t index) {
+  TimerNode* node = slots_[level][index];
+  slots_[level][index] = NULL;
+  while (node != NULL) {
+    TimerNode* next = node->next;
+    Link(node);
+    node = next;
+  }
+}
+
+void TimerWheel::Advance(uint64_t now_ms, std::vector<BGTask>* expired) {
+  if (size_ == 0) {
+    if (now_ms >= current_) {
+      current_ = now_ms + 1;
+    }
+    return;
+  }
+  while (current_ <= now_ms && size_ != 0) {
+    uint64_t index = current_ & kSlotMask;
+    // Cascade when the lower level wraps
+    for (int level = 1; level < kLevels; level++) {
+      if (((current_ >> (kSlotBits * (level - 1))) & kSlotMask) != 0) {
+        break;
+      }
+      Cascade(level, (current_ >> (kSlotBits * level)) & kSlotMask);
+    }
+
+    TimerNode* node = slots_[0][index];
+    slots_[0][index] = NULL;
+    while (node != NULL) {
+      TimerNode* next = node->next;
+      expired->push_back(std::move(node->task));
+      FreeNode(node);
+      size_--;
+      node = next;
+    }
+    current_++;
+  }
+  if (size_ == 0 && now_ms >= current_) {
+    current_ = now_ms + 1;
+  }
+}
+
+uint64_t TimerWheel::NextTimeout(uint64_t now_ms) const {
+  if (size_ == 0) {
+    return kNoTimer;
+  }
+  // The upper levels cascade when the tick wraps to slot 0
+  uint64_t tick = current_;
+  for (int i = 0; i < kSlots; i++, tick++) {
+    if (slots_[0][tick & kSlotMask] != NULL || (tick & kSlotMask) == 0) {
+      break;
+    }
+  }
+  return tick > now_ms ? tick - now_ms : 0;
+}
+
+void TimerWheel::Clear() {
+  for (int level = 0; level < kLevels; level++) {
+    for (int index = 0; index < kSlots; index++) {
+      TimerNode* node = slots_[level][index];
+      slots_[level][index] = NULL;
+      while (node != NULL) {
+        TimerNode* next = node->next;
+        FreeNode(node);
+        node = next;
+      }
+    }
+  }
+  size_ = 0;
+}
+
+}  // namespace pink
@@ -0,0 +1,143 @@
+// Copyright (c) 2015-present, Qihoo, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef PINK_SRC_WORK_STEALING_DEQUE_H_
+#define PINK_SRC_WORK_STEALING_DEQUE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
+
+namespace pink {
+
+/*
+ * Chase-Lev work stealing deque of pointers. Only the owner thread may
+ * Push and Pop at the bottom, any thread may Steal from the top. The
+ * buffer grows on demand, the retired buffers are kept until destruction
+ * since a thief may still be reading them.
+ */
+template <typename T>
+class WorkStealingDeque {
+ public:
+  explicit WorkStealingDeque(int64_t capacity = 1024)
+      : top_(0),
+        bottom_(0),
+        array_(new Array(capacity)) {
+  }
+
+  ~WorkStealingDeque() {
+    delete array_.load(std::memory_order_relaxed);
+    for (auto array : retired_) {
+      delete array;
+    }
+  }
+
+  // Owner only
+  void Push(T* item) {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_acquire);
+    Array* array = array_.load(std::memory_order_relaxed);
+    if (b - t > array->capacity - 1) {
+      array = Grow(array, t, b);
+    }
+    array->Put(b, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+
+  // Owner only, return NULL if the deque is empty
+  T* Pop() {
+    int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    Array* array = array_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_relaxed);
+    if (t > b) {
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return NULL;
+    }
+    T* item = array->Get(b);
+    if (t == b) {
+      // The last one, race with the thieves
+      if (!top_.compare_exchange_strong(t, t + 1,
+                                        std::memory_order_seq_cst,
+                                        std::memory_order_relaxed)) {
+        item = NULL;
+      }
+      bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return item;
+  }
+
+  // Any thread, return NULL if the deque is empty or the race is lost
+  T* Steal() {
+    int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom_.load(std::memory_order_acquire);
+    if (t >= b) {
+      return NULL;
+    }
+    Array* array = array_.load(std::memory_order_acquire);
+    T* item = array->Get(t);
+    if (!top_.compare_exchange_strong(t, t + 1,
+                                      std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+      return NULL;
+    }
+    return item;
+  }
+
+  size_t Size() const {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_relaxed);
+    return b > t ? static_cast<size_t>(b - t) : 0;
+  }
+
+ private:
+  struct Array {
+    int64_t capacity;
+    int64_t mask;
+    std::atomic<T*>* slots;
+
+    explicit Array(int64_t _capacity)
+        : capacity(_capacity),
+          mask(_capacity - 1),
+          slots(new std::atomic<T*>[_capacity]) {
+    }
+    ~Array() {
+      delete[] slots;
+    }
+
+    T* Get(int64_t i) {
+      return slots[i & mask].load(std::memory_order_relaxed);
+    }
+    void Put(int64_t i, T* item) {
+      slots[i & mask].store(item, std::memory_order_relaxed);
+    }
+  };
+
+  Array* Grow(Array* array, int64_t t, int64_t b) {
+    Array* bigger = new Array(array->capacity * 2);
+    for (int64_t i = t; i < b; i++) {
+      bigger->Put(i, array->Get(i));
+    }
+    retired_.push_back(array);
+    array_.store(bigger, std::memory_order_release);
+    return bigger;
+  }
+
+  std::atomic<int64_t> top_;
+  std::atomic<int64_t> bottom_;
+  std::atomic<Array*> array_;
+  std::vector<Array*> retired_;   // owner only
+
+  // No copying allowed
+  WorkStealingDeque(const WorkStealingDeque&);
+  void operator=(const WorkStealingDeque&);
+};
+
+}  // namespace pink
+#endif  // PINK_SRC_WORK_STEALING_DEQUE_H_
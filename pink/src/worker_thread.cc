@@ -13,6 +13,9 @@
 
 namespace pink {
 
+// The notify byte of NotifyWrite(), a new connection is notified by 0
+static const char kNotifyWrite = 'w';
+
 
 WorkerThread::WorkerThread(ConnFactory *conn_factory,
                            ServerThread* server_thread,
@@ -57,6 +60,14 @@ std::vector<ServerThread::ConnInfo> WorkerThread::conns_info() const {
   return result;
 }
 
+void WorkerThread::NotifyWrite(int fd) {
+  {
+  slash::MutexLock l(&mutex_);
+  write_fds_.push(fd);
+  }
+  write(notify_send_fd_, &kNotifyWrite, 1);
+}
+
 PinkConn* WorkerThread::MoveConnOut(int fd) {
   slash::WriteLock l(&rwlock_);
   PinkConn* conn = nullptr;
@@ -110,6 +121,22 @@ void *WorkerThread::ThreadMain() {
       if (pfe->fd == notify_receive_fd_) {
         if (pfe->mask & EPOLLIN) {
           read(notify_receive_fd_, bb, 1);
+          if (bb[0] == kNotifyWrite) {
+            int fd;
+            {
+              slash::MutexLock l(&mutex_);
+              fd = write_fds_.front();
+              write_fds_.pop();
+            }
+            // The connection may be closed, or the fd reused by a new one
+            // that will find nothing to send
+            std::map<int, PinkConn *>::iterator iter = conns_.find(fd);
+            if (iter != conns_.end()) {
+              iter->second->set_is_reply(true);
+              pink_epoll_->PinkModEvent(fd, 0, EPOLLIN | EPOLLOUT);
+            }
+            continue;
+          }
           {
             slash::MutexLock l(&mutex_);
             ti = conn_queue_.front();
@@ -122,6 +149,7 @@ void *WorkerThread::ThreadMain() {
             delete tc;
             continue;
           }
+          tc->set_worker_thread(this);
 
 #ifdef __ENABLE_SSL
           // Create SSL failed
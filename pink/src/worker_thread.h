@@ -49,6 +49,12 @@ class WorkerThread : public Thread {
 
   PinkConn* MoveConnOut(int fd);
 
+  /*
+   * Ask the loop to send the replies of the connection, safe from any
+   * thread, for the replies made out of GetRequest()
+   */
+  void NotifyWrite(int fd);
+
   /*
    * The PbItem queue is the fd queue, receive from dispatch thread
    */
@@ -78,10 +84,12 @@ class WorkerThread : public Thread {
   int cron_interval_;
 
   /*
-   * These two fd receive the notify from dispatch thread
+   * These two fd receive the notify from dispatch thread, and from
+   * NotifyWrite() with the connections to write in write_fds_
    */
   int notify_receive_fd_;
   int notify_send_fd_;
+  std::queue<int> write_fds_;
 
   /*
    * The epoll handler